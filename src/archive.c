@@ -0,0 +1,506 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "archive.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "utils.h"
+
+#define kZipLocalHdrSig 0x04034b50
+#define kZipCentralHdrSig 0x02014b50
+#define kZipEndSig 0x06054b50
+#define kZip64EndSig 0x06064b50
+#define kZip64LocatorSig 0x07064b50
+#define kZipLocalHdrSz 30
+#define kZipCentralHdrSz 46
+#define kZipEndSz 22
+#define kZip64EndSz 56
+#define kZip64LocatorSz 20
+#define kZipMaxCommentSz 0xffff
+#define kZip64ExtraId 0x0001
+#define kZipMethodStored 0
+#define kZipMethodDeflated 8
+#define kZipFlagEncrypted 0x1
+
+// Inflated buffers are zero padded up to a page, similar to file mappings
+#define kArchiveMinBufSize 4096
+
+static const char kTarMagic[] = "ustar";
+static const char kTarPosixMagic[] = "ustar\0";
+
+static u2 readU2(const u1 *p) {
+  u2 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static u4 readU4(const u1 *p) {
+  u4 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static u8 readU8(const u1 *p) {
+  u8 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static bool addMember(archive_t *pArchive,
+                      const char *name,
+                      off_t dataOff,
+                      size_t compSize,
+                      size_t size,
+                      u4 crc,
+                      archiveMethod_t method) {
+  if (!archive_isVdexName(name)) {
+    LOGMSG(l_DEBUG, "Skipping archive member '%s'", name);
+    return true;
+  }
+  if (dataOff < 0 || compSize > (size_t)(pArchive->bufSz - dataOff)) {
+    LOGMSG(l_ERROR, "Archive member '%s' is truncated", name);
+    return false;
+  }
+
+  pArchive->members =
+      utils_realloc(pArchive->members, (pArchive->memberCnt + 1) * sizeof(archiveMember_t));
+  archiveMember_t *pMember = &pArchive->members[pArchive->memberCnt++];
+  pMember->name = strdup(name);
+  if (pMember->name == NULL) {
+    LOGMSG(l_FATAL, "Couldn't allocate memory");
+  }
+  pMember->dataOff = dataOff;
+  pMember->compSize = compSize;
+  pMember->size = size;
+  pMember->crc = crc;
+  pMember->method = method;
+  LOGMSG(l_DEBUG, "Added archive member '%s' (%zu bytes)", name, size);
+  return true;
+}
+
+static bool openTar(archive_t *pArchive) {
+  char longName[PATH_MAX] = { 0 };
+  bool hasLongName = false;
+  off_t off = 0;
+
+  while (off + kTarBlockSize <= pArchive->bufSz) {
+    const u1 *pBlock = pArchive->buf + off;
+    if (archive_isTarEndBlock(pBlock)) {
+      return true;
+    }
+
+    archiveTarHdr_t hdr;
+    if (!archive_parseTarHeader(pBlock, &hdr)) {
+      LOGMSG(l_ERROR, "Invalid tar header at offset %jd", (intmax_t)off);
+      return false;
+    }
+    off_t dataOff = off + kTarBlockSize;
+    if (hdr.size > (u8)(pArchive->bufSz - dataOff)) {
+      LOGMSG(l_ERROR, "Tar member '%s' is truncated", hdr.name);
+      return false;
+    }
+    const u1 *pData = pArchive->buf + dataOff;
+
+    switch (hdr.type) {
+      case 'L':
+        // GNU long name of the next member
+        snprintf(longName, sizeof(longName), "%.*s",
+                 (int)(hdr.size < sizeof(longName) ? hdr.size : sizeof(longName) - 1), pData);
+        hasLongName = true;
+        break;
+      case 'x':
+        hasLongName = archive_parseTarPaxPath(pData, hdr.size, longName, sizeof(longName));
+        break;
+      default:
+        if (archive_isTarRegular(hdr.type) &&
+            !addMember(pArchive, hasLongName ? longName : hdr.name, dataOff, hdr.size, hdr.size, 0,
+                       kArchiveStored)) {
+          return false;
+        }
+        hasLongName = false;
+        break;
+    }
+
+    off = dataOff + utils_roundUp(hdr.size, kTarBlockSize);
+  }
+
+  if (off < pArchive->bufSz) {
+    LOGMSG(l_WARN, "Tar archive is truncated at offset %jd", (intmax_t)off);
+  }
+  return true;
+}
+
+// Zip64 sizes and offset replace the saturated central header fields, in that order
+static bool readZip64Extra(const u1 *pExtra, size_t extraLen, u8 *pSize, u8 *pCompSize, u8 *pOff) {
+  u8 *fields[] = { pSize, pCompSize, pOff };
+  for (size_t pos = 0; pos + 4 <= extraLen;) {
+    u2 id = readU2(pExtra + pos);
+    u2 len = readU2(pExtra + pos + 2);
+    pos += 4;
+    if (pos + len > extraLen) {
+      return false;
+    }
+    if (id == kZip64ExtraId) {
+      size_t fieldPos = pos;
+      for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (*fields[i] != 0xffffffff) {
+          continue;
+        }
+        if (fieldPos + sizeof(u8) > pos + len) {
+          return false;
+        }
+        *fields[i] = readU8(pExtra + fieldPos);
+        fieldPos += sizeof(u8);
+      }
+      return true;
+    }
+    pos += len;
+  }
+  return true;
+}
+
+static const u1 *findZipEnd(const archive_t *pArchive) {
+  if (pArchive->bufSz < kZipEndSz) {
+    return NULL;
+  }
+  off_t minOff = pArchive->bufSz - kZipEndSz - kZipMaxCommentSz;
+  if (minOff < 0) {
+    minOff = 0;
+  }
+  for (off_t off = pArchive->bufSz - kZipEndSz; off >= minOff; off--) {
+    if (readU4(pArchive->buf + off) == kZipEndSig) {
+      return pArchive->buf + off;
+    }
+  }
+  return NULL;
+}
+
+static bool openZip(archive_t *pArchive) {
+  const u1 *pEnd = findZipEnd(pArchive);
+  if (pEnd == NULL) {
+    LOGMSG(l_ERROR, "Zip end of central directory not found");
+    return false;
+  }
+  u8 entryCnt = readU2(pEnd + 10);
+  u8 cdSize = readU4(pEnd + 12);
+  u8 cdOff = readU4(pEnd + 16);
+
+  if (entryCnt == 0xffff || cdSize == 0xffffffff || cdOff == 0xffffffff) {
+    off_t locatorOff = pEnd - pArchive->buf - kZip64LocatorSz;
+    if (locatorOff < 0 || readU4(pArchive->buf + locatorOff) != kZip64LocatorSig) {
+      LOGMSG(l_ERROR, "Zip64 end of central directory locator not found");
+      return false;
+    }
+    u8 end64Off = readU8(pArchive->buf + locatorOff + 8);
+    if (end64Off > (u8)(pArchive->bufSz - kZip64EndSz) ||
+        readU4(pArchive->buf + end64Off) != kZip64EndSig) {
+      LOGMSG(l_ERROR, "Invalid Zip64 end of central directory");
+      return false;
+    }
+    const u1 *pEnd64 = pArchive->buf + end64Off;
+    entryCnt = readU8(pEnd64 + 32);
+    cdSize = readU8(pEnd64 + 40);
+    cdOff = readU8(pEnd64 + 48);
+  }
+
+  if (cdOff > (u8)pArchive->bufSz || cdSize > (u8)pArchive->bufSz - cdOff) {
+    LOGMSG(l_ERROR, "Zip central directory is out of bounds");
+    return false;
+  }
+
+  const u1 *pCd = pArchive->buf + cdOff;
+  const u1 *pCdEnd = pCd + cdSize;
+  for (u8 i = 0; i < entryCnt; i++) {
+    if (pCd + kZipCentralHdrSz > pCdEnd || readU4(pCd) != kZipCentralHdrSig) {
+      LOGMSG(l_ERROR, "Invalid zip central directory entry #%" PRIu64, i);
+      return false;
+    }
+    u2 flags = readU2(pCd + 8);
+    u2 method = readU2(pCd + 10);
+    u4 crc = readU4(pCd + 16);
+    u8 compSize = readU4(pCd + 20);
+    u8 size = readU4(pCd + 24);
+    u2 nameLen = readU2(pCd + 28);
+    u2 extraLen = readU2(pCd + 30);
+    u2 commentLen = readU2(pCd + 32);
+    u8 localOff = readU4(pCd + 42);
+    const u1 *pName = pCd + kZipCentralHdrSz;
+    if (pName + nameLen + extraLen + commentLen > pCdEnd ||
+        !readZip64Extra(pName + nameLen, extraLen, &size, &compSize, &localOff)) {
+      LOGMSG(l_ERROR, "Invalid zip central directory entry #%" PRIu64, i);
+      return false;
+    }
+    pCd = pName + nameLen + extraLen + commentLen;
+
+    char name[PATH_MAX] = { 0 };
+    snprintf(name, sizeof(name), "%.*s", (int)nameLen, pName);
+    if (!archive_isVdexName(name)) {
+      continue;
+    }
+    if (flags & kZipFlagEncrypted) {
+      LOGMSG(l_WARN, "Encrypted zip member '%s' is not supported - skipping", name);
+      continue;
+    }
+    if (method != kZipMethodStored && method != kZipMethodDeflated) {
+      LOGMSG(l_WARN, "Unsupported compression method (%" PRIu16 ") of zip member '%s' - skipping",
+             method, name);
+      continue;
+    }
+    if (method == kZipMethodStored && compSize != size) {
+      LOGMSG(l_ERROR, "Invalid size of stored zip member '%s'", name);
+      return false;
+    }
+
+    // Local header name and extra fields can differ from the central directory ones
+    if (localOff > (u8)(pArchive->bufSz - kZipLocalHdrSz) ||
+        readU4(pArchive->buf + localOff) != kZipLocalHdrSig) {
+      LOGMSG(l_ERROR, "Invalid local header of zip member '%s'", name);
+      return false;
+    }
+    const u1 *pLocal = pArchive->buf + localOff;
+    off_t dataOff = localOff + kZipLocalHdrSz + readU2(pLocal + 26) + readU2(pLocal + 28);
+    if (!addMember(pArchive, name, dataOff, compSize, size, crc,
+                   method == kZipMethodStored ? kArchiveStored : kArchiveDeflated)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+archive_t *archive_open(const char *fileName, bool *pIsArchive) {
+  *pIsArchive = false;
+  int fd = open(fileName, O_RDONLY);
+  if (fd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't open() '%s' file in R/O mode", fileName);
+    return NULL;
+  }
+
+  u1 magic[kTarBlockSize] = { 0 };
+  ssize_t magicSz = utils_readFromFd(fd, magic, sizeof(magic));
+  bool isZip = magicSz >= 4 && (readU4(magic) == kZipLocalHdrSig || readU4(magic) == kZipEndSig);
+  bool isTar = magicSz == kTarBlockSize && archive_isTarBlock(magic);
+  close(fd);
+  if (!isZip && !isTar) {
+    return NULL;
+  }
+  *pIsArchive = true;
+
+  archive_t *pArchive = utils_calloc(sizeof(archive_t));
+  pArchive->buf = utils_mapFileToRead(fileName, &pArchive->bufSz, &pArchive->fd);
+  if (pArchive->buf == NULL) {
+    free(pArchive);
+    return NULL;
+  }
+
+  if (!(isZip ? openZip(pArchive) : openTar(pArchive))) {
+    LOGMSG(l_ERROR, "Failed to list the members of '%s' archive", fileName);
+    archive_close(pArchive);
+    return NULL;
+  }
+  return pArchive;
+}
+
+void archive_close(archive_t *pArchive) {
+  if (pArchive == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < pArchive->memberCnt; i++) {
+    free(pArchive->members[i].name);
+  }
+  free(pArchive->members);
+  munmap(pArchive->buf, pArchive->bufSz);
+  close(pArchive->fd);
+  free(pArchive);
+}
+
+static u1 *inflateMember(const archive_t *pArchive, const archiveMember_t *pMember) {
+  if (pMember->compSize > UINT_MAX || pMember->size > UINT_MAX) {
+    LOGMSG(l_ERROR, "Zip member '%s' is too large", pMember->name);
+    return NULL;
+  }
+
+  size_t bufCap = pMember->size < kArchiveMinBufSize ? kArchiveMinBufSize : pMember->size;
+  u1 *buf = utils_malloc(bufCap);
+  memset(buf + pMember->size, 0, bufCap - pMember->size);
+
+  z_stream zStream;
+  memset(&zStream, 0, sizeof(zStream));
+  if (inflateInit2(&zStream, -MAX_WBITS) != Z_OK) {
+    LOGMSG(l_ERROR, "Couldn't initialize zlib stream");
+    free(buf);
+    return NULL;
+  }
+  zStream.next_in = pArchive->buf + pMember->dataOff;
+  zStream.avail_in = pMember->compSize;
+  zStream.next_out = buf;
+  zStream.avail_out = pMember->size;
+  int zRet = inflate(&zStream, Z_FINISH);
+  inflateEnd(&zStream);
+
+  if (zRet != Z_STREAM_END || zStream.total_out != pMember->size) {
+    LOGMSG(l_ERROR, "Couldn't inflate zip member '%s' (%d)", pMember->name, zRet);
+    free(buf);
+    return NULL;
+  }
+  if (crc32(0, buf, pMember->size) != pMember->crc) {
+    LOGMSG(l_ERROR, "CRC mismatch of zip member '%s'", pMember->name);
+    free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+u1 *archive_getMember(archive_t *pArchive, size_t idx, bool *pOwned) {
+  const archiveMember_t *pMember = &pArchive->members[idx];
+  u1 *pData = pArchive->buf + pMember->dataOff;
+  *pOwned = true;
+
+  if (pMember->method == kArchiveDeflated) {
+    return inflateMember(pArchive, pMember);
+  }
+
+  // Vdex & Dex structures are accessed in place, so their alignment has to be preserved
+  if (((uintptr_t)pData & (sizeof(u4) - 1)) != 0) {
+    LOGMSG(l_DEBUG, "Archive member '%s' is not aligned - copying", pMember->name);
+    size_t bufCap = pMember->size < kArchiveMinBufSize ? kArchiveMinBufSize : pMember->size;
+    u1 *buf = utils_calloc(bufCap);
+    memcpy(buf, pData, pMember->size);
+    return buf;
+  }
+
+  *pOwned = false;
+  return pData;
+}
+
+void archive_putMember(archive_t *pArchive, size_t idx, u1 *buf, bool owned) {
+  if (owned) {
+    free(buf);
+    return;
+  }
+
+  // Drop the private copies of the pages that have been decompiled in place. Each member is
+  // processed once, so only pages entirely within the member are released.
+  const archiveMember_t *pMember = &pArchive->members[idx];
+  uintptr_t pageSz = sysconf(_SC_PAGESIZE);
+  uintptr_t start = utils_roundUp((uintptr_t)buf, pageSz);
+  uintptr_t end = utils_roundDown((uintptr_t)buf + pMember->size, pageSz);
+  if (start < end) {
+    madvise((void *)start, end - start, MADV_DONTNEED);
+  }
+}
+
+bool archive_isVdexName(const char *name) {
+  size_t nameLen = strlen(name);
+  return nameLen > strlen(".vdex") && strcmp(name + nameLen - strlen(".vdex"), ".vdex") == 0;
+}
+
+bool archive_isTarBlock(const u1 *pBlock) {
+  return memcmp(pBlock + 257, kTarMagic, strlen(kTarMagic)) == 0;
+}
+
+bool archive_isTarEndBlock(const u1 *pBlock) {
+  for (size_t i = 0; i < kTarBlockSize; i++) {
+    if (pBlock[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Numeric fields are octal strings, or big-endian base-256 if the high bit is set
+static bool parseTarNumber(const u1 *pField, size_t len, u8 *pVal) {
+  u8 val = 0;
+  if (pField[0] & 0x80) {
+    val = pField[0] & 0x7f;
+    for (size_t i = 1; i < len; i++) {
+      val = (val << 8) | pField[i];
+    }
+    *pVal = val;
+    return true;
+  }
+
+  size_t i = 0;
+  while (i < len && pField[i] == ' ') {
+    i++;
+  }
+  for (; i < len && pField[i] != '\0' && pField[i] != ' '; i++) {
+    if (pField[i] < '0' || pField[i] > '7') {
+      return false;
+    }
+    val = (val << 3) | (pField[i] - '0');
+  }
+  *pVal = val;
+  return true;
+}
+
+bool archive_parseTarHeader(const u1 *pBlock, archiveTarHdr_t *pHdr) {
+  // Checksum is computed with its own field set to spaces
+  u8 checksum = 0;
+  u8 storedChecksum = 0;
+  for (size_t i = 0; i < kTarBlockSize; i++) {
+    checksum += (i >= 148 && i < 156) ? ' ' : pBlock[i];
+  }
+  if (!parseTarNumber(pBlock + 148, 8, &storedChecksum) || storedChecksum != checksum ||
+      !parseTarNumber(pBlock + 124, 12, &pHdr->size)) {
+    return false;
+  }
+  pHdr->type = pBlock[156];
+
+  // POSIX ustar splits long names into a prefix and a name (GNU tar uses the prefix field for
+  // other purposes)
+  const char *pName = (const char *)pBlock;
+  const char *pPrefix = (const char *)pBlock + 345;
+  if (memcmp(pBlock + 257, kTarPosixMagic, sizeof(kTarPosixMagic)) == 0 && pPrefix[0] != '\0') {
+    snprintf(pHdr->name, sizeof(pHdr->name), "%.155s/%.100s", pPrefix, pName);
+  } else {
+    snprintf(pHdr->name, sizeof(pHdr->name), "%.100s", pName);
+  }
+  return true;
+}
+
+// Pax extended headers are "<len> <key>=<value>\n" records
+bool archive_parseTarPaxPath(const u1 *pData, size_t size, char *name, size_t nameLen) {
+  size_t pos = 0;
+  while (pos < size) {
+    size_t recLen = 0;
+    size_t i = pos;
+    for (; i < size && pData[i] >= '0' && pData[i] <= '9'; i++) {
+      recLen = recLen * 10 + (pData[i] - '0');
+    }
+    if (i >= size || pData[i] != ' ' || recLen > size - pos || i + 2 > pos + recLen) {
+      return false;
+    }
+    const char *pKey = (const char *)pData + i + 1;
+    size_t kvLen = pos + recLen - (i + 1) - 1;
+    if (kvLen > strlen("path=") && memcmp(pKey, "path=", strlen("path=")) == 0) {
+      snprintf(name, nameLen, "%.*s", (int)(kvLen - strlen("path=")), pKey + strlen("path="));
+      return true;
+    }
+    pos += recLen;
+  }
+  return false;
+}
+
+bool archive_isTarRegular(char type) { return type == '0' || type == '\0' || type == '7'; }
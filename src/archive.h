@@ -0,0 +1,79 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include "common.h"
+
+#define kTarBlockSize 512
+
+typedef enum { kArchiveStored = 0, kArchiveDeflated } archiveMethod_t;
+
+// Vdex member of a tar or zip archive
+typedef struct {
+  char *name;
+  off_t dataOff;
+  size_t compSize;
+  size_t size;
+  u4 crc;
+  archiveMethod_t method;
+} archiveMember_t;
+
+// Archive input, mapped private and R/W so that stored members can be decompiled in place
+struct archive {
+  int fd;
+  u1 *buf;
+  off_t bufSz;
+  archiveMember_t *members;
+  size_t memberCnt;
+};
+
+// Fields of a tar header block that are needed to walk an archive
+typedef struct {
+  char name[PATH_MAX];
+  u8 size;
+  char type;
+} archiveTarHdr_t;
+
+// Opens the file and lists its Vdex members if it is a tar or zip archive. isArchive is cleared
+// (and NULL returned) for any other file type. For invalid archives NULL is returned with
+// isArchive set.
+archive_t *archive_open(const char *, bool *);
+void archive_close(archive_t *);
+
+// Returns the contents of a member. Stored members point into the archive mapping, unless they are
+// misaligned, while the rest are inflated into a malloc()-ed buffer (owned is set). Buffers are
+// released with archive_putMember().
+u1 *archive_getMember(archive_t *, size_t, bool *);
+void archive_putMember(archive_t *, size_t, u1 *, bool);
+
+bool archive_isVdexName(const char *);
+
+// Tar helpers shared with the stream reader
+bool archive_isTarBlock(const u1 *);
+bool archive_isTarEndBlock(const u1 *);
+bool archive_parseTarHeader(const u1 *, archiveTarHdr_t *);
+bool archive_parseTarPaxPath(const u1 *, size_t, char *, size_t);
+bool archive_isTarRegular(char);
+
+#endif
@@ -0,0 +1,493 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "async_writer.h"
+
+#include <pthread.h>
+
+#include "utils.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+// Headers older than Linux 5.6 lack the openat/close operations
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define ASYNC_WRITER_URING
+#endif
+#endif
+#endif
+
+#define kAsyncWriterThreads 4
+#define kAsyncWriterRingEntries 64
+#define kAsyncWriterMaxPending (64 * 1024 * 1024)
+// Keep write lengths within the 32-bit length field of a submission
+#define kAsyncWriterMaxWrite (1U << 30)
+
+typedef enum { kReqOpen = 0, kReqWrite, kReqFsync, kReqClose } asyncReqState_t;
+
+typedef struct asyncWriterReq {
+  struct asyncWriterReq *next;
+  char path[PATH_MAX];
+  int flags;
+  u1 *buf;
+  size_t size;
+  size_t written;
+  int fd;
+  asyncReqState_t state;
+  bool failed;
+} asyncWriterReq_t;
+
+#ifdef ASYNC_WRITER_URING
+// Submission and completion rings shared with the kernel. They're only accessed from the single
+// writer thread, which keeps at most one operation in flight per request, so neither ring can
+// overflow as long as no more than 'entries' requests are started.
+typedef struct {
+  int fd;
+  unsigned entries;
+  void *sqRing;
+  size_t sqRingSz;
+  void *cqRing;
+  size_t cqRingSz;
+  struct io_uring_sqe *sqes;
+  size_t sqesSz;
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  struct io_uring_cqe *cqes;
+  unsigned toSubmit;
+  unsigned inFlight;
+} uring_t;
+#endif
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t hasWork;
+  pthread_cond_t hasRoom;
+  asyncWriterReq_t *head;
+  asyncWriterReq_t *tail;
+  size_t pendingBytes;
+  size_t failedCnt;
+  bool fsync;
+  bool stopping;
+  bool active;
+  pthread_t *threads;
+  int threadCnt;
+#ifdef ASYNC_WRITER_URING
+  bool useRing;
+  uring_t ring;
+#endif
+} asyncWriter_t;
+
+static asyncWriter_t writer;
+
+// Caller holds the lock
+static asyncWriterReq_t *popRequest(void) {
+  asyncWriterReq_t *pReq = writer.head;
+  if (pReq != NULL) {
+    writer.head = pReq->next;
+    if (writer.head == NULL) {
+      writer.tail = NULL;
+    }
+  }
+  return pReq;
+}
+
+static void finishRequest(asyncWriterReq_t *pReq) {
+  pthread_mutex_lock(&writer.lock);
+  writer.pendingBytes -= pReq->size;
+  if (pReq->failed) {
+    writer.failedCnt++;
+  }
+  pthread_cond_broadcast(&writer.hasRoom);
+  pthread_mutex_unlock(&writer.lock);
+
+  free(pReq->buf);
+  free(pReq);
+}
+
+static void writeFileSync(asyncWriterReq_t *pReq) {
+  int fd = open(pReq->path, pReq->flags, 0644);
+  if (fd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't create output file '%s'", pReq->path);
+    pReq->failed = true;
+    return;
+  }
+
+  if (!utils_writeToFd(fd, pReq->buf, pReq->size)) {
+    LOGMSG(l_ERROR, "Couldn't write '%s' file", pReq->path);
+    pReq->failed = true;
+  } else if (writer.fsync && fsync(fd) != 0) {
+    LOGMSG_P(l_ERROR, "Couldn't fsync() '%s' file", pReq->path);
+    pReq->failed = true;
+  }
+  close(fd);
+}
+
+// Fallback writer for kernels without io_uring
+static void *threadWriter(void *arg __attribute__((unused))) {
+  pthread_mutex_lock(&writer.lock);
+  for (;;) {
+    while (writer.head == NULL && !writer.stopping) {
+      pthread_cond_wait(&writer.hasWork, &writer.lock);
+    }
+    asyncWriterReq_t *pReq = popRequest();
+    if (pReq == NULL) {
+      break;
+    }
+    pthread_mutex_unlock(&writer.lock);
+    writeFileSync(pReq);
+    finishRequest(pReq);
+    pthread_mutex_lock(&writer.lock);
+  }
+  pthread_mutex_unlock(&writer.lock);
+  return NULL;
+}
+
+#ifdef ASYNC_WRITER_URING
+static bool uringSupportsOps(int ringFd) {
+  const u1 ops[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE };
+  const unsigned probeOps = 256;
+  struct io_uring_probe *pProbe =
+      utils_calloc(sizeof(struct io_uring_probe) + probeOps * sizeof(struct io_uring_probe_op));
+  bool ret = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, pProbe, probeOps) == 0;
+  for (size_t i = 0; ret && i < sizeof(ops); i++) {
+    ret = ops[i] <= pProbe->last_op && (pProbe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+  }
+  free(pProbe);
+  return ret;
+}
+
+static void uringDestroy(uring_t *pRing) {
+  if (pRing->sqes != NULL) {
+    munmap(pRing->sqes, pRing->sqesSz);
+  }
+  if (pRing->cqRing != NULL && pRing->cqRing != pRing->sqRing) {
+    munmap(pRing->cqRing, pRing->cqRingSz);
+  }
+  if (pRing->sqRing != NULL) {
+    munmap(pRing->sqRing, pRing->sqRingSz);
+  }
+  close(pRing->fd);
+  memset(pRing, 0, sizeof(uring_t));
+}
+
+static void *uringMap(int ringFd, size_t size, off_t off) {
+  void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, off);
+  return addr == MAP_FAILED ? NULL : addr;
+}
+
+static bool uringInit(uring_t *pRing, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(pRing, 0, sizeof(uring_t));
+
+  pRing->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (pRing->fd == -1) {
+    LOGMSG_P(l_DEBUG, "io_uring_setup() failed");
+    return false;
+  }
+  if (!uringSupportsOps(pRing->fd)) {
+    LOGMSG(l_DEBUG, "io_uring doesn't support the operations of the output writer");
+    goto fail;
+  }
+
+  pRing->sqRingSz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  pRing->cqRingSz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (pRing->cqRingSz > pRing->sqRingSz) {
+      pRing->sqRingSz = pRing->cqRingSz;
+    }
+    pRing->cqRingSz = pRing->sqRingSz;
+  }
+  pRing->sqRing = uringMap(pRing->fd, pRing->sqRingSz, IORING_OFF_SQ_RING);
+  if (pRing->sqRing == NULL) {
+    goto fail;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    pRing->cqRing = pRing->sqRing;
+  } else if ((pRing->cqRing = uringMap(pRing->fd, pRing->cqRingSz, IORING_OFF_CQ_RING)) == NULL) {
+    goto fail;
+  }
+  pRing->sqesSz = params.sq_entries * sizeof(struct io_uring_sqe);
+  pRing->sqes = uringMap(pRing->fd, pRing->sqesSz, IORING_OFF_SQES);
+  if (pRing->sqes == NULL) {
+    goto fail;
+  }
+
+  u1 *sq = pRing->sqRing;
+  u1 *cq = pRing->cqRing;
+  pRing->entries = params.sq_entries;
+  pRing->sqTail = (unsigned *)(sq + params.sq_off.tail);
+  pRing->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+  pRing->sqArray = (unsigned *)(sq + params.sq_off.array);
+  pRing->cqHead = (unsigned *)(cq + params.cq_off.head);
+  pRing->cqTail = (unsigned *)(cq + params.cq_off.tail);
+  pRing->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+  pRing->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+
+fail:
+  LOGMSG_P(l_DEBUG, "Couldn't map io_uring rings");
+  uringDestroy(pRing);
+  return false;
+}
+
+// Queues the current operation of the request (submitted with the next io_uring_enter())
+static void uringQueueRequest(uring_t *pRing, asyncWriterReq_t *pReq) {
+  unsigned tail = *pRing->sqTail;
+  unsigned idx = tail & *pRing->sqMask;
+  struct io_uring_sqe *pSqe = &pRing->sqes[idx];
+  memset(pSqe, 0, sizeof(struct io_uring_sqe));
+
+  switch (pReq->state) {
+    case kReqOpen:
+      pSqe->opcode = IORING_OP_OPENAT;
+      pSqe->fd = AT_FDCWD;
+      pSqe->addr = (uintptr_t)pReq->path;
+      pSqe->len = 0644;
+      pSqe->open_flags = pReq->flags;
+      break;
+    case kReqWrite: {
+      size_t len = pReq->size - pReq->written;
+      pSqe->opcode = IORING_OP_WRITE;
+      pSqe->fd = pReq->fd;
+      pSqe->addr = (uintptr_t)(pReq->buf + pReq->written);
+      pSqe->len = len > kAsyncWriterMaxWrite ? kAsyncWriterMaxWrite : len;
+      pSqe->off = pReq->written;
+      break;
+    }
+    case kReqFsync:
+      pSqe->opcode = IORING_OP_FSYNC;
+      pSqe->fd = pReq->fd;
+      break;
+    case kReqClose:
+      pSqe->opcode = IORING_OP_CLOSE;
+      pSqe->fd = pReq->fd;
+      break;
+  }
+  pSqe->user_data = (uintptr_t)pReq;
+
+  pRing->sqArray[idx] = idx;
+  __atomic_store_n(pRing->sqTail, tail + 1, __ATOMIC_RELEASE);
+  pRing->toSubmit++;
+  pRing->inFlight++;
+}
+
+static asyncReqState_t stateAfterWrite(void) { return writer.fsync ? kReqFsync : kReqClose; }
+
+// Moves the request to its next operation based on the result of the completed one. Returns false
+// once the request is done.
+static bool advanceRequest(asyncWriterReq_t *pReq, int res) {
+  switch (pReq->state) {
+    case kReqOpen:
+      if (res < 0) {
+        errno = -res;
+        LOGMSG_P(l_ERROR, "Couldn't create output file '%s'", pReq->path);
+        pReq->failed = true;
+        return false;
+      }
+      pReq->fd = res;
+      pReq->state = pReq->size > 0 ? kReqWrite : stateAfterWrite();
+      return true;
+    case kReqWrite:
+      if (res == -EINTR || res == -EAGAIN) {
+        return true;
+      }
+      if (res <= 0) {
+        errno = res < 0 ? -res : EIO;
+        LOGMSG_P(l_ERROR, "Couldn't write '%s' file", pReq->path);
+        pReq->failed = true;
+        pReq->state = kReqClose;
+        return true;
+      }
+      pReq->written += res;
+      if (pReq->written == pReq->size) {
+        pReq->state = stateAfterWrite();
+      }
+      return true;
+    case kReqFsync:
+      if (res < 0) {
+        errno = -res;
+        LOGMSG_P(l_ERROR, "Couldn't fsync() '%s' file", pReq->path);
+        pReq->failed = true;
+      }
+      pReq->state = kReqClose;
+      return true;
+    case kReqClose:
+      if (res < 0) {
+        errno = -res;
+        LOGMSG_P(l_ERROR, "Couldn't close '%s' file", pReq->path);
+        pReq->failed = true;
+      }
+      return false;
+  }
+  return false;
+}
+
+static void uringSubmitAndWait(uring_t *pRing) {
+  int ret = syscall(__NR_io_uring_enter, pRing->fd, pRing->toSubmit, 1, IORING_ENTER_GETEVENTS,
+                    NULL, 0);
+  if (ret == -1) {
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      LOGMSG_P(l_FATAL, "io_uring_enter() failed");
+    }
+    return;
+  }
+  pRing->toSubmit -= ret;
+}
+
+static void uringReap(uring_t *pRing) {
+  unsigned head = *pRing->cqHead;
+  unsigned tail = __atomic_load_n(pRing->cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const struct io_uring_cqe *pCqe = &pRing->cqes[head & *pRing->cqMask];
+    asyncWriterReq_t *pReq = (asyncWriterReq_t *)(uintptr_t)pCqe->user_data;
+    pRing->inFlight--;
+    if (advanceRequest(pReq, pCqe->res)) {
+      uringQueueRequest(pRing, pReq);
+    } else {
+      finishRequest(pReq);
+    }
+  }
+  __atomic_store_n(pRing->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static void *uringWriter(void *arg __attribute__((unused))) {
+  uring_t *pRing = &writer.ring;
+  pthread_mutex_lock(&writer.lock);
+  for (;;) {
+    while (writer.head == NULL && pRing->inFlight == 0 && !writer.stopping) {
+      pthread_cond_wait(&writer.hasWork, &writer.lock);
+    }
+
+    // Start as many queued files as there are free ring slots
+    asyncWriterReq_t *pReq = NULL;
+    while (pRing->inFlight < pRing->entries && (pReq = popRequest()) != NULL) {
+      uringQueueRequest(pRing, pReq);
+    }
+    if (pRing->inFlight == 0) {
+      // Stopping and drained
+      break;
+    }
+
+    pthread_mutex_unlock(&writer.lock);
+    uringSubmitAndWait(pRing);
+    uringReap(pRing);
+    pthread_mutex_lock(&writer.lock);
+  }
+  pthread_mutex_unlock(&writer.lock);
+  return NULL;
+}
+#endif
+
+bool asyncWriter_init(bool fsync) {
+  memset(&writer, 0, sizeof(asyncWriter_t));
+  writer.fsync = fsync;
+  pthread_mutex_init(&writer.lock, NULL);
+  pthread_cond_init(&writer.hasWork, NULL);
+  pthread_cond_init(&writer.hasRoom, NULL);
+
+  int threadCnt = kAsyncWriterThreads;
+  void *(*writerFn)(void *) = threadWriter;
+#ifdef ASYNC_WRITER_URING
+  if (uringInit(&writer.ring, kAsyncWriterRingEntries)) {
+    LOGMSG(l_DEBUG, "Using io_uring output writer");
+    writer.useRing = true;
+    threadCnt = 1;
+    writerFn = uringWriter;
+  }
+#endif
+  if (threadCnt > 1) {
+    LOGMSG(l_DEBUG, "Using %d output writer threads", threadCnt);
+  }
+
+  writer.threads = utils_calloc(threadCnt * sizeof(pthread_t));
+  for (; writer.threadCnt < threadCnt; writer.threadCnt++) {
+    int err = pthread_create(&writer.threads[writer.threadCnt], NULL, writerFn, NULL);
+    if (err != 0) {
+      errno = err;
+      LOGMSG_P(l_WARN, "Couldn't spawn output writer thread");
+      break;
+    }
+  }
+  writer.active = writer.threadCnt > 0;
+  if (!writer.active) {
+    asyncWriter_destroy();
+  }
+  return writer.active;
+}
+
+bool asyncWriter_isActive(void) { return writer.active; }
+
+void asyncWriter_enqueue(const char *path, int flags, u1 *buf, size_t size) {
+  asyncWriterReq_t *pReq = utils_calloc(sizeof(asyncWriterReq_t));
+  snprintf(pReq->path, sizeof(pReq->path), "%s", path);
+  pReq->flags = flags;
+  pReq->buf = buf;
+  pReq->size = size;
+  pReq->fd = -1;
+  pReq->state = kReqOpen;
+
+  pthread_mutex_lock(&writer.lock);
+  // A file larger than the limit is still accepted once everything before it has been written
+  while (writer.pendingBytes > 0 && writer.pendingBytes + size > kAsyncWriterMaxPending) {
+    pthread_cond_wait(&writer.hasRoom, &writer.lock);
+  }
+  if (writer.tail == NULL) {
+    writer.head = pReq;
+  } else {
+    writer.tail->next = pReq;
+  }
+  writer.tail = pReq;
+  writer.pendingBytes += size;
+  pthread_cond_signal(&writer.hasWork);
+  pthread_mutex_unlock(&writer.lock);
+}
+
+size_t asyncWriter_destroy(void) {
+  pthread_mutex_lock(&writer.lock);
+  writer.stopping = true;
+  pthread_cond_broadcast(&writer.hasWork);
+  pthread_mutex_unlock(&writer.lock);
+
+  for (int i = 0; i < writer.threadCnt; i++) {
+    pthread_join(writer.threads[i], NULL);
+  }
+  free(writer.threads);
+#ifdef ASYNC_WRITER_URING
+  if (writer.useRing) {
+    uringDestroy(&writer.ring);
+  }
+#endif
+
+  pthread_cond_destroy(&writer.hasRoom);
+  pthread_cond_destroy(&writer.hasWork);
+  pthread_mutex_destroy(&writer.lock);
+  size_t failedCnt = writer.failedCnt;
+  memset(&writer, 0, sizeof(asyncWriter_t));
+  return failedCnt;
+}
@@ -0,0 +1,49 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _ASYNC_WRITER_H_
+#define _ASYNC_WRITER_H_
+
+#include "common.h"
+
+// Asynchronous writer of output files. Each queued file is created, written, optionally fsync()-ed
+// and closed in the background, so that the processing threads don't stall on filesystem metadata
+// updates and writeback. Requests are drained through an io_uring instance when the kernel
+// supports the required operations, or otherwise by a pool of writer threads.
+//
+// The writer is per process: it has to be initialized after fork() and flushed before exit.
+
+// Starts the writer. If fsync is set, each file is synced before it's closed.
+bool asyncWriter_init(bool);
+
+bool asyncWriter_isActive(void);
+
+// Queues a file to be created with the given open flags and written with the contents of the
+// buffer. The writer takes ownership of the buffer (must be malloc()-ed), which is freed once the
+// file has been written. Blocks while too much data is pending, so that memory usage is bounded.
+void asyncWriter_enqueue(const char *, int, u1 *, size_t);
+
+// Waits for all queued files to be written and stops the writer. Returns the number of files
+// that failed to be written.
+size_t asyncWriter_destroy(void);
+
+#endif
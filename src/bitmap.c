@@ -0,0 +1,77 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "bitmap.h"
+
+#include "utils.h"
+
+#define kBitsPerWord (sizeof(u8) * 8)
+
+static bitmap_t **pool;
+static size_t poolSz;
+
+bitmap_t *bitmap_create(size_t nBits) {
+  bitmap_t *pBitmap = utils_calloc(sizeof(bitmap_t));
+  bitmap_reset(pBitmap, nBits);
+  return pBitmap;
+}
+
+void bitmap_destroy(bitmap_t *pBitmap) {
+  if (pBitmap == NULL) {
+    return;
+  }
+  free(pBitmap->words);
+  free(pBitmap);
+}
+
+void bitmap_reset(bitmap_t *pBitmap, size_t nBits) {
+  size_t nWords = nBits / kBitsPerWord + 1;
+  if (nWords > pBitmap->nWords) {
+    free(pBitmap->words);
+    pBitmap->words = utils_malloc(nWords * sizeof(u8));
+    pBitmap->nWords = nWords;
+  }
+  pBitmap->nBits = nBits;
+  memset(pBitmap->words, 0, nWords * sizeof(u8));
+}
+
+bool bitmap_testAndSet(bitmap_t *pBitmap, size_t bit) {
+  CHECK_LT(bit, pBitmap->nBits);
+  const u8 mask = 1ULL << (bit % kBitsPerWord);
+  u8 old = __atomic_fetch_or(&pBitmap->words[bit / kBitsPerWord], mask, __ATOMIC_RELAXED);
+  return (old & mask) != 0;
+}
+
+void bitmap_reservePool(size_t cnt) {
+  if (cnt <= poolSz) {
+    return;
+  }
+  pool = utils_realloc(pool, cnt * sizeof(bitmap_t *));
+  for (; poolSz < cnt; poolSz++) {
+    pool[poolSz] = bitmap_create(0);
+  }
+}
+
+bitmap_t *bitmap_getPooled(size_t idx) {
+  CHECK_LT(idx, poolSz);
+  return pool[idx];
+}
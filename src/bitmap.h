@@ -0,0 +1,51 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _BITMAP_H_
+#define _BITMAP_H_
+
+#include "common.h"
+
+// Fixed size bitmap. Bits are set atomically, so a single bitmap can be shared between threads.
+typedef struct {
+  size_t nBits;
+  size_t nWords;
+  u8 *words;
+} bitmap_t;
+
+bitmap_t *bitmap_create(size_t);
+void bitmap_destroy(bitmap_t *);
+
+// Resizes the bitmap and clears all its bits. Storage is only reallocated when growing, so a
+// bitmap can be cheaply reused across inputs of different sizes.
+void bitmap_reset(bitmap_t *, size_t);
+
+// Atomically sets a bit and returns its previous value
+bool bitmap_testAndSet(bitmap_t *, size_t);
+
+// Bitmaps that are kept for the lifetime of the process (e.g. one per worker thread), so that
+// they're allocated once and only reset between input files. The pool grows to the reserved number
+// of bitmaps, which must be done before the threads that get them are started.
+void bitmap_reservePool(size_t);
+bitmap_t *bitmap_getPooled(size_t);
+
+#endif
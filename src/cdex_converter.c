@@ -0,0 +1,1154 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "cdex_converter.h"
+
+#include "dex.h"
+#include "utils.h"
+
+// Map list item types
+#define kDexTypeHeaderItem 0x0000
+#define kDexTypeStringIdItem 0x0001
+#define kDexTypeTypeIdItem 0x0002
+#define kDexTypeProtoIdItem 0x0003
+#define kDexTypeFieldIdItem 0x0004
+#define kDexTypeMethodIdItem 0x0005
+#define kDexTypeClassDefItem 0x0006
+#define kDexTypeCallSiteIdItem 0x0007
+#define kDexTypeMethodHandleItem 0x0008
+#define kDexTypeMapList 0x1000
+#define kDexTypeTypeList 0x1001
+#define kDexTypeAnnotationSetRefList 0x1002
+#define kDexTypeAnnotationSetItem 0x1003
+#define kDexTypeClassDataItem 0x2000
+#define kDexTypeCodeItem 0x2001
+#define kDexTypeStringDataItem 0x2002
+#define kDexTypeDebugInfoItem 0x2003
+#define kDexTypeAnnotationItem 0x2004
+#define kDexTypeEncodedArrayItem 0x2005
+#define kDexTypeAnnotationsDirectoryItem 0x2006
+#define kDexTypeHiddenapiClassData 0xF000
+
+// Encoded value types that are not followed by (value_arg + 1) bytes
+#define kEncodedValueArray 0x1c
+#define kEncodedValueAnnotation 0x1d
+#define kEncodedValueNull 0x1e
+#define kEncodedValueBoolean 0x1f
+#define kEncodedValueMaxDepth 64
+
+#define kDbgEndSequence 0x00
+#define kDbgAdvancePc 0x01
+#define kDbgAdvanceLine 0x02
+#define kDbgStartLocal 0x03
+#define kDbgStartLocalExtended 0x04
+#define kDbgEndLocal 0x05
+#define kDbgRestartLocal 0x06
+#define kDbgSetFile 0x09
+
+#define kCallSiteIdSz 4
+#define kMethodHandleSz 8
+#define kDebugInfoElementsPerIndex 16
+#define kStdDexVersion "039"
+#define kMaxMapItems 24
+#define kOutBufInitSz (64 * 1024)
+#define kMinDataHoleSz 4096
+
+// Old (CompactDex data section relative) to new (StandardDex file) offsets of the items of a
+// section, sorted by the old offset. Code items are keyed by their offset along with the offset of
+// their debug info, since CompactDex shares a code item between methods with different debug info.
+typedef struct {
+  u8 *keys;
+  u4 *newOffs;
+  size_t cnt;
+  size_t capacity;
+} offMap_t;
+
+typedef struct {
+  const u1 *cdexBuf;
+  u4 mainSize;
+  const u1 *dataBuf;
+  u4 dataSize;
+  const u1 *pDebugInfoBegin;
+  const u4 *pDebugInfoTable;
+  u4 debugInfoBase;
+  u4 debugInfoTableSize;
+  u4 callSiteIdsSize;
+  u4 callSiteIdsOff;
+  u4 methodHandlesSize;
+  u4 methodHandlesOff;
+  u4 hiddenapiOff;
+  offMap_t stringData;
+  offMap_t typeLists;
+  offMap_t debugInfos;
+  offMap_t annotations;
+  offMap_t encodedArrays;
+  offMap_t annotationSets;
+  offMap_t annotationSetRefLists;
+  offMap_t annotationsDirs;
+  offMap_t codeItems;
+  offMap_t classData;
+  u1 *out;
+  size_t outSize;
+  size_t outCapacity;
+  dexMapItem mapItems[kMaxMapItems];
+  u4 mapItemsCnt;
+} cdexConverter_t;
+
+typedef bool (*emitItemFn_t)(cdexConverter_t *, u8);
+typedef size_t (*itemSizeFn_t)(const cdexConverter_t *, u4);
+
+static void offMap_add(offMap_t *pMap, u8 key) {
+  if (pMap->cnt == pMap->capacity) {
+    pMap->capacity = pMap->capacity ? pMap->capacity * 2 : 64;
+    pMap->keys = utils_realloc(pMap->keys, pMap->capacity * sizeof(u8));
+  }
+  pMap->keys[pMap->cnt++] = key;
+}
+
+static int compareKeys(const void *a, const void *b) {
+  const u8 keyA = *(const u8 *)a;
+  const u8 keyB = *(const u8 *)b;
+  return (keyA > keyB) - (keyA < keyB);
+}
+
+// Sorts and deduplicates the collected keys. No keys can be added afterwards.
+static void offMap_seal(offMap_t *pMap) {
+  if (pMap->cnt == 0) {
+    return;
+  }
+  qsort(pMap->keys, pMap->cnt, sizeof(u8), compareKeys);
+  size_t uniqueCnt = 1;
+  for (size_t i = 1; i < pMap->cnt; ++i) {
+    if (pMap->keys[i] != pMap->keys[uniqueCnt - 1]) {
+      pMap->keys[uniqueCnt++] = pMap->keys[i];
+    }
+  }
+  pMap->cnt = uniqueCnt;
+  pMap->newOffs = utils_calloc(pMap->cnt * sizeof(u4));
+}
+
+static u4 offMap_get(const offMap_t *pMap, u8 key) {
+  const u8 *pKey = bsearch(&key, pMap->keys, pMap->cnt, sizeof(u8), compareKeys);
+  CHECK(pKey != NULL);
+  return pMap->newOffs[pKey - pMap->keys];
+}
+
+// Zero offsets stand for a missing optional item
+static u4 offMap_getOpt(const offMap_t *pMap, u4 off) {
+  return off == 0 ? 0 : offMap_get(pMap, off);
+}
+
+static void offMap_destroy(offMap_t *pMap) {
+  free(pMap->keys);
+  free(pMap->newOffs);
+  memset(pMap, 0, sizeof(offMap_t));
+}
+
+// Returns the data section address of an item if its first size bytes are in bounds
+static const u1 *dataAt(const cdexConverter_t *pCtx, size_t off, size_t size) {
+  if (off > pCtx->dataSize || size > pCtx->dataSize - off) {
+    return NULL;
+  }
+  return pCtx->dataBuf + off;
+}
+
+static bool addDataOff(const cdexConverter_t *pCtx, offMap_t *pMap, u4 off) {
+  if (dataAt(pCtx, off, 1) == NULL) {
+    LOGMSG(l_ERROR, "CompactDex data offset %" PRIx32 " is out of bounds", off);
+    return false;
+  }
+  offMap_add(pMap, off);
+  return true;
+}
+
+static bool addDataOffOpt(const cdexConverter_t *pCtx, offMap_t *pMap, u4 off) {
+  return off == 0 || addDataOff(pCtx, pMap, off);
+}
+
+static bool skipLeb128(const u1 **pCursor, const u1 *end) {
+  while (*pCursor < end) {
+    if ((*(*pCursor)++ & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool readULeb128(const u1 **pCursor, const u1 *end, u4 *pValue) {
+  const u1 *start = *pCursor;
+  if (!skipLeb128(pCursor, end)) {
+    return false;
+  }
+  *pValue = dex_readULeb128(&start);
+  return true;
+}
+
+static bool skipEncodedValue(const u1 **pCursor, const u1 *end, int depth);
+
+static bool skipEncodedArray(const u1 **pCursor, const u1 *end, int depth) {
+  u4 size;
+  if (!readULeb128(pCursor, end, &size)) {
+    return false;
+  }
+  for (u4 i = 0; i < size; ++i) {
+    if (!skipEncodedValue(pCursor, end, depth)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool skipEncodedAnnotation(const u1 **pCursor, const u1 *end, int depth) {
+  u4 size;
+  if (!skipLeb128(pCursor, end) || !readULeb128(pCursor, end, &size)) {
+    return false;
+  }
+  for (u4 i = 0; i < size; ++i) {
+    if (!skipLeb128(pCursor, end) || !skipEncodedValue(pCursor, end, depth)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool skipEncodedValue(const u1 **pCursor, const u1 *end, int depth) {
+  if (*pCursor >= end || depth > kEncodedValueMaxDepth) {
+    return false;
+  }
+  const u1 valueType = **pCursor & 0x1f;
+  const size_t valueArg = **pCursor >> 5;
+  ++*pCursor;
+  switch (valueType) {
+    case kEncodedValueArray:
+      return skipEncodedArray(pCursor, end, depth + 1);
+    case kEncodedValueAnnotation:
+      return skipEncodedAnnotation(pCursor, end, depth + 1);
+    case kEncodedValueNull:
+    case kEncodedValueBoolean:
+      return true;
+    default:
+      if ((size_t)(end - *pCursor) < valueArg + 1) {
+        return false;
+      }
+      *pCursor += valueArg + 1;
+      return true;
+  }
+}
+
+// Size of a debug_info_item. Only the operand encodings matter here, since their values (string &
+// type indices, line & address deltas) are not affected by the conversion.
+static size_t debugInfoSize(const u1 *start, const u1 *end) {
+  const u1 *cursor = start;
+  u4 parametersSize;
+  if (!skipLeb128(&cursor, end) || !readULeb128(&cursor, end, &parametersSize)) {
+    return 0;
+  }
+  for (u4 i = 0; i < parametersSize; ++i) {
+    if (!skipLeb128(&cursor, end)) {
+      return 0;
+    }
+  }
+  while (cursor < end) {
+    size_t operandsCnt;
+    switch (*cursor++) {
+      case kDbgEndSequence:
+        return cursor - start;
+      case kDbgAdvancePc:
+      case kDbgAdvanceLine:
+      case kDbgEndLocal:
+      case kDbgRestartLocal:
+      case kDbgSetFile:
+        operandsCnt = 1;
+        break;
+      case kDbgStartLocal:
+        operandsCnt = 3;
+        break;
+      case kDbgStartLocalExtended:
+        operandsCnt = 4;
+        break;
+      default:
+        operandsCnt = 0;
+        break;
+    }
+    for (size_t i = 0; i < operandsCnt; ++i) {
+      if (!skipLeb128(&cursor, end)) {
+        return 0;
+      }
+    }
+  }
+  return 0;
+}
+
+// Size of an encoded_catch_handler_list
+static size_t catchHandlersSize(const u1 *start, const u1 *end) {
+  const u1 *cursor = start;
+  u4 handlersSize;
+  if (!readULeb128(&cursor, end, &handlersSize)) {
+    return 0;
+  }
+  for (u4 i = 0; i < handlersSize; ++i) {
+    const u1 *sizeStart = cursor;
+    if (!skipLeb128(&cursor, end)) {
+      return 0;
+    }
+    s4 size = dex_readSLeb128(&sizeStart);
+    // Pairs of type index & address, followed by the catch-all address if size is not positive
+    u4 lebsCnt = size > 0 ? 2 * (u4)size : 2 * (u4)(-size) + 1;
+    for (u4 j = 0; j < lebsCnt; ++j) {
+      if (!skipLeb128(&cursor, end)) {
+        return 0;
+      }
+    }
+  }
+  return cursor - start;
+}
+
+static void ensureOut(cdexConverter_t *pCtx, size_t size) {
+  if (pCtx->outSize + size <= pCtx->outCapacity) {
+    return;
+  }
+  while (pCtx->outSize + size > pCtx->outCapacity) {
+    pCtx->outCapacity *= 2;
+  }
+  pCtx->out = utils_realloc(pCtx->out, pCtx->outCapacity);
+}
+
+static void alignOut(cdexConverter_t *pCtx, size_t alignment) {
+  size_t padding = utils_allignUp(pCtx->outSize, alignment) - pCtx->outSize;
+  ensureOut(pCtx, padding);
+  memset(pCtx->out + pCtx->outSize, 0, padding);
+  pCtx->outSize += padding;
+}
+
+static void writeOut(cdexConverter_t *pCtx, const void *buf, size_t size) {
+  ensureOut(pCtx, size);
+  memcpy(pCtx->out + pCtx->outSize, buf, size);
+  pCtx->outSize += size;
+}
+
+static void writeOutU4(cdexConverter_t *pCtx, u4 value) {
+  writeOut(pCtx, &value, sizeof(u4));
+}
+
+static void writeOutULeb128(cdexConverter_t *pCtx, u4 value) {
+  ensureOut(pCtx, 5);
+  u1 *end = dex_writeULeb128(pCtx->out + pCtx->outSize, value);
+  pCtx->outSize = end - pCtx->out;
+}
+
+static void addMapItem(cdexConverter_t *pCtx, u2 type, u4 size, u4 offset) {
+  if (size == 0) {
+    return;
+  }
+  CHECK_LT(pCtx->mapItemsCnt, kMaxMapItems);
+  dexMapItem *pItem = &pCtx->mapItems[pCtx->mapItemsCnt++];
+  pItem->type = type;
+  pItem->unused = 0;
+  pItem->size = size;
+  pItem->offset = offset;
+}
+
+// Offset of the debug info of a method, as recorded in the CompactDex debug info offsets table
+static bool getDebugInfoOff(const cdexConverter_t *pCtx, u4 methodIdx, u4 *pDebugInfoOff) {
+  *pDebugInfoOff = 0;
+  if (pCtx->pDebugInfoBegin == NULL) {
+    return true;
+  }
+  if (methodIdx / kDebugInfoElementsPerIndex >= pCtx->debugInfoTableSize) {
+    LOGMSG(l_ERROR, "Method index %" PRIu32 " out of debug info table bounds", methodIdx);
+    return false;
+  }
+  const u1 *end = pCtx->dataBuf + pCtx->dataSize;
+  const u1 *block = dataAt(pCtx,
+                           (size_t)(pCtx->pDebugInfoBegin - pCtx->dataBuf) +
+                               pCtx->pDebugInfoTable[methodIdx / kDebugInfoElementsPerIndex],
+                           2);
+  if (block == NULL) {
+    LOGMSG(l_ERROR, "Malformed CompactDex debug info table");
+    return false;
+  }
+  u2 bitMask = (block[0] << kBitsPerByte) | block[1];
+  block += 2;
+  const u4 bitIndex = methodIdx % kDebugInfoElementsPerIndex;
+  if ((bitMask & (1 << bitIndex)) == 0) {
+    return true;
+  }
+
+  // The offset is the running sum of the lebs of the indexes with a set bit, up to this one
+  bitMask &= (1 << bitIndex) - 1;
+  u4 debugInfoOff = pCtx->debugInfoBase;
+  for (int lebsCnt = __builtin_popcount(bitMask) + 1; lebsCnt > 0; --lebsCnt) {
+    u4 delta;
+    if (!readULeb128(&block, end, &delta)) {
+      LOGMSG(l_ERROR, "Malformed CompactDex debug info table");
+      return false;
+    }
+    debugInfoOff += delta;
+  }
+  *pDebugInfoOff = debugInfoOff;
+  return true;
+}
+
+static bool initDebugInfoTable(cdexConverter_t *pCtx) {
+  const u4 pos = dex_getDebugInfoOffsetsPos(pCtx->cdexBuf);
+  if (pos == 0) {
+    return true;
+  }
+  const u4 tableOff = dex_getDebugInfoOffsetsTableOffset(pCtx->cdexBuf);
+  const u4 methodIdsSize = dex_getMethodIdsSize(pCtx->cdexBuf);
+  pCtx->debugInfoTableSize =
+      (methodIdsSize + kDebugInfoElementsPerIndex - 1) / kDebugInfoElementsPerIndex;
+  if (pos > pCtx->dataSize || dataAt(pCtx, pos + (size_t)tableOff,
+                                     pCtx->debugInfoTableSize * sizeof(u4)) == NULL) {
+    LOGMSG(l_ERROR, "CompactDex debug info table is out of bounds");
+    return false;
+  }
+  pCtx->pDebugInfoBegin = pCtx->dataBuf + pos;
+  pCtx->pDebugInfoTable = (const u4 *)(pCtx->pDebugInfoBegin + tableOff);
+  pCtx->debugInfoBase = dex_getDebugInfoBase(pCtx->cdexBuf);
+  return true;
+}
+
+// The id sections of the main section, along with their StandardDex offsets
+static bool checkIds(const cdexConverter_t *pCtx, u4 size, u4 off, size_t itemSz) {
+  if (size != 0 && (off > pCtx->mainSize || size * itemSz > pCtx->mainSize - off)) {
+    LOGMSG(l_ERROR, "CompactDex id section at %" PRIx32 " is out of bounds", off);
+    return false;
+  }
+  return true;
+}
+
+// The call site ids, method handles & hiddenapi flags are only reachable through the map list
+static bool readMapList(cdexConverter_t *pCtx) {
+  const u4 mapOff = dex_getMapOff(pCtx->cdexBuf);
+  const dexMapList *pMapList = (const dexMapList *)dataAt(pCtx, mapOff, sizeof(u4));
+  if (pMapList == NULL || dataAt(pCtx, mapOff + sizeof(u4),
+                                 (size_t)pMapList->size * sizeof(dexMapItem)) == NULL) {
+    LOGMSG(l_ERROR, "CompactDex map list is out of bounds");
+    return false;
+  }
+  for (u4 i = 0; i < pMapList->size; ++i) {
+    const dexMapItem *pItem = &pMapList->list[i];
+    switch (pItem->type) {
+      case kDexTypeCallSiteIdItem:
+        pCtx->callSiteIdsSize = pItem->size;
+        pCtx->callSiteIdsOff = pItem->offset;
+        if (!checkIds(pCtx, pItem->size, pItem->offset, kCallSiteIdSz)) {
+          return false;
+        }
+        break;
+      case kDexTypeMethodHandleItem:
+        pCtx->methodHandlesSize = pItem->size;
+        pCtx->methodHandlesOff = pItem->offset;
+        if (!checkIds(pCtx, pItem->size, pItem->offset, kMethodHandleSz)) {
+          return false;
+        }
+        break;
+      case kDexTypeHiddenapiClassData:
+        if (dataAt(pCtx, pItem->offset, sizeof(u4)) == NULL ||
+            dataAt(pCtx, pItem->offset, *(const u4 *)(pCtx->dataBuf + pItem->offset)) == NULL) {
+          LOGMSG(l_ERROR, "CompactDex hiddenapi class data is out of bounds");
+          return false;
+        }
+        pCtx->hiddenapiOff = pItem->offset;
+        break;
+      default:
+        break;
+    }
+  }
+  return true;
+}
+
+static bool collectClassData(cdexConverter_t *pCtx, u4 classDataOff) {
+  const u1 *cursor = pCtx->dataBuf + classDataOff;
+  dexClassDataHeader classDataHeader;
+  dex_readClassDataHeader(&cursor, &classDataHeader);
+  for (u4 i = 0; i < classDataHeader.staticFieldsSize + classDataHeader.instanceFieldsSize; ++i) {
+    dexField field;
+    dex_readClassDataField(&cursor, &field);
+  }
+
+  // Method indexes are delta encoded, restarting with each of the direct & virtual lists
+  const u4 listSizes[] = { classDataHeader.directMethodsSize,
+                           classDataHeader.virtualMethodsSize };
+  for (size_t list = 0; list < sizeof(listSizes) / sizeof(listSizes[0]); ++list) {
+    u4 methodIdx = 0;
+    for (u4 i = 0; i < listSizes[list]; ++i) {
+      dexMethod method;
+      dex_readClassDataMethod(&cursor, &method);
+      methodIdx += method.methodIdx;
+      if (method.codeOff == 0) {
+        continue;
+      }
+      u4 debugInfoOff;
+      if (dataAt(pCtx, method.codeOff, sizeof(u2) * 2) == NULL ||
+          !getDebugInfoOff(pCtx, methodIdx, &debugInfoOff) ||
+          !addDataOffOpt(pCtx, &pCtx->debugInfos, debugInfoOff)) {
+        LOGMSG(l_ERROR, "Malformed CompactDex code item of method %" PRIu32, methodIdx);
+        return false;
+      }
+      offMap_add(&pCtx->codeItems, ((u8)method.codeOff << 32) | debugInfoOff);
+    }
+  }
+  return true;
+}
+
+static bool collectAnnotationsDir(cdexConverter_t *pCtx, u4 dirOff) {
+  const u4 *pDir = (const u4 *)dataAt(pCtx, dirOff, 4 * sizeof(u4));
+  if (pDir == NULL) {
+    return false;
+  }
+  const size_t entriesCnt = (size_t)pDir[1] + pDir[2] + pDir[3];
+  const u4 *pEntries =
+      (const u4 *)dataAt(pCtx, dirOff + 4 * sizeof(u4), entriesCnt * 2 * sizeof(u4));
+  if (pEntries == NULL || !addDataOffOpt(pCtx, &pCtx->annotationSets, pDir[0])) {
+    return false;
+  }
+  // Field & method entries point to annotation sets, parameter entries to set ref lists
+  for (size_t i = 0; i < entriesCnt; ++i) {
+    offMap_t *pMap =
+        i < (size_t)pDir[1] + pDir[2] ? &pCtx->annotationSets : &pCtx->annotationSetRefLists;
+    if (!addDataOff(pCtx, pMap, pEntries[2 * i + 1])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Collects the offsets of a list of u4 offsets (annotation set or annotation set ref list)
+static bool collectOffsetsList(cdexConverter_t *pCtx, u4 listOff, offMap_t *pMap, bool optional) {
+  const u4 *pList = (const u4 *)dataAt(pCtx, listOff, sizeof(u4));
+  if (pList == NULL || dataAt(pCtx, listOff + sizeof(u4), (size_t)pList[0] * sizeof(u4)) == NULL) {
+    return false;
+  }
+  for (u4 i = 1; i <= pList[0]; ++i) {
+    if (!(optional ? addDataOffOpt(pCtx, pMap, pList[i]) : addDataOff(pCtx, pMap, pList[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Walks the id sections & the data items that they reference, section by section, to collect the
+// data items that the converted file needs
+static bool collectItems(cdexConverter_t *pCtx) {
+  const u1 *cdexBuf = pCtx->cdexBuf;
+  for (u4 i = 0; i < dex_getStringIdsSize(cdexBuf); ++i) {
+    if (!addDataOff(pCtx, &pCtx->stringData, dex_getStringId(cdexBuf, i)->stringDataOff)) {
+      return false;
+    }
+  }
+  for (u4 i = 0; i < dex_getProtoIdsSize(cdexBuf); ++i) {
+    if (!addDataOffOpt(pCtx, &pCtx->typeLists, dex_getProtoId(cdexBuf, i)->parametersOff)) {
+      return false;
+    }
+  }
+  for (u4 i = 0; i < dex_getClassDefsSize(cdexBuf); ++i) {
+    const dexClassDef *pClassDef = dex_getClassDef(cdexBuf, i);
+    if (!addDataOffOpt(pCtx, &pCtx->typeLists, pClassDef->interfacesOff) ||
+        !addDataOffOpt(pCtx, &pCtx->annotationsDirs, pClassDef->annotationsOff) ||
+        !addDataOffOpt(pCtx, &pCtx->classData, pClassDef->classDataOff) ||
+        !addDataOffOpt(pCtx, &pCtx->encodedArrays, pClassDef->staticValuesOff)) {
+      return false;
+    }
+  }
+  for (u4 i = 0; i < pCtx->callSiteIdsSize; ++i) {
+    const u4 *pCallSiteOff = (const u4 *)(cdexBuf + pCtx->callSiteIdsOff) + i;
+    if (!addDataOff(pCtx, &pCtx->encodedArrays, *pCallSiteOff)) {
+      return false;
+    }
+  }
+
+  offMap_seal(&pCtx->classData);
+  for (size_t i = 0; i < pCtx->classData.cnt; ++i) {
+    if (!collectClassData(pCtx, (u4)pCtx->classData.keys[i])) {
+      return false;
+    }
+  }
+
+  offMap_seal(&pCtx->annotationsDirs);
+  for (size_t i = 0; i < pCtx->annotationsDirs.cnt; ++i) {
+    if (!collectAnnotationsDir(pCtx, (u4)pCtx->annotationsDirs.keys[i])) {
+      LOGMSG(l_ERROR, "Malformed CompactDex annotations directory");
+      return false;
+    }
+  }
+  offMap_seal(&pCtx->annotationSetRefLists);
+  for (size_t i = 0; i < pCtx->annotationSetRefLists.cnt; ++i) {
+    if (!collectOffsetsList(pCtx, (u4)pCtx->annotationSetRefLists.keys[i],
+                            &pCtx->annotationSets, true)) {
+      LOGMSG(l_ERROR, "Malformed CompactDex annotation set ref list");
+      return false;
+    }
+  }
+  offMap_seal(&pCtx->annotationSets);
+  for (size_t i = 0; i < pCtx->annotationSets.cnt; ++i) {
+    if (!collectOffsetsList(pCtx, (u4)pCtx->annotationSets.keys[i], &pCtx->annotations,
+                            false)) {
+      LOGMSG(l_ERROR, "Malformed CompactDex annotation set");
+      return false;
+    }
+  }
+
+  offMap_seal(&pCtx->stringData);
+  offMap_seal(&pCtx->typeLists);
+  offMap_seal(&pCtx->debugInfos);
+  offMap_seal(&pCtx->annotations);
+  offMap_seal(&pCtx->encodedArrays);
+  offMap_seal(&pCtx->codeItems);
+  return true;
+}
+
+// Sizes of the data items that are copied as they are, or 0 if they are malformed
+static size_t stringDataSize(const cdexConverter_t *pCtx, u4 off) {
+  const u1 *start = pCtx->dataBuf + off;
+  const u1 *end = pCtx->dataBuf + pCtx->dataSize;
+  const u1 *cursor = start;
+  const u1 *nul;
+  if (!skipLeb128(&cursor, end) || (nul = memchr(cursor, '\0', end - cursor)) == NULL) {
+    return 0;
+  }
+  return nul + 1 - start;
+}
+
+static size_t typeListSize(const cdexConverter_t *pCtx, u4 off) {
+  const dexTypeList *pTypeList = (const dexTypeList *)dataAt(pCtx, off, sizeof(u4));
+  const size_t size = pTypeList ? sizeof(u4) + pTypeList->size * sizeof(dexTypeItem) : 0;
+  return pTypeList != NULL && dataAt(pCtx, off, size) != NULL ? size : 0;
+}
+
+static size_t debugInfoItemSize(const cdexConverter_t *pCtx, u4 off) {
+  return debugInfoSize(pCtx->dataBuf + off, pCtx->dataBuf + pCtx->dataSize);
+}
+
+static size_t annotationSize(const cdexConverter_t *pCtx, u4 off) {
+  const u1 *start = pCtx->dataBuf + off;
+  const u1 *cursor = start + 1;  // Visibility
+  if (!skipEncodedAnnotation(&cursor, pCtx->dataBuf + pCtx->dataSize, 0)) {
+    return 0;
+  }
+  return cursor - start;
+}
+
+static size_t encodedArraySize(const cdexConverter_t *pCtx, u4 off) {
+  const u1 *start = pCtx->dataBuf + off;
+  const u1 *cursor = start;
+  if (!skipEncodedArray(&cursor, pCtx->dataBuf + pCtx->dataSize, 0)) {
+    return 0;
+  }
+  return cursor - start;
+}
+
+// Sizes of the items that have been walked while collecting, so they are known to be in bounds
+static size_t offsetsListSize(const cdexConverter_t *pCtx, u4 off) {
+  return sizeof(u4) + *(const u4 *)(pCtx->dataBuf + off) * sizeof(u4);
+}
+
+static size_t annotationsDirSize(const cdexConverter_t *pCtx, u4 off) {
+  const u4 *pDir = (const u4 *)(pCtx->dataBuf + off);
+  return (4 + 2 * ((size_t)pDir[1] + pDir[2] + pDir[3])) * sizeof(u4);
+}
+
+static size_t classDataSize(const cdexConverter_t *pCtx, u4 off) {
+  const u1 *start = pCtx->dataBuf + off;
+  const u1 *cursor = start;
+  dexClassDataHeader classDataHeader;
+  dex_readClassDataHeader(&cursor, &classDataHeader);
+  for (u4 i = 0; i < classDataHeader.staticFieldsSize + classDataHeader.instanceFieldsSize; ++i) {
+    dexField field;
+    dex_readClassDataField(&cursor, &field);
+  }
+  for (u4 i = 0; i < classDataHeader.directMethodsSize + classDataHeader.virtualMethodsSize; ++i) {
+    dexMethod method;
+    dex_readClassDataMethod(&cursor, &method);
+  }
+  return cursor - start;
+}
+
+// Extent of a code item, from the start of its preheader to the end of its catch handlers. The
+// try items are 4-byte aligned after the instructions in both formats, and are followed by the
+// catch handlers that they refer to with offsets relative to the handlers list.
+static bool codeItemExtent(const cdexConverter_t *pCtx, u4 codeOff, u4 *pStart, size_t *pSize) {
+  const cdexCode *pCdexCode = (const cdexCode *)(pCtx->dataBuf + codeOff);
+  const u2 flags = pCdexCode->insnsCountAndFlags;
+  const u4 preHeaderSz =
+      (__builtin_popcount(flags & kFlagPreHeaderCombined) +
+       ((flags & kFlagPreHeaderInsnsSize) ? 1 : 0)) * sizeof(u2);
+  if (codeOff < preHeaderSz) {
+    LOGMSG(l_ERROR, "Malformed CompactDex code item at %" PRIx32, codeOff);
+    return false;
+  }
+
+  u4 insnsSize;
+  u2 registersSize, insSize, outsSize, triesSize;
+  dex_DecodeCDexFields((cdexCode *)pCdexCode, &insnsSize, &registersSize, &insSize, &outsSize,
+                       &triesSize, false);
+  const u4 insnsOff = codeOff + offsetof(cdexCode, insns);
+  const size_t insnsSz = (size_t)insnsSize * sizeof(u2);
+  if (dataAt(pCtx, insnsOff, insnsSz) == NULL) {
+    LOGMSG(l_ERROR, "Malformed CompactDex code item at %" PRIx32, codeOff);
+    return false;
+  }
+  *pStart = codeOff - preHeaderSz;
+  *pSize = insnsOff + insnsSz - *pStart;
+  if (triesSize == 0) {
+    return true;
+  }
+
+  const u1 *pTries = (const u1 *)utils_allignUp((uintptr_t)(pCdexCode->insns + insnsSize),
+                                                sizeof(u4));
+  const size_t triesSz = (size_t)triesSize * sizeof(dexTryItem);
+  if (dataAt(pCtx, pTries - pCtx->dataBuf, triesSz) == NULL) {
+    LOGMSG(l_ERROR, "Malformed CompactDex try items at %" PRIx32, codeOff);
+    return false;
+  }
+  const size_t handlersSz = catchHandlersSize(pTries + triesSz, pCtx->dataBuf + pCtx->dataSize);
+  if (handlersSz == 0) {
+    LOGMSG(l_ERROR, "Malformed CompactDex catch handlers at %" PRIx32, codeOff);
+    return false;
+  }
+  *pSize = pTries + triesSz + handlersSz - (pCtx->dataBuf + *pStart);
+  return true;
+}
+
+// Copies a data item that doesn't refer to other data items
+static bool emitLeafItem(cdexConverter_t *pCtx, u4 off, itemSizeFn_t itemSize, const char *name) {
+  const size_t size = itemSize(pCtx, off);
+  if (size == 0) {
+    LOGMSG(l_ERROR, "Malformed CompactDex %s at %" PRIx32, name, off);
+    return false;
+  }
+  writeOut(pCtx, pCtx->dataBuf + off, size);
+  return true;
+}
+
+static bool emitStringData(cdexConverter_t *pCtx, u8 key) {
+  return emitLeafItem(pCtx, key, stringDataSize, "string data");
+}
+
+static bool emitTypeList(cdexConverter_t *pCtx, u8 key) {
+  return emitLeafItem(pCtx, key, typeListSize, "type list");
+}
+
+static bool emitDebugInfo(cdexConverter_t *pCtx, u8 key) {
+  return emitLeafItem(pCtx, key, debugInfoItemSize, "debug info");
+}
+
+static bool emitAnnotation(cdexConverter_t *pCtx, u8 key) {
+  return emitLeafItem(pCtx, key, annotationSize, "annotation");
+}
+
+static bool emitEncodedArray(cdexConverter_t *pCtx, u8 key) {
+  return emitLeafItem(pCtx, key, encodedArraySize, "encoded array");
+}
+
+static bool emitAnnotationSet(cdexConverter_t *pCtx, u8 key) {
+  // Bounds have been checked while collecting
+  const u4 *pList = (const u4 *)(pCtx->dataBuf + key);
+  writeOutU4(pCtx, pList[0]);
+  for (u4 i = 1; i <= pList[0]; ++i) {
+    writeOutU4(pCtx, offMap_get(&pCtx->annotations, pList[i]));
+  }
+  return true;
+}
+
+static bool emitAnnotationSetRefList(cdexConverter_t *pCtx, u8 key) {
+  const u4 *pList = (const u4 *)(pCtx->dataBuf + key);
+  writeOutU4(pCtx, pList[0]);
+  for (u4 i = 1; i <= pList[0]; ++i) {
+    writeOutU4(pCtx, offMap_getOpt(&pCtx->annotationSets, pList[i]));
+  }
+  return true;
+}
+
+static bool emitAnnotationsDir(cdexConverter_t *pCtx, u8 key) {
+  const u4 *pDir = (const u4 *)(pCtx->dataBuf + key);
+  writeOutU4(pCtx, offMap_getOpt(&pCtx->annotationSets, pDir[0]));
+  writeOut(pCtx, &pDir[1], 3 * sizeof(u4));
+  const size_t entriesCnt = (size_t)pDir[1] + pDir[2] + pDir[3];
+  for (size_t i = 0; i < entriesCnt; ++i) {
+    const offMap_t *pMap =
+        i < (size_t)pDir[1] + pDir[2] ? &pCtx->annotationSets : &pCtx->annotationSetRefLists;
+    writeOutU4(pCtx, pDir[4 + 2 * i]);
+    writeOutU4(pCtx, offMap_get(pMap, pDir[4 + 2 * i + 1]));
+  }
+  return true;
+}
+
+static bool emitCodeItem(cdexConverter_t *pCtx, u8 key) {
+  const u4 codeOff = key >> 32;
+  u4 start;
+  size_t size;
+  if (!codeItemExtent(pCtx, codeOff, &start, &size)) {
+    return false;
+  }
+
+  const cdexCode *pCdexCode = (const cdexCode *)(pCtx->dataBuf + codeOff);
+  dexCode code;
+  memset(&code, 0, sizeof(dexCode));
+  dex_DecodeCDexFields((cdexCode *)pCdexCode, &code.insnsSize, &code.registersSize,
+                       &code.insSize, &code.outsSize, &code.triesSize, false);
+  code.debugInfoOff = offMap_getOpt(&pCtx->debugInfos, (u4)key);
+  writeOut(pCtx, &code, offsetof(dexCode, insns));
+  writeOut(pCtx, pCdexCode->insns, (size_t)code.insnsSize * sizeof(u2));
+  if (code.triesSize == 0) {
+    return true;
+  }
+
+  // Try items & catch handlers are copied as they are up to the end of the code item
+  const u1 *pTries = (const u1 *)utils_allignUp((uintptr_t)(pCdexCode->insns + code.insnsSize),
+                                                sizeof(u4));
+  alignOut(pCtx, sizeof(u4));
+  writeOut(pCtx, pTries, pCtx->dataBuf + start + size - pTries);
+  return true;
+}
+
+static bool emitClassData(cdexConverter_t *pCtx, u8 key) {
+  const u1 *cursor = pCtx->dataBuf + key;
+  dexClassDataHeader classDataHeader;
+  dex_readClassDataHeader(&cursor, &classDataHeader);
+  writeOutULeb128(pCtx, classDataHeader.staticFieldsSize);
+  writeOutULeb128(pCtx, classDataHeader.instanceFieldsSize);
+  writeOutULeb128(pCtx, classDataHeader.directMethodsSize);
+  writeOutULeb128(pCtx, classDataHeader.virtualMethodsSize);
+  for (u4 i = 0; i < classDataHeader.staticFieldsSize + classDataHeader.instanceFieldsSize; ++i) {
+    dexField field;
+    dex_readClassDataField(&cursor, &field);
+    writeOutULeb128(pCtx, field.fieldIdx);
+    writeOutULeb128(pCtx, field.accessFlags);
+  }
+
+  const u4 listSizes[] = { classDataHeader.directMethodsSize,
+                           classDataHeader.virtualMethodsSize };
+  for (size_t list = 0; list < sizeof(listSizes) / sizeof(listSizes[0]); ++list) {
+    u4 methodIdx = 0;
+    for (u4 i = 0; i < listSizes[list]; ++i) {
+      dexMethod method;
+      dex_readClassDataMethod(&cursor, &method);
+      methodIdx += method.methodIdx;
+      u4 codeOff = 0;
+      if (method.codeOff != 0) {
+        u4 debugInfoOff;
+        if (!getDebugInfoOff(pCtx, methodIdx, &debugInfoOff)) {
+          LOGMSG(l_ERROR, "Malformed CompactDex code item of method %" PRIu32, methodIdx);
+          return false;
+        }
+        codeOff = offMap_get(&pCtx->codeItems, ((u8)method.codeOff << 32) | debugInfoOff);
+      }
+      writeOutULeb128(pCtx, method.methodIdx);
+      writeOutULeb128(pCtx, method.accessFlags);
+      writeOutULeb128(pCtx, codeOff);
+    }
+  }
+  return true;
+}
+
+// Writes the items of a section in their original order, recording their new offsets
+static bool emitSection(
+    cdexConverter_t *pCtx, offMap_t *pMap, u2 type, size_t alignment, emitItemFn_t emitItem) {
+  alignOut(pCtx, alignment);
+  const u4 sectionOff = pCtx->outSize;
+  for (size_t i = 0; i < pMap->cnt; ++i) {
+    alignOut(pCtx, alignment);
+    pMap->newOffs[i] = pCtx->outSize;
+    if (!emitItem(pCtx, pMap->keys[i])) {
+      return false;
+    }
+  }
+  addMapItem(pCtx, type, pMap->cnt, sectionOff);
+  return true;
+}
+
+static void writeIds(cdexConverter_t *pCtx, dexHeader *pHeader) {
+  const u1 *cdexBuf = pCtx->cdexBuf;
+  u1 *out = pCtx->out;
+
+  u4 *pStringIds = (u4 *)(out + pHeader->stringIdsOff);
+  for (u4 i = 0; i < pHeader->stringIdsSize; ++i) {
+    pStringIds[i] = offMap_get(&pCtx->stringData, dex_getStringId(cdexBuf, i)->stringDataOff);
+  }
+  memcpy(out + pHeader->typeIdsOff, cdexBuf + dex_getTypeIdsOff(cdexBuf),
+         pHeader->typeIdsSize * sizeof(dexTypeId));
+  dexProtoId *pProtoIds = (dexProtoId *)(out + pHeader->protoIdsOff);
+  for (u4 i = 0; i < pHeader->protoIdsSize; ++i) {
+    pProtoIds[i] = *dex_getProtoId(cdexBuf, i);
+    pProtoIds[i].parametersOff = offMap_getOpt(&pCtx->typeLists, pProtoIds[i].parametersOff);
+  }
+  memcpy(out + pHeader->fieldIdsOff, cdexBuf + dex_getFieldIdsOff(cdexBuf),
+         pHeader->fieldIdsSize * sizeof(dexFieldId));
+  memcpy(out + pHeader->methodIdsOff, cdexBuf + dex_getMethodIdsOff(cdexBuf),
+         pHeader->methodIdsSize * sizeof(dexMethodId));
+  dexClassDef *pClassDefs = (dexClassDef *)(out + pHeader->classDefsOff);
+  for (u4 i = 0; i < pHeader->classDefsSize; ++i) {
+    dexClassDef *pClassDef = &pClassDefs[i];
+    *pClassDef = *dex_getClassDef(cdexBuf, i);
+    pClassDef->interfacesOff = offMap_getOpt(&pCtx->typeLists, pClassDef->interfacesOff);
+    pClassDef->annotationsOff = offMap_getOpt(&pCtx->annotationsDirs, pClassDef->annotationsOff);
+    pClassDef->classDataOff = offMap_getOpt(&pCtx->classData, pClassDef->classDataOff);
+    pClassDef->staticValuesOff = offMap_getOpt(&pCtx->encodedArrays, pClassDef->staticValuesOff);
+  }
+}
+
+// Checks the id sections & collects the data items of a CompactDex file
+static bool initConverter(cdexConverter_t *pCtx, const u1 *cdexBuf) {
+  memset(pCtx, 0, sizeof(cdexConverter_t));
+  pCtx->cdexBuf = cdexBuf;
+  pCtx->mainSize = dex_getFileSize(cdexBuf);
+  pCtx->dataBuf = dex_getDataAddr(cdexBuf);
+  pCtx->dataSize = dex_getDataSize(cdexBuf);
+  return checkIds(pCtx, dex_getStringIdsSize(cdexBuf), dex_getStringIdsOff(cdexBuf),
+                  sizeof(dexStringId)) &&
+         checkIds(pCtx, dex_getTypeIdsSize(cdexBuf), dex_getTypeIdsOff(cdexBuf),
+                  sizeof(dexTypeId)) &&
+         checkIds(pCtx, dex_getProtoIdsSize(cdexBuf), dex_getProtoIdsOff(cdexBuf),
+                  sizeof(dexProtoId)) &&
+         checkIds(pCtx, dex_getFieldIdsSize(cdexBuf), dex_getFieldIdsOff(cdexBuf),
+                  sizeof(dexFieldId)) &&
+         checkIds(pCtx, dex_getMethodIdsSize(cdexBuf), dex_getMethodIdsOff(cdexBuf),
+                  sizeof(dexMethodId)) &&
+         checkIds(pCtx, dex_getClassDefsSize(cdexBuf), dex_getClassDefsOff(cdexBuf),
+                  sizeof(dexClassDef)) &&
+         readMapList(pCtx) && initDebugInfoTable(pCtx) && collectItems(pCtx);
+}
+
+static void destroyConverter(cdexConverter_t *pCtx) {
+  offMap_destroy(&pCtx->stringData);
+  offMap_destroy(&pCtx->typeLists);
+  offMap_destroy(&pCtx->debugInfos);
+  offMap_destroy(&pCtx->annotations);
+  offMap_destroy(&pCtx->encodedArrays);
+  offMap_destroy(&pCtx->annotationSets);
+  offMap_destroy(&pCtx->annotationSetRefLists);
+  offMap_destroy(&pCtx->annotationsDirs);
+  offMap_destroy(&pCtx->codeItems);
+  offMap_destroy(&pCtx->classData);
+}
+
+u1 *cdexConverter_toDex(const u1 *cdexBuf, u4 *pDexSize) {
+  cdexConverter_t ctx;
+  bool ret = false;
+  if (!initConverter(&ctx, cdexBuf)) {
+    goto cleanup;
+  }
+
+  // Header & id sections, in the order that the map list requires
+  dexHeader header;
+  memset(&header, 0, sizeof(dexHeader));
+  memcpy(header.magic.dex, kDexMagic, sizeof(kDexMagic));
+  memcpy(header.magic.ver, kStdDexVersion, sizeof(header.magic.ver));
+  memcpy(header.signature, cdexBuf + offsetof(dexHeader, signature), kSHA1Len);
+  header.headerSize = sizeof(dexHeader);
+  header.endianTag = dex_getEndianTag(cdexBuf);
+  u4 off = sizeof(dexHeader);
+  addMapItem(&ctx, kDexTypeHeaderItem, 1, 0);
+#define LAYOUT_IDS(type, size, itemSz, pSize, pOff) \
+  do {                                              \
+    *(pSize) = (size);                              \
+    *(pOff) = (size) ? off : 0;                     \
+    addMapItem(&ctx, (type), (size), off);          \
+    off += (size) * (itemSz);                       \
+  } while (0)
+  LAYOUT_IDS(kDexTypeStringIdItem, dex_getStringIdsSize(cdexBuf), sizeof(dexStringId),
+             &header.stringIdsSize, &header.stringIdsOff);
+  LAYOUT_IDS(kDexTypeTypeIdItem, dex_getTypeIdsSize(cdexBuf), sizeof(dexTypeId),
+             &header.typeIdsSize, &header.typeIdsOff);
+  LAYOUT_IDS(kDexTypeProtoIdItem, dex_getProtoIdsSize(cdexBuf), sizeof(dexProtoId),
+             &header.protoIdsSize, &header.protoIdsOff);
+  LAYOUT_IDS(kDexTypeFieldIdItem, dex_getFieldIdsSize(cdexBuf), sizeof(dexFieldId),
+             &header.fieldIdsSize, &header.fieldIdsOff);
+  LAYOUT_IDS(kDexTypeMethodIdItem, dex_getMethodIdsSize(cdexBuf), sizeof(dexMethodId),
+             &header.methodIdsSize, &header.methodIdsOff);
+  LAYOUT_IDS(kDexTypeClassDefItem, dex_getClassDefsSize(cdexBuf), sizeof(dexClassDef),
+             &header.classDefsSize, &header.classDefsOff);
+  u4 callSiteIdsSize, callSiteIdsOff, methodHandlesSize, methodHandlesOff;
+  LAYOUT_IDS(kDexTypeCallSiteIdItem, ctx.callSiteIdsSize, kCallSiteIdSz, &callSiteIdsSize,
+             &callSiteIdsOff);
+  LAYOUT_IDS(kDexTypeMethodHandleItem, ctx.methodHandlesSize, kMethodHandleSz,
+             &methodHandlesSize, &methodHandlesOff);
+#undef LAYOUT_IDS
+
+  ctx.outCapacity = off + kOutBufInitSz;
+  ctx.out = utils_calloc(ctx.outCapacity);
+  ctx.outSize = off;
+  header.dataOff = off;
+
+  // Leaf items first, so that the items referring to them can be written in a single pass
+  if (!emitSection(&ctx, &ctx.stringData, kDexTypeStringDataItem, 1, emitStringData) ||
+      !emitSection(&ctx, &ctx.typeLists, kDexTypeTypeList, sizeof(u4), emitTypeList) ||
+      !emitSection(&ctx, &ctx.debugInfos, kDexTypeDebugInfoItem, 1, emitDebugInfo) ||
+      !emitSection(&ctx, &ctx.annotations, kDexTypeAnnotationItem, 1, emitAnnotation) ||
+      !emitSection(&ctx, &ctx.encodedArrays, kDexTypeEncodedArrayItem, 1, emitEncodedArray) ||
+      !emitSection(&ctx, &ctx.annotationSets, kDexTypeAnnotationSetItem, sizeof(u4),
+                   emitAnnotationSet) ||
+      !emitSection(&ctx, &ctx.annotationSetRefLists, kDexTypeAnnotationSetRefList, sizeof(u4),
+                   emitAnnotationSetRefList) ||
+      !emitSection(&ctx, &ctx.annotationsDirs, kDexTypeAnnotationsDirectoryItem, sizeof(u4),
+                   emitAnnotationsDir) ||
+      !emitSection(&ctx, &ctx.codeItems, kDexTypeCodeItem, sizeof(u4), emitCodeItem) ||
+      !emitSection(&ctx, &ctx.classData, kDexTypeClassDataItem, 1, emitClassData)) {
+    goto cleanup;
+  }
+
+  // Hiddenapi flags are indexed by class definition and carry offsets relative to themselves
+  if (ctx.hiddenapiOff != 0) {
+    alignOut(&ctx, sizeof(u4));
+    const u4 hiddenapiSize = *(const u4 *)(ctx.dataBuf + ctx.hiddenapiOff);
+    addMapItem(&ctx, kDexTypeHiddenapiClassData, 1, ctx.outSize);
+    writeOut(&ctx, ctx.dataBuf + ctx.hiddenapiOff, hiddenapiSize);
+  }
+
+  alignOut(&ctx, sizeof(u4));
+  header.mapOff = ctx.outSize;
+  addMapItem(&ctx, kDexTypeMapList, 1, header.mapOff);
+  writeOutU4(&ctx, ctx.mapItemsCnt);
+  writeOut(&ctx, ctx.mapItems, ctx.mapItemsCnt * sizeof(dexMapItem));
+
+  header.fileSize = ctx.outSize;
+  header.dataSize = header.fileSize - header.dataOff;
+  memcpy(ctx.out, &header, sizeof(dexHeader));
+  writeIds(&ctx, &header);
+  for (u4 i = 0; i < callSiteIdsSize; ++i) {
+    const u4 *pCallSiteOff = (const u4 *)(cdexBuf + ctx.callSiteIdsOff) + i;
+    u4 newCallSiteOff = offMap_get(&ctx.encodedArrays, *pCallSiteOff);
+    memcpy(ctx.out + callSiteIdsOff + i * kCallSiteIdSz, &newCallSiteOff, sizeof(u4));
+  }
+  memcpy(ctx.out + methodHandlesOff, cdexBuf + ctx.methodHandlesOff,
+         methodHandlesSize * kMethodHandleSz);
+  dex_repairDexCRC(ctx.out, header.fileSize);
+
+  LOGMSG(l_DEBUG, "CompactDex converted to %" PRIu32 " bytes StandardDex (%zu code items)",
+         header.fileSize, ctx.codeItems.cnt);
+  *pDexSize = header.fileSize;
+  ret = true;
+
+cleanup:
+  destroyConverter(&ctx);
+  if (!ret) {
+    free(ctx.out);
+    return NULL;
+  }
+  return ctx.out;
+}
+
+static void addDataRange(cdexDataRanges_t *pRanges, u4 off, size_t size) {
+  if (pRanges->cnt == pRanges->capacity) {
+    pRanges->capacity = pRanges->capacity ? pRanges->capacity * 2 : 256;
+    pRanges->ranges = utils_realloc(pRanges->ranges, pRanges->capacity * sizeof(cdexDataRange_t));
+  }
+  pRanges->ranges[pRanges->cnt].off = off;
+  pRanges->ranges[pRanges->cnt].size = size;
+  pRanges->cnt++;
+}
+
+static bool addSectionRanges(const cdexConverter_t *pCtx,
+                             const offMap_t *pMap,
+                             itemSizeFn_t itemSize,
+                             const char *name,
+                             cdexDataRanges_t *pRanges) {
+  for (size_t i = 0; i < pMap->cnt; ++i) {
+    const size_t size = itemSize(pCtx, pMap->keys[i]);
+    if (size == 0) {
+      LOGMSG(l_ERROR, "Malformed CompactDex %s at %" PRIx32, name, (u4)pMap->keys[i]);
+      return false;
+    }
+    addDataRange(pRanges, pMap->keys[i], size);
+  }
+  return true;
+}
+
+static int compareRanges(const void *a, const void *b) {
+  const cdexDataRange_t *pRangeA = (const cdexDataRange_t *)a;
+  const cdexDataRange_t *pRangeB = (const cdexDataRange_t *)b;
+  return (pRangeA->off > pRangeB->off) - (pRangeA->off < pRangeB->off);
+}
+
+bool cdexConverter_getDataRanges(const u1 *cdexBuf, cdexDataRanges_t *pRanges) {
+  cdexConverter_t ctx;
+  memset(pRanges, 0, sizeof(cdexDataRanges_t));
+  bool ret = false;
+  if (!initConverter(&ctx, cdexBuf) ||
+      !addSectionRanges(&ctx, &ctx.stringData, stringDataSize, "string data", pRanges) ||
+      !addSectionRanges(&ctx, &ctx.typeLists, typeListSize, "type list", pRanges) ||
+      !addSectionRanges(&ctx, &ctx.debugInfos, debugInfoItemSize, "debug info", pRanges) ||
+      !addSectionRanges(&ctx, &ctx.annotations, annotationSize, "annotation", pRanges) ||
+      !addSectionRanges(&ctx, &ctx.encodedArrays, encodedArraySize, "encoded array", pRanges) ||
+      !addSectionRanges(&ctx, &ctx.annotationSets, offsetsListSize, "annotation set", pRanges) ||
+      !addSectionRanges(&ctx, &ctx.annotationSetRefLists, offsetsListSize,
+                        "annotation set ref list", pRanges) ||
+      !addSectionRanges(&ctx, &ctx.annotationsDirs, annotationsDirSize, "annotations directory",
+                        pRanges) ||
+      !addSectionRanges(&ctx, &ctx.classData, classDataSize, "class data", pRanges)) {
+    goto cleanup;
+  }
+  for (size_t i = 0; i < ctx.codeItems.cnt; ++i) {
+    u4 start;
+    size_t size;
+    if (!codeItemExtent(&ctx, ctx.codeItems.keys[i] >> 32, &start, &size)) {
+      goto cleanup;
+    }
+    addDataRange(pRanges, start, size);
+  }
+
+  // Items that the header points to, which have been bounds checked while collecting
+  const u4 mapOff = dex_getMapOff(cdexBuf);
+  addDataRange(pRanges, mapOff,
+               sizeof(u4) + *(const u4 *)(ctx.dataBuf + mapOff) * sizeof(dexMapItem));
+  if (ctx.pDebugInfoBegin != NULL) {
+    addDataRange(pRanges, ctx.pDebugInfoBegin - ctx.dataBuf,
+                 dex_getDebugInfoOffsetsTableOffset(cdexBuf) +
+                     ctx.debugInfoTableSize * sizeof(u4));
+  }
+  if (ctx.hiddenapiOff != 0) {
+    addDataRange(pRanges, ctx.hiddenapiOff, *(const u4 *)(ctx.dataBuf + ctx.hiddenapiOff));
+  }
+
+  // Overlapping (shared code items) & nearby ranges are merged, since holes of less than a page
+  // don't save anything in the output files
+  qsort(pRanges->ranges, pRanges->cnt, sizeof(cdexDataRange_t), compareRanges);
+  size_t merged = 0;
+  for (size_t i = 1; i < pRanges->cnt; ++i) {
+    cdexDataRange_t *pLast = &pRanges->ranges[merged];
+    const cdexDataRange_t *pCur = &pRanges->ranges[i];
+    if (pCur->off <= (size_t)pLast->off + pLast->size + kMinDataHoleSz) {
+      const size_t end = (size_t)pCur->off + pCur->size;
+      if (end > (size_t)pLast->off + pLast->size) {
+        pLast->size = end - pLast->off;
+      }
+    } else {
+      pRanges->ranges[++merged] = *pCur;
+    }
+  }
+  pRanges->cnt = pRanges->cnt ? merged + 1 : 0;
+  ret = true;
+
+cleanup:
+  destroyConverter(&ctx);
+  if (!ret) {
+    cdexConverter_freeDataRanges(pRanges);
+  }
+  return ret;
+}
+
+void cdexConverter_freeDataRanges(cdexDataRanges_t *pRanges) {
+  free(pRanges->ranges);
+  memset(pRanges, 0, sizeof(cdexDataRanges_t));
+}
@@ -0,0 +1,53 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _CDEX_CONVERTER_H_
+#define _CDEX_CONVERTER_H_
+
+#include "common.h"
+
+// Converts a CompactDex file to a StandardDex file. The data section is located through the
+// CompactDex header, so it can be the shared data section of a Vdex file. Code items are expanded
+// to the StandardDex format with their debug info offset taken from the compact debug info table,
+// and only the data items that the file references are kept. Returns a malloc()-ed Dex file with a
+// repaired checksum, or NULL if the CompactDex file is malformed.
+u1 *cdexConverter_toDex(const u1 *, u4 *);
+
+// Range of the data section of a CompactDex file (data section relative offset & size)
+typedef struct {
+  u4 off;
+  u4 size;
+} cdexDataRange_t;
+
+typedef struct {
+  cdexDataRange_t *ranges;
+  size_t cnt;
+  size_t capacity;
+} cdexDataRanges_t;
+
+// Collects the ranges of the data section that a CompactDex file references, sorted & merged with
+// their neighbours when the gap between them is less than a page. Returns false if the CompactDex
+// file is malformed.
+bool cdexConverter_getDataRanges(const u1 *, cdexDataRanges_t *);
+void cdexConverter_freeDataRanges(cdexDataRanges_t *);
+
+#endif
@@ -0,0 +1,325 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "cdex_shared.h"
+
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include "dex.h"
+#include "out_writer.h"
+#include "utils.h"
+
+#define kManifestMaxSz 4096
+#define kManifestKeysCnt 8
+
+typedef struct {
+  char vdexName[NAME_MAX + 1];
+  size_t dexIdx;
+  u4 mainSize;
+  u4 dataOff;   // Data section of the CompactDex file in the shared data file
+  u4 dataSize;
+  char sharedDataName[NAME_MAX + 1];
+  u4 sharedDataSize;
+  u4 sharedDataChecksum;
+} cdexManifest_t;
+
+// The shared data file of the previous manifest, since the manifests of a Vdex file share it
+typedef struct {
+  char path[PATH_MAX + NAME_MAX + 1];
+  u1 *buf;
+  size_t size;
+} sharedDataCache_t;
+
+static bool isCompactDex(const u1 *buf) {
+  return buf != NULL && dex_checkType(buf) == kCompactDex && dex_isValidCDex(buf);
+}
+
+bool cdexShared_writeSharedData(const runArgs_t *pRunArgs,
+                                const char *VdexFileName,
+                                const u1 **dexFiles,
+                                size_t dexFilesCnt) {
+  // The CompactDex files of a Vdex file refer to (parts of) the same shared data section, which is
+  // written as a whole
+  const u1 *dataBegin = NULL;
+  const u1 *dataEnd = NULL;
+  for (size_t i = 0; i < dexFilesCnt; ++i) {
+    if (!isCompactDex(dexFiles[i])) {
+      continue;
+    }
+    const u1 *dataAddr = dex_getDataAddr(dexFiles[i]);
+    if (dataBegin == NULL || dataAddr < dataBegin) {
+      dataBegin = dataAddr;
+    }
+    if (dataEnd == NULL || dataAddr + dex_getDataSize(dexFiles[i]) > dataEnd) {
+      dataEnd = dataAddr + dex_getDataSize(dexFiles[i]);
+    }
+  }
+  if (dataBegin == NULL) {
+    return true;
+  }
+  const u4 sharedSize = dataEnd - dataBegin;
+  if (!outWriter_CdexSharedData(pRunArgs, VdexFileName, dataBegin, sharedSize)) {
+    return false;
+  }
+
+  const char *pBaseName = strrchr(VdexFileName, '/');
+  pBaseName = pBaseName ? pBaseName + 1 : VdexFileName;
+  const char *fileExt = strrchr(pBaseName, '.');
+  int baseNameLen = fileExt ? fileExt - pBaseName : (int)strlen(pBaseName);
+  u4 checksum = adler32(adler32(0L, Z_NULL, 0), dataBegin, sharedSize);
+  for (size_t i = 0; i < dexFilesCnt; ++i) {
+    if (!isCompactDex(dexFiles[i])) {
+      continue;
+    }
+    char manifest[kManifestMaxSz] = { 0 };
+    snprintf(manifest, sizeof(manifest),
+             "vdex=%s\n"
+             "dex_index=%zu\n"
+             "main_size=%" PRIu32 "\n"
+             "data_offset=%" PRIu32 "\n"
+             "data_size=%" PRIu32 "\n"
+             "shared_data=%.*s%s\n"
+             "shared_data_size=%" PRIu32 "\n"
+             "shared_data_checksum=%08" PRIx32 "\n",
+             pBaseName, i, dex_getFileSize(dexFiles[i]),
+             (u4)(dex_getDataAddr(dexFiles[i]) - dataBegin), dex_getDataSize(dexFiles[i]),
+             baseNameLen, pBaseName, kCdexSharedSuffix, sharedSize, checksum);
+    if (!outWriter_CdexManifest(pRunArgs, VdexFileName, i, manifest)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Manifests are untrusted input: the file names they record must not reach out of the output
+// (Vdex name) or manifest (shared data name) directory
+static bool isPlainFileName(const char *name) {
+  return name[0] != '\0' && strlen(name) <= NAME_MAX && strchr(name, '/') == NULL &&
+         strstr(name, "..") == NULL;
+}
+
+static bool parseManifest(const char *manifestPath, cdexManifest_t *pManifest) {
+  FILE *fp = fopen(manifestPath, "r");
+  if (fp == NULL) {
+    LOGMSG_P(l_ERROR, "Couldn't open '%s' manifest", manifestPath);
+    return false;
+  }
+
+  memset(pManifest, 0, sizeof(cdexManifest_t));
+  char line[PATH_MAX + 32];
+  unsigned int keysFound = 0;
+  bool ret = true;
+  while (ret && fgets(line, sizeof(line), fp) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    char *value = strchr(line, '=');
+    if (value == NULL) {
+      continue;
+    }
+    *value++ = '\0';
+    if (strcmp(line, "vdex") == 0) {
+      ret = isPlainFileName(value);
+      snprintf(pManifest->vdexName, sizeof(pManifest->vdexName), "%s", value);
+      keysFound |= 1 << 0;
+    } else if (strcmp(line, "dex_index") == 0) {
+      pManifest->dexIdx = strtoul(value, NULL, 10);
+      keysFound |= 1 << 1;
+    } else if (strcmp(line, "main_size") == 0) {
+      pManifest->mainSize = strtoul(value, NULL, 10);
+      keysFound |= 1 << 2;
+    } else if (strcmp(line, "data_offset") == 0) {
+      pManifest->dataOff = strtoul(value, NULL, 10);
+      keysFound |= 1 << 6;
+    } else if (strcmp(line, "data_size") == 0) {
+      pManifest->dataSize = strtoul(value, NULL, 10);
+      keysFound |= 1 << 7;
+    } else if (strcmp(line, "shared_data") == 0) {
+      // Shared data files are expected next to the manifests
+      ret = isPlainFileName(value);
+      snprintf(pManifest->sharedDataName, sizeof(pManifest->sharedDataName), "%s", value);
+      keysFound |= 1 << 3;
+    } else if (strcmp(line, "shared_data_size") == 0) {
+      pManifest->sharedDataSize = strtoul(value, NULL, 10);
+      keysFound |= 1 << 4;
+    } else if (strcmp(line, "shared_data_checksum") == 0) {
+      pManifest->sharedDataChecksum = strtoul(value, NULL, 16);
+      keysFound |= 1 << 5;
+    }
+  }
+  fclose(fp);
+
+  if (!ret || keysFound != (1 << kManifestKeysCnt) - 1 ||
+      pManifest->dataOff > pManifest->sharedDataSize ||
+      pManifest->dataSize > pManifest->sharedDataSize - pManifest->dataOff) {
+    LOGMSG(l_ERROR, "'%s' is not a valid manifest", manifestPath);
+    return false;
+  }
+  return true;
+}
+
+// Reads a whole file that is expected to have the given size. Returns false on error.
+static bool readFile(const char *path, u1 *buf, size_t size) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't open '%s'", path);
+    return false;
+  }
+  struct stat st;
+  bool ret = fstat(fd, &st) == 0 && (size_t)st.st_size == size &&
+             utils_readFromFd(fd, buf, size) == (ssize_t)size;
+  close(fd);
+  if (!ret) {
+    LOGMSG(l_ERROR, "Couldn't read '%s' or its size doesn't match its manifest", path);
+  }
+  return ret;
+}
+
+static const u1 *loadSharedData(sharedDataCache_t *pCache,
+                                const char *path,
+                                const cdexManifest_t *pManifest) {
+  if (pCache->buf != NULL && strcmp(pCache->path, path) == 0 &&
+      pCache->size == pManifest->sharedDataSize) {
+    return pCache->buf;
+  }
+
+  free(pCache->buf);
+  memset(pCache, 0, sizeof(sharedDataCache_t));
+  u1 *buf = utils_malloc(pManifest->sharedDataSize);
+  if (!readFile(path, buf, pManifest->sharedDataSize)) {
+    free(buf);
+    return NULL;
+  }
+  if (adler32(adler32(0L, Z_NULL, 0), buf, pManifest->sharedDataSize) !=
+      pManifest->sharedDataChecksum) {
+    LOGMSG(l_ERROR, "'%s' checksum doesn't match its manifest", path);
+    free(buf);
+    return NULL;
+  }
+  snprintf(pCache->path, sizeof(pCache->path), "%s", path);
+  pCache->buf = buf;
+  pCache->size = pManifest->sharedDataSize;
+  return buf;
+}
+
+static bool mergeManifest(const char *manifestPath,
+                          const runArgs_t *pRunArgs,
+                          sharedDataCache_t *pCache) {
+  cdexManifest_t manifest;
+  if (!parseManifest(manifestPath, &manifest)) {
+    return false;
+  }
+
+  // The main section is the manifest name without its suffix, the shared data file is in the same
+  // directory
+  char mainPath[PATH_MAX] = { 0 };
+  snprintf(mainPath, sizeof(mainPath), "%.*s",
+           (int)(strlen(manifestPath) - strlen(kCdexManifestSuffix)), manifestPath);
+  char dirPath[PATH_MAX] = { 0 };
+  snprintf(dirPath, sizeof(dirPath), "%s", manifestPath);
+  char sharedPath[PATH_MAX + NAME_MAX + 1] = { 0 };
+  snprintf(sharedPath, sizeof(sharedPath), "%s/%s", dirname(dirPath), manifest.sharedDataName);
+
+  const u1 *sharedBuf = loadSharedData(pCache, sharedPath, &manifest);
+  if (sharedBuf == NULL) {
+    return false;
+  }
+
+  // The data section is placed right after the main section, like the CompactDex header expects
+  u1 *cdexBuf = utils_malloc((size_t)manifest.mainSize + manifest.dataSize);
+  bool ret = false;
+  if (!readFile(mainPath, cdexBuf, manifest.mainSize)) {
+    goto cleanup;
+  }
+  if (manifest.mainSize < sizeof(cdexHeader) || !isCompactDex(cdexBuf) ||
+      dex_getFileSize(cdexBuf) != manifest.mainSize ||
+      dex_getDataOff(cdexBuf) != manifest.mainSize ||
+      dex_getDataSize(cdexBuf) != manifest.dataSize) {
+    LOGMSG(l_ERROR, "'%s' is not the CompactDex main section of its manifest", mainPath);
+    goto cleanup;
+  }
+  memcpy(cdexBuf + manifest.mainSize, sharedBuf + manifest.dataOff, manifest.dataSize);
+  ret = outWriter_CdexFile(pRunArgs, manifest.vdexName, manifest.dexIdx, cdexBuf);
+
+cleanup:
+  free(cdexBuf);
+  return ret;
+}
+
+static bool isManifestName(const char *fileName) {
+  const char *suffix = "cdex" kCdexManifestSuffix;
+  size_t nameLen = strlen(fileName);
+  return nameLen > strlen(suffix) && strcmp(fileName + nameLen - strlen(suffix), suffix) == 0;
+}
+
+static int compareNames(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+bool cdexShared_merge(const char *inputPath, const runArgs_t *pRunArgs, size_t *pMergedCnt) {
+  *pMergedCnt = 0;
+
+  // Manifests of a directory are merged in name order, so that the shared data of a Vdex file is
+  // loaded once
+  char **manifests = NULL;
+  size_t manifestsCnt = 0;
+  if (utils_isValidDir(inputPath)) {
+    DIR *dir = opendir(inputPath);
+    if (dir == NULL) {
+      LOGMSG_P(l_ERROR, "Couldn't open '%s' directory", inputPath);
+      return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (!isManifestName(entry->d_name)) {
+        continue;
+      }
+      manifests = utils_realloc(manifests, (manifestsCnt + 1) * sizeof(char *));
+      manifests[manifestsCnt] = utils_malloc(PATH_MAX);
+      snprintf(manifests[manifestsCnt], PATH_MAX, "%s/%s", inputPath, entry->d_name);
+      manifestsCnt++;
+    }
+    closedir(dir);
+    qsort(manifests, manifestsCnt, sizeof(char *), compareNames);
+  } else if (isManifestName(inputPath)) {
+    manifests = utils_malloc(sizeof(char *));
+    manifests[0] = utils_malloc(PATH_MAX);
+    snprintf(manifests[0], PATH_MAX, "%s", inputPath);
+    manifestsCnt = 1;
+  }
+  if (manifestsCnt == 0) {
+    LOGMSG(l_ERROR, "No CompactDex manifests found in '%s'", inputPath);
+    return false;
+  }
+
+  sharedDataCache_t cache;
+  memset(&cache, 0, sizeof(sharedDataCache_t));
+  for (size_t i = 0; i < manifestsCnt; ++i) {
+    if (mergeManifest(manifests[i], pRunArgs, &cache)) {
+      (*pMergedCnt)++;
+    }
+    free(manifests[i]);
+  }
+  free(cache.buf);
+  free(manifests);
+  return *pMergedCnt == manifestsCnt;
+}
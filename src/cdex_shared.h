@@ -0,0 +1,43 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _CDEX_SHARED_H_
+#define _CDEX_SHARED_H_
+
+#include "common.h"
+
+// Split CompactDex output keeps the shared data section of a Vdex file in a single file, instead
+// of appending it to every CompactDex file. A text manifest next to each CompactDex file (one
+// 'key=value' per line) records the Vdex file & Dex index that it came from, the size of its main
+// section, the range of the shared data file that is its data section and the name, size &
+// Adler-32 checksum of the shared data file, so that self-contained files can be rebuilt.
+
+// Writes the shared data file & the manifests of the CompactDex files of a Vdex file. Called once
+// all Dex files have been processed, since unquickening modifies the shared data in place.
+bool cdexShared_writeSharedData(const runArgs_t *, const char *, const u1 **, size_t);
+
+// Rebuilds the self-contained CompactDex files of the manifests in the input path (a manifest file
+// or a directory with manifests), which are written like the regular output. The number of merged
+// files is returned through the last argument.
+bool cdexShared_merge(const char *, const runArgs_t *, size_t *);
+
+#endif
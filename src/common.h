@@ -82,21 +82,64 @@ typedef __attribute__((__aligned__(1))) int32_t unaligned_s4;
   "    Anestis Bechtsoudis <anestis@census-labs.com>\n" \
   "  Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved."
 
+// See archive.h
+typedef struct archive archive_t;
+// See zip_writer.h
+typedef struct zipWriter zipWriter_t;
+// See tar_writer.h
+typedef struct tarWriter tarWriter_t;
+
+// How input Vdex files are loaded (see in_map.h)
+typedef enum {
+  kMapAuto = 0,   // Picked based on the file size
+  kMapRead,       // pread() into a buffer reused across files
+  kMapMmap,       // Private file mapping faulted in page by page
+  kMapPopulate,   // Private file mapping prefaulted with readahead
+  kMapHugePages,  // Transparent hugepages the file is read into
+} mapStrategy_t;
+
+// Output format of the header-only inventory (see inventory.h)
+typedef enum { kInventoryNone = 0, kInventoryJson, kInventoryCsv } inventoryFormat_t;
+
 typedef struct {
   char *inputFile;
   char **files;
   size_t fileCnt;
+  archive_t *pArchive;  // Set if inputFile is a tar or zip archive, files are its Vdex members
+  int scanJobs;         // Threads walking an input directory
+  size_t rootLen;       // Length of the input root (input dir, or dir of the input file) in files
+  bool *skipped;        // Files that are left out (deodex copies of other ISAs), or NULL
 } infiles_t;
 
 typedef struct {
   char *outputDir;
   bool fileOverride;
   bool unquicken;
+  bool convertCdex;
+  bool trimSharedData;   // Only keep the shared data that each CompactDex file references
+  bool splitSharedData;  // Write the shared data once per Vdex file, next to main sections
+  bool mergeSharedData;  // Rebuild self-contained CompactDex files from split output
+  bool deodex;  // Unquicken & convert into <outputDir>/<app>/classes[N].dex
   bool enableDisassembler;
   bool ignoreCrc;
   bool dumpDeps;
   char *newCrcFile;
+  bool inPlace;  // Patch the new location checksums into the input Vdex file
   bool getApi;
+  int dexJobs;
+  int classJobs;
+  bool directOutput;
+  bool asyncOutput;
+  bool fsyncOutput;
+  bool zipOutput;
+  bool zipStored;
+  int zipJobs;  // Threads deflating zip entries
+  char *outputZip;
+  const char *inputRelPath;  // Path of the Vdex being processed relative to the input root
+  zipWriter_t *pOutZip;  // Zip archive that receives the Dex files of the Vdex being processed
+  tarWriter_t *pOutTar;  // Tar stream to stdout ('-o -') that receives all output files
+  mapStrategy_t mapStrategy;
+  inventoryFormat_t inventory;
 } runArgs_t;
 
 extern void exitWrapper(int);
@@ -0,0 +1,293 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "crawler.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "utils.h"
+#include "vdex_api.h"
+
+#define kDirBufSz (32 * 1024)
+#define kInitialListCap 64
+
+#if defined(__linux__)
+// Record returned by getdents64()
+typedef struct {
+  u8 ino;
+  int64_t off;
+  unsigned short reclen;
+  unsigned char type;
+  char name[];
+} linuxDirent64_t;
+#endif
+
+// Entries of an open directory. On Linux they are read in batches with getdents64() straight into
+// a local buffer, elsewhere through readdir().
+typedef struct {
+  int fd;
+  bool failed;
+#if defined(__linux__)
+  u1 buf[kDirBufSz] __attribute__((aligned(8)));
+  size_t len;
+  size_t off;
+#else
+  DIR *dir;
+#endif
+} dirIter_t;
+
+// Directories pending to be scanned and Vdex files found so far, shared by the crawler threads
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char **dirs;
+  size_t dirCnt;
+  size_t dirCap;
+  size_t busyCnt;  // Threads that are scanning a directory
+  char **files;
+  size_t fileCnt;
+  size_t fileCap;
+} crawler_t;
+
+static bool dirIter_open(dirIter_t *pIter, const char *path) {
+  pIter->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (pIter->fd == -1) {
+    return false;
+  }
+  pIter->failed = false;
+#if defined(__linux__)
+  pIter->len = 0;
+  pIter->off = 0;
+#else
+  pIter->dir = fdopendir(pIter->fd);
+  if (pIter->dir == NULL) {
+    close(pIter->fd);
+    return false;
+  }
+#endif
+  return true;
+}
+
+// Returns false at the end of the directory, or on error in which case failed is set
+static bool dirIter_next(dirIter_t *pIter, const char **pName, unsigned char *pType) {
+#if defined(__linux__)
+  while (pIter->off >= pIter->len) {
+    long readSz = syscall(SYS_getdents64, pIter->fd, pIter->buf, sizeof(pIter->buf));
+    if (readSz < 0 && errno == EINTR) continue;
+    if (readSz <= 0) {
+      pIter->failed = readSz < 0;
+      return false;
+    }
+    pIter->len = readSz;
+    pIter->off = 0;
+  }
+  const linuxDirent64_t *pEntry = (const linuxDirent64_t *)(pIter->buf + pIter->off);
+  pIter->off += pEntry->reclen;
+  *pName = pEntry->name;
+  *pType = pEntry->type;
+#else
+  errno = 0;
+  struct dirent *pEntry = readdir(pIter->dir);
+  if (pEntry == NULL) {
+    pIter->failed = errno != 0;
+    return false;
+  }
+  *pName = pEntry->d_name;
+  *pType = pEntry->d_type;
+#endif
+  return true;
+}
+
+static void dirIter_close(dirIter_t *pIter) {
+#if defined(__linux__)
+  close(pIter->fd);
+#else
+  closedir(pIter->dir);
+#endif
+}
+
+// Appends to a list that grows geometrically
+static void appendPath(char ***pList, size_t *pCnt, size_t *pCap, const char *path) {
+  if (*pCnt == *pCap) {
+    *pCap = *pCap ? *pCap * 2 : kInitialListCap;
+    *pList = utils_realloc(*pList, *pCap * sizeof(char *));
+  }
+  char *pathCopy = strdup(path);
+  if (pathCopy == NULL) {
+    LOGMSG(l_FATAL, "Couldn't allocate memory");
+  }
+  (*pList)[(*pCnt)++] = pathCopy;
+}
+
+// Only the magic & version bytes are read, so that other files (Apk, Oat, Art, etc.) are never
+// mapped just to be rejected by the Vdex parser
+static bool isVdexFile(int dirFd, const char *name) {
+  int fd = openat(dirFd, name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  u1 magic[kVdexApiMagicSz];
+  ssize_t readSz = pread(fd, magic, sizeof(magic), 0);
+  close(fd);
+  return readSz == sizeof(magic) && vdexApi_isSupportedVdex(magic);
+}
+
+static void scanDir(crawler_t *pCrawler, const char *dirPath) {
+  dirIter_t *pIter = utils_malloc(sizeof(dirIter_t));
+  if (!dirIter_open(pIter, dirPath)) {
+    LOGMSG_P(l_ERROR, "Couldn't open dir '%s'", dirPath);
+    free(pIter);
+    return;
+  }
+
+  const char *name = NULL;
+  unsigned char type = DT_UNKNOWN;
+  while (dirIter_next(pIter, &name, &type)) {
+    // Skip special files
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+
+    char path[PATH_MAX + 2];
+    snprintf(path, sizeof(path), "%s/%s", dirPath, name);
+
+    // Symbolic links are followed, and file systems that don't report the type need a stat()
+    if (type == DT_LNK || type == DT_UNKNOWN) {
+      struct stat st;
+      if (fstatat(pIter->fd, name, &st, 0) == -1) {
+        LOGMSG(l_WARN, "Couldn't stat() the '%s' file", path);
+        continue;
+      }
+      type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+    }
+
+    if (type == DT_DIR) {
+      pthread_mutex_lock(&pCrawler->lock);
+      appendPath(&pCrawler->dirs, &pCrawler->dirCnt, &pCrawler->dirCap, path);
+      pthread_cond_signal(&pCrawler->cond);
+      pthread_mutex_unlock(&pCrawler->lock);
+      continue;
+    }
+
+    if (type != DT_REG) {
+      LOGMSG(l_DEBUG, "'%s' is not a regular file, skipping", path);
+      continue;
+    }
+
+    if (!isVdexFile(pIter->fd, name)) {
+      LOGMSG(l_DEBUG, "'%s' is not a supported Vdex file, skipping", path);
+      continue;
+    }
+
+    pthread_mutex_lock(&pCrawler->lock);
+    appendPath(&pCrawler->files, &pCrawler->fileCnt, &pCrawler->fileCap, path);
+    pthread_mutex_unlock(&pCrawler->lock);
+    LOGMSG(l_DEBUG, "Added '%s' to the list of input files", path);
+  }
+  if (pIter->failed) {
+    LOGMSG_P(l_ERROR, "Failed to read '%s' directory", dirPath);
+  }
+
+  dirIter_close(pIter);
+  free(pIter);
+}
+
+// Scans pending directories until there are none left and no other thread is scanning one (which
+// could add more)
+static void *crawlWorker(void *arg) {
+  crawler_t *pCrawler = (crawler_t *)arg;
+  pthread_mutex_lock(&pCrawler->lock);
+  for (;;) {
+    while (pCrawler->dirCnt == 0 && pCrawler->busyCnt > 0) {
+      pthread_cond_wait(&pCrawler->cond, &pCrawler->lock);
+    }
+    if (pCrawler->dirCnt == 0) {
+      break;
+    }
+
+    char *dirPath = pCrawler->dirs[--pCrawler->dirCnt];
+    pCrawler->busyCnt++;
+    pthread_mutex_unlock(&pCrawler->lock);
+    scanDir(pCrawler, dirPath);
+    free(dirPath);
+    pthread_mutex_lock(&pCrawler->lock);
+    pCrawler->busyCnt--;
+  }
+  pthread_cond_broadcast(&pCrawler->cond);
+  pthread_mutex_unlock(&pCrawler->lock);
+  return NULL;
+}
+
+static int comparePaths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+bool crawler_listVdexFiles(const char *dirPath, int jobs, char ***pFiles, size_t *pFileCnt) {
+  // Errors in subdirectories are logged and skipped, only the top one is fatal
+  int dirFd = open(dirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dirFd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't open dir '%s'", dirPath);
+    return false;
+  }
+  close(dirFd);
+
+  crawler_t crawler;
+  memset(&crawler, 0, sizeof(crawler));
+  pthread_mutex_init(&crawler.lock, NULL);
+  pthread_cond_init(&crawler.cond, NULL);
+  appendPath(&crawler.dirs, &crawler.dirCnt, &crawler.dirCap, dirPath);
+
+  // The calling thread is one of the crawlers
+  pthread_t *threads = NULL;
+  int spawned = 0;
+  if (jobs > 1) {
+    threads = utils_calloc((jobs - 1) * sizeof(pthread_t));
+    for (; spawned < jobs - 1; spawned++) {
+      int err = pthread_create(&threads[spawned], NULL, crawlWorker, &crawler);
+      if (err != 0) {
+        errno = err;
+        LOGMSG_P(l_WARN, "Couldn't spawn crawler thread - continuing with %d", spawned + 1);
+        break;
+      }
+    }
+  }
+  crawlWorker(&crawler);
+  for (int i = 0; i < spawned; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+
+  // Threads add files in no particular order
+  qsort(crawler.files, crawler.fileCnt, sizeof(char *), comparePaths);
+
+  free(crawler.dirs);
+  pthread_cond_destroy(&crawler.cond);
+  pthread_mutex_destroy(&crawler.lock);
+  *pFiles = crawler.files;
+  *pFileCnt = crawler.fileCnt;
+  return true;
+}
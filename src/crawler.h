@@ -0,0 +1,34 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _CRAWLER_H_
+#define _CRAWLER_H_
+
+#include "common.h"
+
+// Recursively lists the supported Vdex files of a directory, sorted by path. Directory entries are
+// classified by their type (d_type) without a stat() per entry, and regular files are only listed
+// if their leading bytes carry a supported Vdex magic & version. Directories are walked by the
+// given number of threads. The list and its paths are malloc()-ed.
+bool crawler_listVdexFiles(const char *, int, char ***, size_t *);
+
+#endif
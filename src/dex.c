@@ -24,7 +24,11 @@
 
 #include "utils.h"
 
-static bool enableDisassembler = false;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 static inline u2 get2LE(unsigned char const *pSrc) { return pSrc[0] | (pSrc[1] << 8); }
 
@@ -702,6 +706,27 @@ void dex_repairDexCRC(const u1 *buf, off_t fileSz) {
   memcpy((void *)buf + sizeof(dexMagic), &adler_checksum, sizeof(u4));
 }
 
+u4 dex_computeDexCRCV(const struct iovec *iov, int iovCnt) {
+  u4 adler_checksum = adler32(0L, Z_NULL, 0);
+  size_t non_sum = sizeof(dexMagic) + sizeof(u4);
+  for (int i = 0; i < iovCnt; ++i) {
+    size_t skip = non_sum < iov[i].iov_len ? non_sum : iov[i].iov_len;
+    size_t len = iov[i].iov_len - skip;
+    non_sum -= skip;
+    if (len == 0) {
+      continue;
+    }
+    if (iov[i].iov_base != NULL) {
+      adler_checksum = adler32(adler_checksum, (const u1 *)iov[i].iov_base + skip, len);
+    } else {
+      // Adler-32 is composable and the checksum of a run of zeros is only a function of its length
+      u4 zeros_checksum = ((len % 65521) << 16) | 1;
+      adler_checksum = adler32_combine(adler_checksum, zeros_checksum, len);
+    }
+  }
+  return adler_checksum;
+}
+
 u4 dex_getFirstInstrOff(const u1 *cursor, const dexMethod *pDexMethod) {
   // The first instruction is the last member of the dexCode struct
   if (dex_checkType(cursor) == kNormalDex) {
@@ -729,7 +754,7 @@ u4 dex_readULeb128(const u1 **pStream) {
           // range here, meaning we tolerate garbage in the
           // high four-order bits.
           cur = *(ptr++);
-          result |= cur << 28;
+          result |= (u4)cur << 28;
         }
       }
     }
@@ -739,6 +764,158 @@ u4 dex_readULeb128(const u1 **pStream) {
   return (u4)result;
 }
 
+#if (defined(__SSE2__) || (defined(__aarch64__) && defined(__ARM_NEON))) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ULEB128_SIMD_WINDOW 16
+
+// Smallest page size of the supported targets. Loads that do not cross a page boundary cannot
+// fault, even if they extend past the end of the encoded data.
+static const uintptr_t kULeb128PageSize = 4096;
+static const u4 kULeb128MaxSize = 5;
+
+// Window loads may read past the end of the encoded data (never across a page boundary), so the
+// functions that touch the window are excluded from address sanitizer checks. The window is
+// usable if it can be loaded together with the 8 bytes that compressULeb128 reads for a value
+// starting at its last byte.
+static inline bool isULeb128WindowSafe(const u1 *ptr) {
+  return ((uintptr_t)ptr & (kULeb128PageSize - 1)) <=
+         kULeb128PageSize - ULEB128_SIMD_WINDOW - sizeof(u8);
+}
+
+// Returns a mask with one bit per window byte that has the continuation bit set
+__attribute__((no_sanitize_address)) static inline u4 getULeb128ContinuationMask(
+    const u1 *ptr) {
+#if defined(__SSE2__)
+  return (u4)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ptr));
+#else
+  static const u1 kBitWeights[ULEB128_SIMD_WINDOW] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                                       1, 2, 4, 8, 16, 32, 64, 128 };
+  uint8x16_t bits = vmulq_u8(vshrq_n_u8(vld1q_u8(ptr), 7), vld1q_u8(kBitWeights));
+  return (u4)vaddv_u8(vget_low_u8(bits)) | ((u4)vaddv_u8(vget_high_u8(bits)) << 8);
+#endif
+}
+
+// Zero extends the 16 bytes of the window
+__attribute__((no_sanitize_address)) static inline void widenULeb128Window(const u1 *ptr,
+                                                                         u4 *pValues) {
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i v = _mm_loadu_si128((const __m128i *)ptr);
+  __m128i lo = _mm_unpacklo_epi8(v, zero);
+  __m128i hi = _mm_unpackhi_epi8(v, zero);
+  _mm_storeu_si128((__m128i *)pValues, _mm_unpacklo_epi16(lo, zero));
+  _mm_storeu_si128((__m128i *)(pValues + 4), _mm_unpackhi_epi16(lo, zero));
+  _mm_storeu_si128((__m128i *)(pValues + 8), _mm_unpacklo_epi16(hi, zero));
+  _mm_storeu_si128((__m128i *)(pValues + 12), _mm_unpackhi_epi16(hi, zero));
+#else
+  uint8x16_t v = vld1q_u8(ptr);
+  uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+  uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+  vst1q_u32(pValues, vmovl_u16(vget_low_u16(lo)));
+  vst1q_u32(pValues + 4, vmovl_u16(vget_high_u16(lo)));
+  vst1q_u32(pValues + 8, vmovl_u16(vget_low_u16(hi)));
+  vst1q_u32(pValues + 12, vmovl_u16(vget_high_u16(hi)));
+#endif
+}
+
+// Gathers the 7-bit groups of a len bytes encoded value without per byte branches. Same as
+// dex_readULeb128, only the low four bits of a fifth byte are kept.
+__attribute__((no_sanitize_address)) static inline u4 compressULeb128(const u1 *ptr,
+                                                                     u4 len) {
+  u8 raw;
+  memcpy(&raw, ptr, sizeof(raw));
+  raw &= (1ULL << (len * 8)) - 1;
+  return (u4)((raw & 0x7f) | ((raw >> 1) & 0x3f80) | ((raw >> 2) & 0x1fc000) |
+              ((raw >> 3) & 0xfe00000) | ((raw >> 4) & 0xf0000000));
+}
+#endif
+
+// Same as dex_readULeb128, but fails instead of reading at or past end
+static inline bool readULeb128Bounded(const u1 **pStream, const u1 *end, u4 *pValue) {
+  const u1 *ptr = *pStream;
+  u4 result = 0;
+  for (u4 shift = 0; ptr < end; shift += 7) {
+    u4 cur = *(ptr++);
+    result |= (cur & 0x7f) << shift;
+    // Garbage in the high four bits of a fifth byte is tolerated, as in dex_readULeb128
+    if (cur <= 0x7f || shift == 28) {
+      *pStream = ptr;
+      *pValue = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Decodes the values of the batch readers. If end is not NULL, values must end before it and
+// decoding stops at the first one that doesn't.
+__attribute__((no_sanitize_address)) static inline bool readULeb128Batch(const u1 **pStream,
+                                                                        const u1 *end,
+                                                                        u4 *pValues,
+                                                                        size_t count) {
+  const u1 *ptr = *pStream;
+  size_t i = 0;
+
+#if defined(ULEB128_SIMD_WINDOW)
+  // All values that are decoded from a window end inside of it. Values are gathered with 8 byte
+  // loads from anywhere in the window, so a bounded window also needs those bytes before end.
+  while (i < count && isULeb128WindowSafe(ptr) &&
+         (end == NULL || end - ptr >= ULEB128_SIMD_WINDOW + (ptrdiff_t)sizeof(u8))) {
+    u4 contMask = getULeb128ContinuationMask(ptr);
+    u4 pos = 0;
+
+    // Leading single byte values are widened together when the output has room for the window
+    if (count - i >= ULEB128_SIMD_WINDOW) {
+      pos = contMask == 0 ? ULEB128_SIMD_WINDOW : (u4)__builtin_ctz(contMask);
+      widenULeb128Window(ptr, pValues + i);
+      i += pos;
+    }
+
+    // Walk the terminator bits to decode the remaining values that end inside the window
+    u4 termMask = ~contMask & ((1U << ULEB128_SIMD_WINDOW) - 1) & ~((1U << pos) - 1);
+    while (i < count && termMask != 0) {
+      u4 termPos = (u4)__builtin_ctz(termMask);
+      u4 len = termPos + 1 - pos;
+      if (len > kULeb128MaxSize) {
+        break;
+      }
+      pValues[i++] = compressULeb128(ptr + pos, len);
+      pos = termPos + 1;
+      termMask &= termMask - 1;
+    }
+
+    // Values that do not end in the window and overlong encodings take the scalar path, which
+    // reads at most kULeb128MaxSize bytes (inside the window)
+    if (pos == 0) {
+      pValues[i++] = dex_readULeb128(&ptr);
+    } else {
+      ptr += pos;
+    }
+  }
+#endif
+
+  bool ret = true;
+  if (end == NULL) {
+    for (; i < count; ++i) {
+      pValues[i] = dex_readULeb128(&ptr);
+    }
+  } else {
+    for (; ret && i < count; ++i) {
+      ret = readULeb128Bounded(&ptr, end, &pValues[i]);
+    }
+  }
+  *pStream = ptr;
+  return ret;
+}
+
+void dex_readULeb128Batch(const u1 **pStream, u4 *pValues, size_t count) {
+  readULeb128Batch(pStream, NULL, pValues, count);
+}
+
+bool dex_readULeb128BatchBounded(const u1 **pStream, const u1 *end, u4 *pValues, size_t count) {
+  return readULeb128Batch(pStream, end, pValues, count);
+}
+
 u1 *dex_writeULeb128(u1 *dest, u4 value) {
   u1 out = value & 0x7f;
   value >>= 7;
@@ -769,10 +946,9 @@ u1 *dex_reverseSearchULeb128(u1 *end_ptr) {
   return ptr;
 }
 
-void dex_updateULeb128(u1 *dest, u4 value) {
-  const u1 *old_end = dest;
-  u4 old_value = dex_readULeb128(&old_end);
-  CHECK_LE(ULeb128Size(value), ULeb128Size(old_value));
+// Overwrite the encoded Leb128 that spans [dest, old_end) with a new value
+static void rewriteULeb128(u1 *dest, const u1 *old_end, u4 value) {
+  CHECK_LE(ULeb128Size(value), (u4)(old_end - dest));
   for (u1 *end = dex_writeULeb128(dest, value); end < old_end; end++) {
     // Use longer encoding than necessary to fill the allocated space.
     end[-1] |= 0x80;
@@ -780,6 +956,13 @@ void dex_updateULeb128(u1 *dest, u4 value) {
   }
 }
 
+void dex_updateULeb128(u1 *dest, u4 value) {
+  const u1 *old_end = dest;
+  u4 old_value = dex_readULeb128(&old_end);
+  CHECK_LE(ULeb128Size(value), ULeb128Size(old_value));
+  rewriteULeb128(dest, old_end, value);
+}
+
 s4 dex_readSLeb128(const u1 **data) {
   const u1 *ptr = *data;
   s4 result = *(ptr++);
@@ -814,21 +997,55 @@ s4 dex_readSLeb128(const u1 **data) {
 }
 
 void dex_readClassDataHeader(const u1 **cursor, dexClassDataHeader *pDexClassDataHeader) {
-  pDexClassDataHeader->staticFieldsSize = dex_readULeb128(cursor);
-  pDexClassDataHeader->instanceFieldsSize = dex_readULeb128(cursor);
-  pDexClassDataHeader->directMethodsSize = dex_readULeb128(cursor);
-  pDexClassDataHeader->virtualMethodsSize = dex_readULeb128(cursor);
+  u4 values[4];
+  dex_readULeb128Batch(cursor, values, 4);
+  pDexClassDataHeader->staticFieldsSize = values[0];
+  pDexClassDataHeader->instanceFieldsSize = values[1];
+  pDexClassDataHeader->directMethodsSize = values[2];
+  pDexClassDataHeader->virtualMethodsSize = values[3];
 }
 
 void dex_readClassDataField(const u1 **cursor, dexField *pDexField) {
-  pDexField->fieldIdx = dex_readULeb128(cursor);
-  pDexField->accessFlags = dex_readULeb128(cursor);
+  u4 values[2];
+  dex_readULeb128Batch(cursor, values, 2);
+  pDexField->fieldIdx = values[0];
+  pDexField->accessFlags = values[1];
 }
 
 void dex_readClassDataMethod(const u1 **cursor, dexMethod *pDexMethod) {
+  u4 values[3];
+  dex_readULeb128Batch(cursor, values, 3);
+  pDexMethod->methodIdx = values[0];
+  pDexMethod->accessFlags = values[1];
+  pDexMethod->codeOff = values[2];
+}
+
+// Reads the access flags of a class data member and unhides them in place. The flags are only
+// written back if hiddenapi bits were set, so the pages of untouched class data are not dirtied.
+static u4 readAndUnhideAccessFlags(const u1 **cursor, bool *pUnhidden) {
+  u1 *pFlags = (u1 *)*cursor;
+  u4 accessFlags = dex_readULeb128(cursor);
+  u4 newAccessFlags = dex_decodeAccessFlagsFromDex(accessFlags);
+  *pUnhidden = newAccessFlags != accessFlags;
+  if (*pUnhidden) {
+    rewriteULeb128(pFlags, *cursor, newAccessFlags);
+  }
+  return accessFlags;
+}
+
+bool dex_readClassDataFieldUnhide(const u1 **cursor, dexField *pDexField) {
+  bool unhidden = false;
+  pDexField->fieldIdx = dex_readULeb128(cursor);
+  pDexField->accessFlags = readAndUnhideAccessFlags(cursor, &unhidden);
+  return unhidden;
+}
+
+bool dex_readClassDataMethodUnhide(const u1 **cursor, dexMethod *pDexMethod) {
+  bool unhidden = false;
   pDexMethod->methodIdx = dex_readULeb128(cursor);
-  pDexMethod->accessFlags = dex_readULeb128(cursor);
+  pDexMethod->accessFlags = readAndUnhideAccessFlags(cursor, &unhidden);
   pDexMethod->codeOff = dex_readULeb128(cursor);
+  return unhidden;
 }
 
 // Returns the StringId at the specified index.
@@ -1019,9 +1236,6 @@ void dex_dumpMethodInfo(const u1 *dexFileBuf,
 
 void dex_dumpInstruction(
     const u1 *dexFileBuf, u2 *codePtr, u4 codeOffset, u4 insnIdx, bool highlight) {
-  // Save time if no disassemble
-  if (enableDisassembler == false) return;
-
   // Highlight decompile instructions
   if (highlight) {
     log_dis("[new] ");
@@ -1369,16 +1583,3 @@ u4 dex_decodeAccessFlagsFromDex(u4 dex_access_flags) {
   new_access_flags &= ~GetSecondFlag(new_access_flags);
   return new_access_flags;
 }
-
-void dex_unhideAccessFlags(u1 *data_ptr, u4 new_access_flags, bool is_method) {
-  // Go back 1 uleb to start.
-  data_ptr = dex_reverseSearchULeb128(data_ptr);
-  if (is_method) {
-    // Methods have another uleb field before the access flags
-    data_ptr = dex_reverseSearchULeb128(data_ptr);
-  }
-  dex_updateULeb128(data_ptr, new_access_flags);
-}
-
-void dex_setDisassemblerStatus(bool status) { enableDisassembler = status; }
-bool dex_getDisassemblerStatus(void) { return enableDisassembler; }
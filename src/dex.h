@@ -23,6 +23,7 @@
 #ifndef _DEX_H_
 #define _DEX_H_
 
+#include <sys/uio.h>
 #include <zlib.h>
 
 #include "common.h"
@@ -326,11 +327,25 @@ u4 dex_computeDexCRC(const u1 *, off_t);
 // Repair Dex file CRC
 void dex_repairDexCRC(const u1 *, off_t);
 
+// Compute the CRC of a Dex file that is scattered in several buffers, starting with the header.
+// Buffers with a NULL base stand for runs of zeros.
+u4 dex_computeDexCRCV(const struct iovec *, int);
+
 // Reads an unsigned LEB128 (Little-Endian Base 128) value, updating the
 // given pointer to point just past the end of the read value. This function
 // tolerates non-zero high-order bits in the fifth encoded byte.
 u4 dex_readULeb128(const u1 **);
 
+// Reads count consecutive unsigned LEB128 values into the given array, updating the given pointer
+// to point just past the end of the last value. Same semantics as dex_readULeb128, but values are
+// decoded from 16 bytes SIMD windows where the target supports it.
+void dex_readULeb128Batch(const u1 **, u4 *, size_t);
+
+// Same as dex_readULeb128Batch, but never reads at or past the given end pointer (windows are
+// only used while the window and the 8 byte loads of its values end before it). Returns false if
+// the values don't all end before it, in which case the pointer is left after the last full value.
+bool dex_readULeb128BatchBounded(const u1 **, const u1 *, u4 *, size_t);
+
 // Writes an unsigned LEB128 (Little-Endian Base 128) value, updating the
 // given pointer to point just past the end of the written value.
 u1 *dex_writeULeb128(u1 *dest, u4 value);
@@ -361,6 +376,14 @@ void dex_readClassDataField(const u1 **, dexField *);
 // Read a Leb128 class data method item
 void dex_readClassDataMethod(const u1 **, dexMethod *);
 
+// Read a Leb128 class data field item and remove its hiddenapi flags in the same forward pass.
+// The returned access flags are the ones before unhiding. Returns true if the item was modified.
+bool dex_readClassDataFieldUnhide(const u1 **, dexField *);
+
+// Read a Leb128 class data method item and remove its hiddenapi flags in the same forward pass.
+// The returned access flags are the ones before unhiding. Returns true if the item was modified.
+bool dex_readClassDataMethodUnhide(const u1 **, dexMethod *);
+
 // Methods to access Dex file primitive types
 const dexStringId *dex_getStringId(const u1 *, u4);
 const dexTypeId *dex_getTypeId(const u1 *, u2);
@@ -385,14 +408,13 @@ const char *dex_getMethodDeclaringClassDescriptor(const u1 *, const dexMethodId
 const char *dex_getMethodName(const u1 *, const dexMethodId *);
 
 // Dex disassembler methods
-void dex_setDisassemblerStatus(bool);
-bool dex_getDisassemblerStatus(void);
 void dex_dumpInstruction(const u1 *, u2 *, u4, u4, bool);
 
 // Get Dex data base address
 const u1 *dex_getDataAddr(const u1 *);
 
-// Functions to print information of primitive types (mainly used by disassembler)
+// Functions to print information of primitive types (mainly used by disassembler). They allocate
+// their formatted strings, so callers only invoke them when the disassembler is enabled.
 void dex_dumpClassInfo(const u1 *, u4);
 void dex_dumpMethodInfo(const u1 *, dexMethod *, u4, const char *);
 
@@ -416,7 +438,4 @@ void dex_getCodeItemInfo(const u1 *, dexMethod *, u2 **, u4 *);
 
 u4 dex_decodeAccessFlagsFromDex(u4);
 
-// Changes the dex class data pointed to by data_ptr it to not have any hiddenapi flags.
-void dex_unhideAccessFlags(u1 *, u4, bool);
-
 #endif
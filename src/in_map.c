@@ -0,0 +1,228 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "in_map.h"
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+#define kHugePageSz (2 * 1024 * 1024)
+
+// Buffer of kMapRead files, only ever grown
+static u1 *readBuf;
+static size_t readBufSz;
+
+static size_t pageSize(void) { return sysconf(_SC_PAGESIZE); }
+
+static void getProcFaults(long *pMinFlt, long *pMajFlt) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    memset(&usage, 0, sizeof(usage));
+  }
+  *pMinFlt = usage.ru_minflt;
+  *pMajFlt = usage.ru_majflt;
+}
+
+// Reads the whole file at the beginning of the buffer
+static bool readFile(const char *fileName, int fd, u1 *buf, size_t size) {
+  size_t readSz = 0;
+  while (readSz < size) {
+    ssize_t sz = pread(fd, buf + readSz, size - readSz, readSz);
+    if (sz < 0 && errno == EINTR) continue;
+    if (sz <= 0) {
+      LOGMSG_P(l_WARN, "Couldn't read() the '%s' file", fileName);
+      return false;
+    }
+    readSz += sz;
+  }
+  return true;
+}
+
+static bool loadRead(const char *fileName, inMap_t *pMap) {
+  size_t allocSz = utils_roundUp(pMap->size > 0 ? pMap->size : 1, pageSize());
+  if (allocSz > readBufSz) {
+    free(readBuf);
+    readBuf = utils_malloc(allocSz);
+    readBufSz = allocSz;
+  }
+  if (!readFile(fileName, pMap->fd, readBuf, pMap->size)) {
+    return false;
+  }
+  memset(readBuf + pMap->size, 0, allocSz - pMap->size);
+  pMap->buf = readBuf;
+  pMap->allocSz = allocSz;
+  return true;
+}
+
+static bool loadMmap(const char *fileName, inMap_t *pMap, int extraFlags) {
+  u1 *buf = mmap(NULL, pMap->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | extraFlags, pMap->fd, 0);
+  if (buf == MAP_FAILED) {
+    LOGMSG_P(l_WARN, "Couldn't mmap() the '%s' file", fileName);
+    return false;
+  }
+  pMap->buf = buf;
+  pMap->allocSz = pMap->size;
+  return true;
+}
+
+// Page tables are prefaulted read-only from the page cache (MADV_POPULATE_READ), so that only the
+// pages the decompiler writes to are copied. Kernels without it populate the mapping at mmap()
+// time, which breaks copy-on-write of the whole private mapping up front.
+static bool loadPopulate(const char *fileName, inMap_t *pMap) {
+  posix_fadvise(pMap->fd, 0, pMap->size, POSIX_FADV_SEQUENTIAL);
+#ifdef MADV_POPULATE_READ
+  if (!loadMmap(fileName, pMap, 0)) {
+    return false;
+  }
+  madvise(pMap->buf, pMap->size, MADV_SEQUENTIAL);
+  madvise(pMap->buf, pMap->size, MADV_WILLNEED);
+  if (madvise(pMap->buf, pMap->size, MADV_POPULATE_READ) == 0 || errno != EINVAL) {
+    return true;
+  }
+  munmap(pMap->buf, pMap->size);
+  pMap->buf = NULL;
+#endif
+  if (!loadMmap(fileName, pMap, MAP_POPULATE)) {
+    return false;
+  }
+  madvise(pMap->buf, pMap->size, MADV_SEQUENTIAL);
+  return true;
+}
+
+// File mappings don't get transparent hugepages, so the file is read into an anonymous mapping
+// aligned to the hugepage size. Falls back to a plain mapping if the memory can't be reserved.
+static bool loadHugePages(const char *fileName, inMap_t *pMap) {
+  size_t allocSz = utils_roundUp(pMap->size > 0 ? pMap->size : 1, kHugePageSz);
+  u1 *rawBuf = mmap(NULL, allocSz + kHugePageSz, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (rawBuf == MAP_FAILED) {
+    LOGMSG_P(l_DEBUG, "Couldn't allocate hugepages for the '%s' file - mapping it", fileName);
+    pMap->strategy = kMapMmap;
+    return loadMmap(fileName, pMap, 0);
+  }
+
+  // Trim the unaligned head and tail
+  u1 *buf = (u1 *)utils_roundUp((uintptr_t)rawBuf, kHugePageSz);
+  if (buf > rawBuf) {
+    munmap(rawBuf, buf - rawBuf);
+  }
+  munmap(buf + allocSz, rawBuf + kHugePageSz - buf);
+
+  if (madvise(buf, allocSz, MADV_HUGEPAGE) != 0) {
+    LOGMSG_P(l_DEBUG, "Transparent hugepages are not available for the '%s' file", fileName);
+  }
+  if (!readFile(fileName, pMap->fd, buf, pMap->size)) {
+    munmap(buf, allocSz);
+    return false;
+  }
+  pMap->buf = buf;
+  pMap->allocSz = allocSz;
+  return true;
+}
+
+bool inMap_open(const char *fileName, mapStrategy_t strategy, inMap_t *pMap) {
+  memset(pMap, 0, sizeof(inMap_t));
+  getProcFaults(&pMap->startMinFlt, &pMap->startMajFlt);
+  if ((pMap->fd = open(fileName, O_RDONLY)) == -1) {
+    LOGMSG_P(l_WARN, "Couldn't open() '%s' file in R/O mode", fileName);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(pMap->fd, &st) == -1) {
+    LOGMSG_P(l_WARN, "Couldn't stat() the '%s' file", fileName);
+    close(pMap->fd);
+    return false;
+  }
+  pMap->size = st.st_size;
+
+  if (strategy == kMapAuto) {
+    strategy = pMap->size < kMapReadMaxSz ? kMapRead : kMapPopulate;
+  }
+
+  bool ret = false;
+  pMap->strategy = strategy;
+  switch (strategy) {
+    case kMapRead:
+      ret = loadRead(fileName, pMap);
+      break;
+    case kMapPopulate:
+      ret = loadPopulate(fileName, pMap);
+      break;
+    case kMapHugePages:
+      ret = loadHugePages(fileName, pMap);
+      break;
+    default:
+      pMap->strategy = kMapMmap;
+      ret = loadMmap(fileName, pMap, 0);
+      break;
+  }
+  if (!ret) {
+    close(pMap->fd);
+    return false;
+  }
+  return true;
+}
+
+void inMap_close(inMap_t *pMap) {
+  if (pMap->buf != NULL && pMap->strategy != kMapRead) {
+    munmap(pMap->buf, pMap->allocSz);
+  }
+  close(pMap->fd);
+  pMap->buf = NULL;
+  pMap->fd = -1;
+}
+
+void inMap_getFaults(const inMap_t *pMap, long *pMinFlt, long *pMajFlt) {
+  getProcFaults(pMinFlt, pMajFlt);
+  *pMinFlt -= pMap->startMinFlt;
+  *pMajFlt -= pMap->startMajFlt;
+}
+
+const char *inMap_strategyName(mapStrategy_t strategy) {
+  switch (strategy) {
+    case kMapAuto:
+      return "auto";
+    case kMapRead:
+      return "read";
+    case kMapMmap:
+      return "mmap";
+    case kMapPopulate:
+      return "populate";
+    case kMapHugePages:
+      return "hugepages";
+  }
+  return "unknown";
+}
+
+bool inMap_parseStrategy(const char *name, mapStrategy_t *pStrategy) {
+  for (mapStrategy_t strategy = kMapAuto; strategy <= kMapHugePages; strategy++) {
+    if (strcmp(name, inMap_strategyName(strategy)) == 0) {
+      *pStrategy = strategy;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,57 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _IN_MAP_H_
+#define _IN_MAP_H_
+
+#include "common.h"
+
+// Input Vdex file loaded in a private, writable buffer (backends decompile in place) with any of
+// the strategies of mapStrategy_t. As with file mappings, the buffer is zero padded up to at least
+// the page boundary. The file descriptor is kept open for kernel-space copies of the input.
+typedef struct {
+  u1 *buf;
+  off_t size;
+  int fd;
+  mapStrategy_t strategy;  // Strategy actually used, never kMapAuto
+  size_t allocSz;          // Size of the mapping or buffer backing buf
+  long startMinFlt;        // Process page fault counters when the file was loaded
+  long startMajFlt;
+} inMap_t;
+
+// Files below this size are read instead of mapped with kMapAuto. Larger ones are populated, since
+// reading them eagerly into hugepages costs their whole size in anonymous memory, so kMapHugePages
+// is only used when requested.
+#define kMapReadMaxSz (256 * 1024)
+
+// Loads a file. Only one file loaded with kMapRead can be open at a time per process, since they
+// share the same buffer.
+bool inMap_open(const char *, mapStrategy_t, inMap_t *);
+void inMap_close(inMap_t *);
+
+// Minor and major page faults of the process since the file was loaded
+void inMap_getFaults(const inMap_t *, long *, long *);
+
+const char *inMap_strategyName(mapStrategy_t);
+bool inMap_parseStrategy(const char *, mapStrategy_t *);
+
+#endif
@@ -0,0 +1,308 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "in_stream.h"
+
+#include "utils.h"
+
+#define kStreamMinBufSize 4096
+#define kStreamInitialBufSize (1024 * 1024)
+#define kStreamSkipBufSize (64 * 1024)
+// Sections of a Vdex file are sized with 32-bit fields, but in practice even boot image Vdex files
+// are a few hundred MiB. Sizes come from the stream, so larger files are rejected instead of being
+// allocated up front.
+#define kStreamMaxFileSize (1024ULL * 1024 * 1024)
+
+static const u1 kStreamFrameMagic[] = { 'V', 'D', 'X', 'F' };
+
+typedef struct __attribute__((packed)) {
+  u1 magic[4];
+  u4 nameLen;
+  u8 size;
+} inStreamFrame_t;
+
+static void failStream(inStream_t *pStream) {
+  pStream->failed = true;
+  pStream->done = true;
+}
+
+// Reads from the probed bytes first and then from the input
+static ssize_t streamRead(inStream_t *pStream, u1 *buf, size_t len) {
+  size_t probed = pStream->probeLen - pStream->probeOff;
+  if (probed > len) {
+    probed = len;
+  }
+  memcpy(buf, pStream->probe + pStream->probeOff, probed);
+  pStream->probeOff += probed;
+  if (probed == len) {
+    return len;
+  }
+
+  ssize_t sz = utils_readFromFd(pStream->fd, buf + probed, len - probed);
+  return sz < 0 ? sz : (ssize_t)(probed + sz);
+}
+
+static bool streamSkip(inStream_t *pStream, size_t len) {
+  u1 skipBuf[kStreamSkipBufSize];
+  while (len > 0) {
+    size_t chunk = len < sizeof(skipBuf) ? len : sizeof(skipBuf);
+    if (streamRead(pStream, skipBuf, chunk) != (ssize_t)chunk) {
+      return false;
+    }
+    len -= chunk;
+  }
+  return true;
+}
+
+// Buffers span whole pages (at least kStreamMinBufSize bytes), like file mappings do
+static size_t bufCapacity(size_t size) {
+  size_t pageSz = sysconf(_SC_PAGESIZE);
+  return utils_roundUp(size < kStreamMinBufSize ? kStreamMinBufSize : size, pageSz);
+}
+
+// Zero fill the tail of the buffer like the last page of a file mapping, so that header checks of
+// truncated files don't read past it
+static void padBuffer(u1 *buf, size_t size, size_t bufCap) { memset(buf + size, 0, bufCap - size); }
+
+// Reads a Vdex file (or tar metadata) of known size, described by what in error messages
+static u1 *readFile(inStream_t *pStream, u8 size, const char *what) {
+  if (size > kStreamMaxFileSize) {
+    LOGMSG(l_ERROR, "Size (%" PRIu64 ") of %s exceeds the limit of %llu bytes", size, what,
+           kStreamMaxFileSize);
+    return NULL;
+  }
+  size_t bufCap = bufCapacity(size);
+  u1 *buf = malloc(bufCap);
+  if (buf == NULL) {
+    LOGMSG_P(l_ERROR, "Couldn't allocate %zu bytes for %s", bufCap, what);
+    return NULL;
+  }
+  ssize_t sz = streamRead(pStream, buf, size);
+  if (sz < 0 || (size_t)sz != size) {
+    LOGMSG(l_ERROR, "Truncated %s", what);
+    free(buf);
+    return NULL;
+  }
+  padBuffer(buf, size, bufCap);
+  return buf;
+}
+
+// Names come from the stream, so never let them point outside of the output directory
+static void formatName(const inStream_t *pStream, const char *path, char *name, size_t nameLen) {
+  const char *baseName = strrchr(path, '/');
+  baseName = baseName ? baseName + 1 : path;
+  if (baseName[0] == '\0' || strcmp(baseName, ".") == 0 || strcmp(baseName, "..") == 0) {
+    snprintf(name, nameLen, "stdin_%zu.vdex", pStream->fileIdx);
+  } else {
+    snprintf(name, nameLen, "%s", baseName);
+  }
+}
+
+static bool nextRaw(inStream_t *pStream, char *name, size_t nameLen, u1 **pBuf, off_t *pSize) {
+  size_t bufCap = kStreamInitialBufSize;
+  size_t size = 0;
+  u1 *buf = utils_malloc(bufCap);
+
+  for (;;) {
+    if (size == bufCap) {
+      u1 *newBuf = bufCap < kStreamMaxFileSize ? realloc(buf, bufCap * 2) : NULL;
+      if (newBuf == NULL) {
+        LOGMSG(l_ERROR, "Input stream is larger than %llu bytes", kStreamMaxFileSize);
+        free(buf);
+        return false;
+      }
+      buf = newBuf;
+      bufCap *= 2;
+    }
+    ssize_t sz = streamRead(pStream, buf + size, bufCap - size);
+    if (sz < 0) {
+      LOGMSG_P(l_ERROR, "Couldn't read input stream");
+      free(buf);
+      return false;
+    }
+    size += sz;
+    if (size < bufCap) {
+      break;
+    }
+  }
+
+  padBuffer(buf, size, bufCap);
+  snprintf(name, nameLen, "stdin.vdex");
+  *pBuf = buf;
+  *pSize = size;
+  pStream->done = true;
+  return true;
+}
+
+static bool nextFramed(inStream_t *pStream, char *name, size_t nameLen, u1 **pBuf, off_t *pSize) {
+  inStreamFrame_t frame;
+  ssize_t sz = streamRead(pStream, (u1 *)&frame, sizeof(frame));
+  if (sz == 0) {
+    // Clean end of stream on a frame boundary
+    pStream->done = true;
+    return false;
+  }
+  if (sz != sizeof(frame) ||
+      memcmp(frame.magic, kStreamFrameMagic, sizeof(kStreamFrameMagic)) != 0) {
+    LOGMSG(l_ERROR, "Invalid or truncated header of input stream frame #%zu", pStream->fileIdx);
+    return false;
+  }
+
+  char frameName[PATH_MAX] = { 0 };
+  if (frame.nameLen >= sizeof(frameName)) {
+    LOGMSG(l_ERROR, "Invalid name length (%" PRIu32 ") of input stream frame #%zu", frame.nameLen,
+           pStream->fileIdx);
+    return false;
+  }
+  if (streamRead(pStream, (u1 *)frameName, frame.nameLen) != frame.nameLen) {
+    LOGMSG(l_ERROR, "Truncated input stream frame #%zu", pStream->fileIdx);
+    return false;
+  }
+  formatName(pStream, frameName, name, nameLen);
+
+  char what[PATH_MAX + 64];
+  snprintf(what, sizeof(what), "input stream frame #%zu ('%s')", pStream->fileIdx, name);
+  *pBuf = readFile(pStream, frame.size, what);
+  if (*pBuf == NULL) {
+    return false;
+  }
+  *pSize = frame.size;
+  return true;
+}
+
+// Walks the tar headers up to the next Vdex member, skipping the data of everything else
+static bool nextTar(inStream_t *pStream, char *name, size_t nameLen, u1 **pBuf, off_t *pSize) {
+  char longName[PATH_MAX] = { 0 };
+  bool hasLongName = false;
+  u1 block[kTarBlockSize];
+
+  for (;;) {
+    ssize_t sz = streamRead(pStream, block, sizeof(block));
+    if (sz == 0 || (sz == sizeof(block) && archive_isTarEndBlock(block))) {
+      pStream->done = true;
+      return false;
+    }
+
+    archiveTarHdr_t hdr;
+    if (sz != sizeof(block) || !archive_parseTarHeader(block, &hdr) ||
+        hdr.size > SSIZE_MAX - kStreamMinBufSize) {
+      LOGMSG(l_ERROR, "Invalid or truncated tar header in input stream");
+      return false;
+    }
+    size_t paddedSize = utils_roundUp(hdr.size, kTarBlockSize);
+
+    if (hdr.type == 'L' || hdr.type == 'x') {
+      u1 *pMeta = readFile(pStream, paddedSize, "tar member in input stream");
+      if (pMeta == NULL) {
+        return false;
+      }
+      if (hdr.type == 'L') {
+        snprintf(longName, sizeof(longName), "%.*s",
+                 (int)(hdr.size < sizeof(longName) ? hdr.size : sizeof(longName) - 1), pMeta);
+        hasLongName = true;
+      } else {
+        hasLongName = archive_parseTarPaxPath(pMeta, hdr.size, longName, sizeof(longName));
+      }
+      free(pMeta);
+      continue;
+    }
+
+    const char *pMemberName = hasLongName ? longName : hdr.name;
+    hasLongName = false;
+    if (!archive_isTarRegular(hdr.type) || !archive_isVdexName(pMemberName)) {
+      if (!streamSkip(pStream, paddedSize)) {
+        LOGMSG(l_ERROR, "Truncated tar member '%s' in input stream", pMemberName);
+        return false;
+      }
+      continue;
+    }
+
+    formatName(pStream, pMemberName, name, nameLen);
+    char what[PATH_MAX + 64];
+    snprintf(what, sizeof(what), "tar member '%s' in input stream", pMemberName);
+    *pBuf = readFile(pStream, hdr.size, what);
+    if (*pBuf == NULL) {
+      return false;
+    }
+    if (!streamSkip(pStream, paddedSize - hdr.size)) {
+      LOGMSG(l_ERROR, "Truncated tar member '%s' in input stream", pMemberName);
+      free(*pBuf);
+      return false;
+    }
+    *pSize = hdr.size;
+    return true;
+  }
+}
+
+void inStream_init(inStream_t *pStream, int fd) {
+  memset(pStream, 0, sizeof(inStream_t));
+  pStream->fd = fd;
+}
+
+bool inStream_next(inStream_t *pStream, char *name, size_t nameLen, u1 **pBuf, off_t *pSize) {
+  if (pStream->done) {
+    return false;
+  }
+
+  if (pStream->type == kStreamUnknown) {
+    ssize_t sz = utils_readFromFd(pStream->fd, pStream->probe, sizeof(pStream->probe));
+    if (sz < 0) {
+      LOGMSG_P(l_ERROR, "Couldn't read input stream");
+      failStream(pStream);
+      return false;
+    } else if (sz == 0) {
+      LOGMSG(l_ERROR, "Input stream is empty");
+      failStream(pStream);
+      return false;
+    }
+    pStream->probeLen = sz;
+
+    if (pStream->probeLen >= sizeof(kStreamFrameMagic) &&
+        memcmp(pStream->probe, kStreamFrameMagic, sizeof(kStreamFrameMagic)) == 0) {
+      pStream->type = kStreamFramed;
+    } else if (pStream->probeLen == kTarBlockSize && archive_isTarBlock(pStream->probe)) {
+      pStream->type = kStreamTar;
+    } else {
+      pStream->type = kStreamRaw;
+    }
+  }
+
+  bool ret = false;
+  switch (pStream->type) {
+    case kStreamFramed:
+      ret = nextFramed(pStream, name, nameLen, pBuf, pSize);
+      break;
+    case kStreamTar:
+      ret = nextTar(pStream, name, nameLen, pBuf, pSize);
+      break;
+    default:
+      ret = nextRaw(pStream, name, nameLen, pBuf, pSize);
+      break;
+  }
+
+  if (ret) {
+    pStream->fileIdx++;
+  } else if (!pStream->done) {
+    failStream(pStream);
+  }
+  return ret;
+}
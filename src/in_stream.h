@@ -0,0 +1,60 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _IN_STREAM_H_
+#define _IN_STREAM_H_
+
+#include "archive.h"
+#include "common.h"
+
+// Reader of Vdex files from a non-seekable input, such as stdin or a pipe. The stream holds either
+// a single Vdex file, a tar archive whose Vdex members are read in order, or a sequence of framed
+// Vdex files where each one is prefixed with:
+//
+//   u1 magic[4]  : "VDXF"
+//   u4 nameLen   : length of the name that follows (little-endian)
+//   u8 size      : size of the Vdex file (little-endian)
+//   char name[nameLen] : file name used to name the output files (directories are stripped)
+//
+// Frames with an empty name are named after their index in the stream.
+typedef enum { kStreamUnknown = 0, kStreamRaw, kStreamFramed, kStreamTar } inStreamType_t;
+
+typedef struct {
+  int fd;
+  inStreamType_t type;
+  size_t fileIdx;
+  bool done;
+  bool failed;
+  // Leading bytes consumed while probing the stream type
+  u1 probe[kTarBlockSize];
+  size_t probeLen;
+  size_t probeOff;
+} inStream_t;
+
+void inStream_init(inStream_t *, int);
+
+// Reads the next Vdex file into a malloc()-ed buffer, which is zero padded to a page boundary
+// (and at least 4 KiB) similar to file mappings, and formats its name. Returns false at the end of
+// the stream, or on error (including files over the size limit) in which case failed is set.
+bool inStream_next(inStream_t *, char *, size_t, u1 **, off_t *);
+
+#endif
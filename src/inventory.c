@@ -0,0 +1,163 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "inventory.h"
+
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "vdex_api.h"
+
+// Enough for the headers of Vdex files with up to ~1000 Dex files
+#define kInventoryReadSz 4096
+
+static void printJsonString(const char *str) {
+  putchar('"');
+  for (const unsigned char *p = (const unsigned char *)str; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\') {
+      putchar('\\');
+      putchar(*p);
+    } else if (*p < 0x20) {
+      printf("\\u%04x", *p);
+    } else {
+      putchar(*p);
+    }
+  }
+  putchar('"');
+}
+
+static void printCsvField(const char *str) {
+  if (strpbrk(str, ",\"\r\n") == NULL) {
+    fputs(str, stdout);
+    return;
+  }
+  putchar('"');
+  for (const char *p = str; *p != '\0'; p++) {
+    if (*p == '"') {
+      putchar('"');
+    }
+    putchar(*p);
+  }
+  putchar('"');
+}
+
+static void printInventory(const char *fileName,
+                           const vdexInventory_t *pInv,
+                           inventoryFormat_t format) {
+  const char *quickened = pInv->quickeningInfoSize > 0 ? "true" : "false";
+  if (format == kInventoryJson) {
+    fputs("{\"file\":", stdout);
+    printJsonString(fileName);
+    printf(",\"version\":\"%s\",\"api\":%d,\"dex_files\":%" PRIu32 ",\"dex_size\":%" PRIu32
+           ",\"dex_shared_data_size\":%" PRIu32 ",\"verifier_deps_size\":%" PRIu32
+           ",\"quickening_info_size\":%" PRIu32 ",\"quickened\":%s,\"checksums\":[",
+           pInv->version, pInv->apiLevel, pInv->numberOfDexFiles, pInv->dexSize,
+           pInv->dexSharedDataSize, pInv->verifierDepsSize, pInv->quickeningInfoSize, quickened);
+  } else {
+    printCsvField(fileName);
+    printf(",%s,%d,%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%s,", pInv->version,
+           pInv->apiLevel, pInv->numberOfDexFiles, pInv->dexSize, pInv->dexSharedDataSize,
+           pInv->verifierDepsSize, pInv->quickeningInfoSize, quickened);
+  }
+
+  for (u4 i = 0; i < pInv->numberOfDexFiles; i++) {
+    u4 checksum;
+    memcpy(&checksum, pInv->checksums + i * sizeof(u4), sizeof(u4));
+    if (format == kInventoryJson) {
+      printf("%s\"0x%08" PRIx32 "\"", i > 0 ? "," : "", checksum);
+    } else {
+      printf("%s0x%08" PRIx32, i > 0 ? " " : "", checksum);
+    }
+  }
+  fputs(format == kInventoryJson ? "]}\n" : "\n", stdout);
+}
+
+// Reads from the beginning of the file until the buffer is full or end of file
+static ssize_t readHeaders(int fd, u1 *buf, size_t len) {
+  size_t readSz = 0;
+  while (readSz < len) {
+    ssize_t sz = pread(fd, buf + readSz, len - readSz, readSz);
+    if (sz < 0 && errno == EINTR) continue;
+    if (sz < 0) return -1;
+    if (sz == 0) break;
+    readSz += sz;
+  }
+  return readSz;
+}
+
+void inventory_printHeader(inventoryFormat_t format) {
+  if (format == kInventoryCsv) {
+    puts(
+        "file,version,api,dex_files,dex_size,dex_shared_data_size,verifier_deps_size,"
+        "quickening_info_size,quickened,checksums");
+  }
+}
+
+bool inventory_printFile(const char *fileName, inventoryFormat_t format) {
+  int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    LOGMSG_P(l_WARN, "Couldn't open() '%s' file in R/O mode", fileName);
+    return false;
+  }
+
+  u1 headerBuf[kInventoryReadSz];
+  u1 *buf = headerBuf;
+  vdexInventory_t inv;
+  memset(&inv, 0, sizeof(inv));
+  ssize_t readSz = readHeaders(fd, buf, sizeof(headerBuf));
+  bool ret = readSz > 0 && vdexApi_getInventory(buf, readSz, &inv);
+
+  // Checksums of many Dex files might not fit in the first read
+  struct stat st;
+  if (!ret && readSz == sizeof(headerBuf) && inv.headerSize > sizeof(headerBuf) &&
+      fstat(fd, &st) == 0 && inv.headerSize <= (size_t)st.st_size) {
+    buf = utils_malloc(inv.headerSize);
+    readSz = readHeaders(fd, buf, inv.headerSize);
+    ret = readSz > 0 && vdexApi_getInventory(buf, readSz, &inv);
+  }
+  close(fd);
+
+  if (ret) {
+    printInventory(fileName, &inv, format);
+  } else if (readSz < 0) {
+    LOGMSG_P(l_WARN, "Couldn't read() the '%s' file", fileName);
+  } else {
+    LOGMSG(l_WARN, "Invalid or truncated Vdex header - skipping '%s'", fileName);
+  }
+  if (buf != headerBuf) {
+    free(buf);
+  }
+  return ret;
+}
+
+bool inventory_printBuffer(const char *fileName,
+                           const u1 *buf,
+                           size_t size,
+                           inventoryFormat_t format) {
+  vdexInventory_t inv;
+  if (!vdexApi_getInventory(buf, size, &inv)) {
+    LOGMSG(l_WARN, "Invalid or truncated Vdex header - skipping '%s'", fileName);
+    return false;
+  }
+  printInventory(fileName, &inv, format);
+  return true;
+}
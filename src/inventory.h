@@ -0,0 +1,41 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _INVENTORY_H_
+#define _INVENTORY_H_
+
+#include "common.h"
+
+// Header-only inventory of Vdex files: version, API level, number of Dex files, section sizes,
+// location checksums and whether quickening info is present. Each file is printed to stdout as a
+// JSON object or a CSV record per line.
+
+// Prints the CSV column names (nothing for JSON)
+void inventory_printHeader(inventoryFormat_t);
+
+// Reads only the fixed headers of the file with pread(), without mapping it
+bool inventory_printFile(const char *, inventoryFormat_t);
+
+// Same for a Vdex file that is already in memory
+bool inventory_printBuffer(const char *, const u1 *, size_t, inventoryFormat_t);
+
+#endif
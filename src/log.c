@@ -22,6 +22,7 @@
 
 #include "log.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <sys/time.h>
 #include <time.h>
@@ -33,15 +34,27 @@ static bool log_isTTY;
 static bool inside_line;
 static bool dis_enabled;
 static int log_fd;
+static FILE *log_stdOut;
 static FILE *log_disOut;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 __attribute__((constructor)) void log_init(void) {
   log_minLevel = l_INFO;
+  log_stdOut = stdout;
   log_fd = STDOUT_FILENO;
   log_isTTY = isatty(log_fd);
   log_disOut = stdout;
 }
 
+void log_redirectToStderr() {
+  log_stdOut = stderr;
+  log_fd = STDERR_FILENO;
+  log_isTTY = isatty(log_fd);
+  if (log_disOut == stdout) {
+    log_disOut = stderr;
+  }
+}
+
 void log_setMinLevel(log_level_t dl) { log_minLevel = dl; }
 void log_setDisStatus(bool status) { dis_enabled = status; }
 bool log_getDisStatus() { return dis_enabled; }
@@ -53,7 +66,7 @@ bool log_initLogFile(const char *logFile) {
 
   log_disOut = fopen(logFile, "ab+");
   if (log_disOut == NULL) {
-    log_disOut = stdout;
+    log_disOut = log_stdOut;
     LOGMSG_P(l_ERROR, "Couldn't open logFile '%s'", logFile);
     return false;
   }
@@ -62,11 +75,52 @@ bool log_initLogFile(const char *logFile) {
 
 void log_closeLogFile() {
   fflush(log_disOut);
-  if (log_disOut != stdout) {
+  if (log_disOut != log_stdOut) {
     fclose(log_disOut);
   }
 }
 
+// Formats into the given stack buffer, or into a heap buffer (freed by the caller) if it's too
+// small. Returns NULL if formatting fails.
+static char *formatMsg(char *stackBuf, size_t stackBufSz, const char *fmt, va_list args) {
+  va_list argsCopy;
+  va_copy(argsCopy, args);
+  int len = vsnprintf(stackBuf, stackBufSz, fmt, argsCopy);
+  va_end(argsCopy);
+  if (len < 0) {
+    return NULL;
+  }
+  if ((size_t)len < stackBufSz) {
+    return stackBuf;
+  }
+
+  char *heapBuf = malloc(len + 1);
+  if (heapBuf == NULL) {
+    // Truncated message is better than none
+    return stackBuf;
+  }
+  vsnprintf(heapBuf, len + 1, fmt, args);
+  return heapBuf;
+}
+
+static char *formatLine(char *stackBuf, size_t stackBufSz, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  char *buf = formatMsg(stackBuf, stackBufSz, fmt, args);
+  va_end(args);
+  return buf;
+}
+
+static void writeAll(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t sz = write(fd, buf, len);
+    if (sz < 0 && errno == EINTR) continue;
+    if (sz <= 0) return;
+    buf += sz;
+    len -= sz;
+  }
+}
+
 void log_msg(log_level_t dl,
              bool perr,
              bool raw_print,
@@ -85,20 +139,18 @@ void log_msg(log_level_t dl,
                     { "[INFO]", "\033[1m" },
                     { "[DEBUG]", "\033[0;37m" } };
 
-  char strerr[512];
+  char strerr[512] = { 0 };
   if (perr) {
-    snprintf(strerr, sizeof(strerr), "%s", strerror(errno));
+    snprintf(strerr, sizeof(strerr), ": %s", strerror(errno));
   }
 
   if (dl > log_minLevel) return;
 
-  // stdout might be used from disassembler output. If so, flush before writing generic log entry
-  if (dis_enabled && log_disOut == stdout) fflush(log_disOut);
-
-  // Explicitly print display messages always to stdout and not to log file (if set)
+  // Explicitly print display messages always to stdout (stderr if redirected) and not to log file
+  // (if set)
   int curLogFd = log_fd;
   if (is_display) {
-    curLogFd = STDOUT_FILENO;
+    curLogFd = fileno(log_stdOut);
   }
 
   struct tm tm;
@@ -107,45 +159,52 @@ void log_msg(log_level_t dl,
   gettimeofday(&tv, NULL);
   localtime_r((const time_t *)&tv.tv_sec, &tm);
 
-  if (inside_line && !raw_print) {
-    dprintf(curLogFd, "\n");
-  }
-
-  if (log_isTTY) {
-    dprintf(curLogFd, "%s", logLevels[dl].prefix);
-  }
-
-  if (raw_print) {
-    int fmtLen = strlen(fmt);
-    if (fmtLen > 0 && fmt[fmtLen - 1] == '\n') {
-      inside_line = false;
-    } else {
-      inside_line = true;
-    }
-  } else {
+  char header[PATH_MAX + 128] = { 0 };
+  if (!raw_print) {
     if (!is_display && (log_minLevel >= l_DEBUG || !log_isTTY)) {
-      dprintf(curLogFd, "%s [%d] %d/%02d/%02d %02d:%02d:%02d (%s:%d %s) ", logLevels[dl].descr,
-              getpid(), tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
-              tm.tm_sec, file, line, func);
+      snprintf(header, sizeof(header), "%s [%d] %d/%02d/%02d %02d:%02d:%02d (%s:%d %s) ",
+               logLevels[dl].descr, getpid(), tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+               tm.tm_hour, tm.tm_min, tm.tm_sec, file, line, func);
     } else {
-      dprintf(curLogFd, "%s ", logLevels[dl].descr);
+      snprintf(header, sizeof(header), "%s ", logLevels[dl].descr);
     }
   }
 
+  char msgBuf[1024];
   va_list args;
   va_start(args, fmt);
-  vdprintf(curLogFd, fmt, args);
+  char *msg = formatMsg(msgBuf, sizeof(msgBuf), fmt, args);
   va_end(args);
+  if (msg == NULL) {
+    msg = msgBuf;
+    msgBuf[0] = '\0';
+  }
 
-  if (perr) {
-    dprintf(curLogFd, ": %s", strerr);
+  // Messages are logged from worker threads too, so each one is written with a single write() and
+  // the state of partially printed (raw) lines is shared under the lock
+  pthread_mutex_lock(&log_mutex);
+
+  // stdout might be used from disassembler output. If so, flush before writing generic log entry
+  if (dis_enabled && log_disOut == log_stdOut) fflush(log_disOut);
+
+  const char *leadingNewLine = inside_line && !raw_print ? "\n" : "";
+  if (raw_print) {
+    size_t fmtLen = strlen(fmt);
+    inside_line = !(fmtLen > 0 && fmt[fmtLen - 1] == '\n');
   }
 
-  if (log_isTTY) {
-    dprintf(curLogFd, "\033[0m");
+  char lineBuf[2048];
+  char *logLine = formatLine(lineBuf, sizeof(lineBuf), "%s%s%s%s%s%s%s", leadingNewLine,
+                             log_isTTY ? logLevels[dl].prefix : "", header, msg, strerr,
+                             log_isTTY ? "\033[0m" : "", raw_print ? "" : "\n");
+  if (logLine != NULL) {
+    writeAll(curLogFd, logLine, strlen(logLine));
   }
 
-  if (!raw_print) dprintf(curLogFd, "\n");
+  pthread_mutex_unlock(&log_mutex);
+
+  if (logLine != lineBuf) free(logLine);
+  if (msg != msgBuf) free(msg);
 
   if (dl == l_FATAL) {
     exitWrapper(EXIT_FAILURE);
@@ -30,6 +30,9 @@ typedef enum { l_FATAL = 0, l_ERROR, l_WARN, l_INFO, l_DEBUG, l_MAX_LEVEL } log_
 void log_setMinLevel(log_level_t);
 void log_setDisStatus(bool);
 bool log_getDisStatus();
+// Sends log, display and (unless a log file is set) disassembler output to stderr, so that stdout
+// only carries extracted files
+void log_redirectToStderr();
 bool log_initLogFile(const char *);
 void log_closeLogFile();
 
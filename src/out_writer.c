@@ -22,8 +22,35 @@
 
 #include "out_writer.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "async_writer.h"
+#include "cdex_converter.h"
 #include "dex.h"
+#include "tar_writer.h"
 #include "utils.h"
+#include "zip_writer.h"
+
+// Fits 'classes<N>.cdex' for any Dex index
+#define kClassesNameLen 32
+
+// Name of a Dex file in an Apk: 'classes.<suffix>' for the first one, 'classes<N>.<suffix>' after
+static const char *formatClassesName(char *outBuf,
+                                     size_t outBufLen,
+                                     size_t dexIdx,
+                                     const char *suffix) {
+  if (dexIdx == 0) {
+    snprintf(outBuf, outBufLen, "classes.%s", suffix);
+  } else {
+    snprintf(outBuf, outBufLen, "classes%zu.%s", dexIdx + 1, suffix);
+  }
+  return outBuf;
+}
 
 void outWriter_formatName(char *outBuf,
                           size_t outBufLen,
@@ -55,53 +82,572 @@ void outWriter_formatName(char *outBuf,
   }
 }
 
+static void formatDexFileName(const runArgs_t *pRunArgs,
+                              const char *VdexFileName,
+                              size_t dexIdx,
+                              const u1 *buf,
+                              char *outFile,
+                              size_t outFileLen) {
+  const char *suffix = dex_checkType(buf) == kNormalDex ? "dex" : "cdex";
+  if (!pRunArgs->deodex) {
+    outWriter_formatName(outFile, outFileLen, pRunArgs->outputDir, VdexFileName, dexIdx, suffix);
+    return;
+  }
+
+  // Deodexed Dex files are placed in a directory named after the Vdex file
+  const char *rootPath = pRunArgs->outputDir ? pRunArgs->outputDir : kDeodexDirName;
+  const char *pBaseName = strrchr(VdexFileName, '/');
+  pBaseName = pBaseName ? pBaseName + 1 : VdexFileName;
+  const char *fileExt = strrchr(pBaseName, '.');
+  int baseNameLen = fileExt ? fileExt - pBaseName : (int)strlen(pBaseName);
+  char classesName[kClassesNameLen] = { 0 };
+  snprintf(outFile, outFileLen, "%s/%.*s/%s", rootPath, baseNameLen, pBaseName,
+           formatClassesName(classesName, sizeof(classesName), dexIdx, suffix));
+}
+
+// Creates the directories of a deodexed Dex file, which may race with other workers
+static bool makeDexFileDir(const runArgs_t *pRunArgs, const char *outFile) {
+  if (!pRunArgs->deodex) {
+    return true;
+  }
+
+  char dirPath[PATH_MAX] = { 0 };
+  snprintf(dirPath, sizeof(dirPath), "%s", outFile);
+  char *pAppDir = strrchr(dirPath, '/');
+  *pAppDir = '\0';
+  char *pRootDir = strrchr(dirPath, '/');
+  *pRootDir = '\0';
+  if (mkdir(dirPath, 0755) != 0 && errno != EEXIST) {
+    LOGMSG_P(l_ERROR, "Couldn't create '%s' directory", dirPath);
+    return false;
+  }
+  *pRootDir = '/';
+  if (mkdir(dirPath, 0755) != 0 && errno != EEXIST) {
+    LOGMSG_P(l_ERROR, "Couldn't create '%s' directory", dirPath);
+    return false;
+  }
+  return true;
+}
+
+static int getDexFileFlags(const runArgs_t *pRunArgs) {
+  int fileFlags = O_CREAT | O_RDWR;
+  if (pRunArgs->fileOverride == false) {
+    fileFlags |= O_EXCL;
+  }
+  return fileFlags;
+}
+
+// Name of the Vdex file with its extension replaced by the suffix, in the root path if set
+static void formatVdexName(char *outBuf,
+                           size_t outBufLen,
+                           const char *rootPath,
+                           const char *VdexFileName,
+                           const char *suffix) {
+  const char *fName = VdexFileName;
+  if (rootPath != NULL && strrchr(VdexFileName, '/') != NULL) {
+    fName = strrchr(VdexFileName, '/') + 1;
+  }
+  const char *fileExt = strrchr(fName, '.');
+  int fNameLen = fileExt ? fileExt - fName : (int)strlen(fName);
+  if (rootPath == NULL) {
+    snprintf(outBuf, outBufLen, "%.*s%s", fNameLen, fName, suffix);
+  } else {
+    snprintf(outBuf, outBufLen, "%s/%.*s%s", rootPath, fNameLen, fName, suffix);
+  }
+}
+
+// Creates the output file of a Dex file. Returns -1 on error.
+static int createDexFile(const runArgs_t *pRunArgs,
+                         const char *VdexFileName,
+                         size_t dexIdx,
+                         const u1 *buf,
+                         char *outFile,
+                         size_t outFileLen) {
+  formatDexFileName(pRunArgs, VdexFileName, dexIdx, buf, outFile, outFileLen);
+  if (!makeDexFileDir(pRunArgs, outFile)) {
+    return -1;
+  }
+  int dstfd = open(outFile, getDexFileFlags(pRunArgs), 0644);
+  if (dstfd == -1) {
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG_P(l_ERROR, "Couldn't create output file '%s' - skipping '%s'", outFile,
+             formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
+  }
+  return dstfd;
+}
+
+static bool syncDexFile(bool fsyncOutput, int dstfd, const char *outFile) {
+  if (fsyncOutput && fsync(dstfd) != 0) {
+    LOGMSG_P(l_ERROR, "Couldn't fsync() '%s' file", outFile);
+    return false;
+  }
+  return true;
+}
+
+zipWriter_t *outWriter_openZip(const runArgs_t *pRunArgs, const char *VdexFileName) {
+  char outFile[PATH_MAX] = { 0 };
+  formatVdexName(outFile, sizeof(outFile), pRunArgs->outputDir, VdexFileName, ".zip");
+  return zipWriter_open(outFile, pRunArgs->fileOverride, !pRunArgs->zipStored, pRunArgs->zipJobs);
+}
+
+bool outWriter_zipDexFile(const runArgs_t *pRunArgs,
+                          const char *VdexFileName,
+                          size_t dexIdx,
+                          const u1 *buf,
+                          size_t bufSize) {
+  const char *suffix = dex_checkType(buf) == kNormalDex ? "dex" : "cdex";
+  char classesName[kClassesNameLen] = { 0 };
+  formatClassesName(classesName, sizeof(classesName), dexIdx, suffix);
+
+  // A zip of the whole run keeps the Dex files of each Vdex file in their own directory, named
+  // after the Vdex path relative to the input root (e.g. 'Foo/oat/arm64/Foo/classes.dex'), so that
+  // same-named Vdex files of different directories don't collide
+  char entryName[PATH_MAX] = { 0 };
+  if (pRunArgs->outputZip != NULL) {
+    const char *relPath = pRunArgs->inputRelPath ? pRunArgs->inputRelPath : VdexFileName;
+    const char *pBaseName = strrchr(relPath, '/');
+    pBaseName = pBaseName ? pBaseName + 1 : relPath;
+    const char *fileExt = strrchr(pBaseName, '.');
+    int relPathLen = fileExt ? fileExt - relPath : (int)strlen(relPath);
+    snprintf(entryName, sizeof(entryName), "%.*s/%s", relPathLen, relPath, classesName);
+  } else {
+    snprintf(entryName, sizeof(entryName), "%s", classesName);
+  }
+
+  if (!zipWriter_addEntry(pRunArgs->pOutZip, entryName, dexIdx, buf, bufSize)) {
+    LOGMSG(l_ERROR, "Couldn't add '%s' to zip file - skipping '%s'", entryName, classesName);
+    return false;
+  }
+  return true;
+}
+
 bool outWriter_DexFile(const runArgs_t *pRunArgs,
                        const char *VdexFileName,
                        size_t dexIdx,
                        const u1 *buf,
                        size_t bufSize) {
   char outFile[PATH_MAX] = { 0 };
-  outWriter_formatName(outFile, sizeof(outFile), pRunArgs->outputDir, VdexFileName, dexIdx,
-                       dex_checkType(buf) == kNormalDex ? "dex" : "cdex");
 
-  // Write Dex file
-  int fileFlags = O_CREAT | O_RDWR;
-  if (pRunArgs->fileOverride == false) {
-    fileFlags |= O_EXCL;
+  if (pRunArgs->pOutZip != NULL) {
+    return outWriter_zipDexFile(pRunArgs, VdexFileName, dexIdx, buf, bufSize);
   }
-  int dstfd = -1;
-  dstfd = open(outFile, fileFlags, 0644);
+
+  // Tar entries are named like the files written next to the input (no output directory)
+  if (pRunArgs->pOutTar != NULL) {
+    formatDexFileName(pRunArgs, VdexFileName, dexIdx, buf, outFile, sizeof(outFile));
+    if (!tarWriter_addEntry(pRunArgs->pOutTar, outFile, buf, bufSize)) {
+      char classesName[kClassesNameLen] = { 0 };
+      LOGMSG(l_ERROR, "Couldn't add '%s' to tar stream - skipping '%s'", outFile,
+             formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
+      return false;
+    }
+    return true;
+  }
+
+  // The buffer is usually part of the input mapping which is released as soon as the backend
+  // returns, so the writer gets its own copy
+  if (asyncWriter_isActive()) {
+    formatDexFileName(pRunArgs, VdexFileName, dexIdx, buf, outFile, sizeof(outFile));
+    if (!makeDexFileDir(pRunArgs, outFile)) {
+      return false;
+    }
+    u1 *outBuf = utils_malloc(bufSize);
+    memcpy(outBuf, buf, bufSize);
+    asyncWriter_enqueue(outFile, getDexFileFlags(pRunArgs), outBuf, bufSize);
+    return true;
+  }
+
+  // Write Dex file
+  int dstfd = createDexFile(pRunArgs, VdexFileName, dexIdx, buf, outFile, sizeof(outFile));
   if (dstfd == -1) {
-    LOGMSG_P(l_ERROR, "Couldn't create output file '%s' - skipping 'classes%zu.dex'", outFile,
-             dexIdx);
     return false;
   }
 
   if (!utils_writeToFd(dstfd, buf, bufSize)) {
     close(dstfd);
-    LOGMSG(l_ERROR, "Couldn't write '%s' file - skipping 'classes%zu.dex'", outFile, dexIdx);
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG(l_ERROR, "Couldn't write '%s' file - skipping '%s'", outFile,
+           formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
+    return false;
+  }
+
+  bool ret = syncDexFile(pRunArgs->fsyncOutput, dstfd, outFile);
+  close(dstfd);
+  return ret;
+}
+
+bool outWriter_DexFileFromFd(const runArgs_t *pRunArgs,
+                             const char *VdexFileName,
+                             size_t dexIdx,
+                             const u1 *buf,
+                             size_t bufSize,
+                             int srcFd,
+                             off_t srcOff) {
+  char outFile[PATH_MAX] = { 0 };
+
+  // The asynchronous writer only writes from memory, so the Dex file is queued from a copy instead
+  // of being copied in kernel space
+  if (asyncWriter_isActive()) {
+    formatDexFileName(pRunArgs, VdexFileName, dexIdx, buf, outFile, sizeof(outFile));
+    if (!makeDexFileDir(pRunArgs, outFile)) {
+      return false;
+    }
+    u1 *outBuf = utils_malloc(bufSize);
+    memcpy(outBuf, buf, bufSize);
+    dex_repairDexCRC(outBuf, bufSize);
+    // Overridden files might be larger than the new Dex file
+    asyncWriter_enqueue(outFile, getDexFileFlags(pRunArgs) | O_TRUNC, outBuf, bufSize);
+    return true;
+  }
+
+  int dstfd = createDexFile(pRunArgs, VdexFileName, dexIdx, buf, outFile, sizeof(outFile));
+  if (dstfd == -1) {
+    return false;
+  }
+
+  // Overridden files might be larger than the new Dex file
+  if (ftruncate(dstfd, 0) != 0) {
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG_P(l_ERROR, "Couldn't truncate '%s' file - skipping '%s'", outFile,
+             formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
+    close(dstfd);
+    return false;
+  }
+
+  // Whatever couldn't be copied in kernel space is written from the input mapping
+  size_t copied = utils_copyFdRange(dstfd, srcFd, srcOff, bufSize);
+  if (copied < bufSize && (lseek(dstfd, copied, SEEK_SET) == -1 ||
+                           !utils_writeToFd(dstfd, buf + copied, bufSize - copied))) {
+    close(dstfd);
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG(l_ERROR, "Couldn't write '%s' file - skipping '%s'", outFile,
+           formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
+    return false;
+  }
+
+  // Repair CRC so that Dex parsing tools can run against the output
+  u4 checksum = dex_computeDexCRC(buf, bufSize);
+  if (pwrite(dstfd, &checksum, sizeof(u4), sizeof(dexMagic)) != sizeof(u4)) {
+    close(dstfd);
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG_P(l_ERROR, "Couldn't write checksum of '%s' file - skipping '%s'", outFile,
+             formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
+    return false;
+  }
+
+  bool ret = syncDexFile(pRunArgs->fsyncOutput, dstfd, outFile);
+  close(dstfd);
+  return ret;
+}
+
+// Concatenates the pieces of a Dex file (holes are zeroed) for the writers that need it in one
+// buffer
+static u1 *joinDexFile(const struct iovec *iov, int iovCnt, size_t fileSize) {
+  u1 *buf = utils_calloc(fileSize);
+  size_t off = 0;
+  for (int i = 0; i < iovCnt; ++i) {
+    if (iov[i].iov_base != NULL) {
+      memcpy(buf + off, iov[i].iov_base, iov[i].iov_len);
+    }
+    off += iov[i].iov_len;
+  }
+  return buf;
+}
+
+// Writes a Dex file that is scattered in several buffers, seeking over the holes so that they
+// don't take space in output files
+static bool writeDexFileV(const runArgs_t *pRunArgs,
+                          const char *VdexFileName,
+                          size_t dexIdx,
+                          const struct iovec *iov,
+                          int iovCnt,
+                          size_t fileSize) {
+  char outFile[PATH_MAX] = { 0 };
+  const u1 *header = iov[0].iov_base;
+
+  // Zip & tar entries are added from a single buffer, which the asynchronous writer also needs
+  if (pRunArgs->pOutZip != NULL || pRunArgs->pOutTar != NULL) {
+    u1 *buf = joinDexFile(iov, iovCnt, fileSize);
+    bool ret = outWriter_DexFile(pRunArgs, VdexFileName, dexIdx, buf, fileSize);
+    free(buf);
+    return ret;
+  }
+  if (asyncWriter_isActive()) {
+    formatDexFileName(pRunArgs, VdexFileName, dexIdx, header, outFile, sizeof(outFile));
+    if (!makeDexFileDir(pRunArgs, outFile)) {
+      return false;
+    }
+    asyncWriter_enqueue(outFile, getDexFileFlags(pRunArgs), joinDexFile(iov, iovCnt, fileSize),
+                        fileSize);
+    return true;
+  }
+
+  int dstfd = createDexFile(pRunArgs, VdexFileName, dexIdx, header, outFile, sizeof(outFile));
+  if (dstfd == -1) {
+    return false;
+  }
+
+  // Overridden files might have data where the holes are. The file is extended to its final size
+  // last, in case it ends with a hole.
+  bool ret = ftruncate(dstfd, 0) == 0;
+  for (int i = 0; ret && i < iovCnt;) {
+    int runCnt = 0;
+    while (i + runCnt < iovCnt && iov[i + runCnt].iov_base != NULL) {
+      runCnt++;
+    }
+    if (runCnt > 0) {
+      ret = utils_writevToFd(dstfd, &iov[i], runCnt);
+      i += runCnt;
+    } else {
+      ret = lseek(dstfd, iov[i].iov_len, SEEK_CUR) != -1;
+      i++;
+    }
+  }
+  if (!ret || ftruncate(dstfd, fileSize) != 0) {
+    close(dstfd);
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG_P(l_ERROR, "Couldn't write '%s' file - skipping '%s'", outFile,
+             formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
     return false;
   }
 
+  ret = syncDexFile(pRunArgs->fsyncOutput, dstfd, outFile);
   close(dstfd);
+  return ret;
+}
+
+bool outWriter_CdexFile(const runArgs_t *pRunArgs,
+                        const char *VdexFileName,
+                        size_t dexIdx,
+                        const u1 *cdexBuf) {
+  const u1 *dataBuf = dex_getDataAddr(cdexBuf);
+  const u4 dataSize = dex_getDataSize(cdexBuf);
+  cdexDataRanges_t dataRanges;
+  memset(&dataRanges, 0, sizeof(cdexDataRanges_t));
+  if (pRunArgs->trimSharedData && !cdexConverter_getDataRanges(cdexBuf, &dataRanges)) {
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG(l_WARN, "Couldn't locate the shared data of '%s' - keeping all of it",
+           formatClassesName(classesName, sizeof(classesName), dexIdx, "cdex"));
+  }
+  if (dataRanges.cnt == 0) {
+    dataRanges.cnt = 1;
+    dataRanges.ranges = utils_malloc(sizeof(cdexDataRange_t));
+    dataRanges.ranges[0].off = 0;
+    dataRanges.ranges[0].size = dataSize;
+  }
+
+  // The shared data section is serialized right after the main section, so the offsets of the data
+  // items don't change. The header is patched in a copy, since the input is left untouched.
+  cdexHeader header;
+  memcpy(&header, cdexBuf, sizeof(cdexHeader));
+  header.dataOff = header.fileSize;
+  header.fileSize += dataSize;
+
+  // Header, rest of the main section, then a hole & a range for each of the data ranges and the
+  // hole that is left after the last range
+  struct iovec *iov = utils_malloc((2 * dataRanges.cnt + 3) * sizeof(struct iovec));
+  int iovCnt = 0;
+  iov[iovCnt++] = (struct iovec){ &header, sizeof(cdexHeader) };
+  iov[iovCnt++] = (struct iovec){ (u1 *)cdexBuf + sizeof(cdexHeader),
+                                  header.dataOff - sizeof(cdexHeader) };
+  u4 dataOff = 0;
+  size_t keptSize = 0;
+  for (size_t i = 0; i < dataRanges.cnt; ++i) {
+    const cdexDataRange_t *pRange = &dataRanges.ranges[i];
+    if (pRange->off > dataOff) {
+      iov[iovCnt++] = (struct iovec){ NULL, pRange->off - dataOff };
+    }
+    iov[iovCnt++] = (struct iovec){ (u1 *)dataBuf + pRange->off, pRange->size };
+    dataOff = pRange->off + pRange->size;
+    keptSize += pRange->size;
+  }
+  if (dataSize > dataOff) {
+    iov[iovCnt++] = (struct iovec){ NULL, dataSize - dataOff };
+  }
+  header.checksum = dex_computeDexCRCV(iov, iovCnt);
+
+  if (pRunArgs->trimSharedData) {
+    LOGMSG(l_DEBUG, "Keeping %zu out of %" PRIu32 " shared data bytes in %zu range(s)", keptSize,
+           dataSize, dataRanges.cnt);
+  }
+  bool ret = writeDexFileV(pRunArgs, VdexFileName, dexIdx, iov, iovCnt, header.fileSize);
+  free(iov);
+  cdexConverter_freeDataRanges(&dataRanges);
+  return ret;
+}
+
+bool outWriter_CdexMainSection(const runArgs_t *pRunArgs,
+                               const char *VdexFileName,
+                               size_t dexIdx,
+                               const u1 *cdexBuf) {
+  // The data section is expected right after the main section, where it's placed when merging
+  cdexHeader header;
+  memcpy(&header, cdexBuf, sizeof(cdexHeader));
+  header.dataOff = header.fileSize;
+  struct iovec iov[] = {
+    { &header, sizeof(cdexHeader) },
+    { (u1 *)cdexBuf + sizeof(cdexHeader), header.fileSize - sizeof(cdexHeader) },
+  };
+  header.checksum = dex_computeDexCRCV(iov, 2);
+  return writeDexFileV(pRunArgs, VdexFileName, dexIdx, iov, 2, header.fileSize);
+}
+
+// Writes a file that accompanies the Dex files (or adds it to the tar stream of the run arguments)
+static bool writeAuxFile(const runArgs_t *pRunArgs,
+                         const char *outFile,
+                         const u1 *buf,
+                         size_t size) {
+  if (pRunArgs->pOutTar != NULL) {
+    if (!tarWriter_addEntry(pRunArgs->pOutTar, outFile, buf, size)) {
+      LOGMSG(l_ERROR, "Couldn't add '%s' to tar stream", outFile);
+      return false;
+    }
+    return true;
+  }
+
+  int dstfd = open(outFile, getDexFileFlags(pRunArgs), 0644);
+  if (dstfd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't create output file '%s'", outFile);
+    return false;
+  }
+  if (ftruncate(dstfd, 0) != 0 || !utils_writeToFd(dstfd, buf, size)) {
+    close(dstfd);
+    LOGMSG_P(l_ERROR, "Couldn't write '%s' file", outFile);
+    return false;
+  }
+  bool ret = syncDexFile(pRunArgs->fsyncOutput, dstfd, outFile);
+  close(dstfd);
+  return ret;
+}
+
+bool outWriter_CdexSharedData(const runArgs_t *pRunArgs,
+                              const char *VdexFileName,
+                              const u1 *dataBuf,
+                              size_t dataSize) {
+  char outFile[PATH_MAX] = { 0 };
+  formatVdexName(outFile, sizeof(outFile), pRunArgs->outputDir, VdexFileName, kCdexSharedSuffix);
+  return writeAuxFile(pRunArgs, outFile, dataBuf, dataSize);
+}
+
+bool outWriter_CdexManifest(const runArgs_t *pRunArgs,
+                            const char *VdexFileName,
+                            size_t dexIdx,
+                            const char *manifest) {
+  char outFile[PATH_MAX] = { 0 };
+  outWriter_formatName(outFile, sizeof(outFile), pRunArgs->outputDir, VdexFileName, dexIdx,
+                       "cdex" kCdexManifestSuffix);
+  return writeAuxFile(pRunArgs, outFile, (const u1 *)manifest, strlen(manifest));
+}
+
+bool outWriter_mapDexFile(const runArgs_t *pRunArgs,
+                          const char *VdexFileName,
+                          size_t dexIdx,
+                          const u1 *buf,
+                          size_t bufSize,
+                          outDexMap_t *pOutMap) {
+  void *outBuf = MAP_FAILED;
+  memset(pOutMap, 0, sizeof(outDexMap_t));
+  pOutMap->fd = createDexFile(pRunArgs, VdexFileName, dexIdx, buf, pOutMap->fileName,
+                              sizeof(pOutMap->fileName));
+  if (pOutMap->fd == -1) {
+    return false;
+  }
+
+  // Overridden files might be larger than the new Dex file
+  if (ftruncate(pOutMap->fd, 0) != 0 || !utils_preallocateFd(pOutMap->fd, bufSize)) {
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG_P(l_ERROR, "Couldn't allocate '%s' file - skipping '%s'", pOutMap->fileName,
+             formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
+    goto fail;
+  }
+
+  outBuf = mmap(NULL, bufSize, PROT_READ | PROT_WRITE, MAP_SHARED, pOutMap->fd, 0);
+  if (outBuf == MAP_FAILED) {
+    char classesName[kClassesNameLen] = { 0 };
+    LOGMSG_P(l_ERROR, "Couldn't mmap() '%s' file - skipping '%s'", pOutMap->fileName,
+             formatClassesName(classesName, sizeof(classesName), dexIdx, "dex"));
+    goto fail;
+  }
+
+  pOutMap->buf = outBuf;
+  pOutMap->bufSize = bufSize;
+  pOutMap->fsync = pRunArgs->fsyncOutput;
+  memcpy(pOutMap->buf, buf, bufSize);
   return true;
+
+fail:
+  close(pOutMap->fd);
+  unlink(pOutMap->fileName);
+  pOutMap->fd = -1;
+  return false;
 }
 
-bool outWriter_VdexFile(const runArgs_t *pRunArgs, const char *VdexFileName, u1 *buf, off_t bufSz) {
+bool outWriter_unmapDexFile(outDexMap_t *pOutMap, bool keep) {
+  if (pOutMap->buf == NULL) {
+    return true;
+  }
+
+  bool ret = true;
+  if (munmap(pOutMap->buf, pOutMap->bufSize) != 0) {
+    LOGMSG_P(l_ERROR, "Couldn't munmap() '%s' file", pOutMap->fileName);
+    ret = false;
+  }
+  if (ret && keep) {
+    ret = syncDexFile(pOutMap->fsync, pOutMap->fd, pOutMap->fileName);
+  }
+  close(pOutMap->fd);
+  if (!keep || !ret) {
+    unlink(pOutMap->fileName);
+  }
+
+  pOutMap->buf = NULL;
+  pOutMap->fd = -1;
+  return ret;
+}
+
+static void formatVdexFileName(const runArgs_t *pRunArgs,
+                               const char *VdexFileName,
+                               char *outFileName,
+                               size_t outFileNameLen) {
   const char *fileExt = strrchr(VdexFileName, '.');
   int fNameLen = strlen(VdexFileName);
   if (fileExt) {
     fNameLen = fileExt - VdexFileName;
   }
-  char outFileName[PATH_MAX] = { 0 };
   if (pRunArgs->outputDir == NULL) {
-    snprintf(outFileName, sizeof(outFileName), "%.*s_updated.vdex", fNameLen, VdexFileName);
+    snprintf(outFileName, outFileNameLen, "%.*s_updated.vdex", fNameLen, VdexFileName);
   } else {
     const char *pFileBaseName = utils_fileBasename(VdexFileName);
-    snprintf(outFileName, sizeof(outFileName), "%s/%s_updated.vdex", pRunArgs->outputDir,
+    snprintf(outFileName, outFileNameLen, "%s/%s_updated.vdex", pRunArgs->outputDir,
              pFileBaseName);
     free((void *)pFileBaseName);
   }
+}
+
+static bool patchVdexFd(bool fsyncOutput,
+                        int dstfd,
+                        const char *outFile,
+                        off_t patchOff,
+                        const u1 *patch,
+                        size_t patchSz) {
+  if (pwrite(dstfd, patch, patchSz, patchOff) != (ssize_t)patchSz) {
+    LOGMSG_P(l_ERROR, "Couldn't patch '%s' file", outFile);
+    return false;
+  }
+  return syncDexFile(fsyncOutput, dstfd, outFile);
+}
+
+bool outWriter_VdexFile(const runArgs_t *pRunArgs, const char *VdexFileName, u1 *buf, off_t bufSz) {
+  char outFileName[PATH_MAX] = { 0 };
+  formatVdexFileName(pRunArgs, VdexFileName, outFileName, sizeof(outFileName));
+
+  if (pRunArgs->pOutTar != NULL) {
+    if (!tarWriter_addEntry(pRunArgs->pOutTar, outFileName, buf, bufSz)) {
+      LOGMSG(l_ERROR, "Couldn't add '%s' to tar stream", outFileName);
+      return false;
+    }
+    return true;
+  }
 
   int dstfd = -1;
   dstfd = open(outFileName, O_CREAT | O_RDWR, 0644);
@@ -119,3 +665,58 @@ bool outWriter_VdexFile(const runArgs_t *pRunArgs, const char *VdexFileName, u1
   close(dstfd);
   return true;
 }
+
+bool outWriter_cloneVdexFile(const runArgs_t *pRunArgs,
+                             const char *VdexFileName,
+                             int srcFd,
+                             const u1 *buf,
+                             off_t bufSz,
+                             off_t patchOff,
+                             const u1 *patch,
+                             size_t patchSz) {
+  char outFileName[PATH_MAX] = { 0 };
+  formatVdexFileName(pRunArgs, VdexFileName, outFileName, sizeof(outFileName));
+
+  int dstfd = open(outFileName, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (dstfd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't create output file '%s'", outFileName);
+    return false;
+  }
+
+  // A reflink shares all extents of the input file, so only the patched block is written. Otherwise
+  // the data is copied in kernel space and whatever couldn't be copied is written from the mapping.
+  bool cloned = false;
+#if defined(__linux__) && defined(FICLONE)
+  cloned = ioctl(dstfd, FICLONE, srcFd) == 0;
+#endif
+  if (!cloned) {
+    size_t copied = utils_copyFdRange(dstfd, srcFd, 0, bufSz);
+    if (copied < (size_t)bufSz && (lseek(dstfd, copied, SEEK_SET) == -1 ||
+                                   !utils_writeToFd(dstfd, buf + copied, bufSz - copied))) {
+      close(dstfd);
+      LOGMSG(l_ERROR, "Couldn't write '%s' file", outFileName);
+      return false;
+    }
+  }
+  LOGMSG(l_DEBUG, "'%s' %s from input file", outFileName, cloned ? "reflinked" : "copied");
+
+  bool ret = patchVdexFd(pRunArgs->fsyncOutput, dstfd, outFileName, patchOff, patch, patchSz);
+  close(dstfd);
+  return ret;
+}
+
+bool outWriter_patchVdexFile(const runArgs_t *pRunArgs,
+                             const char *VdexFileName,
+                             off_t patchOff,
+                             const u1 *patch,
+                             size_t patchSz) {
+  int dstfd = open(VdexFileName, O_RDWR);
+  if (dstfd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't open '%s' file for writing", VdexFileName);
+    return false;
+  }
+
+  bool ret = patchVdexFd(pRunArgs->fsyncOutput, dstfd, VdexFileName, patchOff, patch, patchSz);
+  close(dstfd);
+  return ret;
+}
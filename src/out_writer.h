@@ -25,10 +25,75 @@
 
 #include "common.h"
 
+// Directory of the output path that receives the Dex files of '--deodex' runs
+#define kDeodexDirName "vdexExtractor_deodexed"
+
 void outWriter_formatName(char *, size_t, const char *, const char *, size_t, const char *);
 
+// Creates the zip file that receives the Dex files of a Vdex file (<name>.zip)
+zipWriter_t *outWriter_openZip(const runArgs_t *, const char *);
+
+// Adds a Dex file to the zip file of the run arguments as classes.dex, classes2.dex, etc. In a zip
+// of the whole run the entries are placed in a directory named after the Vdex file.
+bool outWriter_zipDexFile(const runArgs_t *, const char *, size_t, const u1 *, size_t);
+
+// Writes a Dex file (or adds it to the zip file or tar stream of the run arguments). When the
+// asynchronous writer is active the file is queued, in which case write errors are only reported
+// when the writer is destroyed.
 bool outWriter_DexFile(const runArgs_t *, const char *, size_t, const u1 *, size_t);
 
+// Writes a Dex file that is an unmodified byte range of the input file, apart from its checksum.
+// The payload is copied in kernel space from the input file (reflinked where supported) and the
+// repaired checksum is written on top. When the asynchronous writer is active, a copy with the
+// repaired checksum is queued instead.
+bool outWriter_DexFileFromFd(
+    const runArgs_t *, const char *, size_t, const u1 *, size_t, int, off_t);
+
+// Writes a CompactDex file followed by the data section that it refers to (the shared data section
+// of a Vdex file), with the header patched accordingly and a repaired checksum. The pieces are
+// written with writev() and checksummed in place instead of being assembled in memory. When the
+// shared data is trimmed, only the ranges that the file references are written and the rest is
+// left as holes (zeros), so the offsets of the data items don't change.
+bool outWriter_CdexFile(const runArgs_t *, const char *, size_t, const u1 *);
+
+// Split CompactDex output: the main section of each CompactDex file is written on its own, with
+// the data section expected right after it. The shared data section of the Vdex file goes to
+// <name>_shared.cdexdata, which the manifest of each CompactDex file refers to
+// (<name>_classes[N].cdex.manifest).
+#define kCdexSharedSuffix "_shared.cdexdata"
+#define kCdexManifestSuffix ".manifest"
+
+bool outWriter_CdexMainSection(const runArgs_t *, const char *, size_t, const u1 *);
+bool outWriter_CdexSharedData(const runArgs_t *, const char *, const u1 *, size_t);
+bool outWriter_CdexManifest(const runArgs_t *, const char *, size_t, const char *);
+
+// Output Dex file that is mapped shared, so that backends can decompile and repair the CRC
+// directly in the destination file instead of in the private input mapping
+typedef struct {
+  char fileName[PATH_MAX];
+  int fd;
+  u1 *buf;
+  size_t bufSize;
+  bool fsync;
+} outDexMap_t;
+
+// Creates the output file with its final size, maps it and copies the Dex file into the mapping
+bool outWriter_mapDexFile(
+    const runArgs_t *, const char *, size_t, const u1 *, size_t, outDexMap_t *);
+
+// Unmaps a mapped output Dex file. If processing failed (keep is false), the file is removed.
+// No-op for maps that are not (or no longer) open.
+bool outWriter_unmapDexFile(outDexMap_t *, bool);
+
+// Writes the updated Vdex file (or adds it to the tar stream of the run arguments)
 bool outWriter_VdexFile(const runArgs_t *, const char *, u1 *, off_t);
 
+// Writes the updated Vdex file as a clone of the input file (from its fd & mapping) with the patch
+// bytes written at the given offset
+bool outWriter_cloneVdexFile(
+    const runArgs_t *, const char *, int, const u1 *, off_t, off_t, const u1 *, size_t);
+
+// Writes the patch bytes at the given offset of the input Vdex file
+bool outWriter_patchVdexFile(const runArgs_t *, const char *, off_t, const u1 *, size_t);
+
 #endif
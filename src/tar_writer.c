@@ -0,0 +1,166 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "tar_writer.h"
+
+#include "utils.h"
+
+#define kTarBlockSize 512
+#define kTarNameSz 100
+#define kTarPrefixSz 155
+#define kTarMaxSize 077777777777ULL
+#define kTarTypeRegular '0'
+#define kTarTypePax 'x'
+#define kTarFileMode 0644
+
+static const u1 kTarZeroBlock[kTarBlockSize];
+
+// Fills a ustar header block for an entry with the given type and size
+static void fillHeader(u1 *hdr,
+                       const char *prefix,
+                       size_t prefixLen,
+                       const char *name,
+                       u8 size,
+                       char type) {
+  memset(hdr, 0, kTarBlockSize);
+  memcpy(hdr, name, strnlen(name, kTarNameSz));
+  // Entries are owned by root and timestamped at the epoch, so that streams are reproducible
+  snprintf((char *)hdr + 100, 8, "%07o", kTarFileMode);
+  snprintf((char *)hdr + 108, 8, "%07o", 0);
+  snprintf((char *)hdr + 116, 8, "%07o", 0);
+  snprintf((char *)hdr + 124, 12, "%011llo", (unsigned long long)size);
+  snprintf((char *)hdr + 136, 12, "%011o", 0);
+  hdr[156] = type;
+  memcpy(hdr + 257, "ustar", 6);
+  memcpy(hdr + 263, "00", 2);
+  memcpy(hdr + 345, prefix, prefixLen);
+
+  // Checksum is computed with the checksum field itself filled with spaces
+  memset(hdr + 148, ' ', 8);
+  u4 chksum = 0;
+  for (size_t i = 0; i < kTarBlockSize; i++) {
+    chksum += hdr[i];
+  }
+  snprintf((char *)hdr + 148, 8, "%06o", chksum);
+}
+
+// Splits a name at a '/' into the ustar prefix and name fields. Returns false if it doesn't fit.
+static bool splitName(const char *name, size_t nameLen, size_t *pPrefixLen) {
+  if (nameLen <= kTarNameSz) {
+    *pPrefixLen = 0;
+    return true;
+  }
+  for (const char *p = strchr(name, '/'); p != NULL; p = strchr(p + 1, '/')) {
+    size_t prefixLen = p - name;
+    if (prefixLen > kTarPrefixSz) {
+      break;
+    }
+    if (nameLen - prefixLen - 1 <= kTarNameSz && prefixLen > 0 && p[1] != '\0') {
+      *pPrefixLen = prefixLen;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Writes a buffer followed by the zero padding up to the next block boundary
+static bool writePadded(int fd, const u1 *buf, size_t size) {
+  size_t padSz = (kTarBlockSize - size % kTarBlockSize) % kTarBlockSize;
+  return utils_writeToFd(fd, buf, size) && utils_writeToFd(fd, kTarZeroBlock, padSz);
+}
+
+// Writes a pax extended header that carries the entry path
+static bool writePaxPath(int fd, const char *name, size_t nameLen) {
+  // Record is "<len> path=<name>\n" where len counts its own digits too
+  size_t bodyLen = nameLen + sizeof(" path=\n") - 1;
+  size_t recLen = bodyLen + 1;
+  while ((size_t)snprintf(NULL, 0, "%zu", recLen) + bodyLen != recLen) {
+    recLen = bodyLen + snprintf(NULL, 0, "%zu", recLen);
+  }
+
+  char *rec = utils_malloc(recLen + 1);
+  snprintf(rec, recLen + 1, "%zu path=%s\n", recLen, name);
+
+  u1 hdr[kTarBlockSize];
+  fillHeader(hdr, "", 0, "PaxHeader", recLen, kTarTypePax);
+  bool ret = utils_writeToFd(fd, hdr, sizeof(hdr)) && writePadded(fd, (const u1 *)rec, recLen);
+  free(rec);
+  return ret;
+}
+
+tarWriter_t *tarWriter_open(int fd) {
+  tarWriter_t *pTar = utils_calloc(sizeof(tarWriter_t));
+  pTar->fd = fd;
+  pthread_mutex_init(&pTar->lock, NULL);
+  return pTar;
+}
+
+bool tarWriter_addEntry(tarWriter_t *pTar, const char *name, const u1 *buf, size_t size) {
+  // Absolute and parent directory paths would be extracted outside of the working directory
+  for (;;) {
+    if (name[0] == '/') {
+      name++;
+    } else if (strncmp(name, "./", 2) == 0) {
+      name += 2;
+    } else if (strncmp(name, "../", 3) == 0) {
+      name += 3;
+    } else {
+      break;
+    }
+  }
+
+  size_t nameLen = strlen(name);
+  if (nameLen == 0 || size > kTarMaxSize) {
+    LOGMSG(l_ERROR, "Invalid tar entry '%s'", name);
+    return false;
+  }
+
+  size_t prefixLen = 0;
+  bool needsPax = !splitName(name, nameLen, &prefixLen);
+  // Readers without pax support get the name truncated
+  u1 hdr[kTarBlockSize];
+  fillHeader(hdr, name, prefixLen, prefixLen > 0 ? name + prefixLen + 1 : name, size,
+             kTarTypeRegular);
+
+  pthread_mutex_lock(&pTar->lock);
+  bool ret = !pTar->failed && (!needsPax || writePaxPath(pTar->fd, name, nameLen)) &&
+             utils_writeToFd(pTar->fd, hdr, sizeof(hdr)) && writePadded(pTar->fd, buf, size);
+  if (!ret && !pTar->failed) {
+    LOGMSG_P(l_ERROR, "Couldn't write '%s' entry to tar stream", name);
+    // A partially written entry corrupts the rest of the stream
+    pTar->failed = true;
+  }
+  pthread_mutex_unlock(&pTar->lock);
+  return ret;
+}
+
+bool tarWriter_close(tarWriter_t *pTar) {
+  // End of archive is marked with two zero blocks
+  bool ret = !pTar->failed && utils_writeToFd(pTar->fd, kTarZeroBlock, kTarBlockSize) &&
+             utils_writeToFd(pTar->fd, kTarZeroBlock, kTarBlockSize);
+  if (!ret && !pTar->failed) {
+    LOGMSG_P(l_ERROR, "Couldn't write end of tar stream");
+  }
+  pthread_mutex_destroy(&pTar->lock);
+  free(pTar);
+  return ret;
+}
@@ -0,0 +1,48 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _TAR_WRITER_H_
+#define _TAR_WRITER_H_
+
+#include <pthread.h>
+
+#include "common.h"
+
+// POSIX (ustar) tar stream written sequentially to an already open file descriptor, usually stdout.
+// Since the stream might be a pipe nothing is ever seeked back, so each entry is written in one go
+// under the lock.
+struct tarWriter {
+  int fd;
+  pthread_mutex_t lock;
+  bool failed;
+};
+
+tarWriter_t *tarWriter_open(int);
+
+// Adds a regular file. Leading '/' and '../' components are stripped from the name, like tar does
+// when creating archives. Names that don't fit in the ustar header are stored in a pax header.
+bool tarWriter_addEntry(tarWriter_t *, const char *, const u1 *, size_t);
+
+// Writes the end of archive marker. The file descriptor is left open.
+bool tarWriter_close(tarWriter_t *);
+
+#endif
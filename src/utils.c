@@ -22,80 +22,97 @@
 
 #include "utils.h"
 
-#include <dirent.h>
+#include <libgen.h>
+#include <pthread.h>
 #include <sys/mman.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 #include <sys/stat.h>
 
-static bool utils_readdir(infiles_t *pFiles, const char *basePath) {
-  DIR *dir = opendir(basePath);
-  if (!dir) {
-    LOGMSG_P(l_ERROR, "Couldn't open dir '%s'", basePath);
-    return false;
-  }
-
-  for (;;) {
-    errno = 0;
-    struct dirent *entry = readdir(dir);
-    if (entry == NULL && errno == EINTR) {
-      continue;
-    }
-    if (entry == NULL && errno != 0) {
-      LOGMSG_P(l_ERROR, "readdir('%s')", basePath);
-      return false;
-    }
-    if (entry == NULL) {
+#include "archive.h"
+#include "crawler.h"
+
+// Buffers passed to a single writev() call, well below IOV_MAX
+#define kMaxWritevIovs 64
+
+// Shared state of the threads spawned from utils_runParallel()
+typedef struct {
+  utils_taskFn_t taskFn;
+  void *taskArg;
+  size_t taskCnt;
+  size_t nextTask;
+  bool failed;
+} taskPool_t;
+
+typedef struct {
+  taskPool_t *pPool;
+  size_t workerIdx;
+} taskWorker_t;
+
+static void *utils_taskWorker(void *arg) {
+  const taskWorker_t *pWorker = (const taskWorker_t *)arg;
+  taskPool_t *pPool = pWorker->pPool;
+  while (!__atomic_load_n(&pPool->failed, __ATOMIC_RELAXED)) {
+    size_t idx = __atomic_fetch_add(&pPool->nextTask, 1, __ATOMIC_RELAXED);
+    if (idx >= pPool->taskCnt) {
       break;
     }
-
-    // Skip special files
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-      continue;
-    }
-
-    char path[PATH_MAX + 2];
-    snprintf(path, sizeof(path), "%s/%s", basePath, entry->d_name);
-
-    struct stat st;
-    if (stat(path, &st) == -1) {
-      LOGMSG(l_WARN, "Couldn't stat() the '%s' file", path);
-      continue;
-    }
-
-    if (S_ISDIR(st.st_mode)) {
-      if (!utils_readdir(pFiles, path)) {
-        LOGMSG(l_ERROR, "Failed to process '%s' directory", path);
-        continue;
-      }
-    }
-
-    if (!S_ISREG(st.st_mode)) {
-      LOGMSG(l_DEBUG, "'%s' is not a regular file, skipping", path);
-      continue;
+    if (!pPool->taskFn(pPool->taskArg, pWorker->workerIdx, idx)) {
+      __atomic_store_n(&pPool->failed, true, __ATOMIC_RELAXED);
     }
+  }
+  return NULL;
+}
 
-    if (st.st_size == 0) {
-      LOGMSG(l_DEBUG, "'%s' is empty", path);
-      continue;
+// Appends the components of an archive member name to the path, dropping the ones that would point
+// outside of it (empty, '.' and '..')
+static void appendMemberPath(char *path, size_t pathLen, const char *memberName) {
+  size_t off = strlen(path);
+  const char *pComp = memberName;
+  while (*pComp != '\0') {
+    size_t compLen = strcspn(pComp, "/");
+    bool skip = compLen == 0 || (compLen == 1 && pComp[0] == '.') ||
+                (compLen == 2 && pComp[0] == '.' && pComp[1] == '.');
+    if (!skip && off < pathLen) {
+      off += snprintf(path + off, pathLen - off, "/%.*s", (int)compLen, pComp);
     }
+    pComp += compLen;
+    pComp += *pComp == '/';
+  }
+}
 
-    if (!(pFiles->files = realloc(pFiles->files, sizeof(char *) * (pFiles->fileCnt + 1)))) {
-      LOGMSG_P(l_ERROR, "Couldn't allocate memory");
-      closedir(dir);
-      return false;
-    }
+static bool utils_initArchive(infiles_t *pFiles) {
+  const archive_t *pArchive = pFiles->pArchive;
+  if (pArchive == NULL) {
+    LOGMSG(l_ERROR, "Invalid archive '%s'", pFiles->inputFile);
+    return false;
+  }
+  if (pArchive->memberCnt == 0) {
+    LOGMSG(l_ERROR, "Archive '%s' doesn't contain any Vdex files", pFiles->inputFile);
+    return false;
+  }
 
-    pFiles->files[pFiles->fileCnt] = strdup(path);
-    if (!pFiles->files[pFiles->fileCnt]) {
-      LOGMSG_P(l_ERROR, "Couldn't allocate memory");
-      closedir(dir);
-      return false;
+  // Members keep their path in the archive, so that members with the same name in different
+  // directories (e.g. the Vdex files of each architecture of an app) are told apart
+  char *inputFile = strdup(pFiles->inputFile);
+  const char *inputDir = dirname(inputFile);
+  pFiles->files = utils_realloc(pFiles->files, pArchive->memberCnt * sizeof(char *));
+  for (size_t i = 0; i < pArchive->memberCnt; i++) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", inputDir);
+    appendMemberPath(path, sizeof(path), pArchive->members[i].name);
+    pFiles->files[i] = strdup(path);
+    if (!pFiles->files[i]) {
+      LOGMSG(l_FATAL, "Couldn't allocate memory");
     }
-    pFiles->fileCnt++;
-
-    LOGMSG(l_DEBUG, "Added '%s' to the list of input files", path);
   }
+  pFiles->fileCnt = pArchive->memberCnt;
+  pFiles->rootLen = strlen(inputDir);
+  free(inputFile);
 
-  closedir(dir);
+  LOGMSG(l_INFO, "%zu Vdex members of '%s' have been added to the list", pFiles->fileCnt,
+         pFiles->inputFile);
   return true;
 }
 
@@ -119,19 +136,23 @@ bool utils_init(infiles_t *pFiles) {
     return false;
   }
 
-  // If a directory, recursively scan
+  // If a directory, recursively scan for Vdex files
   if (S_ISDIR(st.st_mode)) {
-    if (!utils_readdir(pFiles, pFiles->inputFile)) {
+    free(pFiles->files);
+    pFiles->files = NULL;
+    if (!crawler_listVdexFiles(pFiles->inputFile, pFiles->scanJobs, &pFiles->files,
+                               &pFiles->fileCnt)) {
       LOGMSG(l_ERROR, "Failed to recursively process '%s' directory", pFiles->inputFile);
       return false;
     }
 
     if (pFiles->fileCnt == 0) {
-      LOGMSG(l_ERROR, "Directory '%s' doesn't contain any regular files", pFiles->inputFile);
+      LOGMSG(l_ERROR, "Directory '%s' doesn't contain any Vdex files", pFiles->inputFile);
       return false;
     }
+    pFiles->rootLen = strlen(pFiles->inputFile);
 
-    LOGMSG(l_INFO, "%u input files have been added to the list", pFiles->fileCnt);
+    LOGMSG(l_INFO, "%zu input files have been added to the list", pFiles->fileCnt);
     return true;
   }
 
@@ -140,9 +161,18 @@ bool utils_init(infiles_t *pFiles) {
     return false;
   }
 
+  // Archive members are listed with the name they would have if extracted next to the archive
+  bool isArchive = false;
+  pFiles->pArchive = archive_open(pFiles->inputFile, &isArchive);
+  if (isArchive) {
+    return utils_initArchive(pFiles);
+  }
+
   // Single file case
   pFiles->files[0] = pFiles->inputFile;
   pFiles->fileCnt = 1;
+  const char *pBaseName = strrchr(pFiles->inputFile, '/');
+  pFiles->rootLen = pBaseName ? (size_t)(pBaseName - pFiles->inputFile) : 0;
 
   return true;
 }
@@ -161,6 +191,103 @@ bool utils_writeToFd(int fd, const u1 *buf, off_t fileSz) {
   return true;
 }
 
+bool utils_writevToFd(int fd, const struct iovec *iov, int iovCnt) {
+  struct iovec pending[kMaxWritevIovs];
+  int i = 0;
+  size_t done = 0;  // Bytes of iov[i] already written
+  while (i < iovCnt) {
+    int cnt = 0;
+    for (; cnt < kMaxWritevIovs && i + cnt < iovCnt; ++cnt) {
+      size_t skip = cnt == 0 ? done : 0;
+      pending[cnt].iov_base = (u1 *)iov[i + cnt].iov_base + skip;
+      pending[cnt].iov_len = iov[i + cnt].iov_len - skip;
+    }
+    ssize_t sz = writev(fd, pending, cnt);
+    if (sz < 0 && errno == EINTR) continue;
+
+    if (sz < 0) return false;
+
+    // Skip the fully written buffers
+    size_t written = sz + done;
+    while (i < iovCnt && written >= iov[i].iov_len) {
+      written -= iov[i].iov_len;
+      i++;
+    }
+    done = written;
+  }
+
+  return true;
+}
+
+ssize_t utils_readFromFd(int fd, u1 *buf, size_t len) {
+  size_t readSz = 0;
+  while (readSz < len) {
+    ssize_t sz = read(fd, &buf[readSz], len - readSz);
+    if (sz < 0 && errno == EINTR) continue;
+
+    if (sz < 0) return -1;
+    if (sz == 0) break;
+
+    readSz += sz;
+  }
+
+  return readSz;
+}
+
+size_t utils_copyFdRange(int dstFd, int srcFd, off_t srcOff, size_t size) {
+  size_t copied = 0;
+#if defined(__linux__)
+#if defined(__GLIBC__)
+  // copy_file_range() shares the extents on reflink capable filesystems
+  while (copied < size) {
+    loff_t inOff = srcOff + copied;
+    loff_t outOff = copied;
+    ssize_t sz = copy_file_range(srcFd, &inOff, dstFd, &outOff, size - copied, 0);
+    if (sz < 0 && errno == EINTR) continue;
+
+    // Not supported between these files (e.g. cross-filesystem on older kernels)
+    if (sz <= 0) break;
+
+    copied += sz;
+  }
+#endif
+
+  // sendfile() writes at the current offset of the destination file
+  if (copied < size && lseek(dstFd, copied, SEEK_SET) != -1) {
+    while (copied < size) {
+      off_t inOff = srcOff + copied;
+      ssize_t sz = sendfile(dstFd, srcFd, &inOff, size - copied);
+      if (sz < 0 && errno == EINTR) continue;
+
+      if (sz <= 0) break;
+
+      copied += sz;
+    }
+  }
+#else
+  (void)dstFd;
+  (void)srcFd;
+  (void)srcOff;
+  (void)size;
+#endif
+  return copied;
+}
+
+bool utils_preallocateFd(int fd, off_t fileSz) {
+#if defined(__linux__)
+  int err = posix_fallocate(fd, 0, fileSz);
+  if (err == 0) {
+    return true;
+  }
+  // Not all filesystems support preallocation, in which case the file is only extended
+  if (err != EOPNOTSUPP && err != EINVAL) {
+    errno = err;
+    return false;
+  }
+#endif
+  return ftruncate(fd, fileSz) == 0;
+}
+
 u1 *utils_mapFileToRead(const char *fileName, off_t *fileSz, int *fd) {
   if ((*fd = open(fileName, O_RDONLY)) == -1) {
     LOGMSG_P(l_WARN, "Couldn't open() '%s' file in R/O mode", fileName);
@@ -384,6 +511,27 @@ char *utils_fileBasename(char const *path) {
   }
 }
 
+bool utils_makeDirs(const char *path) {
+  char dirPath[PATH_MAX];
+  snprintf(dirPath, sizeof(dirPath), "%s", path);
+  for (char *p = dirPath + 1;; p++) {
+    if (*p != '/' && *p != '\0') {
+      continue;
+    }
+    char sep = *p;
+    *p = '\0';
+    // Directories may be created concurrently by other workers
+    if (mkdir(dirPath, 0755) != 0 && errno != EEXIST) {
+      LOGMSG_P(l_ERROR, "Couldn't create '%s' directory", dirPath);
+      return false;
+    }
+    if (sep == '\0') {
+      return true;
+    }
+    *p = sep;
+  }
+}
+
 bool utils_isValidDir(const char *path) {
   struct stat buf;
   if (stat(path, &buf) != 0) {
@@ -401,3 +549,46 @@ uintptr_t utils_roundDown(uintptr_t x, uintptr_t n) {
 uintptr_t utils_roundUp(uintptr_t x, uintptr_t n) { return utils_roundDown(x + n - 1, n); }
 
 uintptr_t utils_allignUp(uintptr_t x, uintptr_t n) { return utils_roundUp(x, n); }
+
+bool utils_runParallel(int jobs, size_t taskCnt, utils_taskFn_t taskFn, void *taskArg) {
+  taskPool_t pool = {
+    .taskFn = taskFn,
+    .taskArg = taskArg,
+    .taskCnt = taskCnt,
+    .nextTask = 0,
+    .failed = false,
+  };
+
+  if ((size_t)jobs > taskCnt) {
+    jobs = taskCnt;
+  }
+
+  // Calling thread is also a worker (index 0), so spawn one less
+  int spawned = 0;
+  pthread_t *threads = NULL;
+  taskWorker_t *workers = utils_calloc(jobs * sizeof(taskWorker_t));
+  for (int i = 0; i < jobs; i++) {
+    workers[i].pPool = &pool;
+    workers[i].workerIdx = i;
+  }
+  if (jobs > 1) {
+    threads = utils_calloc((jobs - 1) * sizeof(pthread_t));
+    for (; spawned < jobs - 1; spawned++) {
+      int err = pthread_create(&threads[spawned], NULL, utils_taskWorker, &workers[spawned + 1]);
+      if (err != 0) {
+        errno = err;
+        LOGMSG_P(l_WARN, "Couldn't spawn worker thread - continuing with %d", spawned + 1);
+        break;
+      }
+    }
+  }
+
+  utils_taskWorker(&workers[0]);
+
+  for (int i = 0; i < spawned; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  free(workers);
+  return !pool.failed;
+}
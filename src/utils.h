@@ -24,12 +24,25 @@
 #define _UTILS_H_
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "common.h"
 
 bool utils_init(infiles_t *);
 u1 *utils_mapFileToRead(const char *, off_t *, int *);
 bool utils_writeToFd(int, const u1 *, off_t);
+
+// Writes the buffers in order with writev(), resuming after partial writes
+bool utils_writevToFd(int, const struct iovec *, int);
+
+// Reads until the buffer is full or end of file. Returns the number of bytes read or -1 on error.
+ssize_t utils_readFromFd(int, u1 *, size_t);
+bool utils_preallocateFd(int, off_t);
+
+// Copies a byte range of the source file to the beginning of the destination file in kernel space
+// (copy_file_range() or sendfile()). Returns the number of bytes copied, which is less than
+// requested if the files don't support it, in which case the caller writes the remainder.
+size_t utils_copyFdRange(int, int, off_t, size_t);
 void utils_hexDump(char *, const u1 *, int);
 char *utils_bin2hex(const unsigned char *, const size_t);
 void *utils_malloc(size_t);
@@ -47,9 +60,18 @@ u4 *utils_processFileWithCsums(const char *, int *);
 
 char *utils_fileBasename(char const *);
 bool utils_isValidDir(const char *);
+// Creates the directory and its missing parents
+bool utils_makeDirs(const char *);
 
 uintptr_t utils_roundDown(uintptr_t, uintptr_t);
 uintptr_t utils_roundUp(uintptr_t, uintptr_t);
 uintptr_t utils_allignUp(uintptr_t, uintptr_t);
 
+// Task callback for utils_runParallel(), called with the task argument, the index of the calling
+// worker (in [0, jobs)) and the task index. Returns false to signal failure, in which case no new
+// tasks are started.
+typedef bool (*utils_taskFn_t)(void *, size_t, size_t);
+
+bool utils_runParallel(int, size_t, utils_taskFn_t, void *);
+
 #endif
@@ -45,17 +45,23 @@ bool vdex_006_hasDexSection(const u1 *cursor) {
   return pVdexHeader->dexSize != 0;
 }
 
+u4 vdex_006_GetLocationChecksumsOffset(const u1 *cursor) {
+  // Location checksums immediately follow the fixed size header
+  (void)cursor;
+  return sizeof(vdexHeader_006);
+}
+
 u4 vdex_006_GetSizeOfChecksumsSection(const u1 *cursor) {
   const vdexHeader_006 *pVdexHeader = (const vdexHeader_006 *)cursor;
   return sizeof(VdexChecksum) * pVdexHeader->numberOfDexFiles;
 }
 
 const u1 *vdex_006_DexBegin(const u1 *cursor) {
-  return cursor + sizeof(vdexHeader_006) + vdex_006_GetSizeOfChecksumsSection(cursor);
+  return cursor + vdex_006_DexBeginOffset(cursor);
 }
 
 u4 vdex_006_DexBeginOffset(const u1 *cursor) {
-  return sizeof(vdexHeader_006) + vdex_006_GetSizeOfChecksumsSection(cursor);
+  return vdex_006_GetLocationChecksumsOffset(cursor) + vdex_006_GetSizeOfChecksumsSection(cursor);
 }
 
 const u1 *vdex_006_DexEnd(const u1 *cursor) {
@@ -72,7 +78,7 @@ const u1 *vdex_006_GetNextDexFileData(const u1 *cursor, u4 *curOffset) {
   if (*curOffset == 0) {
     if (vdex_006_hasDexSection(cursor)) {
       const u1 *dexBuf = vdex_006_DexBegin(cursor);
-      *curOffset = sizeof(vdexHeader_006) + vdex_006_GetSizeOfChecksumsSection(cursor);
+      *curOffset = vdex_006_DexBeginOffset(cursor);
       LOGMSG(l_DEBUG, "Processing first Dex file at offset:0x%x", *curOffset);
 
       // Adjust curOffset to point at the end of current Dex file
@@ -102,15 +108,10 @@ const u1 *vdex_006_GetNextDexFileData(const u1 *cursor, u4 *curOffset) {
 }
 
 u4 vdex_006_GetLocationChecksum(const u1 *cursor, u4 fileIdx) {
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader_006));
+  u4 *checksums = (u4 *)(cursor + vdex_006_GetLocationChecksumsOffset(cursor));
   return checksums[fileIdx];
 }
 
-void vdex_006_SetLocationChecksum(const u1 *cursor, u4 fileIdx, u4 value) {
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader_006));
-  checksums[fileIdx] = value;
-}
-
 void vdex_006_GetVerifierDeps(const u1 *cursor, vdex_data_array_t *pVerifierDeps) {
   const vdexHeader_006 *pVdexHeader = (const vdexHeader_006 *)cursor;
   pVerifierDeps->data = vdex_006_DexBegin(cursor) + pVdexHeader->dexSize;
@@ -127,6 +128,33 @@ void vdex_006_GetQuickeningInfo(const u1 *cursor, vdex_data_array_t *pQuickInfo)
   pQuickInfo->size = pVdexHeader->quickeningInfoSize;
 }
 
+// Returns false if the buffer doesn't hold the whole header, in which case headerSize is set to the
+// required size
+bool vdex_006_getInventory(const u1 *cursor, size_t size, vdexInventory_t *pInv) {
+  memset(pInv, 0, sizeof(vdexInventory_t));
+  pInv->headerSize = sizeof(vdexHeader_006);
+  if (size < pInv->headerSize) {
+    return false;
+  }
+
+  // Computed without the 32-bit offsets of the accessors, which overflow for bogus headers
+  const vdexHeader_006 *pVdexHeader = (const vdexHeader_006 *)cursor;
+  pInv->headerSize += (size_t)pVdexHeader->numberOfDexFiles * sizeof(VdexChecksum);
+  if (size < pInv->headerSize) {
+    return false;
+  }
+
+  pInv->version = "006";
+  pInv->apiLevel = 26;
+  pInv->numberOfDexFiles = pVdexHeader->numberOfDexFiles;
+  pInv->checksums = cursor + vdex_006_GetLocationChecksumsOffset(cursor);
+  pInv->hasDexSection = vdex_006_hasDexSection(cursor);
+  pInv->dexSize = pVdexHeader->dexSize;
+  pInv->verifierDepsSize = pVdexHeader->verifierDepsSize;
+  pInv->quickeningInfoSize = pVdexHeader->quickeningInfoSize;
+  return true;
+}
+
 void vdex_006_dumpHeaderInfo(const u1 *cursor) {
   const vdexHeader_006 *pVdexHeader = (const vdexHeader_006 *)cursor;
   vdex_data_array_t vDeps;
@@ -187,16 +215,14 @@ bool vdex_006_SanityCheck(const u1 *cursor, size_t bufSz) {
 int vdex_006_process(const char *VdexFileName,
                      const u1 *cursor,
                      size_t bufSz,
+                     int srcFd,
                      const runArgs_t *pRunArgs) {
-  // Update Dex disassembler engine status
-  dex_setDisassemblerStatus(pRunArgs->enableDisassembler);
-
   // Measure time spend to process all Dex files of a Vdex file
   struct timespec timer;
   utils_startTimer(&timer);
 
   // Process Vdex file
-  int ret = vdex_backend_006_process(VdexFileName, cursor, bufSz, pRunArgs);
+  int ret = vdex_backend_006_process(VdexFileName, cursor, bufSz, srcFd, pRunArgs);
 
   // Get elapsed time in ns
   long timeSpend = utils_endTimer(&timer);
@@ -124,6 +124,7 @@ bool vdex_006_isMagicValid(const u1 *);
 bool vdex_006_isVersionValid(const u1 *);
 
 bool vdex_006_hasDexSection(const u1 *);
+u4 vdex_006_GetLocationChecksumsOffset(const u1 *);
 u4 vdex_006_GetSizeOfChecksumsSection(const u1 *);
 const u1 *vdex_006_DexBegin(const u1 *);
 u4 vdex_006_DexBeginOffset(const u1 *);
@@ -131,13 +132,13 @@ const u1 *vdex_006_DexEnd(const u1 *);
 u4 vdex_006_DexEndOffset(const u1 *);
 const u1 *vdex_006_GetNextDexFileData(const u1 *, u4 *);
 u4 vdex_006_GetLocationChecksum(const u1 *, u4);
-void vdex_006_SetLocationChecksum(const u1 *, u4, u4);
 void vdex_006_GetVerifierDeps(const u1 *, vdex_data_array_t *);
 void vdex_006_GetQuickeningInfo(const u1 *, vdex_data_array_t *);
 
+bool vdex_006_getInventory(const u1 *, size_t, vdexInventory_t *);
 void vdex_006_dumpHeaderInfo(const u1 *);
 void vdex_006_dumpDepsInfo(const u1 *);
 bool vdex_006_SanityCheck(const u1 *, size_t);
-int vdex_006_process(const char *, const u1 *, size_t, const runArgs_t *);
+int vdex_006_process(const char *, const u1 *, size_t, int, const runArgs_t *);
 
 #endif
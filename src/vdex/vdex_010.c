@@ -45,17 +45,23 @@ bool vdex_010_hasDexSection(const u1 *cursor) {
   return pVdexHeader->dexSize != 0;
 }
 
+u4 vdex_010_GetLocationChecksumsOffset(const u1 *cursor) {
+  // Location checksums immediately follow the fixed size header
+  (void)cursor;
+  return sizeof(vdexHeader_010);
+}
+
 u4 vdex_010_GetSizeOfChecksumsSection(const u1 *cursor) {
   const vdexHeader_010 *pVdexHeader = (const vdexHeader_010 *)cursor;
   return sizeof(VdexChecksum) * pVdexHeader->numberOfDexFiles;
 }
 
 const u1 *vdex_010_DexBegin(const u1 *cursor) {
-  return cursor + sizeof(vdexHeader_010) + vdex_010_GetSizeOfChecksumsSection(cursor);
+  return cursor + vdex_010_DexBeginOffset(cursor);
 }
 
 u4 vdex_010_DexBeginOffset(const u1 *cursor) {
-  return sizeof(vdexHeader_010) + vdex_010_GetSizeOfChecksumsSection(cursor);
+  return vdex_010_GetLocationChecksumsOffset(cursor) + vdex_010_GetSizeOfChecksumsSection(cursor);
 }
 
 const u1 *vdex_010_DexEnd(const u1 *cursor) {
@@ -72,7 +78,7 @@ const u1 *vdex_010_GetNextDexFileData(const u1 *cursor, u4 *curOffset) {
   if (*curOffset == 0) {
     if (vdex_010_hasDexSection(cursor)) {
       const u1 *dexBuf = vdex_010_DexBegin(cursor);
-      *curOffset = sizeof(vdexHeader_010) + vdex_010_GetSizeOfChecksumsSection(cursor);
+      *curOffset = vdex_010_DexBeginOffset(cursor);
       LOGMSG(l_DEBUG, "Processing first Dex file at offset:0x%x", *curOffset);
 
       // Adjust offset to point at the end of current Dex file
@@ -102,15 +108,10 @@ const u1 *vdex_010_GetNextDexFileData(const u1 *cursor, u4 *curOffset) {
 }
 
 u4 vdex_010_GetLocationChecksum(const u1 *cursor, u4 fileIdx) {
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader_010));
+  u4 *checksums = (u4 *)(cursor + vdex_010_GetLocationChecksumsOffset(cursor));
   return checksums[fileIdx];
 }
 
-void vdex_010_SetLocationChecksum(const u1 *cursor, u4 fileIdx, u4 value) {
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader_010));
-  checksums[fileIdx] = value;
-}
-
 void vdex_010_GetVerifierDeps(const u1 *cursor, vdex_data_array_t *pVerifierDeps) {
   const vdexHeader_010 *pVdexHeader = (const vdexHeader_010 *)cursor;
   pVerifierDeps->data = vdex_010_DexBegin(cursor) + pVdexHeader->dexSize;
@@ -127,6 +128,33 @@ void vdex_010_GetQuickeningInfo(const u1 *cursor, vdex_data_array_t *pQuickInfo)
   pQuickInfo->size = pVdexHeader->quickeningInfoSize;
 }
 
+// Returns false if the buffer doesn't hold the whole header, in which case headerSize is set to the
+// required size
+bool vdex_010_getInventory(const u1 *cursor, size_t size, vdexInventory_t *pInv) {
+  memset(pInv, 0, sizeof(vdexInventory_t));
+  pInv->headerSize = sizeof(vdexHeader_010);
+  if (size < pInv->headerSize) {
+    return false;
+  }
+
+  // Computed without the 32-bit offsets of the accessors, which overflow for bogus headers
+  const vdexHeader_010 *pVdexHeader = (const vdexHeader_010 *)cursor;
+  pInv->headerSize += (size_t)pVdexHeader->numberOfDexFiles * sizeof(VdexChecksum);
+  if (size < pInv->headerSize) {
+    return false;
+  }
+
+  pInv->version = "010";
+  pInv->apiLevel = 27;
+  pInv->numberOfDexFiles = pVdexHeader->numberOfDexFiles;
+  pInv->checksums = cursor + vdex_010_GetLocationChecksumsOffset(cursor);
+  pInv->hasDexSection = vdex_010_hasDexSection(cursor);
+  pInv->dexSize = pVdexHeader->dexSize;
+  pInv->verifierDepsSize = pVdexHeader->verifierDepsSize;
+  pInv->quickeningInfoSize = pVdexHeader->quickeningInfoSize;
+  return true;
+}
+
 void vdex_010_dumpHeaderInfo(const u1 *cursor) {
   const vdexHeader_010 *pVdexHeader = (const vdexHeader_010 *)cursor;
   vdex_data_array_t vDeps;
@@ -187,16 +215,14 @@ bool vdex_010_SanityCheck(const u1 *cursor, size_t bufSz) {
 int vdex_010_process(const char *VdexFileName,
                      const u1 *cursor,
                      size_t bufSz,
+                     int srcFd,
                      const runArgs_t *pRunArgs) {
-  // Update Dex disassembler engine status
-  dex_setDisassemblerStatus(pRunArgs->enableDisassembler);
-
   // Measure time spend to process all Dex files of a Vdex file
   struct timespec timer;
   utils_startTimer(&timer);
 
   // Process Vdex file
-  int ret = vdex_backend_010_process(VdexFileName, cursor, bufSz, pRunArgs);
+  int ret = vdex_backend_010_process(VdexFileName, cursor, bufSz, srcFd, pRunArgs);
 
   // Get elapsed time in ns
   long timeSpend = utils_endTimer(&timer);
@@ -124,6 +124,7 @@ bool vdex_010_isMagicValid(const u1 *);
 bool vdex_010_isVersionValid(const u1 *);
 
 bool vdex_010_hasDexSection(const u1 *);
+u4 vdex_010_GetLocationChecksumsOffset(const u1 *);
 u4 vdex_010_GetSizeOfChecksumsSection(const u1 *);
 const u1 *vdex_010_DexBegin(const u1 *);
 u4 vdex_010_DexBeginOffset(const u1 *);
@@ -131,13 +132,13 @@ const u1 *vdex_010_DexEnd(const u1 *);
 u4 vdex_010_DexEndOffset(const u1 *);
 const u1 *vdex_010_GetNextDexFileData(const u1 *, u4 *);
 u4 vdex_010_GetLocationChecksum(const u1 *, u4);
-void vdex_010_SetLocationChecksum(const u1 *, u4, u4);
 void vdex_010_GetVerifierDeps(const u1 *, vdex_data_array_t *);
 void vdex_010_GetQuickeningInfo(const u1 *, vdex_data_array_t *);
 
+bool vdex_010_getInventory(const u1 *, size_t, vdexInventory_t *);
 void vdex_010_dumpHeaderInfo(const u1 *);
 void vdex_010_dumpDepsInfo(const u1 *);
 bool vdex_010_SanityCheck(const u1 *, size_t);
-int vdex_010_process(const char *, const u1 *, size_t, const runArgs_t *);
+int vdex_010_process(const char *, const u1 *, size_t, int, const runArgs_t *);
 
 #endif
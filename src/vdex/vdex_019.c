@@ -56,13 +56,19 @@ bool vdex_019_hasDexSection(const u1 *cursor) {
                  sizeof(kVdexDexSectVer_019)) == 0);
 }
 
+u4 vdex_019_GetLocationChecksumsOffset(const u1 *cursor) {
+  // Location checksums immediately follow the fixed size header
+  (void)cursor;
+  return sizeof(vdexHeader_019);
+}
+
 u4 vdex_019_GetSizeOfChecksumsSection(const u1 *cursor) {
   const vdexHeader_019 *pVdexHeader = (const vdexHeader_019 *)cursor;
   return sizeof(VdexChecksum) * pVdexHeader->numberOfDexFiles;
 }
 
 u4 vdex_019_GetDexSectionHeaderOffset(const u1 *cursor) {
-  return sizeof(vdexHeader_019) + vdex_019_GetSizeOfChecksumsSection(cursor);
+  return vdex_019_GetLocationChecksumsOffset(cursor) + vdex_019_GetSizeOfChecksumsSection(cursor);
 }
 
 const vdexDexSectHeader_019 *vdex_019_GetDexSectionHeader(const u1 *cursor) {
@@ -95,17 +101,10 @@ u4 vdex_019_DexEndOffset(const u1 *cursor) {
 u4 vdex_019_GetLocationChecksum(const u1 *cursor, u4 fileIdx) {
   const vdexHeader_019 *pVdexHeader = (const vdexHeader_019 *)cursor;
   CHECK_LT(fileIdx, pVdexHeader->numberOfDexFiles);
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader_019));
+  u4 *checksums = (u4 *)(cursor + vdex_019_GetLocationChecksumsOffset(cursor));
   return checksums[fileIdx];
 }
 
-void vdex_019_SetLocationChecksum(const u1 *cursor, u4 fileIdx, u4 value) {
-  const vdexHeader_019 *pVdexHeader = (const vdexHeader_019 *)cursor;
-  CHECK_LT(fileIdx, pVdexHeader->numberOfDexFiles);
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader_019));
-  checksums[fileIdx] = value;
-}
-
 u4 vdex_019_GetVerifierDepsStartOffset(const u1 *cursor) {
   u4 result = vdex_019_GetDexSectionHeaderOffset(cursor);
   if (vdex_019_hasDexSection(cursor)) {
@@ -153,6 +152,40 @@ void vdex_019_GetQuickenInfoOffsetTable(const u1 *dexBuf,
   pOffTable->offset = pQuickInfo->offset + offset;
 }
 
+// Returns false if the buffer doesn't hold the whole header, in which case headerSize is set to the
+// required size
+bool vdex_019_getInventory(const u1 *cursor, size_t size, vdexInventory_t *pInv) {
+  memset(pInv, 0, sizeof(vdexInventory_t));
+  pInv->headerSize = sizeof(vdexHeader_019);
+  if (size < pInv->headerSize) {
+    return false;
+  }
+
+  // Computed without the 32-bit offsets of the accessors, which overflow for bogus headers
+  const vdexHeader_019 *pVdexHeader = (const vdexHeader_019 *)cursor;
+  pInv->hasDexSection = vdex_019_hasDexSection(cursor);
+  pInv->headerSize += (size_t)pVdexHeader->numberOfDexFiles * sizeof(VdexChecksum);
+  if (pInv->hasDexSection) {
+    pInv->headerSize += sizeof(vdexDexSectHeader_019);
+  }
+  if (size < pInv->headerSize) {
+    return false;
+  }
+
+  pInv->version = "019";
+  pInv->apiLevel = 28;
+  pInv->numberOfDexFiles = pVdexHeader->numberOfDexFiles;
+  pInv->checksums = cursor + vdex_019_GetLocationChecksumsOffset(cursor);
+  pInv->verifierDepsSize = pVdexHeader->verifierDepsSize;
+  if (pInv->hasDexSection) {
+    const vdexDexSectHeader_019 *pDexSectHeader = vdex_019_GetDexSectionHeader(cursor);
+    pInv->dexSize = pDexSectHeader->dexSize;
+    pInv->dexSharedDataSize = pDexSectHeader->dexSharedDataSize;
+    pInv->quickeningInfoSize = pDexSectHeader->quickeningInfoSize;
+  }
+  return true;
+}
+
 void vdex_019_dumpHeaderInfo(const u1 *cursor) {
   const vdexHeader_019 *pVdexHeader = (const vdexHeader_019 *)cursor;
   vdex_data_array_t vDeps;
@@ -269,16 +302,14 @@ bool vdex_019_SanityCheck(const u1 *cursor, size_t bufSz) {
 int vdex_019_process(const char *VdexFileName,
                      const u1 *cursor,
                      size_t bufSz,
+                     int srcFd,
                      const runArgs_t *pRunArgs) {
-  // Update Dex disassembler engine status
-  dex_setDisassemblerStatus(pRunArgs->enableDisassembler);
-
   // Measure time spend to process all Dex files of a Vdex file
   struct timespec timer;
   utils_startTimer(&timer);
 
   // Process Vdex file
-  int ret = vdex_backend_019_process(VdexFileName, cursor, bufSz, pRunArgs);
+  int ret = vdex_backend_019_process(VdexFileName, cursor, bufSz, srcFd, pRunArgs);
 
   // Get elapsed time in ns
   long timeSpend = utils_endTimer(&timer);
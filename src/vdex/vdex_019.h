@@ -137,6 +137,7 @@ bool vdex_019_isMagicValid(const u1 *);
 bool vdex_019_isVersionValid(const u1 *);
 
 bool vdex_019_hasDexSection(const u1 *);
+u4 vdex_019_GetLocationChecksumsOffset(const u1 *);
 u4 vdex_019_GetSizeOfChecksumsSection(const u1 *);
 const u1 *vdex_019_DexBegin(const u1 *);
 u4 vdex_019_DexBeginOffset(const u1 *);
@@ -144,7 +145,6 @@ const u1 *vdex_019_DexEnd(const u1 *);
 u4 vdex_019_DexEndOffset(const u1 *);
 const u1 *vdex_019_GetNextDexFileData(const u1 *, u4 *);
 u4 vdex_019_GetLocationChecksum(const u1 *, u4);
-void vdex_019_SetLocationChecksum(const u1 *, u4, u4);
 void vdex_019_GetVerifierDeps(const u1 *, vdex_data_array_t *);
 void vdex_019_GetQuickeningInfo(const u1 *, vdex_data_array_t *);
 
@@ -155,9 +155,10 @@ const vdexDexSectHeader_019 *vdex_019_GetDexSectionHeader(const u1 *);
 // each Dex file in the container
 void vdex_019_GetQuickenInfoOffsetTable(const u1 *, const vdex_data_array_t *, vdex_data_array_t *);
 
+bool vdex_019_getInventory(const u1 *, size_t, vdexInventory_t *);
 void vdex_019_dumpHeaderInfo(const u1 *);
 void vdex_019_dumpDepsInfo(const u1 *);
 bool vdex_019_SanityCheck(const u1 *, size_t);
-int vdex_019_process(const char *, const u1 *, size_t, const runArgs_t *);
+int vdex_019_process(const char *, const u1 *, size_t, int, const runArgs_t *);
 
 #endif
@@ -56,13 +56,19 @@ bool vdex_021_hasDexSection(const u1 *cursor) {
                  sizeof(kVdexDexSectVer_021)) == 0);
 }
 
+u4 vdex_021_GetLocationChecksumsOffset(const u1 *cursor) {
+  // Location checksums immediately follow the fixed size header
+  (void)cursor;
+  return sizeof(vdexHeader_021);
+}
+
 u4 vdex_021_GetSizeOfChecksumsSection(const u1 *cursor) {
   const vdexHeader_021 *pVdexHeader = (const vdexHeader_021 *)cursor;
   return sizeof(VdexChecksum) * pVdexHeader->numberOfDexFiles;
 }
 
 u4 vdex_021_GetDexSectionHeaderOffset(const u1 *cursor) {
-  return sizeof(vdexHeader_021) + vdex_021_GetSizeOfChecksumsSection(cursor);
+  return vdex_021_GetLocationChecksumsOffset(cursor) + vdex_021_GetSizeOfChecksumsSection(cursor);
 }
 
 const vdexDexSectHeader_021 *vdex_021_GetDexSectionHeader(const u1 *cursor) {
@@ -95,17 +101,10 @@ u4 vdex_021_DexEndOffset(const u1 *cursor) {
 u4 vdex_021_GetLocationChecksum(const u1 *cursor, u4 fileIdx) {
   const vdexHeader_021 *pVdexHeader = (const vdexHeader_021 *)cursor;
   CHECK_LT(fileIdx, pVdexHeader->numberOfDexFiles);
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader_021));
+  u4 *checksums = (u4 *)(cursor + vdex_021_GetLocationChecksumsOffset(cursor));
   return checksums[fileIdx];
 }
 
-void vdex_021_SetLocationChecksum(const u1 *cursor, u4 fileIdx, u4 value) {
-  const vdexHeader_021 *pVdexHeader = (const vdexHeader_021 *)cursor;
-  CHECK_LT(fileIdx, pVdexHeader->numberOfDexFiles);
-  u4 *checksums = (u4 *)(cursor + sizeof(vdexHeader_021));
-  checksums[fileIdx] = value;
-}
-
 u4 vdex_021_GetVerifierDepsStartOffset(const u1 *cursor) {
   u4 result = vdex_021_GetDexSectionHeaderOffset(cursor);
   if (vdex_021_hasDexSection(cursor)) {
@@ -196,6 +195,40 @@ void vdex_021_GetQuickenInfoOffsetTable(const u1 *dexBuf,
   pOffTable->offset = pQuickInfo->offset + offset;
 }
 
+// Returns false if the buffer doesn't hold the whole header, in which case headerSize is set to the
+// required size
+bool vdex_021_getInventory(const u1 *cursor, size_t size, vdexInventory_t *pInv) {
+  memset(pInv, 0, sizeof(vdexInventory_t));
+  pInv->headerSize = sizeof(vdexHeader_021);
+  if (size < pInv->headerSize) {
+    return false;
+  }
+
+  // Computed without the 32-bit offsets of the accessors, which overflow for bogus headers
+  const vdexHeader_021 *pVdexHeader = (const vdexHeader_021 *)cursor;
+  pInv->hasDexSection = vdex_021_hasDexSection(cursor);
+  pInv->headerSize += (size_t)pVdexHeader->numberOfDexFiles * sizeof(VdexChecksum);
+  if (pInv->hasDexSection) {
+    pInv->headerSize += sizeof(vdexDexSectHeader_021);
+  }
+  if (size < pInv->headerSize) {
+    return false;
+  }
+
+  pInv->version = "021";
+  pInv->apiLevel = 29;
+  pInv->numberOfDexFiles = pVdexHeader->numberOfDexFiles;
+  pInv->checksums = cursor + vdex_021_GetLocationChecksumsOffset(cursor);
+  pInv->verifierDepsSize = pVdexHeader->verifierDepsSize;
+  if (pInv->hasDexSection) {
+    const vdexDexSectHeader_021 *pDexSectHeader = vdex_021_GetDexSectionHeader(cursor);
+    pInv->dexSize = pDexSectHeader->dexSize;
+    pInv->dexSharedDataSize = pDexSectHeader->dexSharedDataSize;
+    pInv->quickeningInfoSize = pDexSectHeader->quickeningInfoSize;
+  }
+  return true;
+}
+
 void vdex_021_dumpHeaderInfo(const u1 *cursor) {
   const vdexHeader_021 *pVdexHeader = (const vdexHeader_021 *)cursor;
   vdex_data_array_t vDeps;
@@ -347,16 +380,14 @@ bool vdex_021_SanityCheck(const u1 *cursor, size_t bufSz) {
 int vdex_021_process(const char *VdexFileName,
                      const u1 *cursor,
                      size_t bufSz,
+                     int srcFd,
                      const runArgs_t *pRunArgs) {
-  // Update Dex disassembler engine status
-  dex_setDisassemblerStatus(pRunArgs->enableDisassembler);
-
   // Measure time spend to process all Dex files of a Vdex file
   struct timespec timer;
   utils_startTimer(&timer);
 
   // Process Vdex file
-  int ret = vdex_backend_021_process(VdexFileName, cursor, bufSz, pRunArgs);
+  int ret = vdex_backend_021_process(VdexFileName, cursor, bufSz, srcFd, pRunArgs);
 
   // Get elapsed time in ns
   long timeSpend = utils_endTimer(&timer);
@@ -139,6 +139,7 @@ bool vdex_021_isMagicValid(const u1 *);
 bool vdex_021_isVersionValid(const u1 *);
 
 bool vdex_021_hasDexSection(const u1 *);
+u4 vdex_021_GetLocationChecksumsOffset(const u1 *);
 u4 vdex_021_GetSizeOfChecksumsSection(const u1 *);
 const u1 *vdex_021_DexBegin(const u1 *);
 u4 vdex_021_DexBeginOffset(const u1 *);
@@ -146,7 +147,6 @@ const u1 *vdex_021_DexEnd(const u1 *);
 u4 vdex_021_DexEndOffset(const u1 *);
 const u1 *vdex_021_GetNextDexFileData(const u1 *, u4 *);
 u4 vdex_021_GetLocationChecksum(const u1 *, u4);
-void vdex_021_SetLocationChecksum(const u1 *, u4, u4);
 void vdex_021_GetVerifierDeps(const u1 *, vdex_data_array_t *);
 void vdex_021_GetQuickeningInfo(const u1 *, vdex_data_array_t *);
 void vdex_021_GetBootClassPathChecksumData(const u1 *, vdex_data_array_t *);
@@ -159,9 +159,10 @@ const vdexDexSectHeader_021 *vdex_021_GetDexSectionHeader(const u1 *);
 // each Dex file in the container
 void vdex_021_GetQuickenInfoOffsetTable(const u1 *, const vdex_data_array_t *, vdex_data_array_t *);
 
+bool vdex_021_getInventory(const u1 *, size_t, vdexInventory_t *);
 void vdex_021_dumpHeaderInfo(const u1 *);
 void vdex_021_dumpDepsInfo(const u1 *);
 bool vdex_021_SanityCheck(const u1 *, size_t);
-int vdex_021_process(const char *, const u1 *, size_t, const runArgs_t *);
+int vdex_021_process(const char *, const u1 *, size_t, int, const runArgs_t *);
 
 #endif
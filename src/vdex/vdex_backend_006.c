@@ -25,12 +25,27 @@
 #include "../out_writer.h"
 #include "../utils.h"
 #include "vdex_decompiler_006.h"
+#include "vdex_quicken_index.h"
 
 static inline u4 decodeUint32WithOverflowCheck(const u1 **in, const u1 *end) {
   CHECK_LT(*in, end);
   return dex_readULeb128(in);
 }
 
+// Deps entries are decoded in batches of up to kDepsBatchSize values (a multiple of 2 and 3)
+#define kDepsBatchSize 48
+
+static inline void decodeUint32BatchWithOverflowCheck(const u1 **in,
+                                                      const u1 *end,
+                                                      u4 *pValues,
+                                                      size_t count) {
+  CHECK(dex_readULeb128BatchBounded(in, end, pValues, count));
+}
+
+static inline u4 nextDepsBatch(u4 remaining, u4 valuesPerEntry) {
+  return remaining < kDepsBatchSize / valuesPerEntry ? remaining : kDepsBatchSize / valuesPerEntry;
+}
+
 static void decodeDepStrings(const u1 **in, const u1 *end, vdexDepStrings_006 *depStrings) {
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   depStrings->strings = utils_calloc(numOfEntries * sizeof(char *));
@@ -47,9 +62,14 @@ static void decodeDepTypeSet(const u1 **in, const u1 *end, vdexDepTypeSet_006 *p
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepTypeSet->pVdexDepSets = utils_malloc(numOfEntries * sizeof(vdexDepSet_006));
   pVdexDepTypeSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepTypeSet->pVdexDepSets[i].dstIndex = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepTypeSet->pVdexDepSets[i].srcIndex = decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 2);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 2);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepTypeSet->pVdexDepSets[i].dstIndex = values[j * 2];
+      pVdexDepTypeSet->pVdexDepSets[i].srcIndex = values[j * 2 + 1];
+    }
   }
 }
 
@@ -59,9 +79,14 @@ static void decodeDepClasses(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepClassResSet->pVdexDepClasses = utils_malloc(numOfEntries * sizeof(vdexDepClassRes_006));
   pVdexDepClassResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepClassResSet->pVdexDepClasses[i].typeIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepClassResSet->pVdexDepClasses[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 2);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 2);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepClassResSet->pVdexDepClasses[i].typeIdx = values[j * 2];
+      pVdexDepClassResSet->pVdexDepClasses[i].accessFlags = values[j * 2 + 1];
+    }
   }
 }
 
@@ -71,11 +96,15 @@ static void decodeDepFields(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepFieldResSet->pVdexDepFields = utils_malloc(numOfEntries * sizeof(vdexDepFieldRes_006));
   pVdexDepFieldResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < pVdexDepFieldResSet->numberOfEntries; ++i) {
-    pVdexDepFieldResSet->pVdexDepFields[i].fieldIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepFieldResSet->pVdexDepFields[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepFieldResSet->pVdexDepFields[i].declaringClassIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 3);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 3);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepFieldResSet->pVdexDepFields[i].fieldIdx = values[j * 3];
+      pVdexDepFieldResSet->pVdexDepFields[i].accessFlags = values[j * 3 + 1];
+      pVdexDepFieldResSet->pVdexDepFields[i].declaringClassIdx = values[j * 3 + 2];
+    }
   }
 }
 
@@ -85,11 +114,15 @@ static void decodeDepMethods(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepMethodResSet->pVdexDepMethods = utils_malloc(numOfEntries * sizeof(vdexDepMethodRes_006));
   pVdexDepMethodResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepMethodResSet->pVdexDepMethods[i].methodIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepMethodResSet->pVdexDepMethods[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepMethodResSet->pVdexDepMethods[i].declaringClassIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 3);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 3);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepMethodResSet->pVdexDepMethods[i].methodIdx = values[j * 3];
+      pVdexDepMethodResSet->pVdexDepMethods[i].accessFlags = values[j * 3 + 1];
+      pVdexDepMethodResSet->pVdexDepMethods[i].declaringClassIdx = values[j * 3 + 2];
+    }
   }
 }
 
@@ -100,9 +133,13 @@ static void decodeDepUnvfyClasses(const u1 **in,
   pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses =
       utils_malloc(numOfEntries * sizeof(vdexDepUnvfyClass_006));
   pVdexDepUnvfyClassesSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses[i].typeIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 1);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses[i].typeIdx = values[j];
+    }
   }
 }
 
@@ -332,9 +369,66 @@ cleanup:
   destroyDepsInfo(pVdexDeps);
 }
 
+// Walk the methods of a Dex file in iteration order and index their quickening info blobs, which
+// are stored back to back in the same order. Returns false if the blobs overflow the section.
+static bool buildQuickenIndex(const u1 *dexFileBuf,
+                              const u1 **pQuickeningInfoPtr,
+                              const u1 *quickeningInfoEnd,
+                              vdex_quicken_index_t *pIndex) {
+  for (u4 i = 0; i < dex_getClassDefsSize(dexFileBuf); ++i) {
+    const dexClassDef *pDexClassDef = dex_getClassDef(dexFileBuf, i);
+    if (pDexClassDef->classDataOff == 0) {
+      continue;
+    }
+    const u1 *curClassDataCursor = dexFileBuf + pDexClassDef->classDataOff;
+
+    dexClassDataHeader pDexClassDataHeader;
+    memset(&pDexClassDataHeader, 0, sizeof(dexClassDataHeader));
+    dex_readClassDataHeader(&curClassDataCursor, &pDexClassDataHeader);
+
+    // Skip static & instance fields
+    u4 fieldsSize = pDexClassDataHeader.staticFieldsSize + pDexClassDataHeader.instanceFieldsSize;
+    for (u4 j = 0; j < fieldsSize; ++j) {
+      dexField pDexField;
+      memset(&pDexField, 0, sizeof(dexField));
+      dex_readClassDataField(&curClassDataCursor, &pDexField);
+    }
+
+    // For each direct & virtual method
+    u4 methodsSize =
+        pDexClassDataHeader.directMethodsSize + pDexClassDataHeader.virtualMethodsSize;
+    for (u4 j = 0; j < methodsSize; ++j) {
+      dexMethod curDexMethod;
+      memset(&curDexMethod, 0, sizeof(dexMethod));
+      dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
+
+      // Skip empty, native or abstract methods
+      if (curDexMethod.codeOff == 0) {
+        continue;
+      }
+
+      // For quickening info blob the first 4bytes are the inner blobs size
+      if (quickeningInfoEnd - *pQuickeningInfoPtr < (ptrdiff_t)sizeof(u4)) {
+        return false;
+      }
+      u4 quickening_size = *(u4 *)*pQuickeningInfoPtr;
+      *pQuickeningInfoPtr += sizeof(u4);
+      if ((size_t)(quickeningInfoEnd - *pQuickeningInfoPtr) < quickening_size) {
+        return false;
+      }
+      vdexQuickenIndex_add(pIndex, curDexMethod.codeOff, *pQuickeningInfoPtr, quickening_size);
+      *pQuickeningInfoPtr += quickening_size;
+    }
+  }
+
+  vdexQuickenIndex_sort(pIndex);
+  return true;
+}
+
 int vdex_backend_006_process(const char *VdexFileName,
                              const u1 *cursor,
                              size_t bufSz,
+                             int srcFd,
                              const runArgs_t *pRunArgs) {
   // Basic size checks
   if (!vdex_006_SanityCheck(cursor, bufSz)) {
@@ -348,12 +442,21 @@ int vdex_backend_006_process(const char *VdexFileName,
   const u1 *const quickening_info_end = quickInfo.data + quickInfo.size;
 
   const vdexHeader_006 *pVdexHeader = (const vdexHeader_006 *)cursor;
-  const u1 *dexFileBuf = NULL;
-  u4 offset = 0;
+  if (pVdexHeader->numberOfDexFiles == 0) {
+    return 0;
+  }
 
-  // For each Dex file
+  // Locate all Dex files up front and index their quickening info, so that methods can be
+  // unquickened independently of the order the blobs are stored in
+  const u1 **dexFiles = utils_calloc(pVdexHeader->numberOfDexFiles * sizeof(u1 *));
+  vdex_quicken_index_t *quickenIndexes =
+      utils_calloc(pVdexHeader->numberOfDexFiles * sizeof(vdex_quicken_index_t));
+  u4 offset = 0;
+  int ret = pVdexHeader->numberOfDexFiles;
+  outDexMap_t outDexMap;
+  memset(&outDexMap, 0, sizeof(outDexMap_t));
   for (size_t dex_file_idx = 0; dex_file_idx < pVdexHeader->numberOfDexFiles; ++dex_file_idx) {
-    dexFileBuf = vdex_006_GetNextDexFileData(cursor, &offset);
+    const u1 *dexFileBuf = vdex_006_GetNextDexFileData(cursor, &offset);
     if (dexFileBuf == NULL) {
       LOGMSG(l_ERROR, "Failed to extract 'classes%zu.dex' - skipping", dex_file_idx);
       continue;
@@ -365,6 +468,51 @@ int vdex_backend_006_process(const char *VdexFileName,
       LOGMSG(l_ERROR, "'classes%zu.dex' is an invalid Dex file - skipping", dex_file_idx);
       continue;
     }
+    dexFiles[dex_file_idx] = dexFileBuf;
+
+    vdexQuickenIndex_init(&quickenIndexes[dex_file_idx]);
+    if (pRunArgs->unquicken && quickInfo.size != 0 &&
+        !buildQuickenIndex(dexFileBuf, &quickening_info_ptr, quickening_info_end,
+                           &quickenIndexes[dex_file_idx])) {
+      LOGMSG(l_ERROR, "Quickening info of 'classes%zu.dex' overflows its section", dex_file_idx);
+      ret = -1;
+      goto cleanup;
+    }
+  }
+
+  if (pRunArgs->unquicken && (quickening_info_ptr != quickening_info_end)) {
+    LOGMSG(l_ERROR, "Failed to process all quickening info data");
+    ret = -1;
+    goto cleanup;
+  }
+
+  // Decompiler context reused for all methods of all Dex files
+  vdexDecompilerCtx_006 decompilerCtx;
+  memset(&decompilerCtx, 0, sizeof(vdexDecompilerCtx_006));
+  decompilerCtx.enableDisassembler = pRunArgs->enableDisassembler;
+
+  // For each Dex file
+  for (size_t dex_file_idx = 0; dex_file_idx < pVdexHeader->numberOfDexFiles; ++dex_file_idx) {
+    const u1 *dexFileBuf = dexFiles[dex_file_idx];
+    if (dexFileBuf == NULL) {
+      continue;
+    }
+    vdex_quicken_index_t *pQuickenIndex = &quickenIndexes[dex_file_idx];
+
+    // Without unquickening the output is a verbatim copy of the Dex file range of the input, apart
+    // from the repaired CRC, so it can be copied from the input file in kernel space
+    const bool passthrough = !pRunArgs->unquicken && srcFd != -1;
+
+    // Copy the Dex file to its output once and decompile it there, instead of modifying the
+    // private input mapping and writing it out afterwards
+    if (pRunArgs->directOutput && !passthrough) {
+      if (!outWriter_mapDexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
+                                dex_getFileSize(dexFileBuf), &outDexMap)) {
+        ret = -1;
+        goto cleanup;
+      }
+      dexFileBuf = outDexMap.buf;
+    }
 
     // For each class
     log_dis("file #%zu: classDefsSize=%" PRIu32 "\n", dex_file_idx,
@@ -372,7 +520,9 @@ int vdex_backend_006_process(const char *VdexFileName,
     for (u4 i = 0; i < dex_getClassDefsSize(dexFileBuf); ++i) {
       u4 lastIdx = 0;
       const dexClassDef *pDexClassDef = dex_getClassDef(dexFileBuf, i);
-      dex_dumpClassInfo(dexFileBuf, i);
+      if (pRunArgs->enableDisassembler) {
+        dex_dumpClassInfo(dexFileBuf, i);
+      }
 
       // Cursor for currently processed class data item
       const u1 *curClassDataCursor;
@@ -406,7 +556,9 @@ int vdex_backend_006_process(const char *VdexFileName,
         dexMethod curDexMethod;
         memset(&curDexMethod, 0, sizeof(dexMethod));
         dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
-        dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "direct");
+        if (pRunArgs->enableDisassembler) {
+          dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "direct");
+        }
         lastIdx += curDexMethod.methodIdx;
 
         // Skip empty methods
@@ -415,17 +567,22 @@ int vdex_backend_006_process(const char *VdexFileName,
         }
 
         if (pRunArgs->unquicken && quickInfo.size != 0) {
-          // For quickening info blob the first 4bytes are the inner blobs size
-          u4 quickening_size = *(u4 *)quickening_info_ptr;
-          quickening_info_ptr += sizeof(u4);
-          if (!vdex_decompiler_006_decompile(dexFileBuf, &curDexMethod, quickening_info_ptr,
-                                             quickening_size, true)) {
+          const vdex_quicken_entry_t *pEntry =
+              vdexQuickenIndex_claim(pQuickenIndex, curDexMethod.codeOff);
+          if (pEntry == NULL) {
+            LOGMSG(l_ERROR, "Missing quickening info for code item at offset '0x%" PRIx32 "'",
+                   curDexMethod.codeOff);
+            ret = -1;
+            goto cleanup;
+          }
+          if (!vdex_decompiler_006_decompile(&decompilerCtx, dexFileBuf, &curDexMethod,
+                                             pEntry->blob.data, pEntry->blob.size, true)) {
             LOGMSG(l_ERROR, "Failed to decompile Dex file");
-            return -1;
+            ret = -1;
+            goto cleanup;
           }
-          quickening_info_ptr += quickening_size;
         } else {
-          vdex_decompiler_006_walk(dexFileBuf, &curDexMethod);
+          vdex_decompiler_006_walk(&decompilerCtx, dexFileBuf, &curDexMethod);
         }
       }
 
@@ -435,7 +592,9 @@ int vdex_backend_006_process(const char *VdexFileName,
         dexMethod curDexMethod;
         memset(&curDexMethod, 0, sizeof(dexMethod));
         dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
-        dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "virtual");
+        if (pRunArgs->enableDisassembler) {
+          dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "virtual");
+        }
         lastIdx += curDexMethod.methodIdx;
 
         // Skip native or abstract methods
@@ -444,17 +603,22 @@ int vdex_backend_006_process(const char *VdexFileName,
         }
 
         if (pRunArgs->unquicken && quickInfo.size != 0) {
-          // For quickening info blob the first 4bytes are the inner blobs size
-          u4 quickening_size = *(u4 *)quickening_info_ptr;
-          quickening_info_ptr += sizeof(u4);
-          if (!vdex_decompiler_006_decompile(dexFileBuf, &curDexMethod, quickening_info_ptr,
-                                             quickening_size, true)) {
+          const vdex_quicken_entry_t *pEntry =
+              vdexQuickenIndex_claim(pQuickenIndex, curDexMethod.codeOff);
+          if (pEntry == NULL) {
+            LOGMSG(l_ERROR, "Missing quickening info for code item at offset '0x%" PRIx32 "'",
+                   curDexMethod.codeOff);
+            ret = -1;
+            goto cleanup;
+          }
+          if (!vdex_decompiler_006_decompile(&decompilerCtx, dexFileBuf, &curDexMethod,
+                                             pEntry->blob.data, pEntry->blob.size, true)) {
             LOGMSG(l_ERROR, "Failed to decompile Dex file");
-            return -1;
+            ret = -1;
+            goto cleanup;
           }
-          quickening_info_ptr += quickening_size;
         } else {
-          vdex_decompiler_006_walk(dexFileBuf, &curDexMethod);
+          vdex_decompiler_006_walk(&decompilerCtx, dexFileBuf, &curDexMethod);
         }
       }
     }
@@ -470,24 +634,40 @@ int vdex_backend_006_process(const char *VdexFileName,
           LOGMSG(l_ERROR,
                  "Unexpected checksum (%" PRIx32 " vs %" PRIx32 ") - failed to unquicken Dex file",
                  curChecksum, dex_getChecksum(dexFileBuf));
-          return -1;
+          ret = -1;
+          goto cleanup;
         }
       }
-    } else {
+    } else if (!passthrough) {
       // Repair CRC if not decompiling so we can still run Dex parsing tools against output
       dex_repairDexCRC(dexFileBuf, dex_getFileSize(dexFileBuf));
     }
 
-    if (!outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
-                           dex_getFileSize(dexFileBuf))) {
-      return -1;
+    if (outDexMap.buf != NULL) {
+      if (!outWriter_unmapDexFile(&outDexMap, true)) {
+        ret = -1;
+        goto cleanup;
+      }
+    } else if (passthrough) {
+      if (!outWriter_DexFileFromFd(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
+                                   dex_getFileSize(dexFileBuf), srcFd, dexFileBuf - cursor)) {
+        ret = -1;
+        goto cleanup;
+      }
+    } else if (!outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
+                                  dex_getFileSize(dexFileBuf))) {
+      ret = -1;
+      goto cleanup;
     }
   }
 
-  if (pRunArgs->unquicken && (quickening_info_ptr != quickening_info_end)) {
-    LOGMSG(l_ERROR, "Failed to process all quickening info data");
-    return -1;
+// Cleanup
+cleanup:
+  outWriter_unmapDexFile(&outDexMap, false);
+  for (size_t dex_file_idx = 0; dex_file_idx < pVdexHeader->numberOfDexFiles; ++dex_file_idx) {
+    vdexQuickenIndex_destroy(&quickenIndexes[dex_file_idx]);
   }
-
-  return pVdexHeader->numberOfDexFiles;
+  free(quickenIndexes);
+  free(dexFiles);
+  return ret;
 }
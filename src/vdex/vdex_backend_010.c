@@ -26,34 +26,61 @@
 #include "../utils.h"
 #include "vdex_common.h"
 #include "vdex_decompiler_010.h"
+#include "vdex_quicken_index.h"
 
-static const u1 *quickening_info_ptr;
-static const unaligned_u4 *current_code_item_ptr;
-static const unaligned_u4 *current_code_item_end;
-
-static void QuickeningInfoIt_Init(u4 dex_file_idx,
+static void QuickeningInfoIt_Init(vdexQuickeningInfoIt_010 *pIt,
+                                  u4 dex_file_idx,
                                   u4 numberOfDexFiles,
                                   const u1 *quicken_ptr,
                                   u4 quicken_size) {
-  quickening_info_ptr = quicken_ptr;
+  pIt->quickening_info_ptr = quicken_ptr;
   const unaligned_u4 *dex_file_indices =
       (unaligned_u4 *)(quicken_ptr + quicken_size - numberOfDexFiles * sizeof(u4));
-  current_code_item_end = (dex_file_idx == numberOfDexFiles - 1)
-                              ? dex_file_indices
-                              : (unaligned_u4 *)(quicken_ptr + dex_file_indices[dex_file_idx + 1]);
-  current_code_item_ptr = (unaligned_u4 *)(quicken_ptr + dex_file_indices[dex_file_idx]);
+  pIt->current_code_item_end =
+      (dex_file_idx == numberOfDexFiles - 1)
+          ? dex_file_indices
+          : (unaligned_u4 *)(quicken_ptr + dex_file_indices[dex_file_idx + 1]);
+  pIt->current_code_item_ptr = (unaligned_u4 *)(quicken_ptr + dex_file_indices[dex_file_idx]);
 }
 
-static bool QuickeningInfoIt_Done() { return current_code_item_ptr == current_code_item_end; }
+static bool QuickeningInfoIt_Done(const vdexQuickeningInfoIt_010 *pIt) {
+  return pIt->current_code_item_ptr == pIt->current_code_item_end;
+}
 
-static void QuickeningInfoIt_Advance() { current_code_item_ptr += 2; }
+static void QuickeningInfoIt_Advance(vdexQuickeningInfoIt_010 *pIt) {
+  pIt->current_code_item_ptr += 2;
+}
 
-static u4 QuickeningInfoIt_GetCurrentCodeItemOffset() { return current_code_item_ptr[0]; }
+static u4 QuickeningInfoIt_GetCurrentCodeItemOffset(const vdexQuickeningInfoIt_010 *pIt) {
+  return pIt->current_code_item_ptr[0];
+}
 
-static void GetCurrentQuickeningInfo(vdex_data_array_t *quickInfo) {
+static void GetCurrentQuickeningInfo(const vdexQuickeningInfoIt_010 *pIt,
+                                     vdex_data_array_t *quickInfo) {
   // Add sizeof(uint32_t) to remove the length from the data pointer.
-  quickInfo->data = quickening_info_ptr + current_code_item_ptr[1] + sizeof(u4);
-  quickInfo->size = *(unaligned_u4 *)(quickening_info_ptr + current_code_item_ptr[1]);
+  quickInfo->data = pIt->quickening_info_ptr + pIt->current_code_item_ptr[1] + sizeof(u4);
+  quickInfo->size = *(unaligned_u4 *)(pIt->quickening_info_ptr + pIt->current_code_item_ptr[1]);
+}
+
+// Index the quickening info blobs of a Dex file by code item offset
+static void buildQuickenIndex(u4 dex_file_idx,
+                              u4 numberOfDexFiles,
+                              const vdex_data_array_t *pQuickInfo,
+                              vdex_quicken_index_t *pIndex) {
+  if (pQuickInfo->size == 0) {
+    return;
+  }
+
+  vdexQuickeningInfoIt_010 quickInfoIt;
+  QuickeningInfoIt_Init(&quickInfoIt, dex_file_idx, numberOfDexFiles, pQuickInfo->data,
+                        pQuickInfo->size);
+  for (; !QuickeningInfoIt_Done(&quickInfoIt); QuickeningInfoIt_Advance(&quickInfoIt)) {
+    vdex_data_array_t blob;
+    GetCurrentQuickeningInfo(&quickInfoIt, &blob);
+    vdexQuickenIndex_add(pIndex, QuickeningInfoIt_GetCurrentCodeItemOffset(&quickInfoIt),
+                         blob.data, blob.size);
+  }
+  vdexQuickenIndex_sort(pIndex);
 }
 
 static inline u4 decodeUint32WithOverflowCheck(const u1 **in, const u1 *end) {
@@ -61,6 +88,20 @@ static inline u4 decodeUint32WithOverflowCheck(const u1 **in, const u1 *end) {
   return dex_readULeb128(in);
 }
 
+// Deps entries are decoded in batches of up to kDepsBatchSize values (a multiple of 2 and 3)
+#define kDepsBatchSize 48
+
+static inline void decodeUint32BatchWithOverflowCheck(const u1 **in,
+                                                      const u1 *end,
+                                                      u4 *pValues,
+                                                      size_t count) {
+  CHECK(dex_readULeb128BatchBounded(in, end, pValues, count));
+}
+
+static inline u4 nextDepsBatch(u4 remaining, u4 valuesPerEntry) {
+  return remaining < kDepsBatchSize / valuesPerEntry ? remaining : kDepsBatchSize / valuesPerEntry;
+}
+
 static void decodeDepStrings(const u1 **in, const u1 *end, vdexDepStrings_010 *depStrings) {
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   depStrings->strings = utils_calloc(numOfEntries * sizeof(char *));
@@ -77,9 +118,14 @@ static void decodeDepTypeSet(const u1 **in, const u1 *end, vdexDepTypeSet_010 *p
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepTypeSet->pVdexDepSets = utils_malloc(numOfEntries * sizeof(vdexDepSet_010));
   pVdexDepTypeSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepTypeSet->pVdexDepSets[i].dstIndex = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepTypeSet->pVdexDepSets[i].srcIndex = decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 2);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 2);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepTypeSet->pVdexDepSets[i].dstIndex = values[j * 2];
+      pVdexDepTypeSet->pVdexDepSets[i].srcIndex = values[j * 2 + 1];
+    }
   }
 }
 
@@ -89,9 +135,14 @@ static void decodeDepClasses(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepClassResSet->pVdexDepClasses = utils_malloc(numOfEntries * sizeof(vdexDepClassRes_010));
   pVdexDepClassResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepClassResSet->pVdexDepClasses[i].typeIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepClassResSet->pVdexDepClasses[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 2);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 2);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepClassResSet->pVdexDepClasses[i].typeIdx = values[j * 2];
+      pVdexDepClassResSet->pVdexDepClasses[i].accessFlags = values[j * 2 + 1];
+    }
   }
 }
 
@@ -101,11 +152,15 @@ static void decodeDepFields(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepFieldResSet->pVdexDepFields = utils_malloc(numOfEntries * sizeof(vdexDepFieldRes_010));
   pVdexDepFieldResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < pVdexDepFieldResSet->numberOfEntries; ++i) {
-    pVdexDepFieldResSet->pVdexDepFields[i].fieldIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepFieldResSet->pVdexDepFields[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepFieldResSet->pVdexDepFields[i].declaringClassIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 3);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 3);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepFieldResSet->pVdexDepFields[i].fieldIdx = values[j * 3];
+      pVdexDepFieldResSet->pVdexDepFields[i].accessFlags = values[j * 3 + 1];
+      pVdexDepFieldResSet->pVdexDepFields[i].declaringClassIdx = values[j * 3 + 2];
+    }
   }
 }
 
@@ -115,11 +170,15 @@ static void decodeDepMethods(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepMethodResSet->pVdexDepMethods = utils_malloc(numOfEntries * sizeof(vdexDepMethodRes_010));
   pVdexDepMethodResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepMethodResSet->pVdexDepMethods[i].methodIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepMethodResSet->pVdexDepMethods[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepMethodResSet->pVdexDepMethods[i].declaringClassIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 3);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 3);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepMethodResSet->pVdexDepMethods[i].methodIdx = values[j * 3];
+      pVdexDepMethodResSet->pVdexDepMethods[i].accessFlags = values[j * 3 + 1];
+      pVdexDepMethodResSet->pVdexDepMethods[i].declaringClassIdx = values[j * 3 + 2];
+    }
   }
 }
 
@@ -130,9 +189,13 @@ static void decodeDepUnvfyClasses(const u1 **in,
   pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses =
       utils_malloc(numOfEntries * sizeof(vdexDepUnvfyClass_010));
   pVdexDepUnvfyClassesSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses[i].typeIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 1);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses[i].typeIdx = values[j];
+    }
   }
 }
 
@@ -347,6 +410,7 @@ cleanup:
 int vdex_backend_010_process(const char *VdexFileName,
                              const u1 *cursor,
                              size_t bufSz,
+                             int srcFd,
                              const runArgs_t *pRunArgs) {
   // Basic size checks
   if (!vdex_010_SanityCheck(cursor, bufSz)) {
@@ -358,13 +422,13 @@ int vdex_backend_010_process(const char *VdexFileName,
   const u1 *dexFileBuf = NULL;
   u4 offset = 0;
 
+  // Decompiler context reused for all methods of all Dex files
+  vdexDecompilerCtx_010 decompilerCtx;
+  memset(&decompilerCtx, 0, sizeof(vdexDecompilerCtx_010));
+  decompilerCtx.enableDisassembler = pRunArgs->enableDisassembler;
+
   // For each Dex file
   for (size_t dex_file_idx = 0; dex_file_idx < pVdexHeader->numberOfDexFiles; ++dex_file_idx) {
-    vdex_data_array_t quickInfo;
-    vdex_010_GetQuickeningInfo(cursor, &quickInfo);
-    QuickeningInfoIt_Init(dex_file_idx, pVdexHeader->numberOfDexFiles, quickInfo.data,
-                          quickInfo.size);
-
     dexFileBuf = vdex_010_GetNextDexFileData(cursor, &offset);
     if (dexFileBuf == NULL) {
       LOGMSG(l_ERROR, "Failed to extract 'classes%zu.dex' - skipping", dex_file_idx);
@@ -378,13 +442,39 @@ int vdex_backend_010_process(const char *VdexFileName,
       continue;
     }
 
+    // Without unquickening the output is a verbatim copy of the Dex file range of the input, apart
+    // from the repaired CRC, so it can be copied from the input file in kernel space
+    const bool passthrough = !pRunArgs->unquicken && srcFd != -1;
+
+    // Copy the Dex file to its output once and decompile it there, instead of modifying the
+    // private input mapping and writing it out afterwards
+    outDexMap_t outDexMap;
+    memset(&outDexMap, 0, sizeof(outDexMap_t));
+    if (pRunArgs->directOutput && !passthrough) {
+      if (!outWriter_mapDexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
+                                dex_getFileSize(dexFileBuf), &outDexMap)) {
+        return -1;
+      }
+      dexFileBuf = outDexMap.buf;
+    }
+
+    vdex_data_array_t quickInfo;
+    vdex_010_GetQuickeningInfo(cursor, &quickInfo);
+    vdex_quicken_index_t quickenIndex;
+    vdexQuickenIndex_init(&quickenIndex);
+    if (pRunArgs->unquicken) {
+      buildQuickenIndex(dex_file_idx, pVdexHeader->numberOfDexFiles, &quickInfo, &quickenIndex);
+    }
+
     // For each class
     log_dis("file #%zu: classDefsSize=%" PRIu32 "\n", dex_file_idx,
             dex_getClassDefsSize(dexFileBuf));
     for (u4 i = 0; i < dex_getClassDefsSize(dexFileBuf); ++i) {
       u4 lastIdx = 0;
       const dexClassDef *pDexClassDef = dex_getClassDef(dexFileBuf, i);
-      dex_dumpClassInfo(dexFileBuf, i);
+      if (pRunArgs->enableDisassembler) {
+        dex_dumpClassInfo(dexFileBuf, i);
+      }
 
       // Cursor for currently processed class data item
       const u1 *curClassDataCursor;
@@ -418,7 +508,9 @@ int vdex_backend_010_process(const char *VdexFileName,
         dexMethod curDexMethod;
         memset(&curDexMethod, 0, sizeof(dexMethod));
         dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
-        dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "direct");
+        if (pRunArgs->enableDisassembler) {
+          dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "direct");
+        }
         lastIdx += curDexMethod.methodIdx;
 
         // Skip empty methods
@@ -428,19 +520,21 @@ int vdex_backend_010_process(const char *VdexFileName,
 
         if (pRunArgs->unquicken) {
           vdex_data_array_t curQuickInfo;
-          curQuickInfo.data = NULL;
-          curQuickInfo.size = 0;
-          if (!QuickeningInfoIt_Done() &&
-              curDexMethod.codeOff == QuickeningInfoIt_GetCurrentCodeItemOffset()) {
-            GetCurrentQuickeningInfo(&curQuickInfo);
-            QuickeningInfoIt_Advance();
+          memset(&curQuickInfo, 0, sizeof(vdex_data_array_t));
+          const vdex_quicken_entry_t *pEntry =
+              vdexQuickenIndex_claim(&quickenIndex, curDexMethod.codeOff);
+          if (pEntry != NULL) {
+            curQuickInfo = pEntry->blob;
           }
-          if (!vdex_decompiler_010_decompile(dexFileBuf, &curDexMethod, &curQuickInfo, true)) {
+          if (!vdex_decompiler_010_decompile(&decompilerCtx, dexFileBuf, &curDexMethod,
+                                             &curQuickInfo, true)) {
             LOGMSG(l_ERROR, "Failed to decompile Dex file");
+            vdexQuickenIndex_destroy(&quickenIndex);
+            outWriter_unmapDexFile(&outDexMap, false);
             return -1;
           }
         } else {
-          vdex_decompiler_010_walk(dexFileBuf, &curDexMethod);
+          vdex_decompiler_010_walk(&decompilerCtx, dexFileBuf, &curDexMethod);
         }
       }
 
@@ -450,7 +544,9 @@ int vdex_backend_010_process(const char *VdexFileName,
         dexMethod curDexMethod;
         memset(&curDexMethod, 0, sizeof(dexMethod));
         dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
-        dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "virtual");
+        if (pRunArgs->enableDisassembler) {
+          dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "virtual");
+        }
         lastIdx += curDexMethod.methodIdx;
 
         // Skip native or abstract methods
@@ -460,27 +556,32 @@ int vdex_backend_010_process(const char *VdexFileName,
 
         if (pRunArgs->unquicken) {
           vdex_data_array_t curQuickInfo;
-          curQuickInfo.data = NULL;
-          curQuickInfo.size = 0;
-          if (!QuickeningInfoIt_Done() &&
-              curDexMethod.codeOff == QuickeningInfoIt_GetCurrentCodeItemOffset()) {
-            GetCurrentQuickeningInfo(&curQuickInfo);
-            QuickeningInfoIt_Advance();
+          memset(&curQuickInfo, 0, sizeof(vdex_data_array_t));
+          const vdex_quicken_entry_t *pEntry =
+              vdexQuickenIndex_claim(&quickenIndex, curDexMethod.codeOff);
+          if (pEntry != NULL) {
+            curQuickInfo = pEntry->blob;
           }
-          if (!vdex_decompiler_010_decompile(dexFileBuf, &curDexMethod, &curQuickInfo, true)) {
+          if (!vdex_decompiler_010_decompile(&decompilerCtx, dexFileBuf, &curDexMethod,
+                                             &curQuickInfo, true)) {
             LOGMSG(l_ERROR, "Failed to decompile Dex file");
+            vdexQuickenIndex_destroy(&quickenIndex);
+            outWriter_unmapDexFile(&outDexMap, false);
             return -1;
           }
         } else {
-          vdex_decompiler_010_walk(dexFileBuf, &curDexMethod);
+          vdex_decompiler_010_walk(&decompilerCtx, dexFileBuf, &curDexMethod);
         }
       }
     }
 
     if (pRunArgs->unquicken) {
       // All QuickeningInfo data should have been consumed
-      if (!QuickeningInfoIt_Done()) {
+      bool allClaimed = vdexQuickenIndex_allClaimed(&quickenIndex);
+      vdexQuickenIndex_destroy(&quickenIndex);
+      if (!allClaimed) {
         LOGMSG(l_ERROR, "Failed to use all quickening info");
+        outWriter_unmapDexFile(&outDexMap, false);
         return -1;
       }
       // If unquicken was successful original checksum should verify
@@ -493,16 +594,26 @@ int vdex_backend_010_process(const char *VdexFileName,
           LOGMSG(l_ERROR,
                  "Unexpected checksum (%" PRIx32 " vs %" PRIx32 ") - failed to unquicken Dex file",
                  curChecksum, dex_getChecksum(dexFileBuf));
+          outWriter_unmapDexFile(&outDexMap, false);
           return -1;
         }
       }
-    } else {
+    } else if (!passthrough) {
       // Repair CRC if not decompiling so we can still run Dex parsing tools against output
       dex_repairDexCRC(dexFileBuf, dex_getFileSize(dexFileBuf));
     }
 
-    if (!outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
-                           dex_getFileSize(dexFileBuf))) {
+    if (outDexMap.buf != NULL) {
+      if (!outWriter_unmapDexFile(&outDexMap, true)) {
+        return -1;
+      }
+    } else if (passthrough) {
+      if (!outWriter_DexFileFromFd(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
+                                   dex_getFileSize(dexFileBuf), srcFd, dexFileBuf - cursor)) {
+        return -1;
+      }
+    } else if (!outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
+                                  dex_getFileSize(dexFileBuf))) {
       return -1;
     }
   }
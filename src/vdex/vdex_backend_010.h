@@ -42,7 +42,14 @@ typedef struct __attribute__((packed)) {
   vdexDepData_010 *pVdexDepData;
 } vdexDeps_010;
 
+// Iterator over the (code item offset, quickening info offset) pairs of a Dex file
+typedef struct {
+  const u1 *quickening_info_ptr;
+  const unaligned_u4 *current_code_item_ptr;
+  const unaligned_u4 *current_code_item_end;
+} vdexQuickeningInfoIt_010;
+
 void vdex_backend_010_dumpDepsInfo(const u1 *);
-int vdex_backend_010_process(const char *, const u1 *, size_t, const runArgs_t *);
+int vdex_backend_010_process(const char *, const u1 *, size_t, int, const runArgs_t *);
 
 #endif
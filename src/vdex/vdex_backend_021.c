@@ -22,26 +22,13 @@
 
 #include "vdex_backend_021.h"
 
-#include "../hashset/hashset.h"
+#include "../bitmap.h"
+#include "../cdex_converter.h"
+#include "../cdex_shared.h"
 #include "../out_writer.h"
 #include "../utils.h"
 #include "vdex_decompiler_021.h"
 
-const u4 *pCompactOffsetTable_21;
-u4 compactOffsetMinOffset_21;
-const u1 *pCompactOffsetDataBegin_21;
-
-static inline int POPCOUNT(uintptr_t x) {
-  return (sizeof(uintptr_t) == sizeof(u4)) ? __builtin_popcount(x) : __builtin_popcountll(x);
-}
-
-static void initCompactOffset(const u1 *cursor) {
-  pCompactOffsetDataBegin_21 = cursor + (2 * sizeof(u4));
-  compactOffsetMinOffset_21 = ((u4 *)cursor)[0];  // First 4 bytes are are the minimum offset
-  u4 tableOffset = ((u4 *)cursor)[1];          // Next 4 bytes are the table offset
-  pCompactOffsetTable_21 = (u4 *)(pCompactOffsetDataBegin_21 + tableOffset);
-}
-
 // This value is coupled with the leb chunk bitmask. That logic must also be adjusted when the
 // integer is modified.
 static const size_t kElementsPerIndex = 16;
@@ -50,29 +37,58 @@ static const size_t kElementsPerIndex = 16;
 // [uint16_t] 16 bit mask for what indexes actually have a non zero offset for the chunk.
 // [lebs] Up to 16 lebs encoded using leb128, one leb bit. The leb specifies how the offset
 // changes compared to the previous index.
-static u4 getOffset(u4 index) {
-  const u4 offset = pCompactOffsetTable_21[index / kElementsPerIndex];
-  const size_t bit_index = index % kElementsPerIndex;
-
-  const u1 *block = pCompactOffsetDataBegin_21 + offset;
+static void decodeCompactOffsetBlock(const vdexCompactOffsetTable_021 *pOffTable,
+                                     u4 blockIdx,
+                                     u4 *pOffsets,
+                                     size_t offsetsCnt) {
+  const u1 *block = pOffTable->pDataBegin + pOffTable->pTable[blockIdx];
   u2 bit_mask = *block;
   ++block;
   bit_mask = (bit_mask << kBitsPerByte) | *block;
   ++block;
-  if ((bit_mask & (1 << bit_index)) == 0) {
-    // Bit is not set means the offset is 0.
-    return 0u;
-  }
-  // Trim off the bits above the index we want and count how many bits are set. This is how many
-  // lebs we need to decode.
-  size_t count = POPCOUNT((uintptr_t)(bit_mask) << (kBitsPerIntPtrT - 1 - bit_index));
-  CHECK_GT(count, 0u);
-  u4 current_offset = compactOffsetMinOffset_21;
-  do {
-    current_offset += dex_readULeb128(&block);
-    --count;
-  } while (count > 0);
-  return current_offset;
+
+  // Offsets of the indexes with a set bit are a running sum over the block's lebs. Bit not set
+  // means the offset is 0.
+  u4 current_offset = pOffTable->minOffset;
+  for (size_t bit_index = 0; bit_index < offsetsCnt; ++bit_index) {
+    if ((bit_mask & (1 << bit_index)) == 0) {
+      pOffsets[bit_index] = 0u;
+    } else {
+      current_offset += dex_readULeb128(&block);
+      pOffsets[bit_index] = current_offset;
+    }
+  }
+}
+
+// Decode the whole compact offset table once, so that the per method lookup is a single load
+static void initCompactOffset(vdexCompactOffsetTable_021 *pOffTable,
+                              const u1 *cursor,
+                              u4 numberOfIndexes) {
+  pOffTable->pDataBegin = cursor + (2 * sizeof(u4));
+  pOffTable->minOffset = ((u4 *)cursor)[0];  // First 4 bytes are are the minimum offset
+  u4 tableOffset = ((u4 *)cursor)[1];        // Next 4 bytes are the table offset
+  pOffTable->pTable = (u4 *)(pOffTable->pDataBegin + tableOffset);
+
+  pOffTable->offsets = utils_malloc((numberOfIndexes + 1) * sizeof(u4));
+  pOffTable->numberOfIndexes = numberOfIndexes;
+  for (u4 index = 0; index < numberOfIndexes; index += kElementsPerIndex) {
+    size_t offsetsCnt = numberOfIndexes - index;
+    if (offsetsCnt > kElementsPerIndex) {
+      offsetsCnt = kElementsPerIndex;
+    }
+    decodeCompactOffsetBlock(pOffTable, index / kElementsPerIndex, &pOffTable->offsets[index],
+                             offsetsCnt);
+  }
+}
+
+static void destroyCompactOffset(vdexCompactOffsetTable_021 *pOffTable) {
+  free(pOffTable->offsets);
+  pOffTable->offsets = NULL;
+}
+
+static u4 getOffset(const vdexCompactOffsetTable_021 *pOffTable, u4 index) {
+  CHECK_LT(index, pOffTable->numberOfIndexes);
+  return pOffTable->offsets[index];
 }
 
 static size_t quickenInfoTableSizeInBytes(const u1 *data, u4 dataSize) {
@@ -99,6 +115,20 @@ static inline u4 decodeUint32WithOverflowCheck(const u1 **in, const u1 *end) {
   return dex_readULeb128(in);
 }
 
+// Deps entries are decoded in batches of up to kDepsBatchSize values (a multiple of 2 and 3)
+#define kDepsBatchSize 48
+
+static inline void decodeUint32BatchWithOverflowCheck(const u1 **in,
+                                                      const u1 *end,
+                                                      u4 *pValues,
+                                                      size_t count) {
+  CHECK(dex_readULeb128BatchBounded(in, end, pValues, count));
+}
+
+static inline u4 nextDepsBatch(u4 remaining, u4 valuesPerEntry) {
+  return remaining < kDepsBatchSize / valuesPerEntry ? remaining : kDepsBatchSize / valuesPerEntry;
+}
+
 static void decodeDepStrings(const u1 **in, const u1 *end, vdexDepStrings_021 *depStrings) {
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   depStrings->strings = utils_calloc(numOfEntries * sizeof(char *));
@@ -115,9 +145,14 @@ static void decodeDepTypeSet(const u1 **in, const u1 *end, vdexDepTypeSet_021 *p
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepTypeSet->pVdexDepSets = utils_malloc(numOfEntries * sizeof(vdexDepSet_021));
   pVdexDepTypeSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepTypeSet->pVdexDepSets[i].dstIndex = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepTypeSet->pVdexDepSets[i].srcIndex = decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 2);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 2);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepTypeSet->pVdexDepSets[i].dstIndex = values[j * 2];
+      pVdexDepTypeSet->pVdexDepSets[i].srcIndex = values[j * 2 + 1];
+    }
   }
 }
 
@@ -127,9 +162,14 @@ static void decodeDepClasses(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepClassResSet->pVdexDepClasses = utils_malloc(numOfEntries * sizeof(vdexDepClassRes_021));
   pVdexDepClassResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepClassResSet->pVdexDepClasses[i].typeIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepClassResSet->pVdexDepClasses[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 2);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 2);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepClassResSet->pVdexDepClasses[i].typeIdx = values[j * 2];
+      pVdexDepClassResSet->pVdexDepClasses[i].accessFlags = values[j * 2 + 1];
+    }
   }
 }
 
@@ -139,11 +179,15 @@ static void decodeDepFields(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepFieldResSet->pVdexDepFields = utils_malloc(numOfEntries * sizeof(vdexDepFieldRes_021));
   pVdexDepFieldResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < pVdexDepFieldResSet->numberOfEntries; ++i) {
-    pVdexDepFieldResSet->pVdexDepFields[i].fieldIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepFieldResSet->pVdexDepFields[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepFieldResSet->pVdexDepFields[i].declaringClassIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 3);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 3);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepFieldResSet->pVdexDepFields[i].fieldIdx = values[j * 3];
+      pVdexDepFieldResSet->pVdexDepFields[i].accessFlags = values[j * 3 + 1];
+      pVdexDepFieldResSet->pVdexDepFields[i].declaringClassIdx = values[j * 3 + 2];
+    }
   }
 }
 
@@ -153,11 +197,15 @@ static void decodeDepMethods(const u1 **in,
   u4 numOfEntries = decodeUint32WithOverflowCheck(in, end);
   pVdexDepMethodResSet->pVdexDepMethods = utils_malloc(numOfEntries * sizeof(vdexDepMethodRes_021));
   pVdexDepMethodResSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepMethodResSet->pVdexDepMethods[i].methodIdx = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepMethodResSet->pVdexDepMethods[i].accessFlags = decodeUint32WithOverflowCheck(in, end);
-    pVdexDepMethodResSet->pVdexDepMethods[i].declaringClassIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 3);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch * 3);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepMethodResSet->pVdexDepMethods[i].methodIdx = values[j * 3];
+      pVdexDepMethodResSet->pVdexDepMethods[i].accessFlags = values[j * 3 + 1];
+      pVdexDepMethodResSet->pVdexDepMethods[i].declaringClassIdx = values[j * 3 + 2];
+    }
   }
 }
 
@@ -168,9 +216,13 @@ static void decodeDepUnvfyClasses(const u1 **in,
   pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses =
       utils_malloc(numOfEntries * sizeof(vdexDepUnvfyClass_021));
   pVdexDepUnvfyClassesSet->numberOfEntries = numOfEntries;
-  for (u4 i = 0; i < numOfEntries; ++i) {
-    pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses[i].typeIdx =
-        decodeUint32WithOverflowCheck(in, end);
+  u4 values[kDepsBatchSize];
+  for (u4 i = 0; i < numOfEntries;) {
+    u4 batch = nextDepsBatch(numOfEntries - i, 1);
+    decodeUint32BatchWithOverflowCheck(in, end, values, batch);
+    for (u4 j = 0; j < batch; ++j, ++i) {
+      pVdexDepUnvfyClassesSet->pVdexDepUnvfyClasses[i].typeIdx = values[j];
+    }
   }
 }
 
@@ -390,288 +442,487 @@ cleanup:
   destroyDepsInfo(pVdexDeps);
 }
 
-int vdex_backend_021_process(const char *VdexFileName,
-                             const u1 *cursor,
-                             size_t bufSz,
-                             const runArgs_t *pRunArgs) {
-  int ret = 0;
-
-  // Basic size checks
-  if (!vdex_021_SanityCheck(cursor, bufSz)) {
-    LOGMSG(l_ERROR, "Malformed Vdex file");
-    return -1;
-  }
-
-  // Not all Vdex files have Dex data to process
-  if (!vdex_021_hasDexSection(cursor)) {
-    LOGMSG(l_DEBUG, "Vdex has no Dex data - skipping");
-    return 0;
+// Map a code item to its bit in the dedup bitmap
+static bool getCodeItemBit(const vdexClassShards_021 *pShards, const u2 *pCode, size_t *pBit) {
+  const u1 *pCodeItem = (const u1 *)pCode;
+  if (pCodeItem < pShards->pDataBegin ||
+      pCodeItem >= pShards->pDataBegin + (pShards->nCodeItemBits << pShards->codeItemShift)) {
+    LOGMSG(l_ERROR, "Code item at offset '0x%tx' is out of the data section",
+           pCodeItem - pShards->dexFileBuf);
+    return false;
   }
+  *pBit = (pCodeItem - pShards->pDataBegin) >> pShards->codeItemShift;
+  return true;
+}
 
-  const vdexHeader_021 *pVdexHeader = (const vdexHeader_021 *)cursor;
-  const u1 *dexFileBuf = NULL;
-  u4 offset = 0;
-
-  // For each Dex file
-  for (size_t dex_file_idx = 0; dex_file_idx < pVdexHeader->numberOfDexFiles; ++dex_file_idx) {
-    dexFileBuf = vdex_021_GetNextDexFileData(cursor, &offset);
-    if (dexFileBuf == NULL) {
-      LOGMSG(l_ERROR, "Failed to extract 'classes%zu.dex' - skipping", dex_file_idx);
-      continue;
-    }
-
-    // Check if valid Dex or CompactDex file
-    dex_dumpHeaderInfo(dexFileBuf);
-    if (!dex_isValidDex(dexFileBuf) && !dex_isValidCDex(dexFileBuf)) {
-      LOGMSG(l_ERROR, "'classes%zu.dex' is an invalid Dex file - skipping", dex_file_idx);
-      continue;
+// Process a range of the class definitions of a Dex file. Returns false on error.
+static bool processClassShard(void *arg,
+                              size_t workerIdx __attribute__((unused)),
+                              size_t shardIdx) {
+  const vdexClassShards_021 *pShards = (const vdexClassShards_021 *)arg;
+  const u1 *dexFileBuf = pShards->dexFileBuf;
+  const runArgs_t *pRunArgs = pShards->pRunArgs;
+  const vdex_data_array_t *pQuickenInfo = pShards->pQuickenInfo;
+  const u4 classBegin = (u8)pShards->classDefsSize * shardIdx / pShards->shardCnt;
+  const u4 classEnd = (u8)pShards->classDefsSize * (shardIdx + 1) / pShards->shardCnt;
+
+  // Decompiler context reused for all methods of the shard
+  vdexDecompilerCtx_021 decompilerCtx;
+  memset(&decompilerCtx, 0, sizeof(vdexDecompilerCtx_021));
+  decompilerCtx.enableDisassembler = pRunArgs->enableDisassembler;
+
+  bool classDataModified = false;
+  for (u4 i = classBegin; i < classEnd; ++i) {
+    const dexClassDef *pDexClassDef = dex_getClassDef(dexFileBuf, i);
+
+    if (pRunArgs->enableDisassembler) {
+      dex_dumpClassInfo(dexFileBuf, i);
     }
 
-    vdex_data_array_t quickenInfo, quickenInfoOffTable;
-    vdex_021_GetQuickeningInfo(cursor, &quickenInfo);
+    // Last read field or method index to apply delta to
+    u4 lastIdx = 0;
 
-    // Check if there is something to decompile
-    if (quickenInfo.size == 0) {
-      LOGMSG(l_DEBUG, "Nothing to decompile in 'classes%zu.dex'", dex_file_idx);
+    // Cursor for currently processed class data item
+    const u1 *curClassDataCursor;
+    if (pDexClassDef->classDataOff == 0) {
+      continue;
     } else {
-      vdex_021_GetQuickenInfoOffsetTable(dexFileBuf, &quickenInfo, &quickenInfoOffTable);
-      initCompactOffset(quickenInfoOffTable.data);
+      curClassDataCursor = dex_getDataAddr(dexFileBuf) + pDexClassDef->classDataOff;
     }
 
-    // Make sure to not unquicken the same code item multiple times.
-    hashset_t unquickened_code_items = hashset_create();
-    if (!unquickened_code_items) {
-      LOGMSG(l_ERROR, "Failed to create hashset");
-      return -1;
-    }
-
-    // For each class
-    log_dis("file #%zu: classDefsSize=%" PRIu32 "\n", dex_file_idx,
-            dex_getClassDefsSize(dexFileBuf));
-    for (u4 i = 0; i < dex_getClassDefsSize(dexFileBuf); ++i) {
-      const dexClassDef *pDexClassDef = dex_getClassDef(dexFileBuf, i);
-
-      dex_dumpClassInfo(dexFileBuf, i);
-
-      // Last read field or method index to apply delta to
-      u4 lastIdx = 0;
-
-      // Cursor for currently processed class data item
-      const u1 *curClassDataCursor;
-      if (pDexClassDef->classDataOff == 0) {
-        continue;
-      } else {
-        curClassDataCursor = dex_getDataAddr(dexFileBuf) + pDexClassDef->classDataOff;
+    dexClassDataHeader pDexClassDataHeader;
+    memset(&pDexClassDataHeader, 0, sizeof(dexClassDataHeader));
+    dex_readClassDataHeader(&curClassDataCursor, &pDexClassDataHeader);
+
+    // Skip static fields
+    for (u4 j = 0; j < pDexClassDataHeader.staticFieldsSize; ++j) {
+      dexField pDexField;
+      memset(&pDexField, 0, sizeof(dexField));
+      // APIs are unhidden regardless if we're decompiling or not
+      if (dex_readClassDataFieldUnhide(&curClassDataCursor, &pDexField)) {
+        classDataModified = true;
       }
+    }
 
-      dexClassDataHeader pDexClassDataHeader;
-      memset(&pDexClassDataHeader, 0, sizeof(dexClassDataHeader));
-      dex_readClassDataHeader(&curClassDataCursor, &pDexClassDataHeader);
-
-      // Skip static fields
-      for (u4 j = 0; j < pDexClassDataHeader.staticFieldsSize; ++j) {
-        dexField pDexField;
-        memset(&pDexField, 0, sizeof(dexField));
-        dex_readClassDataField(&curClassDataCursor, &pDexField);
-
-        // APIs are unhidden regardless if we're decompiling or not
-        dex_unhideAccessFlags((u1 *)curClassDataCursor,
-                              dex_decodeAccessFlagsFromDex(pDexField.accessFlags), false);
+    // Skip instance fields
+    for (u4 j = 0; j < pDexClassDataHeader.instanceFieldsSize; ++j) {
+      dexField pDexField;
+      memset(&pDexField, 0, sizeof(dexField));
+      // APIs are unhidden regardless if we're decompiling or not
+      if (dex_readClassDataFieldUnhide(&curClassDataCursor, &pDexField)) {
+        classDataModified = true;
       }
+    }
 
-      // Skip instance fields
-      for (u4 j = 0; j < pDexClassDataHeader.instanceFieldsSize; ++j) {
-        dexField pDexField;
-        memset(&pDexField, 0, sizeof(dexField));
-        dex_readClassDataField(&curClassDataCursor, &pDexField);
-
-        // APIs are unhidden regardless if we're decompiling or not
-        dex_unhideAccessFlags((u1 *)curClassDataCursor,
-                              dex_decodeAccessFlagsFromDex(pDexField.accessFlags), false);
+    // For each direct method
+    lastIdx = 0;
+    for (u4 j = 0; j < pDexClassDataHeader.directMethodsSize; ++j) {
+      dexMethod curDexMethod;
+      memset(&curDexMethod, 0, sizeof(dexMethod));
+      // APIs are unhidden regardless if we're decompiling or not
+      if (dex_readClassDataMethodUnhide(&curClassDataCursor, &curDexMethod)) {
+        classDataModified = true;
       }
-
-      // For each direct method
-      lastIdx = 0;
-      for (u4 j = 0; j < pDexClassDataHeader.directMethodsSize; ++j) {
-        dexMethod curDexMethod;
-        memset(&curDexMethod, 0, sizeof(dexMethod));
-        dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
+      if (pRunArgs->enableDisassembler) {
         dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "direct");
+      }
 
-        // APIs are unhidden regardless if we're decompiling or not
-        dex_unhideAccessFlags((u1 *)curClassDataCursor,
-                              dex_decodeAccessFlagsFromDex(curDexMethod.accessFlags), true);
+      // Skip empty methods
+      if (curDexMethod.codeOff == 0) {
+        goto next_dmethod;
+      }
 
-        // Skip empty methods
-        if (curDexMethod.codeOff == 0) {
+      if (pRunArgs->unquicken) {
+        // Check if we've already unquickened the code item
+        u2 *pCode = NULL;
+        u4 codeSize = 0;
+        dex_getCodeItemInfo(dexFileBuf, &curDexMethod, &pCode, &codeSize);
+        size_t codeItemBit = 0;
+        if (!getCodeItemBit(pShards, pCode, &codeItemBit)) {
+          return false;
+        }
+        if (bitmap_testAndSet(pShards->pUnquickenedCodeItems, codeItemBit)) {
+          vdex_decompiler_021_walk(&decompilerCtx, dexFileBuf, &curDexMethod);
           goto next_dmethod;
         }
 
-        if (pRunArgs->unquicken) {
-          // Check if we've already unquickened the code item
-          u2 *pCode = NULL;
-          u4 codeSize = 0;
-          dex_getCodeItemInfo(dexFileBuf, &curDexMethod, &pCode, &codeSize);
-          if (hashset_is_member(unquickened_code_items, (void *)pCode)) {
-            vdex_decompiler_021_walk(dexFileBuf, &curDexMethod);
-            goto next_dmethod;
-          }
-
-          // Since new code item, add to set
-          hashset_add(unquickened_code_items, (void *)pCode);
-
-          // Offset being 0 means not quickened.
-          const u4 qOffset = getOffset(lastIdx + curDexMethod.methodIdx);
-
-          // Get quickenData for method and decompile
-          vdex_data_array_t quickenData;
-          memset(&quickenData, 0, sizeof(vdex_data_array_t));
-          if (quickenInfo.size != 0 && qOffset != 0u) {
-            getQuickeningInfoAt(&quickenInfo, qOffset, &quickenData);
-          }
-
-          if (!vdex_decompiler_021_decompile(dexFileBuf, &curDexMethod, &quickenData, true)) {
-            LOGMSG(l_ERROR, "Failed to decompile Dex file");
-            hashset_destroy(unquickened_code_items);
-            return -1;
-          }
-
-        next_dmethod:
-          // Update lastIdx since followings delta_idx are based on 1st elements idx
-          lastIdx += curDexMethod.methodIdx;
-        } else {
-          vdex_decompiler_021_walk(dexFileBuf, &curDexMethod);
+        // Offset being 0 means not quickened.
+        const u4 qOffset =
+            pQuickenInfo->size != 0
+                ? getOffset(pShards->pCompactOffsetTable, lastIdx + curDexMethod.methodIdx)
+                : 0u;
+
+        // Get quickenData for method and decompile
+        vdex_data_array_t quickenData;
+        memset(&quickenData, 0, sizeof(vdex_data_array_t));
+        if (pQuickenInfo->size != 0 && qOffset != 0u) {
+          getQuickeningInfoAt(pQuickenInfo, qOffset, &quickenData);
+        }
+
+        if (!vdex_decompiler_021_decompile(&decompilerCtx, dexFileBuf, &curDexMethod,
+                                           &quickenData, true)) {
+          LOGMSG(l_ERROR, "Failed to decompile Dex file");
+          return false;
         }
-      }  // EOF direct methods iterator
-
-      // For each virtual method
-      lastIdx = 0;
-      for (u4 j = 0; j < pDexClassDataHeader.virtualMethodsSize; ++j) {
-        dexMethod curDexMethod;
-        memset(&curDexMethod, 0, sizeof(dexMethod));
-        dex_readClassDataMethod(&curClassDataCursor, &curDexMethod);
+
+      next_dmethod:
+        // Update lastIdx since followings delta_idx are based on 1st elements idx
+        lastIdx += curDexMethod.methodIdx;
+      } else {
+        vdex_decompiler_021_walk(&decompilerCtx, dexFileBuf, &curDexMethod);
+      }
+    }  // EOF direct methods iterator
+
+    // For each virtual method
+    lastIdx = 0;
+    for (u4 j = 0; j < pDexClassDataHeader.virtualMethodsSize; ++j) {
+      dexMethod curDexMethod;
+      memset(&curDexMethod, 0, sizeof(dexMethod));
+      // APIs are unhidden regardless if we're decompiling or not
+      if (dex_readClassDataMethodUnhide(&curClassDataCursor, &curDexMethod)) {
+        classDataModified = true;
+      }
+      if (pRunArgs->enableDisassembler) {
         dex_dumpMethodInfo(dexFileBuf, &curDexMethod, lastIdx, "virtual");
+      }
 
-        // APIs are unhidden regardless if we're decompiling or not
-        dex_unhideAccessFlags((u1 *)curClassDataCursor,
-                              dex_decodeAccessFlagsFromDex(curDexMethod.accessFlags), true);
+      // Skip native or abstract methods
+      if (curDexMethod.codeOff == 0) {
+        goto next_vmethod;
+      }
 
-        // Skip native or abstract methods
-        if (curDexMethod.codeOff == 0) {
+      if (pRunArgs->unquicken) {
+        // Check if we've already unquickened the code item
+        u2 *pCode = NULL;
+        u4 codeSize = 0;
+        dex_getCodeItemInfo(dexFileBuf, &curDexMethod, &pCode, &codeSize);
+        size_t codeItemBit = 0;
+        if (!getCodeItemBit(pShards, pCode, &codeItemBit)) {
+          return false;
+        }
+        if (bitmap_testAndSet(pShards->pUnquickenedCodeItems, codeItemBit)) {
+          vdex_decompiler_021_walk(&decompilerCtx, dexFileBuf, &curDexMethod);
           goto next_vmethod;
         }
 
-        if (pRunArgs->unquicken) {
-          // Check if we've already unquickened the code item
-          u2 *pCode = NULL;
-          u4 codeSize = 0;
-          dex_getCodeItemInfo(dexFileBuf, &curDexMethod, &pCode, &codeSize);
-          if (hashset_is_member(unquickened_code_items, (void *)pCode)) {
-            vdex_decompiler_021_walk(dexFileBuf, &curDexMethod);
-            goto next_vmethod;
-          }
-
-          // Since new code item, add to set
-          hashset_add(unquickened_code_items, (void *)pCode);
-
-          // Offset being 0 means not quickened.
-          const u4 qOffset = getOffset(lastIdx + curDexMethod.methodIdx);
-
-          // Get quickenData for method and decompile
-          vdex_data_array_t quickenData;
-          memset(&quickenData, 0, sizeof(vdex_data_array_t));
-          if (quickenInfo.size != 0 && qOffset != 0u) {
-            getQuickeningInfoAt(&quickenInfo, qOffset, &quickenData);
-          }
-
-          if (!vdex_decompiler_021_decompile(dexFileBuf, &curDexMethod, &quickenData, true)) {
-            LOGMSG(l_ERROR, "Failed to decompile Dex file");
-            hashset_destroy(unquickened_code_items);
-            return -1;
-          }
-
-        next_vmethod:
-          // Update lastIdx since followings delta_idx are based on 1st elements idx
-          lastIdx += curDexMethod.methodIdx;
-        } else {
-          vdex_decompiler_021_walk(dexFileBuf, &curDexMethod);
+        // Offset being 0 means not quickened.
+        const u4 qOffset =
+            pQuickenInfo->size != 0
+                ? getOffset(pShards->pCompactOffsetTable, lastIdx + curDexMethod.methodIdx)
+                : 0u;
+
+        // Get quickenData for method and decompile
+        vdex_data_array_t quickenData;
+        memset(&quickenData, 0, sizeof(vdex_data_array_t));
+        if (pQuickenInfo->size != 0 && qOffset != 0u) {
+          getQuickeningInfoAt(pQuickenInfo, qOffset, &quickenData);
+        }
+
+        if (!vdex_decompiler_021_decompile(&decompilerCtx, dexFileBuf, &curDexMethod,
+                                           &quickenData, true)) {
+          LOGMSG(l_ERROR, "Failed to decompile Dex file");
+          return false;
         }
-      }  // EOF virtual methods iterator
-    }
 
-    // Destroy hashset for current dex file
-    hashset_destroy(unquickened_code_items);
+      next_vmethod:
+        // Update lastIdx since followings delta_idx are based on 1st elements idx
+        lastIdx += curDexMethod.methodIdx;
+      } else {
+        vdex_decompiler_021_walk(&decompilerCtx, dexFileBuf, &curDexMethod);
+      }
+    }  // EOF virtual methods iterator
+  }
 
-    // Some adjustments that are needed for the deduplicated shared data section
-    const u1 *dataBuf = NULL;
-    u4 dataSize = 0;
-    if (dex_checkType(dexFileBuf) == kCompactDex) {
-      cdexHeader *pCdexHeader = (cdexHeader *)dexFileBuf;
-      u4 mainSectionSize = pCdexHeader->fileSize;
-      u4 shared_section_size = pCdexHeader->dataSize;
-      const u1 *origDataAddr = dex_getDataAddr(dexFileBuf);
+  if (classDataModified) {
+    __atomic_store_n(pShards->pClassDataModified, true, __ATOMIC_RELAXED);
+  }
+  return true;
+}
 
-      // The shared section will be serialized right after the dex file.
-      pCdexHeader->dataOff = pCdexHeader->fileSize;
-      pCdexHeader->fileSize += shared_section_size;
+// Process a single Dex file of the Vdex. Returns false if processing of the Vdex must be aborted.
+static bool processDexFile(void *arg, size_t workerIdx, size_t dex_file_idx) {
+  vdexDexJobs_021 *pDexJobs = (vdexDexJobs_021 *)arg;
+  const char *VdexFileName = pDexJobs->VdexFileName;
+  const u1 *cursor = pDexJobs->cursor;
+  const runArgs_t *pRunArgs = pDexJobs->pRunArgs;
+  const u1 *dexFileBuf = pDexJobs->dexFiles[dex_file_idx];
+  bool ret = true;
+
+  if (dexFileBuf == NULL) {
+    LOGMSG(l_ERROR, "Failed to extract 'classes%zu.dex' - skipping", dex_file_idx);
+    return true;
+  }
 
-      // Allocate a new map
-      const u1 *cdexBuf = utils_malloc(pCdexHeader->fileSize);
+  // Check if valid Dex or CompactDex file
+  dex_dumpHeaderInfo(dexFileBuf);
+  if (!dex_isValidDex(dexFileBuf) && !dex_isValidCDex(dexFileBuf)) {
+    LOGMSG(l_ERROR, "'classes%zu.dex' is an invalid Dex file - skipping", dex_file_idx);
+    return true;
+  }
 
-      // Copy main section
-      memcpy((void *)cdexBuf, dexFileBuf, mainSectionSize);
+  vdex_data_array_t quickenInfo, quickenInfoOffTable;
+  vdex_021_GetQuickeningInfo(cursor, &quickenInfo);
+
+  // Check if there is something to decompile
+  vdexCompactOffsetTable_021 compactOffsetTable;
+  memset(&compactOffsetTable, 0, sizeof(vdexCompactOffsetTable_021));
+  if (quickenInfo.size == 0) {
+    LOGMSG(l_DEBUG, "Nothing to decompile in 'classes%zu.dex'", dex_file_idx);
+  } else if (pRunArgs->unquicken) {
+    vdex_021_GetQuickenInfoOffsetTable(dexFileBuf, &quickenInfo, &quickenInfoOffTable);
+    initCompactOffset(&compactOffsetTable, quickenInfoOffTable.data,
+                      dex_getMethodIdsSize(dexFileBuf));
+  }
 
-      // Copy data section
-      memcpy((void *)(cdexBuf + mainSectionSize), origDataAddr, shared_section_size);
+  // Copy a StandardDex file to its output once and decompile it there, instead of modifying the
+  // private input mapping and writing it out afterwards. CompactDex output is written along with
+  // the shared data section after processing, so it keeps using its own writer.
+  outDexMap_t outDexMap;
+  memset(&outDexMap, 0, sizeof(outDexMap_t));
+  if (pRunArgs->directOutput && dex_checkType(dexFileBuf) == kNormalDex) {
+    if (!outWriter_mapDexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf,
+                              dex_getFileSize(dexFileBuf), &outDexMap)) {
+      destroyCompactOffset(&compactOffsetTable);
+      return false;
+    }
+    dexFileBuf = outDexMap.buf;
+  }
 
-      dataBuf = cdexBuf;
-      dataSize = pCdexHeader->fileSize;
-    } else {
-      dataBuf = dexFileBuf;
-      dataSize = dex_getFileSize(dexFileBuf);
+  bool classDataModified = false;
+
+  // Make sure to not unquicken the same code item multiple times. Code items are 4-byte aligned
+  // in StandardDex and 2-byte aligned in CompactDex.
+  vdexClassShards_021 classShards = {
+    .dexFileBuf = dexFileBuf,
+    .pRunArgs = pRunArgs,
+    .pQuickenInfo = &quickenInfo,
+    .pCompactOffsetTable = &compactOffsetTable,
+    .pDataBegin = dexFileBuf + dex_getDataOff(dexFileBuf),
+    .codeItemShift = dex_checkType(dexFileBuf) == kNormalDex ? 2 : 1,
+    .classDefsSize = dex_getClassDefsSize(dexFileBuf),
+    .shardCnt = 1,
+    .pClassDataModified = &classDataModified,
+  };
+  if (dex_checkType(dexFileBuf) == kCompactDex) {
+    // Shared data code items can be referenced from several CompactDex files of the Vdex, which are
+    // processed concurrently, so they're deduplicated in a single bitmap
+    classShards.pDataBegin = pDexJobs->pCdexDataBegin;
+    classShards.nCodeItemBits = pDexJobs->nCdexCodeItemBits;
+    classShards.pUnquickenedCodeItems = pDexJobs->pCdexCodeItems;
+  } else {
+    classShards.nCodeItemBits = dex_getDataSize(dexFileBuf) >> classShards.codeItemShift;
+    classShards.pUnquickenedCodeItems = bitmap_getPooled(workerIdx);
+    bitmap_reset(classShards.pUnquickenedCodeItems, classShards.nCodeItemBits);
+  }
+
+  // For each class
+  log_dis("file #%zu: classDefsSize=%" PRIu32 "\n", dex_file_idx,
+          dex_getClassDefsSize(dexFileBuf));
+  if (pRunArgs->classJobs > 1 && classShards.classDefsSize > 1) {
+    classShards.shardCnt = (size_t)pRunArgs->classJobs * kClassShardsPerJob;
+    if (classShards.shardCnt > classShards.classDefsSize) {
+      classShards.shardCnt = classShards.classDefsSize;
     }
+  }
+  bool shardsOk;
+  if (classShards.shardCnt > 1) {
+    shardsOk = utils_runParallel(pRunArgs->classJobs, classShards.shardCnt, processClassShard,
+                                 &classShards);
+  } else {
+    shardsOk = processClassShard(&classShards, 0, 0);
+  }
+  destroyCompactOffset(&compactOffsetTable);
+  if (!shardsOk) {
+    outWriter_unmapDexFile(&outDexMap, false);
+    return false;
+  }
+
+  // CompactDex files share the data section that they refer to, so they're written once all Dex
+  // files of the Vdex have been unquickened (see writeCdexFile())
+  if (dex_checkType(dexFileBuf) == kCompactDex) {
+    return true;
+  }
 
-    if (pRunArgs->unquicken) {
-      // TODO: Update this after a method to convert CDEX->DEX is decided
-      if (dex_checkType(dataBuf) == kCompactDex) {
+  // Without unquickening and hiddenapi flags to remove, a StandardDex output is a verbatim copy of
+  // the Dex file range of the input, apart from the repaired CRC, so it can be copied from the
+  // input file in kernel space
+  const bool passthrough = !pRunArgs->unquicken && !classDataModified && outDexMap.buf == NULL &&
+                           pDexJobs->srcFd != -1;
+
+  const u1 *dataBuf = dexFileBuf;
+  u4 dataSize = dex_getFileSize(dexFileBuf);
+  if (pRunArgs->unquicken) {
+    // If unquicken was successful original checksum should verify
+    u4 curChecksum = dex_computeDexCRC(dataBuf, dataSize);
+    if (curChecksum != dex_getChecksum(dataBuf)) {
+      // If ignore CRC errors is enabled, repair CRC (see issue #3)
+      if (pRunArgs->ignoreCrc) {
         dex_repairDexCRC(dataBuf, dataSize);
       } else {
-        // If unquicken was successful original checksum should verify
-        u4 curChecksum = dex_computeDexCRC(dataBuf, dataSize);
-        if (curChecksum != dex_getChecksum(dataBuf)) {
-          // If ignore CRC errors is enabled, repair CRC (see issue #3)
-          if (pRunArgs->ignoreCrc) {
-            dex_repairDexCRC(dataBuf, dataSize);
-          } else {
-            LOGMSG(l_ERROR,
-                   "Unexpected checksum (%" PRIx32 " vs %" PRIx32
-                   ") - failed to unquicken Dex file",
-                   curChecksum, dex_getChecksum(dataBuf));
-            ret = -1;
-            goto loop_end;
-          }
-        }
+        LOGMSG(l_ERROR,
+               "Unexpected checksum (%" PRIx32 " vs %" PRIx32 ") - failed to unquicken Dex file",
+               curChecksum, dex_getChecksum(dataBuf));
+        ret = false;
+        goto cleanup;
       }
-    } else {
-      // Repair CRC if not decompiling so we can still run Dex parsing tools against output
-      dex_repairDexCRC(dataBuf, dataSize);
     }
+  } else if (!passthrough) {
+    // Repair CRC if not decompiling so we can still run Dex parsing tools against output
+    dex_repairDexCRC(dataBuf, dataSize);
+  }
 
-    if (!outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dataBuf, dataSize)) {
-      ret = -1;
-      goto loop_end;
+  if (outDexMap.buf != NULL) {
+    if (!outWriter_unmapDexFile(&outDexMap, true)) {
+      ret = false;
+      goto cleanup;
+    }
+  } else if (passthrough) {
+    if (!outWriter_DexFileFromFd(pRunArgs, VdexFileName, dex_file_idx, dataBuf, dataSize,
+                                 pDexJobs->srcFd, dataBuf - pDexJobs->cursor)) {
+      ret = false;
+      goto cleanup;
     }
+  } else if (!outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dataBuf, dataSize)) {
+    ret = false;
+    goto cleanup;
+  }
+
+cleanup:
+  outWriter_unmapDexFile(&outDexMap, false);
+  return ret;
+}
 
-  loop_end:
-    if (dex_checkType(dataBuf) == kCompactDex) {
-      free((void *)dataBuf);
+// Write a CompactDex file of the Vdex, after all of them have been unquickened. Returns false if
+// processing of the Vdex must be aborted.
+static bool writeCdexFile(void *arg,
+                          size_t workerIdx __attribute__((unused)),
+                          size_t dex_file_idx) {
+  vdexDexJobs_021 *pDexJobs = (vdexDexJobs_021 *)arg;
+  const char *VdexFileName = pDexJobs->VdexFileName;
+  const runArgs_t *pRunArgs = pDexJobs->pRunArgs;
+  const u1 *dexFileBuf = pDexJobs->dexFiles[dex_file_idx];
+
+  // Invalid files have already been reported & skipped by processDexFile()
+  if (dexFileBuf == NULL || dex_checkType(dexFileBuf) != kCompactDex ||
+      !dex_isValidCDex(dexFileBuf)) {
+    return true;
+  }
+
+  // CompactDex files are written along with the shared data section that they refer to, which is
+  // read in place
+  if (!pRunArgs->convertCdex) {
+    if (pRunArgs->splitSharedData) {
+      return outWriter_CdexMainSection(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf);
     }
+    return outWriter_CdexFile(pRunArgs, VdexFileName, dex_file_idx, dexFileBuf);
+  }
 
-    // Check if we have a cached error from current dexFile
-    if (ret != 0) {
-      return ret;
+  // The converter reads the shared data section in place and only keeps the items of this file.
+  // The original checksum doesn't apply to the new layout, which the converter has checksummed.
+  u4 dataSize = 0;
+  u1 *dataBuf = cdexConverter_toDex(dexFileBuf, &dataSize);
+  if (dataBuf == NULL) {
+    LOGMSG(l_ERROR, "Failed to convert 'classes%zu.cdex' to StandardDex - skipping", dex_file_idx);
+    __atomic_add_fetch(&pDexJobs->failedDexCnt, 1, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  bool ret = outWriter_DexFile(pRunArgs, VdexFileName, dex_file_idx, dataBuf, dataSize);
+  free(dataBuf);
+  return ret;
+}
+
+int vdex_backend_021_process(const char *VdexFileName,
+                             const u1 *cursor,
+                             size_t bufSz,
+                             int srcFd,
+                             const runArgs_t *pRunArgs) {
+  // Basic size checks
+  if (!vdex_021_SanityCheck(cursor, bufSz)) {
+    LOGMSG(l_ERROR, "Malformed Vdex file");
+    return -1;
+  }
+
+  // Not all Vdex files have Dex data to process
+  if (!vdex_021_hasDexSection(cursor)) {
+    LOGMSG(l_DEBUG, "Vdex has no Dex data - skipping");
+    return 0;
+  }
+
+  const vdexHeader_021 *pVdexHeader = (const vdexHeader_021 *)cursor;
+  if (pVdexHeader->numberOfDexFiles == 0) {
+    return 0;
+  }
+
+  // Locate all Dex files up front, so that they can be processed independently, along with the
+  // span of the data sections of the CompactDex files (clamped to the input)
+  const u1 **dexFiles = utils_calloc(pVdexHeader->numberOfDexFiles * sizeof(u1 *));
+  bool hasCompactDex = false;
+  const u1 *pCdexDataBegin = cursor + bufSz;
+  const u1 *pCdexDataEnd = cursor;
+  u4 offset = 0;
+  for (size_t dex_file_idx = 0; dex_file_idx < pVdexHeader->numberOfDexFiles; ++dex_file_idx) {
+    const u1 *dexFileBuf = vdex_021_GetNextDexFileData(cursor, &offset);
+    dexFiles[dex_file_idx] = dexFileBuf;
+    if (dexFileBuf == NULL || dex_checkType(dexFileBuf) != kCompactDex) {
+      continue;
+    }
+    hasCompactDex = true;
+    if (dex_isValidCDex(dexFileBuf)) {
+      const u1 *pDataBegin = dexFileBuf + dex_getDataOff(dexFileBuf);
+      const u1 *pDataEnd = pDataBegin + dex_getDataSize(dexFileBuf);
+      pCdexDataBegin = pDataBegin < pCdexDataBegin ? pDataBegin : pCdexDataBegin;
+      pCdexDataEnd = pDataEnd > pCdexDataEnd ? pDataEnd : pCdexDataEnd;
     }
-  }  // EOF of dex file iterator
+  }
+  if (pCdexDataBegin < cursor) {
+    pCdexDataBegin = cursor;
+  }
+  if (pCdexDataEnd > cursor + bufSz) {
+    pCdexDataEnd = cursor + bufSz;
+  }
+  if (pCdexDataEnd < pCdexDataBegin) {
+    pCdexDataEnd = pCdexDataBegin;
+  }
+
+  size_t workersCnt = 1;
+  if (pRunArgs->dexJobs > 1) {
+    workersCnt = (size_t)pRunArgs->dexJobs < pVdexHeader->numberOfDexFiles
+                     ? (size_t)pRunArgs->dexJobs
+                     : pVdexHeader->numberOfDexFiles;
+  }
+
+  // Code item dedup bitmaps are allocated once per worker and reset for every Dex file. The one
+  // after them is shared by the CompactDex files of the Vdex.
+  bitmap_reservePool(workersCnt + 1);
+  vdexDexJobs_021 dexJobs = {
+    .VdexFileName = VdexFileName,
+    .cursor = cursor,
+    .srcFd = srcFd,
+    .pRunArgs = pRunArgs,
+    .dexFiles = dexFiles,
+    .pCdexDataBegin = pCdexDataBegin,
+    .nCdexCodeItemBits = (size_t)(pCdexDataEnd - pCdexDataBegin) >> 1,
+  };
+  if (hasCompactDex) {
+    dexJobs.pCdexCodeItems = bitmap_getPooled(workersCnt);
+    bitmap_reset(dexJobs.pCdexCodeItems, dexJobs.nCdexCodeItemBits);
+  }
+
+  // CompactDex files are only written after the shared data has been unquickened for all of them,
+  // so that their output doesn't depend on the order in which the Dex files are processed
+  bool ret = utils_runParallel(workersCnt, pVdexHeader->numberOfDexFiles, processDexFile, &dexJobs);
+  if (ret && hasCompactDex) {
+    ret = utils_runParallel(workersCnt, pVdexHeader->numberOfDexFiles, writeCdexFile, &dexJobs);
+  }
+
+  // Split CompactDex output writes the shared data once, after it has been unquickened for all
+  // Dex files
+  if (ret && hasCompactDex && pRunArgs->splitSharedData && !pRunArgs->convertCdex) {
+    ret = cdexShared_writeSharedData(pRunArgs, VdexFileName, dexFiles,
+                                     pVdexHeader->numberOfDexFiles);
+  }
 
-  return pVdexHeader->numberOfDexFiles;
+  free(dexFiles);
+  return ret ? (int)(pVdexHeader->numberOfDexFiles - dexJobs.failedDexCnt) : -1;
 }
@@ -23,10 +23,15 @@
 #ifndef _VDEX_BACKEND_021_H_
 #define _VDEX_BACKEND_021_H_
 
+#include "../bitmap.h"
 #include "../common.h"
 #include "../dex.h"
 #include "vdex_021.h"
 
+// Class definitions shards per class job, so that shards with few quickened methods don't leave
+// threads idle
+#define kClassShardsPerJob ((size_t)4)
+
 typedef struct __attribute__((packed)) {
   vdexDepStrings_021 extraStrings;
   vdexDepTypeSet_021 assignTypeSets;
@@ -42,7 +47,48 @@ typedef struct __attribute__((packed)) {
   vdexDepData_021 *pVdexDepData;
 } vdexDeps_021;
 
+// Compact offset table that maps method indices to quickening info offsets, along with its
+// pre-decoded flat copy
+typedef struct {
+  const u1 *pDataBegin;
+  u4 minOffset;
+  const u4 *pTable;
+  u4 *offsets;
+  u4 numberOfIndexes;
+} vdexCompactOffsetTable_021;
+
+// Input shared by the workers that process the Dex files of a Vdex file
+typedef struct {
+  const char *VdexFileName;
+  const u1 *cursor;
+  int srcFd;
+  const runArgs_t *pRunArgs;
+  const u1 **dexFiles;
+  // Dedup bitmap shared by all CompactDex files, over the span of their data sections
+  const u1 *pCdexDataBegin;
+  size_t nCdexCodeItemBits;
+  bitmap_t *pCdexCodeItems;
+  size_t failedDexCnt;  // Dex files that were skipped after processing (e.g. failed conversion)
+} vdexDexJobs_021;
+
+// Input shared by the workers that process the class definitions of a Dex file
+typedef struct {
+  const u1 *dexFileBuf;
+  const runArgs_t *pRunArgs;
+  const vdex_data_array_t *pQuickenInfo;
+  const vdexCompactOffsetTable_021 *pCompactOffsetTable;
+  // Dedup bitmap of already unquickened code items, one bit per code item slot of the data section
+  const u1 *pDataBegin;
+  u4 codeItemShift;
+  size_t nCodeItemBits;
+  bitmap_t *pUnquickenedCodeItems;
+  u4 classDefsSize;
+  size_t shardCnt;
+  // Set if hiddenapi flags were removed from the class data
+  bool *pClassDataModified;
+} vdexClassShards_021;
+
 void vdex_backend_021_dumpDepsInfo(const u1 *);
-int vdex_backend_021_process(const char *, const u1 *, size_t, const runArgs_t *);
+int vdex_backend_021_process(const char *, const u1 *, size_t, int, const runArgs_t *);
 
 #endif
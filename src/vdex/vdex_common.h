@@ -38,4 +38,18 @@ typedef struct {
   u4 offset;       // Offset from Vdex begin
 } vdex_data_array_t;
 
+// Fixed header fields of a Vdex file, read without touching the Dex files
+typedef struct {
+  const char *version;
+  int apiLevel;
+  u4 numberOfDexFiles;
+  const u1 *checksums;  // Location checksums (numberOfDexFiles, possibly unaligned)
+  bool hasDexSection;
+  u4 dexSize;
+  u4 dexSharedDataSize;
+  u4 verifierDepsSize;
+  u4 quickeningInfoSize;
+  size_t headerSize;  // Leading bytes of the file that hold the fields above
+} vdexInventory_t;
+
 #endif
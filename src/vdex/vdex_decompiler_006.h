@@ -27,10 +27,27 @@
 #include "../dex.h"
 #include "../dex_instruction.h"
 
+// Decompiler state. Each caller owns its context, so that multiple methods can be decompiled
+// concurrently from different threads.
+typedef struct {
+  bool enableDisassembler;
+
+  // Quickening info of the currently decompiled method
+  const u1 *quickening_info_ptr;
+  const u1 *quickening_info_end;
+
+  // Code item iterator
+  u2 *code_ptr;
+  u2 *code_end;
+  u4 dex_pc;
+  u4 cur_code_off;
+} vdexDecompilerCtx_006;
+
 // Dex decompiler driver function using quicken_info data
-bool vdex_decompiler_006_decompile(const u1 *, dexMethod *, const u1 *, u4, bool);
+bool vdex_decompiler_006_decompile(
+    vdexDecompilerCtx_006 *, const u1 *, dexMethod *, const u1 *, u4, bool);
 
 // Dex decompiler walk method that simply disassembles code blocks
-void vdex_decompiler_006_walk(const u1 *, dexMethod *);
+void vdex_decompiler_006_walk(vdexDecompilerCtx_006 *, const u1 *, dexMethod *);
 
 #endif
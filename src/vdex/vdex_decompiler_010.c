@@ -24,51 +24,53 @@
 
 #include "../utils.h"
 
-static const u1 *quicken_info_ptr;
-static size_t quicken_info_number_of_indices;
-static size_t quicken_index;
-
-static u2 GetData(size_t index) {
-  return quicken_info_ptr[index * 2] | ((u2)(quicken_info_ptr[index * 2 + 1]) << 8);
+static u2 GetData(const vdexDecompilerCtx_010 *pCtx, size_t index) {
+  return pCtx->quicken_info_ptr[index * 2] | ((u2)(pCtx->quicken_info_ptr[index * 2 + 1]) << 8);
 }
 
 static size_t NumberOfIndices(size_t bytes) { return bytes / sizeof(u2); }
 
-static u2 *code_ptr;
-static u2 *code_end;
-static u4 dex_pc;
-static u4 cur_code_off;
+static void initCodeIterator(vdexDecompilerCtx_010 *pCtx, u2 *pCode, u4 codeSize, u4 startCodeOff) {
+  pCtx->code_ptr = pCode;
+  pCtx->code_end = pCode + codeSize;
+  pCtx->dex_pc = 0;
+  pCtx->cur_code_off = startCodeOff;
+}
 
-static void initCodeIterator(u2 *pCode, u4 codeSize, u4 startCodeOff) {
-  code_ptr = pCode;
-  code_end = pCode + codeSize;
-  dex_pc = 0;
-  cur_code_off = startCodeOff;
+static bool isCodeIteratorDone(const vdexDecompilerCtx_010 *pCtx) {
+  return pCtx->code_ptr >= pCtx->code_end;
 }
 
-static bool isCodeIteratorDone() { return code_ptr >= code_end; }
+static void codeIteratorAdvance(vdexDecompilerCtx_010 *pCtx) {
+  u4 instruction_size = dexInstr_SizeInCodeUnits(pCtx->code_ptr);
+  pCtx->code_ptr += instruction_size;
+  pCtx->dex_pc += instruction_size;
+  pCtx->cur_code_off += instruction_size * sizeof(u2);
+}
 
-static void codeIteratorAdvance() {
-  u4 instruction_size = dexInstr_SizeInCodeUnits(code_ptr);
-  code_ptr += instruction_size;
-  dex_pc += instruction_size;
-  cur_code_off += instruction_size * sizeof(u2);
+static void dumpInstruction(const vdexDecompilerCtx_010 *pCtx,
+                            const u1 *dexFileBuf,
+                            bool highlight) {
+  // Save time if no disassemble
+  if (pCtx->enableDisassembler) {
+    dex_dumpInstruction(dexFileBuf, pCtx->code_ptr, pCtx->cur_code_off, pCtx->dex_pc, highlight);
+  }
 }
 
-static u2 NextIndex() {
-  CHECK_LT(quicken_index, quicken_info_number_of_indices);
-  const u2 ret = GetData(quicken_index);
-  quicken_index++;
+static u2 NextIndex(vdexDecompilerCtx_010 *pCtx) {
+  CHECK_LT(pCtx->quicken_index, pCtx->quicken_info_number_of_indices);
+  const u2 ret = GetData(pCtx, pCtx->quicken_index);
+  pCtx->quicken_index++;
   return ret;
 }
 
-static bool DecompileNop(u2 *insns) {
-  const u2 reference_index = NextIndex();
+static bool DecompileNop(vdexDecompilerCtx_010 *pCtx, u2 *insns) {
+  const u2 reference_index = NextIndex(pCtx);
   if (reference_index == kDexNoIndex16) {
     // This means it was a normal nop and not a check-cast.
     return false;
   }
-  const u2 type_index = NextIndex();
+  const u2 type_index = NextIndex(pCtx);
   dexInstr_SetOpcode(insns, CHECK_CAST);
   dexInstr_SetVRegA_21c(insns, reference_index);
   dexInstr_SetVRegB_21c(insns, type_index);
@@ -76,14 +78,17 @@ static bool DecompileNop(u2 *insns) {
   return true;
 }
 
-static void DecompileInstanceFieldAccess(u2 *insns, Code new_opcode) {
-  u2 index = NextIndex();
+static void DecompileInstanceFieldAccess(vdexDecompilerCtx_010 *pCtx, u2 *insns, Code new_opcode) {
+  u2 index = NextIndex(pCtx);
   dexInstr_SetOpcode(insns, new_opcode);
   dexInstr_SetVRegC_22c(insns, index);
 }
 
-static void DecompileInvokeVirtual(u2 *insns, Code new_opcode, bool is_range) {
-  u2 index = NextIndex();
+static void DecompileInvokeVirtual(vdexDecompilerCtx_010 *pCtx,
+                                   u2 *insns,
+                                   Code new_opcode,
+                                   bool is_range) {
+  u2 index = NextIndex(pCtx);
   dexInstr_SetOpcode(insns, new_opcode);
   if (is_range) {
     dexInstr_SetVRegB_3rc(insns, index);
@@ -92,7 +97,8 @@ static void DecompileInvokeVirtual(u2 *insns, Code new_opcode, bool is_range) {
   }
 }
 
-bool vdex_decompiler_010_decompile(const u1 *dexFileBuf,
+bool vdex_decompiler_010_decompile(vdexDecompilerCtx_010 *pCtx,
+                                   const u1 *dexFileBuf,
                                    dexMethod *pDexMethod,
                                    const vdex_data_array_t *pQuickInfo,
                                    bool decompile_return_instruction) {
@@ -103,77 +109,77 @@ bool vdex_decompiler_010_decompile(const u1 *dexFileBuf,
   dexCode *pDexCode = (dexCode *)(dexFileBuf + pDexMethod->codeOff);
   u4 startCodeOff = dex_getFirstInstrOff(dexFileBuf, pDexMethod);
 
-  quicken_info_ptr = pQuickInfo->data;
-  quicken_index = 0;
-  quicken_info_number_of_indices = NumberOfIndices(pQuickInfo->size);
+  pCtx->quicken_info_ptr = pQuickInfo->data;
+  pCtx->quicken_index = 0;
+  pCtx->quicken_info_number_of_indices = NumberOfIndices(pQuickInfo->size);
 
   log_dis("    quickening_size=%" PRIx32 " (%" PRIu32 ")\n", pQuickInfo->size, pQuickInfo->size);
-  initCodeIterator(pDexCode->insns, pDexCode->insnsSize, startCodeOff);
+  initCodeIterator(pCtx, pDexCode->insns, pDexCode->insnsSize, startCodeOff);
 
-  while (isCodeIteratorDone() == false) {
+  while (isCodeIteratorDone(pCtx) == false) {
     bool hasCodeChange = true;
-    dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, false);
-    switch (dexInstr_getOpcode(code_ptr)) {
+    dumpInstruction(pCtx, dexFileBuf, false);
+    switch (dexInstr_getOpcode(pCtx->code_ptr)) {
       case RETURN_VOID_NO_BARRIER:
         if (decompile_return_instruction) {
-          dexInstr_SetOpcode(code_ptr, RETURN_VOID);
+          dexInstr_SetOpcode(pCtx->code_ptr, RETURN_VOID);
         }
         break;
       case NOP:
-        if (quicken_info_number_of_indices > 0) {
+        if (pCtx->quicken_info_number_of_indices > 0) {
           // Only try to decompile NOP if there are more than 0 indices. Not having
           // any index happens when we unquicken a code item that only has
           // RETURN_VOID_NO_BARRIER as quickened instruction.
-          hasCodeChange = DecompileNop(code_ptr);
+          hasCodeChange = DecompileNop(pCtx, pCtx->code_ptr);
         }
         break;
       case IGET_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET);
         break;
       case IGET_WIDE_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_WIDE);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_WIDE);
         break;
       case IGET_OBJECT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_OBJECT);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_OBJECT);
         break;
       case IGET_BOOLEAN_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_BOOLEAN);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_BOOLEAN);
         break;
       case IGET_BYTE_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_BYTE);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_BYTE);
         break;
       case IGET_CHAR_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_CHAR);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_CHAR);
         break;
       case IGET_SHORT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IGET_SHORT);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_SHORT);
         break;
       case IPUT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT);
         break;
       case IPUT_BOOLEAN_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_BOOLEAN);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_BOOLEAN);
         break;
       case IPUT_BYTE_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_BYTE);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_BYTE);
         break;
       case IPUT_CHAR_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_CHAR);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_CHAR);
         break;
       case IPUT_SHORT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_SHORT);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_SHORT);
         break;
       case IPUT_WIDE_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_WIDE);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_WIDE);
         break;
       case IPUT_OBJECT_QUICK:
-        DecompileInstanceFieldAccess(code_ptr, IPUT_OBJECT);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_OBJECT);
         break;
       case INVOKE_VIRTUAL_QUICK:
-        DecompileInvokeVirtual(code_ptr, INVOKE_VIRTUAL, false);
+        DecompileInvokeVirtual(pCtx, pCtx->code_ptr, INVOKE_VIRTUAL, false);
         break;
       case INVOKE_VIRTUAL_RANGE_QUICK:
-        DecompileInvokeVirtual(code_ptr, INVOKE_VIRTUAL_RANGE, true);
+        DecompileInvokeVirtual(pCtx, pCtx->code_ptr, INVOKE_VIRTUAL_RANGE, true);
         break;
       default:
         hasCodeChange = false;
@@ -181,18 +187,18 @@ bool vdex_decompiler_010_decompile(const u1 *dexFileBuf,
     }
 
     if (hasCodeChange) {
-      dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, true);
+      dumpInstruction(pCtx, dexFileBuf, true);
     }
-    codeIteratorAdvance();
+    codeIteratorAdvance(pCtx);
   }
 
-  if (quicken_index != quicken_info_number_of_indices) {
-    if (quicken_index == 0) {
+  if (pCtx->quicken_index != pCtx->quicken_info_number_of_indices) {
+    if (pCtx->quicken_index == 0) {
       LOGMSG(l_ERROR,
              "Failed to use any value in quickening info, potentially due to duplicate methods.");
     } else {
       LOGMSG(l_ERROR, "Failed to use all values in quickening info, '%zx' items not processed",
-             quicken_info_number_of_indices - quicken_index);
+             pCtx->quicken_info_number_of_indices - pCtx->quicken_index);
       return false;
     }
   }
@@ -200,12 +206,19 @@ bool vdex_decompiler_010_decompile(const u1 *dexFileBuf,
   return true;
 }
 
-void vdex_decompiler_010_walk(const u1 *dexFileBuf, dexMethod *pDexMethod) {
+void vdex_decompiler_010_walk(vdexDecompilerCtx_010 *pCtx,
+                               const u1 *dexFileBuf,
+                               dexMethod *pDexMethod) {
+  // Walking the code is only needed for the disassembler output
+  if (!pCtx->enableDisassembler) {
+    return;
+  }
+
   dexCode *pDexCode = (dexCode *)(dexFileBuf + pDexMethod->codeOff);
   u4 startCodeOff = dex_getFirstInstrOff(dexFileBuf, pDexMethod);
-  initCodeIterator(pDexCode->insns, pDexCode->insnsSize, startCodeOff);
-  while (isCodeIteratorDone() == false) {
-    dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, false);
-    codeIteratorAdvance();
+  initCodeIterator(pCtx, pDexCode->insns, pDexCode->insnsSize, startCodeOff);
+  while (isCodeIteratorDone(pCtx) == false) {
+    dumpInstruction(pCtx, dexFileBuf, false);
+    codeIteratorAdvance(pCtx);
   }
 }
@@ -28,10 +28,28 @@
 #include "../dex_instruction.h"
 #include "vdex_common.h"
 
+// Decompiler state. Each caller owns its context, so that multiple methods can be decompiled
+// concurrently from different threads.
+typedef struct {
+  bool enableDisassembler;
+
+  // Quicken info of the currently decompiled method
+  const u1 *quicken_info_ptr;
+  size_t quicken_info_number_of_indices;
+  size_t quicken_index;
+
+  // Code item iterator
+  u2 *code_ptr;
+  u2 *code_end;
+  u4 dex_pc;
+  u4 cur_code_off;
+} vdexDecompilerCtx_010;
+
 // Dex decompiler driver function using quicken_info data
-bool vdex_decompiler_010_decompile(const u1 *, dexMethod *, const vdex_data_array_t *, bool);
+bool vdex_decompiler_010_decompile(
+    vdexDecompilerCtx_010 *, const u1 *, dexMethod *, const vdex_data_array_t *, bool);
 
 // Dex decompiler walk method that simply disassembles code blocks
-void vdex_decompiler_010_walk(const u1 *, dexMethod *);
+void vdex_decompiler_010_walk(vdexDecompilerCtx_010 *, const u1 *, dexMethod *);
 
 #endif
@@ -24,59 +24,63 @@
 
 #include "../utils.h"
 
-static const u1 *quicken_info_ptr;
-static size_t quicken_info_number_of_indices;
-static size_t quicken_index;
-
-static u2 GetData(size_t index) {
-  return quicken_info_ptr[index * 2] | ((u2)(quicken_info_ptr[index * 2 + 1]) << 8);
+static u2 GetData(const vdexDecompilerCtx_019 *pCtx, size_t index) {
+  return pCtx->quicken_info_ptr[index * 2] | ((u2)(pCtx->quicken_info_ptr[index * 2 + 1]) << 8);
 }
 
 static u4 NumberOfIndices(const u1 **data, u4 data_size) {
   return data_size != 0 ? dex_readULeb128(data) : 0u;
 }
 
-static u2 *code_ptr;
-static u2 *code_end;
-static u4 dex_pc;
-static u4 cur_code_off;
+static void initQuickenInfoTable(vdexDecompilerCtx_019 *pCtx,
+                                 const vdex_data_array_t *quickenData) {
+  pCtx->quicken_info_ptr = quickenData->data;
+  pCtx->quicken_index = 0;
+  pCtx->quicken_info_number_of_indices =
+      NumberOfIndices(&pCtx->quicken_info_ptr, quickenData->size);
+}
 
-static void initQuickenInfoTable(const vdex_data_array_t *quickenData) {
-  quicken_info_ptr = quickenData->data;
-  quicken_index = 0;
-  quicken_info_number_of_indices = NumberOfIndices(&quicken_info_ptr, quickenData->size);
+static void initCodeIterator(vdexDecompilerCtx_019 *pCtx, u2 *pCode, u4 codeSize, u4 startCodeOff) {
+  pCtx->code_ptr = pCode;
+  pCtx->code_end = pCode + codeSize;
+  pCtx->dex_pc = 0;
+  pCtx->cur_code_off = startCodeOff;
 }
 
-static void initCodeIterator(u2 *pCode, u4 codeSize, u4 startCodeOff) {
-  code_ptr = pCode;
-  code_end = pCode + codeSize;
-  dex_pc = 0;
-  cur_code_off = startCodeOff;
+static bool isCodeIteratorDone(const vdexDecompilerCtx_019 *pCtx) {
+  return pCtx->code_ptr >= pCtx->code_end;
 }
 
-static bool isCodeIteratorDone() { return code_ptr >= code_end; }
+static void codeIteratorAdvance(vdexDecompilerCtx_019 *pCtx) {
+  u4 instruction_size = dexInstr_SizeInCodeUnits(pCtx->code_ptr);
+  pCtx->code_ptr += instruction_size;
+  pCtx->dex_pc += instruction_size;
+  pCtx->cur_code_off += instruction_size * sizeof(u2);
+}
 
-static void codeIteratorAdvance() {
-  u4 instruction_size = dexInstr_SizeInCodeUnits(code_ptr);
-  code_ptr += instruction_size;
-  dex_pc += instruction_size;
-  cur_code_off += instruction_size * sizeof(u2);
+static void dumpInstruction(const vdexDecompilerCtx_019 *pCtx,
+                            const u1 *dexFileBuf,
+                            bool highlight) {
+  // Save time if no disassemble
+  if (pCtx->enableDisassembler) {
+    dex_dumpInstruction(dexFileBuf, pCtx->code_ptr, pCtx->cur_code_off, pCtx->dex_pc, highlight);
+  }
 }
 
-static u2 NextIndex() {
-  CHECK_LT(quicken_index, quicken_info_number_of_indices);
-  const u2 ret = GetData(quicken_index);
-  quicken_index++;
+static u2 NextIndex(vdexDecompilerCtx_019 *pCtx) {
+  CHECK_LT(pCtx->quicken_index, pCtx->quicken_info_number_of_indices);
+  const u2 ret = GetData(pCtx, pCtx->quicken_index);
+  pCtx->quicken_index++;
   return ret;
 }
 
-static bool DecompileNop(u2 *insns) {
-  const u2 reference_index = NextIndex();
+static bool DecompileNop(vdexDecompilerCtx_019 *pCtx, u2 *insns) {
+  const u2 reference_index = NextIndex(pCtx);
   if (reference_index == kDexNoIndex16) {
     // This means it was a normal nop and not a check-cast.
     return false;
   }
-  const u2 type_index = NextIndex();
+  const u2 type_index = NextIndex(pCtx);
   dexInstr_SetOpcode(insns, CHECK_CAST);
   dexInstr_SetVRegA_21c(insns, reference_index);
   dexInstr_SetVRegB_21c(insns, type_index);
@@ -84,14 +88,17 @@ static bool DecompileNop(u2 *insns) {
   return true;
 }
 
-static void DecompileInstanceFieldAccess(u2 *insns, Code new_opcode) {
-  u2 index = NextIndex();
+static void DecompileInstanceFieldAccess(vdexDecompilerCtx_019 *pCtx, u2 *insns, Code new_opcode) {
+  u2 index = NextIndex(pCtx);
   dexInstr_SetOpcode(insns, new_opcode);
   dexInstr_SetVRegC_22c(insns, index);
 }
 
-static void DecompileInvokeVirtual(u2 *insns, Code new_opcode, bool is_range) {
-  u2 index = NextIndex();
+static void DecompileInvokeVirtual(vdexDecompilerCtx_019 *pCtx,
+                                   u2 *insns,
+                                   Code new_opcode,
+                                   bool is_range) {
+  u2 index = NextIndex(pCtx);
   dexInstr_SetOpcode(insns, new_opcode);
   if (is_range) {
     dexInstr_SetVRegB_3rc(insns, index);
@@ -100,7 +107,8 @@ static void DecompileInvokeVirtual(u2 *insns, Code new_opcode, bool is_range) {
   }
 }
 
-bool vdex_decompiler_019_decompile(const u1 *dexFileBuf,
+bool vdex_decompiler_019_decompile(vdexDecompilerCtx_019 *pCtx,
+                                   const u1 *dexFileBuf,
                                    dexMethod *pDexMethod,
                                    const vdex_data_array_t *quickenData,
                                    bool decompile_return_instruction) {
@@ -115,92 +123,92 @@ bool vdex_decompiler_019_decompile(const u1 *dexFileBuf,
 
   u4 startCodeOff = dex_getFirstInstrOff(dexFileBuf, pDexMethod);
 
-  // Initialize global data for every method that is decompiled
-  initQuickenInfoTable(quickenData);
-  initCodeIterator(pCode, codeSize, startCodeOff);
+  // Initialize context data for every method that is decompiled
+  initQuickenInfoTable(pCtx, quickenData);
+  initCodeIterator(pCtx, pCode, codeSize, startCodeOff);
 
   log_dis("    quickening_size=%" PRIx32 " (%" PRIu32 ")\n", quickenData->size, quickenData->size);
 
-  while (isCodeIteratorDone() == false) {
+  while (isCodeIteratorDone(pCtx) == false) {
     bool hasCodeChange = true;
-    dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, false);
-    switch (dexInstr_getOpcode(code_ptr)) {
+    dumpInstruction(pCtx, dexFileBuf, false);
+    switch (dexInstr_getOpcode(pCtx->code_ptr)) {
       case RETURN_VOID_NO_BARRIER:
         if (decompile_return_instruction) {
-          dexInstr_SetOpcode(code_ptr, RETURN_VOID);
+          dexInstr_SetOpcode(pCtx->code_ptr, RETURN_VOID);
         }
         break;
       case NOP:
-        if (quicken_info_number_of_indices > 0) {
+        if (pCtx->quicken_info_number_of_indices > 0) {
           // Only try to decompile NOP if there are more than 0 indices. Not having
           // any index happens when we unquicken a code item that only has
           // RETURN_VOID_NO_BARRIER as quickened instruction.
-          hasCodeChange = DecompileNop(code_ptr);
+          hasCodeChange = DecompileNop(pCtx, pCtx->code_ptr);
         }
         break;
       case IGET_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IGET);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET);
         break;
       case IGET_WIDE_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IGET_WIDE);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_WIDE);
         break;
       case IGET_OBJECT_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IGET_OBJECT);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_OBJECT);
         break;
       case IGET_BOOLEAN_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IGET_BOOLEAN);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_BOOLEAN);
         break;
       case IGET_BYTE_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IGET_BYTE);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_BYTE);
         break;
       case IGET_CHAR_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IGET_CHAR);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_CHAR);
         break;
       case IGET_SHORT_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IGET_SHORT);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IGET_SHORT);
         break;
       case IPUT_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IPUT);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT);
         break;
       case IPUT_BOOLEAN_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IPUT_BOOLEAN);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_BOOLEAN);
         break;
       case IPUT_BYTE_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IPUT_BYTE);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_BYTE);
         break;
       case IPUT_CHAR_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IPUT_CHAR);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_CHAR);
         break;
       case IPUT_SHORT_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IPUT_SHORT);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_SHORT);
         break;
       case IPUT_WIDE_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IPUT_WIDE);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_WIDE);
         break;
       case IPUT_OBJECT_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInstanceFieldAccess(code_ptr, IPUT_OBJECT);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInstanceFieldAccess(pCtx, pCtx->code_ptr, IPUT_OBJECT);
         break;
       case INVOKE_VIRTUAL_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInvokeVirtual(code_ptr, INVOKE_VIRTUAL, false);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInvokeVirtual(pCtx, pCtx->code_ptr, INVOKE_VIRTUAL, false);
         break;
       case INVOKE_VIRTUAL_RANGE_QUICK:
-        CHECK_GT(quicken_info_number_of_indices, 0);
-        DecompileInvokeVirtual(code_ptr, INVOKE_VIRTUAL_RANGE, true);
+        CHECK_GT(pCtx->quicken_info_number_of_indices, 0);
+        DecompileInvokeVirtual(pCtx, pCtx->code_ptr, INVOKE_VIRTUAL_RANGE, true);
         break;
       default:
         hasCodeChange = false;
@@ -208,18 +216,18 @@ bool vdex_decompiler_019_decompile(const u1 *dexFileBuf,
     }
 
     if (hasCodeChange) {
-      dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, true);
+      dumpInstruction(pCtx, dexFileBuf, true);
     }
-    codeIteratorAdvance();
+    codeIteratorAdvance(pCtx);
   }
 
-  if (quicken_index != quicken_info_number_of_indices) {
-    if (quicken_index == 0) {
+  if (pCtx->quicken_index != pCtx->quicken_info_number_of_indices) {
+    if (pCtx->quicken_index == 0) {
       LOGMSG(l_ERROR,
              "Failed to use any value in quickening info, potentially due to duplicate methods.");
     } else {
       LOGMSG(l_ERROR, "Failed to use all values in quickening info, '%zx' items not processed",
-             quicken_info_number_of_indices - quicken_index);
+             pCtx->quicken_info_number_of_indices - pCtx->quicken_index);
       return false;
     }
   }
@@ -227,7 +235,14 @@ bool vdex_decompiler_019_decompile(const u1 *dexFileBuf,
   return true;
 }
 
-void vdex_decompiler_019_walk(const u1 *dexFileBuf, dexMethod *pDexMethod) {
+void vdex_decompiler_019_walk(vdexDecompilerCtx_019 *pCtx,
+                               const u1 *dexFileBuf,
+                               dexMethod *pDexMethod) {
+  // Walking the code is only needed for the disassembler output
+  if (!pCtx->enableDisassembler) {
+    return;
+  }
+
   // We have different code items in Standard Dex and Compact Dex
   u2 *pCode = NULL;
   u4 codeSize = 0;
@@ -242,9 +257,9 @@ void vdex_decompiler_019_walk(const u1 *dexFileBuf, dexMethod *pDexMethod) {
   }
 
   u4 startCodeOff = dex_getFirstInstrOff(dexFileBuf, pDexMethod);
-  initCodeIterator(pCode, codeSize, startCodeOff);
-  while (isCodeIteratorDone() == false) {
-    dex_dumpInstruction(dexFileBuf, code_ptr, cur_code_off, dex_pc, false);
-    codeIteratorAdvance();
+  initCodeIterator(pCtx, pCode, codeSize, startCodeOff);
+  while (isCodeIteratorDone(pCtx) == false) {
+    dumpInstruction(pCtx, dexFileBuf, false);
+    codeIteratorAdvance(pCtx);
   }
 }
@@ -0,0 +1,94 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "vdex_quicken_index.h"
+
+#include "../utils.h"
+
+static int compareEntries(const void *a, const void *b) {
+  const vdex_quicken_entry_t *pA = (const vdex_quicken_entry_t *)a;
+  const vdex_quicken_entry_t *pB = (const vdex_quicken_entry_t *)b;
+  if (pA->codeOff != pB->codeOff) {
+    return pA->codeOff < pB->codeOff ? -1 : 1;
+  }
+
+  // Keep blobs of the same code item in their original (iteration) order
+  if (pA->blob.data != pB->blob.data) {
+    return pA->blob.data < pB->blob.data ? -1 : 1;
+  }
+  return 0;
+}
+
+void vdexQuickenIndex_init(vdex_quicken_index_t *pIndex) {
+  memset(pIndex, 0, sizeof(vdex_quicken_index_t));
+}
+
+void vdexQuickenIndex_destroy(vdex_quicken_index_t *pIndex) {
+  free(pIndex->entries);
+  memset(pIndex, 0, sizeof(vdex_quicken_index_t));
+}
+
+void vdexQuickenIndex_add(vdex_quicken_index_t *pIndex, u4 codeOff, const u1 *data, u4 size) {
+  if (pIndex->count == pIndex->capacity) {
+    size_t newCapacity = pIndex->capacity ? pIndex->capacity * 2 : 64;
+    pIndex->entries = utils_realloc(pIndex->entries, newCapacity * sizeof(vdex_quicken_entry_t));
+    pIndex->capacity = newCapacity;
+  }
+
+  vdex_quicken_entry_t *pEntry = &pIndex->entries[pIndex->count++];
+  memset(pEntry, 0, sizeof(vdex_quicken_entry_t));
+  pEntry->codeOff = codeOff;
+  pEntry->blob.data = data;
+  pEntry->blob.size = size;
+}
+
+void vdexQuickenIndex_sort(vdex_quicken_index_t *pIndex) {
+  if (pIndex->count > 1) {
+    qsort(pIndex->entries, pIndex->count, sizeof(vdex_quicken_entry_t), compareEntries);
+  }
+}
+
+const vdex_quicken_entry_t *vdexQuickenIndex_claim(vdex_quicken_index_t *pIndex, u4 codeOff) {
+  // Lower bound binary search
+  size_t lo = 0, hi = pIndex->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (pIndex->entries[mid].codeOff < codeOff) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (size_t i = lo; i < pIndex->count && pIndex->entries[i].codeOff == codeOff; ++i) {
+    vdex_quicken_entry_t *pEntry = &pIndex->entries[i];
+    if (!__atomic_exchange_n(&pEntry->claimed, true, __ATOMIC_RELAXED)) {
+      __atomic_fetch_add(&pIndex->claimedCnt, 1, __ATOMIC_RELAXED);
+      return pEntry;
+    }
+  }
+  return NULL;
+}
+
+bool vdexQuickenIndex_allClaimed(const vdex_quicken_index_t *pIndex) {
+  return __atomic_load_n(&pIndex->claimedCnt, __ATOMIC_RELAXED) == pIndex->count;
+}
@@ -0,0 +1,58 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _VDEX_QUICKEN_INDEX_H_
+#define _VDEX_QUICKEN_INDEX_H_
+
+#include "../common.h"
+#include "vdex_common.h"
+
+// Quickening info blob of a single code item
+typedef struct {
+  u4 codeOff;
+  bool claimed;
+  vdex_data_array_t blob;
+} vdex_quicken_entry_t;
+
+// Code item offset to quickening info blob index of a Dex file. Pre-Pie Vdex files store the blobs
+// in method iteration order, so the index allows methods to be unquickened in any order.
+typedef struct {
+  vdex_quicken_entry_t *entries;
+  size_t count;
+  size_t capacity;
+  size_t claimedCnt;
+} vdex_quicken_index_t;
+
+void vdexQuickenIndex_init(vdex_quicken_index_t *);
+void vdexQuickenIndex_destroy(vdex_quicken_index_t *);
+void vdexQuickenIndex_add(vdex_quicken_index_t *, u4, const u1 *, u4);
+
+// Sorts the entries by code item offset. Must be called once all entries have been added.
+void vdexQuickenIndex_sort(vdex_quicken_index_t *);
+
+// Returns the first not yet claimed blob of a code item and marks it as claimed. Returns NULL if
+// the code item has no (more) quickening info. Safe to call from multiple threads.
+const vdex_quicken_entry_t *vdexQuickenIndex_claim(vdex_quicken_index_t *, u4);
+
+bool vdexQuickenIndex_allClaimed(const vdex_quicken_index_t *);
+
+#endif
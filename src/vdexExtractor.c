@@ -23,11 +23,41 @@
 #include <getopt.h>
 #include <libgen.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
 
+#include "archive.h"
+#include "async_writer.h"
+#include "cdex_shared.h"
 #include "common.h"
+#include "in_map.h"
+#include "in_stream.h"
+#include "inventory.h"
 #include "log.h"
+#include "out_writer.h"
+#include "tar_writer.h"
 #include "utils.h"
 #include "vdex_api.h"
+#include "zip_writer.h"
+
+// Counters collected while processing the input files
+typedef struct {
+  size_t vdexCnt;
+  size_t processedVdexCnt;
+  size_t processedDexCnt;
+  long minFaults;  // Page faults while loading & processing input files
+  long majFaults;
+} procStats_t;
+
+// Shared (across worker processes) state of the multi-file worker pool. Each worker updates only
+// its own stats slot, which are merged by the parent after all workers have exited.
+typedef struct {
+  size_t nextFile;
+  procStats_t workers[];
+} workerPool_t;
+
+// Upper bound of the worker process & thread counts (-j, --scan-jobs, --dex-jobs, --class-jobs,
+// --zip-jobs)
+#define kMaxJobs 4096
 
 // exit() wrapper
 void exitWrapper(int errCode) {
@@ -40,15 +70,52 @@ static void usage(bool exit_success) {
   LOGMSG_RAW(l_INFO, "              " PROG_NAME " ver. " PROG_VERSION "\n");
   LOGMSG_RAW(l_INFO, PROG_AUTHORS "\n\n");
   LOGMSG_RAW(l_INFO,"%s",
-             " -i, --input=<path>   : input dir (search recursively) or single file\n"
-             " -o, --output=<path>  : output path (default is same as input)\n"
+             " -i, --input=<path>   : input dir (search recursively), single file or '-' for stdin\n"
+             "                        (tar & zip archives are searched for Vdex members)\n"
+             " --stdin              : same as '-i -' (see README for streaming multiple files)\n"
+             " -o, --output=<path>  : output path (default is same as input) or '-' for a tar stream\n"
+             "                        of all output files to stdout\n"
              " -f, --file-override  : allow output file override if already exists (default: false)\n"
              " --no-unquicken       : disable unquicken bytecode decompiler (don't de-odex)\n"
+             " --convert-cdex       : convert CompactDex files to StandardDex files when exporting\n"
+             " --trim-shared-data   : append only the shared data ranges that each CompactDex file\n"
+             "                        references (the rest is left as holes)\n"
+             " --split-shared-data  : write the main section of each CompactDex file on its own, with\n"
+             "                        the shared data once per Vdex file (<name>_shared.cdexdata)\n"
+             "                        and a manifest per CompactDex file\n"
+             " --merge-shared-data  : rebuild self-contained CompactDex files from the manifests of\n"
+             "                        split output (input manifest or dir, requires output path)\n"
+             " --deodex             : unquicken & convert CompactDex files into a deodexed layout\n"
+             "                        (<output>/vdexExtractor_deodexed/<app>/classes[N].dex)\n"
              " --deps               : dump verified dependencies information\n"
              " --dis                : enable bytecode disassembler\n"
              " --ignore-crc-error   : decompiled Dex CRC errors are ignored (see issue #3)\n"
              " --new-crc=<path>     : text file with extracted Apk or Dex file location checksum(s)\n"
+             " --in-place           : patch the '--new-crc' checksums into the input Vdex file\n"
+             "                        instead of writing an updated copy\n"
              " --get-api             : get Android API level based on Vdex version (expects single Vdex file)\n"
+             " --inventory[=<fmt>]  : print the Vdex headers of the input files to stdout instead of\n"
+             "                        processing them, one 'json' (default) or 'csv' line per file\n"
+             " -j, --jobs=<n>       : number of parallel workers when processing multiple input files\n"
+             "                        (0 for all online CPUs, default: 1)\n"
+             " --scan-jobs=<n>      : number of threads searching an input dir for Vdex files\n"
+             "                        (0 for all online CPUs, default: 1)\n"
+             " --dex-jobs=<n>       : number of threads unquickening the Dex files of a multidex Vdex\n"
+             "                        (0 for all online CPUs, default: 1)\n"
+             " --class-jobs=<n>     : number of threads unquickening the classes of a single Dex file\n"
+             "                        (0 for all online CPUs, default: 1)\n"
+             " --direct-output      : decompile directly into shared mmap()-ed output Dex files\n"
+             " --async-output       : write output Dex files in the background (io_uring or writer\n"
+             "                        threads)\n"
+             " --fsync-output       : fsync() output Dex files before closing them\n"
+             " --output-format=<fmt>: 'dex' for separate Dex files (default) or 'zip' for one\n"
+             "                        <name>.zip with classes[N].dex entries per Vdex file\n"
+             " --output-zip=<path>  : write the Dex files of the whole run to a single zip file\n"
+             " --zip-method=<method>: 'deflate' (default) or 'stored' zip entries\n"
+             " --zip-jobs=<n>       : number of threads deflating zip entries\n"
+             "                        (0 for all online CPUs, default: 1)\n"
+             " --map-strategy=<s>   : how input files are loaded: 'read', 'mmap', 'populate',\n"
+             "                        'hugepages' or 'auto' (default, based on file size)\n"
              " -v, --debug=LEVEL    : log level (0 - FATAL ... 4 - DEBUG), default: '3' (INFO)\n"
              " -l, --log-file=<path>: save disassembler and/or verified dependencies output to log "
                                      "file (default is STDOUT)\n"
@@ -61,27 +128,438 @@ static void usage(bool exit_success) {
 }
 // clang-format on
 
+// Parses a number of jobs argument, where 0 selects all online CPUs
+static int parseJobsArg(const char *optName, const char *arg) {
+  char *endptr = NULL;
+  errno = 0;
+  long jobs = strtol(arg, &endptr, 10);
+  if (errno != 0 || endptr == arg || *endptr != '\0' || jobs < 0 || jobs > kMaxJobs) {
+    LOGMSG(l_ERROR, "Invalid %s value '%s' (expected 0 - %d)", optName, arg, kMaxJobs);
+    usage(false);
+  }
+  return (int)jobs;
+}
+
+static void processBuffer(const char *fileName,
+                          u1 *buf,
+                          off_t fileSz,
+                          int srcfd,
+                          const runArgs_t *pRunArgs,
+                          procStats_t *pStats) {
+  vdex_api_env_t vdex_api_env;
+  vdex_api_env_t *pVdex = &vdex_api_env;
+
+  // Validate Vdex magic header and initialize matching version backend
+  if (!vdexApi_initEnv(buf, pVdex)) {
+    LOGMSG(l_WARN, "Invalid Vdex header - skipping '%s'", fileName);
+    return;
+  }
+
+  pVdex->dumpHeaderInfo(buf);
+  pStats->vdexCnt++;
+
+  // Dump Vdex verified dependencies info
+  if (pRunArgs->dumpDeps) {
+    log_setDisStatus(true);  // TODO: Remove
+    // TODO: Migrate this to vdex_process to avoid iterating Dex files twice. For now it's not
+    // a priority since the two flags offer different functionalities thus no point using them
+    // at the same time.
+    pVdex->dumpDepsInfo(buf);
+    log_setDisStatus(false);
+  }
+
+  if (pRunArgs->enableDisassembler) {
+    log_setDisStatus(true);
+  }
+
+  // Unless the whole run goes to a single zip file, each Vdex file gets its own. Zip files of
+  // Vdex files without any Dex file or that failed to process are removed.
+  runArgs_t fileArgs = *pRunArgs;
+  if (pRunArgs->zipOutput && pRunArgs->pOutZip == NULL) {
+    fileArgs.pOutZip = outWriter_openZip(pRunArgs, fileName);
+    if (fileArgs.pOutZip == NULL) {
+      LOGMSG(l_ERROR, "Couldn't create zip file - skipping '%s'", fileName);
+      return;
+    }
+  }
+
+  // Unquicken Dex bytecode or simply walk optimized Dex files. Zip and tar entries can't be copied
+  // from the input file in kernel space.
+  if (fileArgs.pOutZip != NULL || fileArgs.pOutTar != NULL) {
+    srcfd = -1;
+  }
+  int ret = pVdex->process(fileName, buf, (size_t)fileSz, srcfd, &fileArgs);
+  // Entries are written once all Dex files of the Vdex file are in, sorted by Dex index
+  if (fileArgs.pOutZip != NULL && !zipWriter_flush(fileArgs.pOutZip) && ret > 0) {
+    ret = -1;
+  }
+  if (fileArgs.pOutZip != pRunArgs->pOutZip && !zipWriter_close(fileArgs.pOutZip, ret > 0) &&
+      ret > 0) {
+    ret = -1;
+  }
+  if (ret == -1) {
+    LOGMSG(l_ERROR, "Failed to process Dex files - skipping '%s'", fileName);
+    return;
+  }
+
+  pStats->processedDexCnt += ret;
+  pStats->processedVdexCnt++;
+}
+
+// Path of an input file relative to the input root
+static const char *getRelativePath(const infiles_t *pFiles, size_t idx) {
+  const char *path = pFiles->files[idx] + pFiles->rootLen;
+  while (*path == '/') {
+    path++;
+  }
+  return path;
+}
+
+static void processFile(const infiles_t *pFiles,
+                        size_t idx,
+                        const runArgs_t *pRunArgs,
+                        procStats_t *pStats) {
+  const char *fileName = pFiles->files[idx];
+  inMap_t inMap;
+
+  LOGMSG(l_DEBUG, "Processing '%s'", fileName);
+
+  // Read or mmap file
+  if (!inMap_open(fileName, pRunArgs->mapStrategy, &inMap)) {
+    LOGMSG(l_ERROR, "Open & map failed - skipping '%s'", fileName);
+    return;
+  }
+
+  runArgs_t fileArgs = *pRunArgs;
+  fileArgs.inputRelPath = getRelativePath(pFiles, idx);
+  processBuffer(fileName, inMap.buf, inMap.size, inMap.fd, &fileArgs, pStats);
+
+  long minFaults = 0, majFaults = 0;
+  inMap_getFaults(&inMap, &minFaults, &majFaults);
+  LOGMSG(l_DEBUG, "'%s' (%s, %" PRId64 " bytes): %ld minor & %ld major page faults", fileName,
+         inMap_strategyName(inMap.strategy), (int64_t)inMap.size, minFaults, majFaults);
+  pStats->minFaults += minFaults;
+  pStats->majFaults += majFaults;
+
+  // Clean-up
+  inMap_close(&inMap);
+}
+
+// Members are processed straight from the archive mapping or inflated in memory. There is no
+// input file for the kernel-space passthrough copy of unmodified Dex files.
+static void processArchiveMember(const infiles_t *pFiles,
+                                 size_t idx,
+                                 const runArgs_t *pRunArgs,
+                                 procStats_t *pStats) {
+  archive_t *pArchive = pFiles->pArchive;
+  const archiveMember_t *pMember = &pArchive->members[idx];
+  LOGMSG(l_DEBUG, "Processing '%s' from '%s'", pMember->name, pFiles->inputFile);
+
+  // Output files of members in subdirectories go to the same subdirectories of the output
+  // directory, so that members with the same name don't overwrite each other. Tar entries, entries
+  // of the run zip file and the deodex layout are named by the writers.
+  runArgs_t memberArgs = *pRunArgs;
+  char outputDir[PATH_MAX] = { 0 };
+  const char *relPath = getRelativePath(pFiles, idx);
+  memberArgs.inputRelPath = relPath;
+  const char *pBaseName = strrchr(relPath, '/');
+  if (pBaseName != NULL && pRunArgs->pOutTar == NULL && pRunArgs->pOutZip == NULL &&
+      !pRunArgs->deodex) {
+    if (pRunArgs->outputDir == NULL) {
+      snprintf(outputDir, sizeof(outputDir), "%.*s", (int)(pBaseName - pFiles->files[idx]),
+               pFiles->files[idx]);
+    } else {
+      snprintf(outputDir, sizeof(outputDir), "%s/%.*s", pRunArgs->outputDir,
+               (int)(pBaseName - relPath), relPath);
+    }
+    if (!utils_makeDirs(outputDir)) {
+      LOGMSG(l_ERROR, "Couldn't create output directory - skipping '%s'", pFiles->files[idx]);
+      return;
+    }
+    memberArgs.outputDir = outputDir;
+  }
+
+  bool owned = false;
+  u1 *buf = archive_getMember(pArchive, idx, &owned);
+  if (buf == NULL) {
+    LOGMSG(l_ERROR, "Couldn't read archive member - skipping '%s'", pMember->name);
+    return;
+  }
+
+  processBuffer(pFiles->files[idx], buf, pMember->size, -1, &memberArgs, pStats);
+  archive_putMember(pArchive, idx, buf, owned);
+}
+
+static bool printFileInventory(const infiles_t *pFiles, size_t idx, inventoryFormat_t format) {
+  archive_t *pArchive = pFiles->pArchive;
+  if (pArchive == NULL) {
+    return inventory_printFile(pFiles->files[idx], format);
+  }
+
+  bool owned = false;
+  u1 *buf = archive_getMember(pArchive, idx, &owned);
+  if (buf == NULL) {
+    LOGMSG(l_ERROR, "Couldn't read archive member - skipping '%s'", pArchive->members[idx].name);
+    return false;
+  }
+  bool ret = inventory_printBuffer(pFiles->files[idx], buf, pArchive->members[idx].size, format);
+  archive_putMember(pArchive, idx, buf, owned);
+  return ret;
+}
+
+// The asynchronous writer is per process, so each pool worker starts its own
+static void startOutputWriter(const runArgs_t *pRunArgs) {
+  if (pRunArgs->asyncOutput && !asyncWriter_init(pRunArgs->fsyncOutput)) {
+    LOGMSG(l_WARN, "Couldn't start asynchronous output writer - writing synchronously");
+  }
+}
+
+static void stopOutputWriter(procStats_t *pStats) {
+  if (asyncWriter_isActive()) {
+    size_t failedCnt = asyncWriter_destroy();
+    if (failedCnt > 0) {
+      LOGMSG(l_ERROR, "%zu Dex files couldn't be written", failedCnt);
+      pStats->processedDexCnt -= failedCnt < pStats->processedDexCnt ? failedCnt
+                                                                     : pStats->processedDexCnt;
+    }
+  }
+}
+
+// Streamed input is buffered in memory, since the Vdex sections are not laid out in processing
+// order and the backends decompile in place
+static bool processStream(int fd, const runArgs_t *pRunArgs, procStats_t *pStats) {
+  inStream_t stream;
+  inStream_init(&stream, fd);
+  startOutputWriter(pRunArgs);
+
+  // Names of streamed files are already reduced to their base name
+  runArgs_t fileArgs = *pRunArgs;
+  char fileName[PATH_MAX] = { 0 };
+  fileArgs.inputRelPath = fileName;
+  u1 *buf = NULL;
+  off_t fileSz = 0;
+  while (inStream_next(&stream, fileName, sizeof(fileName), &buf, &fileSz)) {
+    LOGMSG(l_DEBUG, "Processing '%s' (%jd bytes) from stdin", fileName, (intmax_t)fileSz);
+    processBuffer(fileName, buf, fileSz, -1, &fileArgs, pStats);
+    free(buf);
+  }
+
+  stopOutputWriter(pStats);
+  return !stream.failed;
+}
+
+// Claim input files one at a time until the list is exhausted. When called from the pool workers
+// pNextFile lives in shared memory, so each file is processed exactly once.
+static void processFiles(const infiles_t *pFiles,
+                         const runArgs_t *pRunArgs,
+                         size_t *pNextFile,
+                         procStats_t *pStats) {
+  startOutputWriter(pRunArgs);
+
+  for (;;) {
+    size_t f = __atomic_fetch_add(pNextFile, 1, __ATOMIC_RELAXED);
+    if (f >= pFiles->fileCnt) {
+      break;
+    }
+    if (pFiles->skipped != NULL && pFiles->skipped[f]) {
+      continue;
+    }
+    if (pFiles->pArchive != NULL) {
+      processArchiveMember(pFiles, f, pRunArgs, pStats);
+    } else {
+      processFile(pFiles, f, pRunArgs, pStats);
+    }
+  }
+
+  stopOutputWriter(pStats);
+}
+
+// Input files are spread over forked worker processes, each with its own input buffers, output
+// writer & exit path, so a fatal error in one file doesn't take down the others. Within a worker the
+// backends may still run Dex & class level threads (--dex-jobs, --class-jobs).
+static bool processFilesWithPool(const infiles_t *pFiles,
+                                 const runArgs_t *pRunArgs,
+                                 int jobs,
+                                 procStats_t *pStats) {
+  size_t poolSz = sizeof(workerPool_t) + jobs * sizeof(procStats_t);
+  workerPool_t *pPool =
+      mmap(NULL, poolSz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (pPool == MAP_FAILED) {
+    LOGMSG_P(l_ERROR, "Couldn't allocate shared memory for worker pool");
+    return false;
+  }
+  memset(pPool, 0, poolSz);
+
+  // Don't let the workers inherit (and later duplicate) pending buffered output
+  fflush(NULL);
+
+  bool ret = true;
+  pid_t *workerPids = utils_calloc(jobs * sizeof(pid_t));
+  int spawned = 0;
+  for (int i = 0; i < jobs; i++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      LOGMSG_P(l_WARN, "Couldn't spawn worker #%d", i);
+      break;
+    } else if (pid == 0) {
+      processFiles(pFiles, pRunArgs, &pPool->nextFile, &pPool->workers[i]);
+      exitWrapper(EXIT_SUCCESS);
+    }
+    workerPids[spawned++] = pid;
+  }
+  LOGMSG(l_DEBUG, "%d workers have been spawned", spawned);
+
+  // Workers that are already running drain any files left behind by the ones that failed to
+  // spawn. If none could be spawned, process the whole list from the main process.
+  if (spawned == 0) {
+    processFiles(pFiles, pRunArgs, &pPool->nextFile, &pPool->workers[0]);
+  }
+
+  for (int i = 0; i < spawned; i++) {
+    int status = 0;
+    if (waitpid(workerPids[i], &status, 0) == -1) {
+      LOGMSG_P(l_ERROR, "Failed to wait for worker (pid %d)", workerPids[i]);
+      ret = false;
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      LOGMSG(l_ERROR, "Worker (pid %d) terminated abnormally", workerPids[i]);
+      ret = false;
+    }
+  }
+
+  // Merge per worker counters
+  for (int i = 0; i < jobs; i++) {
+    pStats->vdexCnt += pPool->workers[i].vdexCnt;
+    pStats->processedVdexCnt += pPool->workers[i].processedVdexCnt;
+    pStats->processedDexCnt += pPool->workers[i].processedDexCnt;
+    pStats->minFaults += pPool->workers[i].minFaults;
+    pStats->majFaults += pPool->workers[i].majFaults;
+  }
+
+  free(workerPids);
+  munmap(pPool, poolSz);
+  return ret;
+}
+
+// Instruction sets whose copy of a Vdex file is deodexed, most preferred first
+static const char *kDeodexIsas[] = { "arm64", "x86_64", "arm", "x86" };
+
+typedef struct {
+  const char *path;
+  const char *appName;  // Base name without extension, which names the deodex directory
+  int appNameLen;
+  int isaRank;
+  size_t idx;
+} deodexCopy_t;
+
+// Rank of the instruction set directory of a Vdex file (oat/<isa>/<app>.vdex)
+static int getIsaRank(const char *path, const char *pBaseName) {
+  const char *pIsaEnd = pBaseName - 1;
+  const char *pIsa = pIsaEnd;
+  while (pIsa > path && pIsa[-1] != '/') {
+    pIsa--;
+  }
+  int isaCnt = sizeof(kDeodexIsas) / sizeof(kDeodexIsas[0]);
+  for (int i = 0; i < isaCnt; i++) {
+    if (strlen(kDeodexIsas[i]) == (size_t)(pIsaEnd - pIsa) &&
+        strncmp(pIsa, kDeodexIsas[i], pIsaEnd - pIsa) == 0) {
+      return i;
+    }
+  }
+  return isaCnt;
+}
+
+static int compareDeodexCopies(const void *a, const void *b) {
+  const deodexCopy_t *pA = a;
+  const deodexCopy_t *pB = b;
+  int minLen = pA->appNameLen < pB->appNameLen ? pA->appNameLen : pB->appNameLen;
+  int cmp = strncmp(pA->appName, pB->appName, minLen);
+  if (cmp != 0 || pA->appNameLen != pB->appNameLen) {
+    return cmp != 0 ? cmp : pA->appNameLen - pB->appNameLen;
+  }
+  if (pA->isaRank != pB->isaRank) {
+    return pA->isaRank - pB->isaRank;
+  }
+  return strcmp(pA->path, pB->path);
+}
+
+// Apps ship a Vdex file per instruction set with the same Dex files, which all deodex into the same
+// <app>/ directory. Only the copy of the preferred instruction set is processed, so that the others
+// neither fail on its files nor overwrite them. Returns the number of skipped files.
+static size_t skipDeodexCopies(infiles_t *pFiles) {
+  deodexCopy_t *copies = utils_calloc(pFiles->fileCnt * sizeof(deodexCopy_t));
+  for (size_t i = 0; i < pFiles->fileCnt; i++) {
+    const char *path = pFiles->files[i];
+    const char *pBaseName = strrchr(path, '/');
+    pBaseName = pBaseName ? pBaseName + 1 : path;
+    const char *fileExt = strrchr(pBaseName, '.');
+    copies[i].path = path;
+    copies[i].appName = pBaseName;
+    copies[i].appNameLen = fileExt ? fileExt - pBaseName : (int)strlen(pBaseName);
+    copies[i].isaRank = pBaseName > path ? getIsaRank(path, pBaseName) : 0;
+    copies[i].idx = i;
+  }
+  qsort(copies, pFiles->fileCnt, sizeof(deodexCopy_t), compareDeodexCopies);
+
+  size_t skippedCnt = 0;
+  pFiles->skipped = utils_calloc(pFiles->fileCnt * sizeof(bool));
+  for (size_t i = 1, first = 0; i < pFiles->fileCnt; i++) {
+    if (copies[i].appNameLen != copies[first].appNameLen ||
+        strncmp(copies[i].appName, copies[first].appName, copies[i].appNameLen) != 0) {
+      first = i;
+      continue;
+    }
+    LOGMSG(l_DEBUG, "Skipping '%s' - its app is deodexed from '%s'", copies[i].path,
+           copies[first].path);
+    pFiles->skipped[copies[i].idx] = true;
+    skippedCnt++;
+  }
+  free(copies);
+  return skippedCnt;
+}
+
 int main(int argc, char **argv) {
   int c;
   int logLevel = l_INFO;
+  int jobs = 1;
   const char *logFile = NULL;
   runArgs_t pRunArgs = {
     .outputDir = NULL,
     .fileOverride = false,
     .unquicken = true,
+    .convertCdex = false,
+    .trimSharedData = false,
+    .splitSharedData = false,
+    .mergeSharedData = false,
+    .deodex = false,
     .enableDisassembler = false,
     .ignoreCrc = false,
     .dumpDeps = false,
     .newCrcFile = NULL,
+    .inPlace = false,
     .getApi = false,
+    .dexJobs = 1,
+    .classJobs = 1,
+    .directOutput = false,
+    .asyncOutput = false,
+    .fsyncOutput = false,
+    .zipOutput = false,
+    .zipStored = false,
+    .zipJobs = 1,
+    .outputZip = NULL,
+    .inputRelPath = NULL,
+    .pOutZip = NULL,
+    .pOutTar = NULL,
+    .mapStrategy = kMapAuto,
+    .inventory = kInventoryNone,
   };
   infiles_t pFiles = {
     .inputFile = NULL,
     .files = NULL,
     .fileCnt = 0,
+    .pArchive = NULL,
+    .scanJobs = 1,
+    .skipped = NULL,
   };
-  vdex_api_env_t vdex_api_env;
-  vdex_api_env_t *pVdex = &vdex_api_env;
 
   if (argc < 1) usage(true);
 
@@ -94,12 +572,32 @@ int main(int argc, char **argv) {
                                { "new-crc", required_argument, 0, 0x104 },
                                { "ignore-crc-error", no_argument, 0, 0x105 },
                                { "get-api", no_argument, 0, 0x106 },
+                               { "jobs", required_argument, 0, 'j' },
+                               { "dex-jobs", required_argument, 0, 0x107 },
+                               { "class-jobs", required_argument, 0, 0x108 },
+                               { "direct-output", no_argument, 0, 0x109 },
+                               { "async-output", no_argument, 0, 0x10a },
+                               { "fsync-output", no_argument, 0, 0x10b },
+                               { "stdin", no_argument, 0, 0x10c },
+                               { "output-format", required_argument, 0, 0x10d },
+                               { "output-zip", required_argument, 0, 0x10e },
+                               { "zip-method", required_argument, 0, 0x10f },
+                               { "map-strategy", required_argument, 0, 0x110 },
+                               { "scan-jobs", required_argument, 0, 0x111 },
+                               { "inventory", optional_argument, 0, 0x112 },
+                               { "convert-cdex", no_argument, 0, 0x113 },
+                               { "deodex", no_argument, 0, 0x114 },
+                               { "trim-shared-data", no_argument, 0, 0x115 },
+                               { "split-shared-data", no_argument, 0, 0x116 },
+                               { "merge-shared-data", no_argument, 0, 0x117 },
+                               { "in-place", no_argument, 0, 0x118 },
+                               { "zip-jobs", required_argument, 0, 0x119 },
                                { "debug", required_argument, 0, 'v' },
                                { "log-file", required_argument, 0, 'l' },
                                { "help", no_argument, 0, 'h' },
                                { 0, 0, 0, 0 } };
 
-  while ((c = getopt_long(argc, argv, "i:o:fv:l:h?", longopts, NULL)) != -1) {
+  while ((c = getopt_long(argc, argv, "i:o:fj:v:l:h?", longopts, NULL)) != -1) {
     switch (c) {
       case 'i':
         pFiles.inputFile = optarg;
@@ -128,6 +626,87 @@ int main(int argc, char **argv) {
       case 0x106:
         pRunArgs.getApi = true;
         break;
+      case 0x107:
+        pRunArgs.dexJobs = parseJobsArg("--dex-jobs", optarg);
+        break;
+      case 0x108:
+        pRunArgs.classJobs = parseJobsArg("--class-jobs", optarg);
+        break;
+      case 0x109:
+        pRunArgs.directOutput = true;
+        break;
+      case 0x10a:
+        pRunArgs.asyncOutput = true;
+        break;
+      case 0x10b:
+        pRunArgs.fsyncOutput = true;
+        break;
+      case 0x10c:
+        pFiles.inputFile = "-";
+        break;
+      case 0x10d:
+        if (strcmp(optarg, "zip") == 0) {
+          pRunArgs.zipOutput = true;
+        } else if (strcmp(optarg, "dex") == 0) {
+          pRunArgs.zipOutput = false;
+        } else {
+          LOGMSG(l_FATAL, "Invalid output format '%s'", optarg);
+        }
+        break;
+      case 0x10e:
+        pRunArgs.outputZip = optarg;
+        pRunArgs.zipOutput = true;
+        break;
+      case 0x10f:
+        if (strcmp(optarg, "stored") == 0) {
+          pRunArgs.zipStored = true;
+        } else if (strcmp(optarg, "deflate") == 0) {
+          pRunArgs.zipStored = false;
+        } else {
+          LOGMSG(l_FATAL, "Invalid zip method '%s'", optarg);
+        }
+        break;
+      case 0x110:
+        if (!inMap_parseStrategy(optarg, &pRunArgs.mapStrategy)) {
+          LOGMSG(l_FATAL, "Invalid map strategy '%s'", optarg);
+        }
+        break;
+      case 0x111:
+        pFiles.scanJobs = parseJobsArg("--scan-jobs", optarg);
+        break;
+      case 0x112:
+        if (optarg == NULL || strcmp(optarg, "json") == 0) {
+          pRunArgs.inventory = kInventoryJson;
+        } else if (strcmp(optarg, "csv") == 0) {
+          pRunArgs.inventory = kInventoryCsv;
+        } else {
+          LOGMSG(l_FATAL, "Invalid inventory format '%s'", optarg);
+        }
+        break;
+      case 0x113:
+        pRunArgs.convertCdex = true;
+        break;
+      case 0x114:
+        pRunArgs.deodex = true;
+        break;
+      case 0x115:
+        pRunArgs.trimSharedData = true;
+        break;
+      case 0x116:
+        pRunArgs.splitSharedData = true;
+        break;
+      case 0x117:
+        pRunArgs.mergeSharedData = true;
+        break;
+      case 0x118:
+        pRunArgs.inPlace = true;
+        break;
+      case 0x119:
+        pRunArgs.zipJobs = parseJobsArg("--zip-jobs", optarg);
+        break;
+      case 'j':
+        jobs = parseJobsArg("--jobs", optarg);
+        break;
       case 'v':
         logLevel = atoi(optarg);
         break;
@@ -144,6 +723,15 @@ int main(int argc, char **argv) {
     }
   }
 
+  // Output files or the inventory are streamed to stdout, so it can't carry anything else
+  bool toStdout = pRunArgs.outputDir != NULL && strcmp(pRunArgs.outputDir, "-") == 0;
+  if (toStdout || pRunArgs.inventory != kInventoryNone) {
+    log_redirectToStderr();
+  }
+  if (toStdout) {
+    pRunArgs.outputDir = NULL;
+  }
+
   // Adjust log level
   if (logLevel < 0 || logLevel >= l_MAX_LEVEL) {
     LOGMSG(l_FATAL, "Invalid debug level '%d'", logLevel);
@@ -156,8 +744,20 @@ int main(int argc, char **argv) {
     exitWrapper(EXIT_FAILURE);
   }
 
-  // Initialize input files
-  if (!utils_init(&pFiles)) {
+  if (pFiles.scanJobs == 0) {
+    pFiles.scanJobs = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (pFiles.scanJobs < 1) {
+    LOGMSG(l_FATAL, "Invalid number of scan jobs '%d'", pFiles.scanJobs);
+  }
+
+  // Initialize input files. Streamed input is read while processing and manifests are searched
+  // while merging.
+  bool fromStdin = pFiles.inputFile != NULL && strcmp(pFiles.inputFile, "-") == 0;
+  if (pRunArgs.mergeSharedData && (fromStdin || pFiles.inputFile == NULL)) {
+    LOGMSG(l_FATAL, "Merging shared data expects an input manifest or directory");
+  }
+  if (!fromStdin && !pRunArgs.mergeSharedData && !utils_init(&pFiles)) {
     LOGMSG(l_FATAL, "Couldn't load input files");
     exitWrapper(EXIT_FAILURE);
   }
@@ -171,7 +771,7 @@ int main(int argc, char **argv) {
   int mainRet = EXIT_FAILURE;
 
   if (pRunArgs.getApi) {
-    if (pFiles.fileCnt != 1) {
+    if (pFiles.fileCnt != 1 || pFiles.pArchive != NULL) {
       LOGMSG(l_ERROR, "Exactly one input Vdex file is expected when querying API level");
       goto complete;
     }
@@ -186,13 +786,85 @@ int main(int argc, char **argv) {
     goto complete;
   }
 
+  // Header-only inventory of the input files, which are not processed
+  if (pRunArgs.inventory != kInventoryNone) {
+    if (fromStdin) {
+      LOGMSG(l_ERROR, "Inventory expects input files");
+      goto complete;
+    }
+
+    inventory_printHeader(pRunArgs.inventory);
+    size_t failedCnt = 0;
+    for (size_t i = 0; i < pFiles.fileCnt; i++) {
+      if (!printFileInventory(&pFiles, i, pRunArgs.inventory)) {
+        failedCnt++;
+      }
+    }
+    if (failedCnt > 0) {
+      LOGMSG(l_ERROR, "%zu out of %zu files couldn't be inventoried", failedCnt, pFiles.fileCnt);
+    } else {
+      mainRet = EXIT_SUCCESS;
+    }
+    goto complete;
+  }
+
+  if (toStdout) {
+    if (isatty(STDOUT_FILENO)) {
+      LOGMSG(l_FATAL, "Refusing to write tar stream to a terminal");
+    }
+    if (pRunArgs.zipOutput) {
+      LOGMSG(l_FATAL, "Tar stream output can't be combined with zip output");
+    }
+    pRunArgs.pOutTar = tarWriter_open(STDOUT_FILENO);
+  }
+
+  // Rebuild self-contained CompactDex files from split output, next to which they can't be written
+  if (pRunArgs.mergeSharedData) {
+    if (pRunArgs.outputDir == NULL && pRunArgs.pOutTar == NULL) {
+      LOGMSG(l_ERROR, "Merging shared data requires an output path");
+      goto complete;
+    }
+    if (pRunArgs.zipOutput || pRunArgs.outputZip != NULL) {
+      LOGMSG(l_FATAL, "Merging shared data can't be combined with zip output");
+    }
+    if (pRunArgs.outputDir != NULL) {
+      char inputDir[PATH_MAX] = { 0 };
+      snprintf(inputDir, sizeof(inputDir), "%s", pFiles.inputFile);
+      char inputReal[PATH_MAX] = { 0 }, outputReal[PATH_MAX] = { 0 };
+      if (realpath(utils_isValidDir(pFiles.inputFile) ? inputDir : dirname(inputDir),
+                   inputReal) != NULL &&
+          realpath(pRunArgs.outputDir, outputReal) != NULL && strcmp(inputReal, outputReal) == 0) {
+        LOGMSG(l_ERROR, "Merged files can't be written to the directory of the split files");
+        goto complete;
+      }
+    }
+
+    size_t mergedCnt = 0;
+    if (cdexShared_merge(pFiles.inputFile, &pRunArgs, &mergedCnt)) {
+      mainRet = EXIT_SUCCESS;
+    }
+    DISPLAY(l_INFO, "%zu CompactDex files have been merged", mergedCnt);
+    DISPLAY(l_INFO, "Merged CompactDex files are available in '%s'",
+            pRunArgs.pOutTar ? "stdout" : pRunArgs.outputDir);
+    goto complete;
+  }
+
+  if (pRunArgs.inPlace && pRunArgs.newCrcFile == NULL) {
+    LOGMSG(l_FATAL, "In-place update requires new location checksums ('--new-crc')");
+  }
+
   // Parse input file with checksums (expects one per line) and update location checksum
   if (pRunArgs.newCrcFile) {
-    if (pFiles.fileCnt != 1) {
+    if (pFiles.fileCnt != 1 || pFiles.pArchive != NULL) {
       LOGMSG(l_ERROR, "Exactly one input Vdex file is expected when updating location checksums");
       goto complete;
     }
 
+    if (pRunArgs.inPlace && (pRunArgs.outputDir != NULL || pRunArgs.pOutTar != NULL)) {
+      LOGMSG(l_ERROR, "In-place update can't be combined with an output path");
+      goto complete;
+    }
+
     int nSums = -1;
     u4 *checksums = utils_processFileWithCsums(pRunArgs.newCrcFile, &nSums);
     if (checksums == NULL || nSums < 1) {
@@ -205,84 +877,174 @@ int main(int argc, char **argv) {
     } else {
       mainRet = EXIT_SUCCESS;
       DISPLAY(l_INFO, "%d location checksums have been updated", nSums);
-      DISPLAY(l_INFO, "Update Vdex file is available in '%s'",
-              pRunArgs.outputDir ? pRunArgs.outputDir : dirname(pFiles.inputFile));
+      if (pRunArgs.inPlace) {
+        DISPLAY(l_INFO, "'%s' Vdex file has been updated in place", pFiles.files[0]);
+      } else {
+        const char *outLocation =
+            pRunArgs.outputDir ? pRunArgs.outputDir : dirname(pFiles.inputFile);
+        DISPLAY(l_INFO, "Update Vdex file is available in '%s'",
+                pRunArgs.pOutTar ? "stdout" : outLocation);
+      }
     }
 
     free(checksums);
     goto complete;
   }
 
-  size_t vdexCnt = 0, processedVdexCnt = 0, processedDexCnt = 0;
-  DISPLAY(l_INFO, "Processing %zu file(s) from %s", pFiles.fileCnt, pFiles.inputFile);
+  if (pRunArgs.splitSharedData && (pRunArgs.zipOutput || pRunArgs.outputZip != NULL)) {
+    LOGMSG(l_FATAL, "Split shared data can't be combined with zip output");
+  }
 
-  for (size_t f = 0; f < pFiles.fileCnt; f++) {
-    off_t fileSz = 0;
-    int srcfd = -1;
-    u1 *buf = NULL;
+  // Deodexed Dex files go to a directory per Vdex file under the deodex directory of the output
+  // path, which are all created on demand. Tar entries are named relative to the deodex directory.
+  char deodexDir[PATH_MAX] = { 0 };
+  if (pRunArgs.deodex) {
+    if (pRunArgs.zipOutput || pRunArgs.outputZip != NULL) {
+      LOGMSG(l_FATAL, "Deodex layout can't be combined with zip output");
+    }
+    if (!pRunArgs.unquicken) {
+      LOGMSG(l_WARN, "Deodex mode always unquickens - ignoring '--no-unquicken'");
+    }
+    pRunArgs.unquicken = true;
+    pRunArgs.convertCdex = true;
+    pRunArgs.ignoreCrc = true;
+    if (!toStdout) {
+      snprintf(deodexDir, sizeof(deodexDir), "%s/%s",
+               pRunArgs.outputDir ? pRunArgs.outputDir : ".", kDeodexDirName);
+      pRunArgs.outputDir = deodexDir;
+    }
+    size_t skippedCnt = fromStdin ? 0 : skipDeodexCopies(&pFiles);
+    if (skippedCnt > 0) {
+      DISPLAY(l_INFO, "Skipping %zu Vdex file(s) of other instruction sets of the same apps",
+              skippedCnt);
+    }
+  }
 
-    LOGMSG(l_DEBUG, "Processing '%s'", pFiles.files[f]);
+  if (jobs == 0) {
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (jobs < 1) {
+    LOGMSG(l_FATAL, "Invalid number of jobs '%d'", jobs);
+  }
+  if ((size_t)jobs > pFiles.fileCnt) {
+    jobs = pFiles.fileCnt;
+  }
+  if (jobs > 1 && (pRunArgs.enableDisassembler || pRunArgs.dumpDeps)) {
+    LOGMSG(l_WARN, "Disassembler & dependencies output can't be interleaved - running single job");
+    jobs = 1;
+  }
 
-    // mmap file
-    buf = utils_mapFileToRead(pFiles.files[f], &fileSz, &srcfd);
-    if (buf == NULL) {
-      LOGMSG(l_ERROR, "Open & map failed - skipping '%s'", pFiles.files[f]);
-      continue;
-    }
+  if (pRunArgs.dexJobs == 0) {
+    pRunArgs.dexJobs = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (pRunArgs.dexJobs < 1) {
+    LOGMSG(l_FATAL, "Invalid number of Dex jobs '%d'", pRunArgs.dexJobs);
+  }
+  if (pRunArgs.dexJobs > 1 && pRunArgs.enableDisassembler) {
+    LOGMSG(l_WARN, "Disassembler output can't be interleaved - running single Dex job");
+    pRunArgs.dexJobs = 1;
+  }
 
-    // Validate Vdex magic header and initialize matching version backend
-    if (!vdexApi_initEnv(buf, pVdex)) {
-      LOGMSG(l_WARN, "Invalid Vdex header - skipping '%s'", pFiles.files[f]);
-      goto next_file;
-    }
+  if (pRunArgs.classJobs == 0) {
+    pRunArgs.classJobs = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (pRunArgs.classJobs < 1) {
+    LOGMSG(l_FATAL, "Invalid number of class jobs '%d'", pRunArgs.classJobs);
+  }
+  if (pRunArgs.classJobs > 1 && pRunArgs.enableDisassembler) {
+    LOGMSG(l_WARN, "Disassembler output can't be interleaved - running single class job");
+    pRunArgs.classJobs = 1;
+  }
 
-    pVdex->dumpHeaderInfo(buf);
-    vdexCnt++;
+  if (pRunArgs.zipJobs == 0) {
+    pRunArgs.zipJobs = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (pRunArgs.zipJobs < 1) {
+    LOGMSG(l_FATAL, "Invalid number of zip jobs '%d'", pRunArgs.zipJobs);
+  }
 
-    // Dump Vdex verified dependencies info
-    if (pRunArgs.dumpDeps) {
-      log_setDisStatus(true);  // TODO: Remove
-      // TODO: Migrate this to vdex_process to avoid iterating Dex files twice. For now it's not
-      // a priority since the two flags offer different functionalities thus no point using them
-      // at the same time.
-      pVdex->dumpDepsInfo(buf);
-      log_setDisStatus(false);
+  if (pRunArgs.zipOutput && pRunArgs.directOutput) {
+    LOGMSG(l_WARN, "Zip entries can't be decompiled in place - ignoring direct output");
+    pRunArgs.directOutput = false;
+  }
+  if (pRunArgs.outputZip != NULL) {
+    if (jobs > 1) {
+      LOGMSG(l_WARN, "Zip file of the whole run can't be shared by workers - running single job");
+      jobs = 1;
     }
-
-    if (pRunArgs.enableDisassembler) {
-      log_setDisStatus(true);
+    pRunArgs.pOutZip = zipWriter_open(pRunArgs.outputZip, pRunArgs.fileOverride,
+                                      !pRunArgs.zipStored, pRunArgs.zipJobs);
+    if (pRunArgs.pOutZip == NULL) {
+      LOGMSG(l_ERROR, "Couldn't create '%s' zip file", pRunArgs.outputZip);
+      goto complete;
     }
+  }
 
-    // Unquicken Dex bytecode or simply walk optimized Dex files
-    int ret = pVdex->process(pFiles.files[f], buf, (size_t)fileSz, &pRunArgs);
-    if (ret == -1) {
-      LOGMSG(l_ERROR, "Failed to process Dex files - skipping '%s'", pFiles.files[f]);
-      goto next_file;
+  if (pRunArgs.pOutTar != NULL) {
+    if (jobs > 1) {
+      LOGMSG(l_WARN, "Tar stream can't be shared by workers - running single job");
+      jobs = 1;
+    }
+    if (pRunArgs.directOutput || pRunArgs.asyncOutput) {
+      LOGMSG(l_WARN, "Tar entries are written in sequence - ignoring direct & async output");
+      pRunArgs.directOutput = false;
+      pRunArgs.asyncOutput = false;
     }
+  }
 
-    processedDexCnt += ret;
-    processedVdexCnt++;
+  procStats_t stats = { 0 };
+  bool inputFailed = false;
+  if (fromStdin) {
+    DISPLAY(l_INFO, "Processing Vdex file(s) from stdin");
+    if (!processStream(STDIN_FILENO, &pRunArgs, &stats)) {
+      LOGMSG(l_ERROR, "Failed to read all Vdex files from stdin");
+      inputFailed = true;
+    }
+  } else if (jobs > 1) {
+    DISPLAY(l_INFO, "Processing %zu file(s) from %s", pFiles.fileCnt, pFiles.inputFile);
+    LOGMSG(l_DEBUG, "Using a pool of %d workers", jobs);
+    if (!processFilesWithPool(&pFiles, &pRunArgs, jobs, &stats)) {
+      LOGMSG(l_ERROR, "Worker pool failed to process all input files");
+      inputFailed = true;
+    }
+  } else {
+    DISPLAY(l_INFO, "Processing %zu file(s) from %s", pFiles.fileCnt, pFiles.inputFile);
+    size_t nextFile = 0;
+    processFiles(&pFiles, &pRunArgs, &nextFile, &stats);
+  }
 
-  next_file:
-    // Clean-up
-    munmap(buf, fileSz);
-    close(srcfd);
+  if (pRunArgs.pOutZip != NULL && !zipWriter_close(pRunArgs.pOutZip, true)) {
+    LOGMSG(l_ERROR, "Failed to write '%s' zip file", pRunArgs.outputZip);
+    inputFailed = true;
   }
 
-  DISPLAY(l_INFO, "%zu out of %u Vdex files have been processed", processedVdexCnt, vdexCnt);
-  DISPLAY(l_INFO, "%u Dex files have been extracted in total", processedDexCnt);
-  DISPLAY(l_INFO, "Extracted Dex files are available in '%s'",
-          pRunArgs.outputDir ? pRunArgs.outputDir
-                             : (utils_isValidDir(pFiles.inputFile) ? pFiles.inputFile
-                                                                   : dirname(pFiles.inputFile)));
-  mainRet = EXIT_SUCCESS;
+  DISPLAY(l_INFO, "%zu out of %zu Vdex files have been processed", stats.processedVdexCnt,
+          stats.vdexCnt);
+  DISPLAY(l_INFO, "%zu Dex files have been extracted in total", stats.processedDexCnt);
+  LOGMSG(l_DEBUG, "%ld minor & %ld major page faults while processing input files",
+         stats.minFaults, stats.majFaults);
+  const char *outLocation = pRunArgs.pOutTar ? "stdout" : pRunArgs.outputZip;
+  if (outLocation == NULL) {
+    outLocation = pRunArgs.outputDir ? pRunArgs.outputDir
+                                     : (utils_isValidDir(pFiles.inputFile)
+                                            ? pFiles.inputFile
+                                            : dirname(pFiles.inputFile));
+  }
+  DISPLAY(l_INFO, "Extracted Dex files are available in '%s'", outLocation);
+  mainRet = inputFailed ? EXIT_FAILURE : EXIT_SUCCESS;
 
 complete:
-  if (pFiles.fileCnt > 1) {
+  if (pRunArgs.pOutTar != NULL && !tarWriter_close(pRunArgs.pOutTar)) {
+    LOGMSG(l_ERROR, "Failed to write tar stream to stdout");
+    mainRet = EXIT_FAILURE;
+  }
+  if (pFiles.fileCnt > 1 || pFiles.pArchive != NULL) {
     for (size_t i = 0; i < pFiles.fileCnt; i++) {
       free(pFiles.files[i]);
     }
   }
   free(pFiles.files);
+  free(pFiles.skipped);
+  archive_close(pFiles.pArchive);
   exitWrapper(mainRet);
 }
@@ -32,6 +32,11 @@
 #include "vdex/vdex_019.h"
 #include "vdex/vdex_021.h"
 
+bool vdexApi_isSupportedVdex(const u1 *cursor) {
+  return vdex_006_isValidVdex(cursor) || vdex_010_isValidVdex(cursor) ||
+         vdex_019_isValidVdex(cursor) || vdex_021_isValidVdex(cursor);
+}
+
 bool vdexApi_initEnv(const u1 *cursor, vdex_api_env_t *env) {
   // Check if a supported Vdex version is found
   if (vdex_006_isValidVdex(cursor)) {
@@ -39,21 +44,25 @@ bool vdexApi_initEnv(const u1 *cursor, vdex_api_env_t *env) {
     env->dumpHeaderInfo = vdex_006_dumpHeaderInfo;
     env->dumpDepsInfo = vdex_006_dumpDepsInfo;
     env->process = vdex_006_process;
+    env->getInventory = vdex_006_getInventory;
   } else if (vdex_010_isValidVdex(cursor)) {
     LOGMSG(l_DEBUG, "Initializing environment for Vdex version '010'");
     env->dumpHeaderInfo = vdex_010_dumpHeaderInfo;
     env->dumpDepsInfo = vdex_010_dumpDepsInfo;
     env->process = vdex_010_process;
+    env->getInventory = vdex_010_getInventory;
   } else if (vdex_019_isValidVdex(cursor)) {
     LOGMSG(l_DEBUG, "Initializing environment for Vdex version '019'");
     env->dumpHeaderInfo = vdex_019_dumpHeaderInfo;
     env->dumpDepsInfo = vdex_019_dumpDepsInfo;
     env->process = vdex_019_process;
+    env->getInventory = vdex_019_getInventory;
   } else if (vdex_021_isValidVdex(cursor)) {
     LOGMSG(l_DEBUG, "Initializing environment for Vdex version '021'");
     env->dumpHeaderInfo = vdex_021_dumpHeaderInfo;
     env->dumpDepsInfo = vdex_021_dumpDepsInfo;
     env->process = vdex_021_process;
+    env->getInventory = vdex_021_getInventory;
   } else {
     LOGMSG(l_ERROR, "Unsupported Vdex version");
     return false;
@@ -62,6 +71,26 @@ bool vdexApi_initEnv(const u1 *cursor, vdex_api_env_t *env) {
   return true;
 }
 
+// Returns the offset & number of entries of the location checksums section
+static bool getChecksumsSection(const u1 *buf, off_t *pOff, u4 *pCnt) {
+  if (vdex_006_isValidVdex(buf)) {
+    *pOff = vdex_006_GetLocationChecksumsOffset(buf);
+    *pCnt = vdex_006_GetSizeOfChecksumsSection(buf) / sizeof(VdexChecksum);
+  } else if (vdex_010_isValidVdex(buf)) {
+    *pOff = vdex_010_GetLocationChecksumsOffset(buf);
+    *pCnt = vdex_010_GetSizeOfChecksumsSection(buf) / sizeof(VdexChecksum);
+  } else if (vdex_019_isValidVdex(buf)) {
+    *pOff = vdex_019_GetLocationChecksumsOffset(buf);
+    *pCnt = vdex_019_GetSizeOfChecksumsSection(buf) / sizeof(VdexChecksum);
+  } else if (vdex_021_isValidVdex(buf)) {
+    *pOff = vdex_021_GetLocationChecksumsOffset(buf);
+    *pCnt = vdex_021_GetSizeOfChecksumsSection(buf) / sizeof(VdexChecksum);
+  } else {
+    return false;
+  }
+  return true;
+}
+
 bool vdexApi_updateChecksums(const char *inVdexFileName,
                              int nCsums,
                              u4 *checksums,
@@ -77,61 +106,41 @@ bool vdexApi_updateChecksums(const char *inVdexFileName,
     return ret;
   }
 
-  if (vdex_006_isValidVdex(buf)) {
-    const vdexHeader_006 *pVdexHeader = (const vdexHeader_006 *)buf;
-    if ((u4)nCsums != pVdexHeader->numberOfDexFiles) {
-      LOGMSG(l_ERROR, "%d checksums loaded from file, although Vdex has %" PRIu32 " Dex entries",
-             nCsums, pVdexHeader->numberOfDexFiles)
-      goto fini;
-    }
-
-    for (u4 i = 0; i < pVdexHeader->numberOfDexFiles; ++i) {
-      vdex_006_SetLocationChecksum(buf, i, checksums[i]);
-    }
-  } else if (vdex_010_isValidVdex(buf)) {
-    const vdexHeader_010 *pVdexHeader = (const vdexHeader_010 *)buf;
-    if ((u4)nCsums != pVdexHeader->numberOfDexFiles) {
-      LOGMSG(l_ERROR, "%d checksums loaded from file, although Vdex has %" PRIu32 " Dex entries",
-             nCsums, pVdexHeader->numberOfDexFiles)
-      goto fini;
-    }
-
-    for (u4 i = 0; i < pVdexHeader->numberOfDexFiles; ++i) {
-      vdex_010_SetLocationChecksum(buf, i, checksums[i]);
-    }
-  } else if (vdex_019_isValidVdex(buf)) {
-    const vdexHeader_019 *pVdexHeader = (const vdexHeader_019 *)buf;
-    if ((u4)nCsums != pVdexHeader->numberOfDexFiles) {
-      LOGMSG(l_ERROR, "%d checksums loaded from file, although Vdex has %" PRIu32 " Dex entries",
-             nCsums, pVdexHeader->numberOfDexFiles)
-      goto fini;
-    }
-
-    for (u4 i = 0; i < pVdexHeader->numberOfDexFiles; ++i) {
-      vdex_019_SetLocationChecksum(buf, i, checksums[i]);
-    }
-  } else if (vdex_021_isValidVdex(buf)) {
-    const vdexHeader_021 *pVdexHeader = (const vdexHeader_021 *)buf;
-    if ((u4)nCsums != pVdexHeader->numberOfDexFiles) {
-      LOGMSG(l_ERROR, "%d checksums loaded from file, although Vdex has %" PRIu32 " Dex entries",
-             nCsums, pVdexHeader->numberOfDexFiles)
-      goto fini;
-    }
-
-    for (u4 i = 0; i < pVdexHeader->numberOfDexFiles; ++i) {
-      vdex_021_SetLocationChecksum(buf, i, checksums[i]);
-    }
-  } else {
+  off_t csumsOff = 0;
+  u4 numberOfDexFiles = 0;
+  if (!getChecksumsSection(buf, &csumsOff, &numberOfDexFiles)) {
     LOGMSG(l_ERROR, "Unsupported Vdex version - updateChecksums failed");
     goto fini;
   }
 
-  if (!outWriter_VdexFile(pRunArgs, inVdexFileName, buf, fileSz)) {
-    LOGMSG(l_ERROR, "Failed to write updated Vdex file");
+  if ((u4)nCsums != numberOfDexFiles) {
+    LOGMSG(l_ERROR, "%d checksums loaded from file, although Vdex has %" PRIu32 " Dex entries",
+           nCsums, numberOfDexFiles)
     goto fini;
   }
 
-  ret = true;
+  size_t csumsSz = nCsums * sizeof(u4);
+  if (csumsOff + (off_t)csumsSz > fileSz) {
+    LOGMSG(l_ERROR, "Location checksums section is out of '%s' file bounds", inVdexFileName);
+    goto fini;
+  }
+
+  // Only the checksums section changes, so files are patched rather than rewritten unless the
+  // whole updated file has to be added to the tar stream
+  if (pRunArgs->inPlace) {
+    ret = outWriter_patchVdexFile(pRunArgs, inVdexFileName, csumsOff, (const u1 *)checksums,
+                                  csumsSz);
+  } else if (pRunArgs->pOutTar == NULL) {
+    ret = outWriter_cloneVdexFile(pRunArgs, inVdexFileName, srcfd, buf, fileSz, csumsOff,
+                                  (const u1 *)checksums, csumsSz);
+  } else {
+    memcpy(buf + csumsOff, checksums, csumsSz);
+    ret = outWriter_VdexFile(pRunArgs, inVdexFileName, buf, fileSz);
+  }
+
+  if (!ret) {
+    LOGMSG(l_ERROR, "Failed to write updated Vdex file");
+  }
 
 fini:
   munmap(buf, fileSz);
@@ -170,3 +179,14 @@ fini:
   close(srcfd);
   return ret;
 }
+
+bool vdexApi_getInventory(const u1 *buf, size_t size, vdexInventory_t *pInv) {
+  memset(pInv, 0, sizeof(vdexInventory_t));
+  if (size < kVdexApiMagicSz || !vdexApi_isSupportedVdex(buf)) {
+    return false;
+  }
+
+  vdex_api_env_t vdex_api_env;
+  vdexApi_initEnv(buf, &vdex_api_env);
+  return vdex_api_env.getInventory(buf, size, pInv);
+}
@@ -24,15 +24,25 @@
 #define _VDEX_API_H_
 
 #include "common.h"
+#include "vdex/vdex_common.h"
 
 typedef struct {
   void (*dumpHeaderInfo)(const u1 *);
   void (*dumpDepsInfo)(const u1 *);
-  int (*process)(const char *, const u1 *, size_t, const runArgs_t *);
+  int (*process)(const char *, const u1 *, size_t, int, const runArgs_t *);
+  bool (*getInventory)(const u1 *, size_t, vdexInventory_t *);
 } vdex_api_env_t;
 
+// Number of leading bytes (magic & versions) that identify a supported Vdex file
+#define kVdexApiMagicSz 12
+
+bool vdexApi_isSupportedVdex(const u1 *);
 bool vdexApi_initEnv(const u1 *, vdex_api_env_t *);
 bool vdexApi_updateChecksums(const char *, int, u4 *, const runArgs_t *);
 bool vdexApi_printApiLevel(const char *);
 
+// Reads the fixed headers of a supported Vdex file from its leading bytes. Returns false if the
+// file is not supported, or if more bytes are needed (headerSize is set to the required size).
+bool vdexApi_getInventory(const u1 *, size_t, vdexInventory_t *);
+
 #endif
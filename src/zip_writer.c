@@ -0,0 +1,476 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "zip_writer.h"
+
+#include <zlib.h>
+
+#include "utils.h"
+
+#define kZipLocalHdrSig 0x04034b50
+#define kZipCentralHdrSig 0x02014b50
+#define kZipEndSig 0x06054b50
+#define kZip64EndSig 0x06064b50
+#define kZip64LocatorSig 0x07064b50
+#define kZipLocalHdrSz 30
+#define kZipCentralHdrSz 46
+#define kZipEndSz 22
+#define kZip64EndSz 56
+#define kZip64LocatorSz 20
+#define kZip64ExtraId 0x0001
+#define kZip64ExtraSz 12
+#define kZipMethodStored 0
+#define kZipMethodDeflated 8
+#define kZipVersion 20
+#define kZip64Version 45
+// Made by Unix, so that the external attributes carry the file mode
+#define kZipVersionMadeBy ((3 << 8) | kZip64Version)
+#define kZipFileAttrs (0100644U << 16)
+// Entries are timestamped 1980-01-01 00:00, so that archives are reproducible
+#define kZipDosTime 0
+#define kZipDosDate ((1 << 5) | 1)
+#define kZipMax32 0xffffffffU
+#define kZipMax16 0xffffU
+// Bound of the added data that waits for a deflate thread
+#define kZipMaxQueued (64 * 1024 * 1024)
+
+static u1 *putU2(u1 *p, u2 v) {
+  memcpy(p, &v, sizeof(v));
+  return p + sizeof(v);
+}
+
+static u1 *putU4(u1 *p, u4 v) {
+  memcpy(p, &v, sizeof(v));
+  return p + sizeof(v);
+}
+
+static u1 *putU8(u1 *p, u8 v) {
+  memcpy(p, &v, sizeof(v));
+  return p + sizeof(v);
+}
+
+// Raw deflate into a malloc()-ed buffer. Returns NULL if it fails.
+static u1 *deflateBuf(const u1 *buf, size_t size, size_t *pCompSize) {
+  z_stream zStream;
+  memset(&zStream, 0, sizeof(zStream));
+  if (deflateInit2(&zStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    LOGMSG(l_ERROR, "Couldn't initialize zlib stream");
+    return NULL;
+  }
+
+  uLong bound = deflateBound(&zStream, size);
+  u1 *compBuf = utils_malloc(bound);
+  zStream.next_in = (Bytef *)buf;
+  zStream.avail_in = size;
+  zStream.next_out = compBuf;
+  zStream.avail_out = bound;
+  int zRet = deflate(&zStream, Z_FINISH);
+  *pCompSize = zStream.total_out;
+  deflateEnd(&zStream);
+
+  if (zRet != Z_STREAM_END) {
+    LOGMSG(l_ERROR, "Couldn't deflate zip entry (%d)", zRet);
+    free(compBuf);
+    return NULL;
+  }
+  return compBuf;
+}
+
+// Computes the checksum and, if deflate is set and it pays off, replaces the data of the entry with
+// its compressed form. Incompressible entries are stored, like most zip tools do.
+static void compressEntry(zipPending_t *pEntry, bool deflate) {
+  pEntry->crc = crc32(0, pEntry->data, pEntry->size);
+  if (!deflate || pEntry->size == 0) {
+    return;
+  }
+
+  size_t compSize = 0;
+  u1 *compBuf = deflateBuf(pEntry->data, pEntry->size, &compSize);
+  if (compBuf != NULL && compSize < pEntry->size) {
+    free(pEntry->data);
+    pEntry->data = compBuf;
+    pEntry->compSize = compSize;
+    pEntry->method = kZipMethodDeflated;
+  } else {
+    free(compBuf);
+  }
+}
+
+static void *deflateThread(void *arg) {
+  zipWriter_t *pZip = arg;
+  pthread_mutex_lock(&pZip->lock);
+  for (;;) {
+    while (pZip->head == NULL && !pZip->stopping) {
+      pthread_cond_wait(&pZip->hasWork, &pZip->lock);
+    }
+    zipPending_t *pEntry = pZip->head;
+    if (pEntry == NULL) {
+      break;
+    }
+    pZip->head = pEntry->next;
+    if (pZip->head == NULL) {
+      pZip->tail = NULL;
+    }
+    pthread_mutex_unlock(&pZip->lock);
+
+    compressEntry(pEntry, true);
+
+    pthread_mutex_lock(&pZip->lock);
+    pZip->queuedBytes -= pEntry->size;
+    pthread_cond_broadcast(&pZip->hasRoom);
+    if (pZip->queuedBytes == 0) {
+      pthread_cond_broadcast(&pZip->jobDone);
+    }
+  }
+  pthread_mutex_unlock(&pZip->lock);
+  return NULL;
+}
+
+// Waits for the queued entries to be compressed and joins the deflate threads
+static void stopThreads(zipWriter_t *pZip) {
+  pthread_mutex_lock(&pZip->lock);
+  pZip->stopping = true;
+  pthread_cond_broadcast(&pZip->hasWork);
+  pthread_mutex_unlock(&pZip->lock);
+  for (int i = 0; i < pZip->threadCnt; i++) {
+    pthread_join(pZip->threads[i], NULL);
+  }
+  free(pZip->threads);
+  pZip->threads = NULL;
+  pZip->threadCnt = 0;
+}
+
+zipWriter_t *zipWriter_open(const char *fileName, bool override, bool deflate, int jobs) {
+  int fileFlags = O_CREAT | O_WRONLY | O_TRUNC;
+  if (!override) {
+    fileFlags |= O_EXCL;
+  }
+  int fd = open(fileName, fileFlags, 0644);
+  if (fd == -1) {
+    LOGMSG_P(l_ERROR, "Couldn't create output file '%s'", fileName);
+    return NULL;
+  }
+
+  zipWriter_t *pZip = utils_calloc(sizeof(zipWriter_t));
+  snprintf(pZip->fileName, sizeof(pZip->fileName), "%s", fileName);
+  pZip->fd = fd;
+  pZip->deflate = deflate;
+  pthread_mutex_init(&pZip->lock, NULL);
+  pthread_cond_init(&pZip->hasWork, NULL);
+  pthread_cond_init(&pZip->hasRoom, NULL);
+  pthread_cond_init(&pZip->jobDone, NULL);
+
+  // Without any deflate thread, entries are compressed by the threads that add them
+  if (deflate && jobs > 0) {
+    pZip->threads = utils_calloc(jobs * sizeof(pthread_t));
+    for (; pZip->threadCnt < jobs; pZip->threadCnt++) {
+      int err = pthread_create(&pZip->threads[pZip->threadCnt], NULL, deflateThread, pZip);
+      if (err != 0) {
+        errno = err;
+        LOGMSG_P(l_WARN, "Couldn't spawn zip deflate thread");
+        break;
+      }
+    }
+  }
+  return pZip;
+}
+
+bool zipWriter_addEntry(zipWriter_t *pZip,
+                        const char *name,
+                        u8 key,
+                        const u1 *buf,
+                        size_t size) {
+  if (size >= kZipMax32 || strlen(name) > kZipMax16) {
+    LOGMSG(l_ERROR, "Zip entry '%s' is too large", name);
+    return false;
+  }
+
+  // The buffer is usually part of the input mapping, which doesn't outlive the backend
+  zipPending_t *pEntry = utils_calloc(sizeof(zipPending_t));
+  pEntry->name = strdup(name);
+  if (pEntry->name == NULL) {
+    LOGMSG(l_FATAL, "Couldn't allocate memory");
+  }
+  pEntry->key = key;
+  pEntry->data = utils_malloc(size > 0 ? size : 1);
+  memcpy(pEntry->data, buf, size);
+  pEntry->size = size;
+  pEntry->compSize = size;
+  pEntry->method = kZipMethodStored;
+
+  bool queue = pZip->threadCnt > 0 && size > 0;
+  if (!queue) {
+    compressEntry(pEntry, pZip->deflate);
+  }
+
+  pthread_mutex_lock(&pZip->lock);
+  if (queue) {
+    // An entry larger than the limit is still accepted once everything before it is compressed
+    while (pZip->queuedBytes > 0 && pZip->queuedBytes + size > kZipMaxQueued) {
+      pthread_cond_wait(&pZip->hasRoom, &pZip->lock);
+    }
+    if (pZip->tail == NULL) {
+      pZip->head = pEntry;
+    } else {
+      pZip->tail->next = pEntry;
+    }
+    pZip->tail = pEntry;
+    pZip->queuedBytes += size;
+    pthread_cond_signal(&pZip->hasWork);
+  }
+  pZip->pending = utils_realloc(pZip->pending, (pZip->pendingCnt + 1) * sizeof(zipPending_t *));
+  pZip->pending[pZip->pendingCnt++] = pEntry;
+  bool ret = !pZip->failed;
+  pthread_mutex_unlock(&pZip->lock);
+  return ret;
+}
+
+static int comparePending(const void *a, const void *b) {
+  const zipPending_t *pA = *(const zipPending_t *const *)a;
+  const zipPending_t *pB = *(const zipPending_t *const *)b;
+  if (pA->key != pB->key) {
+    return pA->key < pB->key ? -1 : 1;
+  }
+  return strcmp(pA->name, pB->name);
+}
+
+// Position of the name among the written entry names, or where it would be inserted
+static size_t findName(const zipWriter_t *pZip, const char *name, bool *pFound) {
+  size_t lo = 0, hi = pZip->entryCnt;
+  *pFound = false;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(pZip->sortedNames[mid], name);
+    if (cmp == 0) {
+      *pFound = true;
+      return mid;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Entries of a batch usually come from a single Vdex file, so they are few and compared pairwise
+static const char *findDuplicate(const zipWriter_t *pZip) {
+  for (size_t i = 0; i < pZip->pendingCnt; i++) {
+    const char *name = pZip->pending[i]->name;
+    bool found = false;
+    findName(pZip, name, &found);
+    for (size_t j = 0; j < i && !found; j++) {
+      found = strcmp(pZip->pending[j]->name, name) == 0;
+    }
+    if (found) {
+      return name;
+    }
+  }
+  return NULL;
+}
+
+// Appends the local header & data of the entry and records it for the central directory
+static bool writeEntry(zipWriter_t *pZip, const zipPending_t *pEntry) {
+  size_t nameLen = strlen(pEntry->name);
+  u1 hdr[kZipLocalHdrSz];
+  u1 *p = putU4(hdr, kZipLocalHdrSig);
+  p = putU2(p, kZipVersion);
+  p = putU2(p, 0);
+  p = putU2(p, pEntry->method);
+  p = putU2(p, kZipDosTime);
+  p = putU2(p, kZipDosDate);
+  p = putU4(p, pEntry->crc);
+  p = putU4(p, pEntry->compSize);
+  p = putU4(p, pEntry->size);
+  p = putU2(p, nameLen);
+  putU2(p, 0);
+
+  if (!utils_writeToFd(pZip->fd, hdr, sizeof(hdr)) ||
+      !utils_writeToFd(pZip->fd, (const u1 *)pEntry->name, nameLen) ||
+      !utils_writeToFd(pZip->fd, pEntry->data, pEntry->compSize)) {
+    LOGMSG_P(l_ERROR, "Couldn't write '%s' entry to '%s' file", pEntry->name, pZip->fileName);
+    return false;
+  }
+
+  bool found = false;
+  size_t namePos = findName(pZip, pEntry->name, &found);
+  pZip->entries = utils_realloc(pZip->entries, (pZip->entryCnt + 1) * sizeof(zipEntry_t));
+  pZip->sortedNames = utils_realloc(pZip->sortedNames, (pZip->entryCnt + 1) * sizeof(char *));
+  zipEntry_t *pCdEntry = &pZip->entries[pZip->entryCnt];
+  pCdEntry->name = strdup(pEntry->name);
+  if (pCdEntry->name == NULL) {
+    LOGMSG(l_FATAL, "Couldn't allocate memory");
+  }
+  memmove(&pZip->sortedNames[namePos + 1], &pZip->sortedNames[namePos],
+          (pZip->entryCnt - namePos) * sizeof(char *));
+  pZip->sortedNames[namePos] = pCdEntry->name;
+  pZip->entryCnt++;
+  pCdEntry->crc = pEntry->crc;
+  pCdEntry->compSize = pEntry->compSize;
+  pCdEntry->size = pEntry->size;
+  pCdEntry->localOff = pZip->off;
+  pCdEntry->method = pEntry->method;
+  pZip->off += sizeof(hdr) + nameLen + pEntry->compSize;
+  return true;
+}
+
+// Frees the added entries, none of which may still be queued for compression
+static void dropPending(zipWriter_t *pZip) {
+  for (size_t i = 0; i < pZip->pendingCnt; i++) {
+    free(pZip->pending[i]->name);
+    free(pZip->pending[i]->data);
+    free(pZip->pending[i]);
+  }
+  free(pZip->pending);
+  pZip->pending = NULL;
+  pZip->pendingCnt = 0;
+}
+
+bool zipWriter_flush(zipWriter_t *pZip) {
+  pthread_mutex_lock(&pZip->lock);
+  while (pZip->queuedBytes > 0) {
+    pthread_cond_wait(&pZip->jobDone, &pZip->lock);
+  }
+
+  if (pZip->pendingCnt > 1) {
+    qsort(pZip->pending, pZip->pendingCnt, sizeof(zipPending_t *), comparePending);
+  }
+  // Readers would only see one of the entries, so the whole batch is rejected
+  const char *dupName = findDuplicate(pZip);
+  bool isDuplicate = dupName != NULL;
+  if (isDuplicate) {
+    LOGMSG(l_ERROR, "Duplicate '%s' entry in '%s' file - discarding the added entries", dupName,
+           pZip->fileName);
+  }
+  for (size_t i = 0; i < pZip->pendingCnt && !isDuplicate && !pZip->failed; i++) {
+    pZip->failed = !writeEntry(pZip, pZip->pending[i]);
+  }
+  dropPending(pZip);
+  bool ret = !pZip->failed && !isDuplicate;
+  pthread_mutex_unlock(&pZip->lock);
+  return ret;
+}
+
+static bool writeCentralDir(zipWriter_t *pZip) {
+  size_t cdCap = kZip64EndSz + kZip64LocatorSz + kZipEndSz;
+  for (size_t i = 0; i < pZip->entryCnt; i++) {
+    cdCap += kZipCentralHdrSz + strlen(pZip->entries[i].name) + kZip64ExtraSz;
+  }
+  u1 *cd = utils_malloc(cdCap);
+  u1 *p = cd;
+
+  for (size_t i = 0; i < pZip->entryCnt; i++) {
+    const zipEntry_t *pEntry = &pZip->entries[i];
+    bool isZip64 = pEntry->localOff >= kZipMax32;
+    size_t nameLen = strlen(pEntry->name);
+    p = putU4(p, kZipCentralHdrSig);
+    p = putU2(p, kZipVersionMadeBy);
+    p = putU2(p, isZip64 ? kZip64Version : kZipVersion);
+    p = putU2(p, 0);
+    p = putU2(p, pEntry->method);
+    p = putU2(p, kZipDosTime);
+    p = putU2(p, kZipDosDate);
+    p = putU4(p, pEntry->crc);
+    p = putU4(p, pEntry->compSize);
+    p = putU4(p, pEntry->size);
+    p = putU2(p, nameLen);
+    p = putU2(p, isZip64 ? kZip64ExtraSz : 0);
+    p = putU2(p, 0);
+    p = putU2(p, 0);
+    p = putU2(p, 0);
+    p = putU4(p, kZipFileAttrs);
+    p = putU4(p, isZip64 ? kZipMax32 : pEntry->localOff);
+    memcpy(p, pEntry->name, nameLen);
+    p += nameLen;
+    if (isZip64) {
+      p = putU2(p, kZip64ExtraId);
+      p = putU2(p, sizeof(u8));
+      p = putU8(p, pEntry->localOff);
+    }
+  }
+
+  u8 cdOff = pZip->off;
+  u8 cdSize = p - cd;
+  bool isZip64 = pZip->entryCnt >= kZipMax16 || cdOff >= kZipMax32 || cdSize >= kZipMax32;
+  if (isZip64) {
+    u8 end64Off = cdOff + cdSize;
+    p = putU4(p, kZip64EndSig);
+    p = putU8(p, kZip64EndSz - 12);
+    p = putU2(p, kZipVersionMadeBy);
+    p = putU2(p, kZip64Version);
+    p = putU4(p, 0);
+    p = putU4(p, 0);
+    p = putU8(p, pZip->entryCnt);
+    p = putU8(p, pZip->entryCnt);
+    p = putU8(p, cdSize);
+    p = putU8(p, cdOff);
+
+    p = putU4(p, kZip64LocatorSig);
+    p = putU4(p, 0);
+    p = putU8(p, end64Off);
+    p = putU4(p, 1);
+  }
+
+  p = putU4(p, kZipEndSig);
+  p = putU2(p, 0);
+  p = putU2(p, 0);
+  p = putU2(p, isZip64 ? kZipMax16 : pZip->entryCnt);
+  p = putU2(p, isZip64 ? kZipMax16 : pZip->entryCnt);
+  p = putU4(p, isZip64 ? kZipMax32 : cdSize);
+  p = putU4(p, isZip64 ? kZipMax32 : cdOff);
+  p = putU2(p, 0);
+
+  bool ret = utils_writeToFd(pZip->fd, cd, p - cd);
+  if (!ret) {
+    LOGMSG_P(l_ERROR, "Couldn't write central directory of '%s' file", pZip->fileName);
+  }
+  free(cd);
+  return ret;
+}
+
+bool zipWriter_close(zipWriter_t *pZip, bool keep) {
+  stopThreads(pZip);
+  bool ret = !pZip->failed;
+  if (keep) {
+    ret = zipWriter_flush(pZip) && writeCentralDir(pZip);
+  } else {
+    dropPending(pZip);
+  }
+  close(pZip->fd);
+  if (!keep || !ret) {
+    unlink(pZip->fileName);
+  }
+
+  for (size_t i = 0; i < pZip->entryCnt; i++) {
+    free(pZip->entries[i].name);
+  }
+  free(pZip->entries);
+  free(pZip->sortedNames);
+  pthread_cond_destroy(&pZip->jobDone);
+  pthread_cond_destroy(&pZip->hasRoom);
+  pthread_cond_destroy(&pZip->hasWork);
+  pthread_mutex_destroy(&pZip->lock);
+  free(pZip);
+  return ret;
+}
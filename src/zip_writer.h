@@ -0,0 +1,97 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _ZIP_WRITER_H_
+#define _ZIP_WRITER_H_
+
+#include <pthread.h>
+
+#include "common.h"
+
+// Central directory record of a written entry
+typedef struct {
+  char *name;
+  u4 crc;
+  u8 compSize;
+  u8 size;
+  u8 localOff;
+  u2 method;
+} zipEntry_t;
+
+// Entry that has been added but not written yet. Its data is a private copy of the added buffer,
+// which the deflate threads replace with the compressed one.
+typedef struct zipPending {
+  struct zipPending *next;
+  char *name;
+  u8 key;
+  u1 *data;
+  size_t size;
+  size_t compSize;
+  u4 crc;
+  u2 method;
+} zipPending_t;
+
+// Zip archive that is written sequentially. Entries can be added from multiple threads and are
+// compressed by a pool of deflate threads, which is sized independently of the threads that add
+// them. Added entries are buffered until zipWriter_flush(), which writes them sorted by their key
+// (the Dex index), so that the archive doesn't depend on thread scheduling.
+struct zipWriter {
+  char fileName[PATH_MAX];
+  int fd;
+  bool deflate;
+  pthread_mutex_t lock;
+  pthread_cond_t hasWork;
+  pthread_cond_t hasRoom;
+  pthread_cond_t jobDone;
+  zipPending_t **pending;
+  size_t pendingCnt;
+  size_t queuedBytes;
+  zipPending_t *head;
+  zipPending_t *tail;
+  bool stopping;
+  pthread_t *threads;
+  int threadCnt;
+  u8 off;
+  zipEntry_t *entries;
+  size_t entryCnt;
+  char **sortedNames;  // Names of the written entries in strcmp order, to reject duplicates
+  bool failed;
+};
+
+// Creates the zip file. Existing files are only replaced if override is set. If deflate is set,
+// entries are compressed by the given number of threads.
+zipWriter_t *zipWriter_open(const char *, bool, bool, int);
+
+// Adds a copy of the buffer as an entry with the given name. Entries added between two flushes
+// are written in ascending key order. Blocks while too much data waits to be compressed.
+bool zipWriter_addEntry(zipWriter_t *, const char *, u8, const u1 *, size_t);
+
+// Waits for the added entries to be compressed and appends them to the file. If any of them has
+// the name of a written entry or of another added one, none is written and false is returned, while
+// the file remains usable.
+bool zipWriter_flush(zipWriter_t *);
+
+// Flushes the added entries, writes the central directory and closes the file. If keep is false
+// or writing failed, the file is removed.
+bool zipWriter_close(zipWriter_t *, bool);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "dex.h"
+#include "test.h"
+
+// Microbenchmark of the ULEB128 decoders: the scalar reader in a loop against the batch reader, on
+// value mixes of Vdex deps & Dex class data and in batches of the deps decoder size & larger.
+
+#define kNumValues (1 << 20)
+#define kRounds 64
+
+static u4 nextRandom(u4 *pState) {
+  u4 x = *pState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *pState = x;
+  return x;
+}
+
+// Returns a value of 2 - maxLen encoded bytes, or of a single byte with the given percentage
+static u4 randomValue(u4 *pState, u4 maxLen, u4 singleBytePct) {
+  u4 r = nextRandom(pState);
+  if (r % 100 < singleBytePct) {
+    return nextRandom(pState) & 0x7f;
+  }
+  u4 len = 2 + nextRandom(pState) % (maxLen - 1);
+  return len >= 5 ? nextRandom(pState) : nextRandom(pState) & ((1U << (7 * len)) - 1);
+}
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Keeps the decoded values live
+static volatile u4 sink;
+
+static void decodeScalar(const u1 *enc, u4 *values) {
+  const u1 *ptr = enc;
+  for (size_t i = 0; i < kNumValues; ++i) {
+    values[i] = dex_readULeb128(&ptr);
+  }
+}
+
+static bool decodeBatch(const u1 *enc, const u1 *end, u4 *values, size_t batch, bool bounded) {
+  const u1 *ptr = enc;
+  bool ret = true;
+  for (size_t i = 0; i < kNumValues; i += batch) {
+    size_t count = kNumValues - i < batch ? kNumValues - i : batch;
+    if (bounded) {
+      ret &= dex_readULeb128BatchBounded(&ptr, end, values + i, count);
+    } else {
+      dex_readULeb128Batch(&ptr, values + i, count);
+    }
+  }
+  return ret && ptr == end;
+}
+
+// Returns the mean ns per value of kRounds decodes after an untimed warm up decode, or -1 if the
+// batch decoder fails. A batch size of 0 selects the scalar reader.
+static double bench(const u1 *enc, const u1 *end, u4 *values, size_t batch, bool bounded) {
+  double start = 0;
+  for (int r = -1; r < kRounds; ++r) {
+    if (r == 0) {
+      start = nowNs();
+    }
+    if (batch == 0) {
+      decodeScalar(enc, values);
+    } else if (!decodeBatch(enc, end, values, batch, bounded)) {
+      return -1;
+    }
+    sink += values[r + 1];
+  }
+  return (nowNs() - start) / ((double)kRounds * kNumValues);
+}
+
+int main(void) {
+  static const struct {
+    const char *name;
+    u4 maxLen;
+    u4 singleBytePct;
+  } kMixes[] = {
+    { "1 byte", 2, 100 },
+    { "deps (90% 1 byte, <= 3)", 3, 90 },
+    { "class data (60% 1 byte, <= 3)", 3, 60 },
+    { "uniform 1 - 5 bytes", 5, 20 },
+  };
+  u1 *enc = malloc(kNumValues * 5 + 64);
+  u4 *expected = malloc(kNumValues * sizeof(u4));
+  u4 *values = malloc(kNumValues * sizeof(u4));
+
+  printf("%-32s %8s %8s %8s %8s %8s\n", "ns/value", "scalar", "b48", "b48/bnd", "b4096",
+         "b4096/bnd");
+  for (size_t m = 0; m < sizeof(kMixes) / sizeof(kMixes[0]); ++m) {
+    u4 state = 0x2545f491;
+    u1 *end = enc;
+    for (size_t i = 0; i < kNumValues; ++i) {
+      expected[i] = randomValue(&state, kMixes[m].maxLen, kMixes[m].singleBytePct);
+      end = dex_writeULeb128(end, expected[i]);
+    }
+
+    printf("%-32s", kMixes[m].name);
+    static const size_t kBatches[] = { 0, 48, 48, 4096, 4096 };
+    for (size_t b = 0; b < sizeof(kBatches) / sizeof(kBatches[0]); ++b) {
+      memset(values, 0, kNumValues * sizeof(u4));
+      double nsPerValue = bench(enc, end, values, kBatches[b], b % 2 == 0);
+      TEST_CHECK(nsPerValue >= 0);
+      TEST_CHECK(memcmp(values, expected, kNumValues * sizeof(u4)) == 0);
+      printf(" %8.3f", nsPerValue);
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  free(values);
+  free(expected);
+  free(enc);
+  return test_report("bench_uleb128");
+}
@@ -0,0 +1,93 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "test.h"
+
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+
+size_t test_checks = 0;
+size_t test_failures = 0;
+
+// The tool's exit path closes the log file; tests have none
+void exitWrapper(int errCode) { exit(errCode); }
+
+int test_report(const char *name) {
+  fprintf(stderr, "%s: %zu checks, %zu failed\n", name, test_checks, test_failures);
+  return test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+const char *test_dataPath(const char *fileName) {
+  static char path[PATH_MAX];
+  const char *dataDir = getenv("VDEX_TEST_DATA");
+  snprintf(path, sizeof(path), "%s/%s", dataDir ? dataDir : "data", fileName);
+  return path;
+}
+
+char *test_makeTmpDir(void) {
+  char *dir = strdup("/tmp/vdexExtractor-test.XXXXXX");
+  if (dir == NULL || mkdtemp(dir) == NULL) {
+    fprintf(stderr, "mkdtemp failed: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return dir;
+}
+
+static int removeEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+void test_removeTmpDir(char *dir) {
+  nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  free(dir);
+}
+
+u1 *test_readFile(const char *path, size_t *pSize) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    return NULL;
+  }
+  u1 *buf = NULL;
+  size_t size = 0, cap = 0;
+  for (;;) {
+    if (size == cap) {
+      cap = cap ? cap * 2 : 65536;
+      buf = realloc(buf, cap);
+      if (buf == NULL) {
+        exit(EXIT_FAILURE);
+      }
+    }
+    size_t n = fread(buf + size, 1, cap - size, fp);
+    if (n == 0) {
+      break;
+    }
+    size += n;
+  }
+  fclose(fp);
+  *pSize = size;
+  return buf;
+}
@@ -0,0 +1,55 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include "common.h"
+
+// Minimal test harness: checks log the failing expression and are counted, so that all checks of a
+// test binary run and test_report() returns its exit code.
+extern size_t test_checks;
+extern size_t test_failures;
+
+#define TEST_CHECK(cond)                                                            \
+  do {                                                                              \
+    test_checks++;                                                                  \
+    if (!(cond)) {                                                                  \
+      test_failures++;                                                              \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);      \
+    }                                                                               \
+  } while (false)
+
+// Prints the results of the test binary and returns its exit code
+int test_report(const char *);
+
+// Path of a file in the test data directory
+const char *test_dataPath(const char *);
+
+// Creates a temporary directory, which test_removeTmpDir() removes together with its contents
+char *test_makeTmpDir(void);
+void test_removeTmpDir(char *);
+
+// Reads a whole file into a malloc()-ed buffer. Returns NULL if the file can't be read.
+u1 *test_readFile(const char *, size_t *);
+
+#endif
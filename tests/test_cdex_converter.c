@@ -0,0 +1,196 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include "cdex_converter.h"
+#include "dex.h"
+#include "log.h"
+#include "test.h"
+#include "vdex/vdex_019.h"
+#include "vdex/vdex_021.h"
+
+// CompactDex files of Vdex fixtures are converted to StandardDex and checked against their source:
+// a valid header & checksum, the same ids and the same code of every method.
+
+typedef const u1 *(*getNextDexFileDataFn_t)(const u1 *, u4 *);
+
+static const struct {
+  const char *name;
+  getNextDexFileDataFn_t getNextDexFileData;
+} kFixtures[] = {
+  { "v019_1d_3c_cdex.vdex", vdex_019_GetNextDexFileData },
+  { "v019_3d_40c_cdex.vdex", vdex_019_GetNextDexFileData },
+  { "v019_rich_cdex.vdex", vdex_019_GetNextDexFileData },
+  { "v021_3d_40c_cdex.vdex", vdex_021_GetNextDexFileData },
+};
+
+static const u1 *getClassData(const u1 *dexBuf, u4 classIdx) {
+  const dexClassDef *pClassDef = dex_getClassDef(dexBuf, classIdx);
+  return pClassDef->classDataOff == 0 ? NULL : dex_getDataAddr(dexBuf) + pClassDef->classDataOff;
+}
+
+static void checkMethods(const u1 *cdexBuf, const u1 *dexBuf, const u1 **pCdexCursor,
+                         const u1 **pDexCursor, u4 methodsCnt) {
+  for (u4 i = 0; i < methodsCnt; ++i) {
+    dexMethod cdexMethod, dexMethod;
+    dex_readClassDataMethod(pCdexCursor, &cdexMethod);
+    dex_readClassDataMethod(pDexCursor, &dexMethod);
+    TEST_CHECK(cdexMethod.methodIdx == dexMethod.methodIdx);
+    TEST_CHECK(cdexMethod.accessFlags == dexMethod.accessFlags);
+    TEST_CHECK((cdexMethod.codeOff == 0) == (dexMethod.codeOff == 0));
+    if (cdexMethod.codeOff == 0 || dexMethod.codeOff == 0) {
+      continue;
+    }
+
+    u2 *pCdexInsns, *pDexInsns;
+    u4 cdexInsnsSize, dexInsnsSize;
+    dex_getCodeItemInfo(cdexBuf, &cdexMethod, &pCdexInsns, &cdexInsnsSize);
+    dex_getCodeItemInfo(dexBuf, &dexMethod, &pDexInsns, &dexInsnsSize);
+    TEST_CHECK(cdexInsnsSize == dexInsnsSize);
+    if (cdexInsnsSize == dexInsnsSize) {
+      TEST_CHECK(memcmp(pCdexInsns, pDexInsns, dexInsnsSize * sizeof(u2)) == 0);
+    }
+  }
+}
+
+static void checkConversion(const u1 *cdexBuf, const u1 *dexBuf, u4 dexSize) {
+  TEST_CHECK(dex_isValidDex(dexBuf));
+  TEST_CHECK(dex_getFileSize(dexBuf) == dexSize);
+  TEST_CHECK(dex_getChecksum(dexBuf) == dex_computeDexCRC(dexBuf, dexSize));
+
+  const bool sameIdsSizes = dex_getStringIdsSize(dexBuf) == dex_getStringIdsSize(cdexBuf) &&
+                            dex_getTypeIdsSize(dexBuf) == dex_getTypeIdsSize(cdexBuf) &&
+                            dex_getProtoIdsSize(dexBuf) == dex_getProtoIdsSize(cdexBuf) &&
+                            dex_getFieldIdsSize(dexBuf) == dex_getFieldIdsSize(cdexBuf) &&
+                            dex_getMethodIdsSize(dexBuf) == dex_getMethodIdsSize(cdexBuf) &&
+                            dex_getClassDefsSize(dexBuf) == dex_getClassDefsSize(cdexBuf);
+  TEST_CHECK(sameIdsSizes);
+  if (!sameIdsSizes) {
+    return;
+  }
+
+  for (u4 i = 0; i < dex_getStringIdsSize(dexBuf); ++i) {
+    TEST_CHECK(strcmp(dex_getStringDataByIdx(cdexBuf, i), dex_getStringDataByIdx(dexBuf, i)) == 0);
+  }
+  TEST_CHECK(memcmp(dexBuf + dex_getMethodIdsOff(dexBuf), cdexBuf + dex_getMethodIdsOff(cdexBuf),
+                    dex_getMethodIdsSize(dexBuf) * sizeof(dexMethodId)) == 0);
+
+  for (u4 i = 0; i < dex_getClassDefsSize(dexBuf); ++i) {
+    const u1 *pCdexCursor = getClassData(cdexBuf, i);
+    const u1 *pDexCursor = getClassData(dexBuf, i);
+    TEST_CHECK((pCdexCursor == NULL) == (pDexCursor == NULL));
+    if (pCdexCursor == NULL || pDexCursor == NULL) {
+      continue;
+    }
+
+    dexClassDataHeader cdexHeader, dexHeader;
+    dex_readClassDataHeader(&pCdexCursor, &cdexHeader);
+    dex_readClassDataHeader(&pDexCursor, &dexHeader);
+    TEST_CHECK(memcmp(&cdexHeader, &dexHeader, sizeof(dexHeader)) == 0);
+    if (memcmp(&cdexHeader, &dexHeader, sizeof(dexHeader)) != 0) {
+      continue;
+    }
+    for (u4 j = 0; j < dexHeader.staticFieldsSize + dexHeader.instanceFieldsSize; ++j) {
+      dexField cdexField, dexField;
+      dex_readClassDataField(&pCdexCursor, &cdexField);
+      dex_readClassDataField(&pDexCursor, &dexField);
+      TEST_CHECK(cdexField.fieldIdx == dexField.fieldIdx);
+      TEST_CHECK(cdexField.accessFlags == dexField.accessFlags);
+    }
+    checkMethods(cdexBuf, dexBuf, &pCdexCursor, &pDexCursor,
+                 dexHeader.directMethodsSize + dexHeader.virtualMethodsSize);
+  }
+}
+
+static void testFixture(const char *name, getNextDexFileDataFn_t getNextDexFileData) {
+  size_t vdexSize;
+  u1 *vdexBuf = test_readFile(test_dataPath(name), &vdexSize);
+  TEST_CHECK(vdexBuf != NULL);
+  if (vdexBuf == NULL) {
+    return;
+  }
+
+  // The number of Dex files follows the magic & versions in all Vdex headers
+  u4 numberOfDexFiles;
+  memcpy(&numberOfDexFiles, vdexBuf + 12, sizeof(u4));
+  TEST_CHECK(numberOfDexFiles > 0);
+
+  u4 offset = 0;
+  for (u4 i = 0; i < numberOfDexFiles; ++i) {
+    const u1 *cdexBuf = getNextDexFileData(vdexBuf, &offset);
+    TEST_CHECK(cdexBuf != NULL && dex_isValidCDex(cdexBuf));
+    if (cdexBuf == NULL) {
+      break;
+    }
+
+    u4 dexSize = 0;
+    u1 *dexBuf = cdexConverter_toDex(cdexBuf, &dexSize);
+    TEST_CHECK(dexBuf != NULL);
+    if (dexBuf != NULL) {
+      checkConversion(cdexBuf, dexBuf, dexSize);
+    }
+    free(dexBuf);
+  }
+
+  free(vdexBuf);
+}
+
+// Debug info tables that point out of the data section fail the conversion
+static void testMalformed(void) {
+  size_t vdexSize;
+  u1 *vdexBuf = test_readFile(test_dataPath("v019_rich_cdex.vdex"), &vdexSize);
+  TEST_CHECK(vdexBuf != NULL);
+  if (vdexBuf == NULL) {
+    return;
+  }
+
+  u4 offset = 0;
+  u1 *cdexBuf = (u1 *)vdex_019_GetNextDexFileData(vdexBuf, &offset);
+  TEST_CHECK(cdexBuf != NULL);
+  if (cdexBuf != NULL) {
+    cdexHeader *pHeader = (cdexHeader *)cdexBuf;
+    TEST_CHECK(pHeader->debugInfoOffsetsPos != 0);
+    u4 dexSize = 0;
+
+    // Offset of the first block of the debug info table
+    u4 *pFirstBlockOff = (u4 *)(cdexBuf + pHeader->dataOff + pHeader->debugInfoOffsetsPos +
+                                pHeader->debugInfoOffsetsTableOffset);
+    u4 firstBlockOff = *pFirstBlockOff;
+    *pFirstBlockOff = pHeader->dataSize;
+    TEST_CHECK(cdexConverter_toDex(cdexBuf, &dexSize) == NULL);
+    *pFirstBlockOff = firstBlockOff;
+
+    // Position of the debug info table
+    pHeader->debugInfoOffsetsPos = pHeader->dataSize + 1;
+    TEST_CHECK(cdexConverter_toDex(cdexBuf, &dexSize) == NULL);
+  }
+
+  free(vdexBuf);
+}
+
+int main(void) {
+  log_setMinLevel(l_FATAL);
+  for (size_t i = 0; i < sizeof(kFixtures) / sizeof(kFixtures[0]); ++i) {
+    testFixture(kFixtures[i].name, kFixtures[i].getNextDexFileData);
+  }
+  testMalformed();
+  return test_report("test_cdex_converter");
+}
@@ -0,0 +1,249 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "cdex_shared.h"
+#include "log.h"
+#include "out_writer.h"
+#include "test.h"
+#include "vdex_api.h"
+
+// The CompactDex files of a Vdex fixture are extracted self-contained & split, the split output is
+// merged back and must be byte equal to the self-contained one. Manifests are untrusted input, so
+// malformed ones must be rejected without writing anything.
+
+#define kFixture "v019_3d_40c_cdex.vdex"
+#define kFixtureDexCnt 3
+
+static runArgs_t getRunArgs(char *outputDir) {
+  runArgs_t runArgs;
+  memset(&runArgs, 0, sizeof(runArgs_t));
+  runArgs.outputDir = outputDir;
+  runArgs.unquicken = true;
+  runArgs.dexJobs = 1;
+  runArgs.classJobs = 1;
+  return runArgs;
+}
+
+static bool extract(const runArgs_t *pRunArgs) {
+  size_t vdexSize;
+  u1 *vdexBuf = test_readFile(test_dataPath(kFixture), &vdexSize);
+  if (vdexBuf == NULL) {
+    return false;
+  }
+  vdex_api_env_t env;
+  bool ret = vdexApi_initEnv(vdexBuf, &env) &&
+             env.process(kFixture, vdexBuf, vdexSize, -1, pRunArgs) == kFixtureDexCnt;
+  free(vdexBuf);
+  return ret;
+}
+
+static char *joinPath(const char *dir, const char *name) {
+  char *path = malloc(PATH_MAX);
+  snprintf(path, PATH_MAX, "%s/%s", dir, name);
+  return path;
+}
+
+// Returns the number of entries in the directory (apart from dot files), or -1 on error
+static int countFiles(const char *dirPath) {
+  DIR *dir = opendir(dirPath);
+  if (dir == NULL) {
+    return -1;
+  }
+  int cnt = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    cnt += entry->d_name[0] != '.';
+  }
+  closedir(dir);
+  return cnt;
+}
+
+// Every file of the expected directory must have a byte equal copy in the actual one
+static void checkSameFiles(const char *expectedDir, const char *actualDir) {
+  TEST_CHECK(countFiles(expectedDir) == kFixtureDexCnt);
+  TEST_CHECK(countFiles(actualDir) == kFixtureDexCnt);
+  DIR *dir = opendir(expectedDir);
+  TEST_CHECK(dir != NULL);
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    char *expectedPath = joinPath(expectedDir, entry->d_name);
+    char *actualPath = joinPath(actualDir, entry->d_name);
+    size_t expectedSize = 0, actualSize = 0;
+    u1 *expected = test_readFile(expectedPath, &expectedSize);
+    u1 *actual = test_readFile(actualPath, &actualSize);
+    TEST_CHECK(expected != NULL && actual != NULL);
+    TEST_CHECK(expectedSize == actualSize);
+    if (expected != NULL && actual != NULL && expectedSize == actualSize) {
+      TEST_CHECK(memcmp(expected, actual, expectedSize) == 0);
+    }
+    free(expected);
+    free(actual);
+    free(expectedPath);
+    free(actualPath);
+  }
+  closedir(dir);
+}
+
+// Returns the path of the first manifest in the directory
+static char *findManifest(const char *dirPath) {
+  DIR *dir = opendir(dirPath);
+  if (dir == NULL) {
+    return NULL;
+  }
+  char *path = NULL;
+  struct dirent *entry;
+  while (path == NULL && (entry = readdir(dir)) != NULL) {
+    const char *suffix = strstr(entry->d_name, kCdexManifestSuffix);
+    if (suffix != NULL && strcmp(suffix, kCdexManifestSuffix) == 0) {
+      path = joinPath(dirPath, entry->d_name);
+    }
+  }
+  closedir(dir);
+  return path;
+}
+
+static bool writeFile(const char *path, const char *content) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    return false;
+  }
+  bool ret = fputs(content, fp) >= 0;
+  return fclose(fp) == 0 && ret;
+}
+
+// Replaces the line of a manifest key with the given one (or drops it if NULL)
+static void replaceKey(const char *manifest, const char *key, const char *line, char *out,
+                       size_t outSize) {
+  out[0] = '\0';
+  size_t keyLen = strlen(key);
+  for (const char *p = manifest; *p != '\0';) {
+    const char *eol = strchr(p, '\n');
+    size_t lineLen = eol ? (size_t)(eol - p) + 1 : strlen(p);
+    size_t outLen = strlen(out);
+    if (strncmp(p, key, keyLen) == 0 && p[keyLen] == '=') {
+      if (line != NULL) {
+        snprintf(out + outLen, outSize - outLen, "%s\n", line);
+      }
+    } else {
+      snprintf(out + outLen, outSize - outLen, "%.*s", (int)lineLen, p);
+    }
+    p += lineLen;
+  }
+}
+
+static void testMalformedManifests(const char *tmpDir, const char *splitDir, char *mergedDir) {
+  char *manifestPath = findManifest(splitDir);
+  TEST_CHECK(manifestPath != NULL);
+  if (manifestPath == NULL) {
+    return;
+  }
+  size_t manifestSize;
+  char *manifest = (char *)test_readFile(manifestPath, &manifestSize);
+  TEST_CHECK(manifest != NULL);
+  if (manifest == NULL) {
+    free(manifestPath);
+    return;
+  }
+  manifest = realloc(manifest, manifestSize + 1);
+  manifest[manifestSize] = '\0';
+
+  static const struct {
+    const char *key;
+    const char *line;
+  } kVariants[] = {
+    { "vdex", "vdex=../escaped.vdex" },
+    { "vdex", "vdex=/tmp/escaped.vdex" },
+    { "vdex", "vdex=sub/escaped.vdex" },
+    { "vdex", "vdex=" },
+    { "shared_data", "shared_data=../escaped_shared.cdexdata" },
+    { "shared_data", "shared_data=.." },
+    { "data_size", NULL },
+    { "data_size", "data_size=4294967295" },
+    { "shared_data_checksum", "shared_data_checksum=00000000" },
+  };
+  runArgs_t mergeArgs = getRunArgs(mergedDir);
+  mergeArgs.mergeSharedData = true;
+  mergeArgs.fileOverride = true;
+  char variant[4096];
+  for (size_t i = 0; i < sizeof(kVariants) / sizeof(kVariants[0]); ++i) {
+    replaceKey(manifest, kVariants[i].key, kVariants[i].line, variant, sizeof(variant));
+    TEST_CHECK(writeFile(manifestPath, variant));
+    size_t mergedCnt = 1;
+    TEST_CHECK(!cdexShared_merge(manifestPath, &mergeArgs, &mergedCnt));
+    TEST_CHECK(mergedCnt == 0);
+  }
+
+  // Nothing was written next to the output directories
+  TEST_CHECK(countFiles(tmpDir) == 3);
+
+  // The original manifest still merges
+  TEST_CHECK(writeFile(manifestPath, manifest));
+  size_t mergedCnt = 0;
+  TEST_CHECK(cdexShared_merge(manifestPath, &mergeArgs, &mergedCnt));
+  TEST_CHECK(mergedCnt == 1);
+
+  free(manifest);
+  free(manifestPath);
+}
+
+int main(void) {
+  log_setMinLevel(l_FATAL);
+  char *tmpDir = test_makeTmpDir();
+  char *fullDir = joinPath(tmpDir, "full");
+  char *splitDir = joinPath(tmpDir, "split");
+  char *mergedDir = joinPath(tmpDir, "merged");
+  TEST_CHECK(mkdir(fullDir, 0755) == 0 && mkdir(splitDir, 0755) == 0 &&
+             mkdir(mergedDir, 0755) == 0);
+
+  runArgs_t fullArgs = getRunArgs(fullDir);
+  TEST_CHECK(extract(&fullArgs));
+  runArgs_t splitArgs = getRunArgs(splitDir);
+  splitArgs.splitSharedData = true;
+  TEST_CHECK(extract(&splitArgs));
+
+  // A main section & a manifest per CompactDex file, and a single shared data file
+  TEST_CHECK(countFiles(splitDir) == 2 * kFixtureDexCnt + 1);
+
+  runArgs_t mergeArgs = getRunArgs(mergedDir);
+  mergeArgs.mergeSharedData = true;
+  size_t mergedCnt = 0;
+  TEST_CHECK(cdexShared_merge(splitDir, &mergeArgs, &mergedCnt));
+  TEST_CHECK(mergedCnt == kFixtureDexCnt);
+  checkSameFiles(fullDir, mergedDir);
+
+  testMalformedManifests(tmpDir, splitDir, mergedDir);
+
+  free(fullDir);
+  free(splitDir);
+  free(mergedDir);
+  test_removeTmpDir(tmpDir);
+  return test_report("test_cdex_shared");
+}
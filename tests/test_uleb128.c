@@ -0,0 +1,215 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "dex.h"
+#include "test.h"
+
+#define kNumValues 4096
+
+// Fixed seed xorshift, so that failures are reproducible
+static u4 nextRandom(u4 *pState) {
+  u4 x = *pState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *pState = x;
+  return x;
+}
+
+// Mix of encoded lengths, weighted towards the short values that dominate Dex & Vdex data
+static u4 randomValue(u4 *pState) {
+  u4 r = nextRandom(pState);
+  switch (r % 8) {
+    case 0:
+    case 1:
+    case 2:
+      return r >> 25;
+    case 3:
+    case 4:
+      return r >> 18;
+    case 5:
+      return r >> 11;
+    case 6:
+      return r >> 4;
+    default:
+      return r;
+  }
+}
+
+// Maps two pages with the second one inaccessible, so that reads past the end of the first one
+// fault. Returns the start of the first page.
+static u1 *mapGuardedPages(size_t pageSize) {
+  u1 *pages = mmap(NULL, 2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pages == MAP_FAILED || mprotect(pages + pageSize, pageSize, PROT_NONE) != 0) {
+    fprintf(stderr, "guard page mapping failed: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return pages;
+}
+
+static void testScalarRoundTrip(void) {
+  static const u4 kEdges[] = { 0,          1,          0x7f,       0x80,       0x3fff,
+                               0x4000,     0x1fffff,   0x200000,   0xfffffff,  0x10000000,
+                               0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff };
+  u1 buf[8];
+  for (size_t i = 0; i < sizeof(kEdges) / sizeof(kEdges[0]); ++i) {
+    u1 *end = dex_writeULeb128(buf, kEdges[i]);
+    const u1 *ptr = buf;
+    TEST_CHECK(dex_readULeb128(&ptr) == kEdges[i]);
+    TEST_CHECK(ptr == end);
+  }
+}
+
+// Batch decoding must match the scalar decoder for every start alignment and count, including
+// the windows that straddle the values
+static void testBatchMatchesScalar(void) {
+  u1 *enc = malloc(kNumValues * 5 + 64);
+  u4 *values = malloc(kNumValues * sizeof(u4));
+  u4 *decoded = malloc(kNumValues * sizeof(u4));
+  u4 state = 0x9e3779b9;
+
+  for (size_t align = 0; align < 16; ++align) {
+    u1 *end = enc + align;
+    for (size_t i = 0; i < kNumValues; ++i) {
+      values[i] = randomValue(&state);
+      end = dex_writeULeb128(end, values[i]);
+    }
+
+    static const size_t kCounts[] = { 0, 1, 2, 15, 16, 17, 31, 33, 255, kNumValues };
+    for (size_t c = 0; c < sizeof(kCounts) / sizeof(kCounts[0]); ++c) {
+      size_t count = kCounts[c];
+      const u1 *scalarPtr = enc + align;
+      for (size_t i = 0; i < count; ++i) {
+        dex_readULeb128(&scalarPtr);
+      }
+
+      const u1 *ptr = enc + align;
+      memset(decoded, 0xa5, kNumValues * sizeof(u4));
+      dex_readULeb128Batch(&ptr, decoded, count);
+      TEST_CHECK(ptr == scalarPtr);
+      TEST_CHECK(memcmp(decoded, values, count * sizeof(u4)) == 0);
+
+      ptr = enc + align;
+      memset(decoded, 0xa5, kNumValues * sizeof(u4));
+      TEST_CHECK(dex_readULeb128BatchBounded(&ptr, end, decoded, count));
+      TEST_CHECK(ptr == scalarPtr);
+      TEST_CHECK(memcmp(decoded, values, count * sizeof(u4)) == 0);
+    }
+  }
+
+  free(decoded);
+  free(values);
+  free(enc);
+}
+
+// Overlong encodings and garbage in the high bits of a fifth byte decode like dex_readULeb128
+static void testMalformed(void) {
+  static const u1 kInput[] = {
+    0x80, 0x00,                    // overlong 0
+    0xff, 0xff, 0xff, 0xff, 0xff,  // garbage in the high bits of the fifth byte
+    0x80, 0x80, 0x80, 0x80, 0x00,  // overlong 0 of the maximum length
+    0x81, 0x80, 0x80, 0x80, 0x7f,  // 0xf0000001
+    0x05,
+  };
+  u4 expected[5], decoded[5];
+  const u1 *scalarPtr = kInput;
+  for (size_t i = 0; i < 5; ++i) {
+    expected[i] = dex_readULeb128(&scalarPtr);
+  }
+  TEST_CHECK(expected[1] == 0xffffffff);
+  TEST_CHECK(expected[3] == 0xf0000001);
+  TEST_CHECK(scalarPtr == kInput + sizeof(kInput));
+
+  // Copy to a buffer with slack after the values, so that the window path is taken too
+  u1 buf[64] = { 0 };
+  memcpy(buf, kInput, sizeof(kInput));
+  const u1 *ptr = buf;
+  dex_readULeb128Batch(&ptr, decoded, 5);
+  TEST_CHECK(ptr == buf + sizeof(kInput));
+  TEST_CHECK(memcmp(decoded, expected, sizeof(expected)) == 0);
+
+  ptr = buf;
+  TEST_CHECK(dex_readULeb128BatchBounded(&ptr, buf + sizeof(kInput), decoded, 5));
+  TEST_CHECK(ptr == buf + sizeof(kInput));
+  TEST_CHECK(memcmp(decoded, expected, sizeof(expected)) == 0);
+}
+
+// Values that end on the last byte of a mapping are decoded without touching the next page, and
+// the bounded reader fails on values truncated at the end without reading past it
+static void testGuardPage(void) {
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  u1 *pages = mapGuardedPages(pageSize);
+  u1 *pageEnd = pages + pageSize;
+  u4 state = 0x12345678;
+  u4 values[64], decoded[64];
+
+  for (size_t count = 1; count <= 64; count += 7) {
+    u1 enc[64 * 5];
+    u1 *encEnd = enc;
+    for (size_t i = 0; i < count; ++i) {
+      values[i] = randomValue(&state);
+      encEnd = dex_writeULeb128(encEnd, values[i]);
+    }
+    size_t len = encEnd - enc;
+    u1 *start = pageEnd - len;
+    memcpy(start, enc, len);
+
+    const u1 *ptr = start;
+    dex_readULeb128Batch(&ptr, decoded, count);
+    TEST_CHECK(ptr == pageEnd);
+    TEST_CHECK(memcmp(decoded, values, count * sizeof(u4)) == 0);
+
+    ptr = start;
+    TEST_CHECK(dex_readULeb128BatchBounded(&ptr, pageEnd, decoded, count));
+    TEST_CHECK(ptr == pageEnd);
+    TEST_CHECK(memcmp(decoded, values, count * sizeof(u4)) == 0);
+
+    // One more value than encoded runs into the end
+    ptr = start;
+    TEST_CHECK(!dex_readULeb128BatchBounded(&ptr, pageEnd, decoded, count + 1));
+  }
+
+  // A value whose continuation bits run to the end of the mapping
+  memset(pageEnd - 3, 0x80, 3);
+  const u1 *ptr = pageEnd - 3;
+  TEST_CHECK(!dex_readULeb128BatchBounded(&ptr, pageEnd, decoded, 1));
+
+  // The bound is honoured before the end of the mapping too: 7 maximum length values fit, the
+  // 8th one is truncated
+  u1 *bound = pages + pageSize / 2;
+  memset(pages, 0x80, pageSize);
+  ptr = bound - 39;
+  TEST_CHECK(!dex_readULeb128BatchBounded(&ptr, bound, decoded, 8));
+
+  munmap(pages, 2 * pageSize);
+}
+
+int main(void) {
+  testScalarRoundTrip();
+  testBatchMatchesScalar();
+  testMalformed();
+  testGuardPage();
+  return test_report("test_uleb128");
+}
@@ -0,0 +1,227 @@
+/*
+
+   vdexExtractor
+   -----------------------------------------
+
+   Anestis Bechtsoudis <anestis@census-labs.com>
+   Copyright 2017 - 2020 by CENSUS S.A. All Rights Reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <pthread.h>
+#include <zlib.h>
+
+#include "log.h"
+#include "test.h"
+#include "zip_writer.h"
+
+// Entries are added out of order by several threads and must come out sorted by key, with the same
+// bytes regardless of the number of deflate threads.
+
+#define kEntryCnt 24
+#define kEntrySz 8192
+#define kAddThreads 3
+#define kLocalHdrSz 30
+
+typedef struct {
+  zipWriter_t *pZip;
+  u1 (*entries)[kEntrySz];
+  int thread;
+  bool ok;  // The check counters aren't thread safe
+} addArgs_t;
+
+static u4 readU4(const u1 *p) {
+  u4 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static u2 readU2(const u1 *p) {
+  u2 v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Odd entries are random (stored), even ones are compressible (deflated)
+static void fillEntries(u1 (*entries)[kEntrySz]) {
+  u4 seed = 0x12345678;
+  for (size_t i = 0; i < kEntryCnt; i++) {
+    for (size_t j = 0; j < kEntrySz; j++) {
+      seed = seed * 1103515245 + 12345;
+      entries[i][j] = i % 2 ? (u1)(seed >> 16) : (u1)(j % 13);
+    }
+  }
+}
+
+static size_t entrySize(size_t idx) { return kEntrySz - idx * 64; }
+
+// Each thread adds its share of the entries in descending key order
+static void *addEntries(void *arg) {
+  addArgs_t *pArgs = arg;
+  for (int i = kEntryCnt - 1 - pArgs->thread; i >= 0; i -= kAddThreads) {
+    char name[32];
+    snprintf(name, sizeof(name), "classes%d.dex", i + 1);
+    if (!zipWriter_addEntry(pArgs->pZip, name, i, pArgs->entries[i], entrySize(i))) {
+      pArgs->ok = false;
+    }
+  }
+  return NULL;
+}
+
+static u1 *writeZip(const char *path,
+                    bool deflate,
+                    int jobs,
+                    u1 (*entries)[kEntrySz],
+                    size_t *pSz) {
+  zipWriter_t *pZip = zipWriter_open(path, true, deflate, jobs);
+  TEST_CHECK(pZip != NULL);
+  if (pZip == NULL) {
+    return NULL;
+  }
+
+  pthread_t threads[kAddThreads];
+  addArgs_t args[kAddThreads];
+  for (int t = 0; t < kAddThreads; t++) {
+    args[t] = (addArgs_t){ .pZip = pZip, .entries = entries, .thread = t, .ok = true };
+    TEST_CHECK(pthread_create(&threads[t], NULL, addEntries, &args[t]) == 0);
+  }
+  for (int t = 0; t < kAddThreads; t++) {
+    pthread_join(threads[t], NULL);
+    TEST_CHECK(args[t].ok);
+  }
+  TEST_CHECK(zipWriter_close(pZip, true));
+  return test_readFile(path, pSz);
+}
+
+// Walks the local headers, which must be sorted by key, and checks the data of each entry
+static void checkEntries(const u1 *zip, size_t zipSz, u1 (*entries)[kEntrySz], bool deflate) {
+  size_t off = 0;
+  u1 *outBuf = malloc(kEntrySz);
+  for (size_t i = 0; i < kEntryCnt; i++) {
+    TEST_CHECK(off + kLocalHdrSz <= zipSz && readU4(zip + off) == 0x04034b50);
+    if (off + kLocalHdrSz > zipSz) {
+      break;
+    }
+    u2 method = readU2(zip + off + 8);
+    u4 crc = readU4(zip + off + 14);
+    u4 compSize = readU4(zip + off + 18);
+    u4 size = readU4(zip + off + 22);
+    u2 nameLen = readU2(zip + off + 26);
+    const u1 *name = zip + off + kLocalHdrSz;
+    const u1 *data = name + nameLen;
+    off += kLocalHdrSz + nameLen + compSize;
+    TEST_CHECK(off <= zipSz);
+    if (off > zipSz) {
+      break;
+    }
+
+    char expName[32];
+    snprintf(expName, sizeof(expName), "classes%zu.dex", i + 1);
+    TEST_CHECK(nameLen == strlen(expName) && memcmp(name, expName, nameLen) == 0);
+    TEST_CHECK(size == entrySize(i) && crc == crc32(0, entries[i], size));
+    TEST_CHECK(method == (deflate && i % 2 == 0 ? 8 : 0));
+    if (method == 0) {
+      TEST_CHECK(compSize == size && memcmp(data, entries[i], size) == 0);
+      continue;
+    }
+
+    z_stream zStream;
+    memset(&zStream, 0, sizeof(zStream));
+    TEST_CHECK(inflateInit2(&zStream, -MAX_WBITS) == Z_OK);
+    zStream.next_in = (Bytef *)data;
+    zStream.avail_in = compSize;
+    zStream.next_out = outBuf;
+    zStream.avail_out = kEntrySz;
+    TEST_CHECK(inflate(&zStream, Z_FINISH) == Z_STREAM_END);
+    TEST_CHECK(zStream.total_out == size && memcmp(outBuf, entries[i], size) == 0);
+    inflateEnd(&zStream);
+  }
+  // The central directory follows the last entry
+  TEST_CHECK(off + 4 <= zipSz && readU4(zip + off) == 0x02014b50);
+  free(outBuf);
+}
+
+int main(void) {
+  log_setMinLevel(l_FATAL);
+  char *tmpDir = test_makeTmpDir();
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/out.zip", tmpDir);
+
+  u1(*entries)[kEntrySz] = malloc(kEntryCnt * kEntrySz);
+  fillEntries(entries);
+
+  size_t storedSz = 0;
+  u1 *stored = writeZip(path, false, 4, entries, &storedSz);
+  if (stored != NULL) {
+    checkEntries(stored, storedSz, entries, false);
+  }
+
+  // Compressed by the adding threads, by one and by several deflate threads
+  const int jobs[] = { 0, 1, 4 };
+  u1 *first = NULL;
+  size_t firstSz = 0;
+  for (size_t i = 0; i < sizeof(jobs) / sizeof(jobs[0]); i++) {
+    size_t zipSz = 0;
+    u1 *zip = writeZip(path, true, jobs[i], entries, &zipSz);
+    if (zip == NULL) {
+      continue;
+    }
+    checkEntries(zip, zipSz, entries, true);
+    if (first == NULL) {
+      first = zip;
+      firstSz = zipSz;
+    } else {
+      TEST_CHECK(zipSz == firstSz && memcmp(zip, first, zipSz) == 0);
+      free(zip);
+    }
+  }
+
+  zipWriter_t *pZip = NULL;
+
+  // A batch that repeats a written name or one of its own is discarded, the archive keeps the rest
+  pZip = zipWriter_open(path, true, true, 2);
+  TEST_CHECK(pZip != NULL);
+  if (pZip != NULL) {
+    TEST_CHECK(zipWriter_addEntry(pZip, "Foo/oat/arm/Foo/classes.dex", 0, entries[0], kEntrySz));
+    TEST_CHECK(zipWriter_addEntry(pZip, "Foo/oat/arm64/Foo/classes.dex", 0, entries[0], kEntrySz));
+    TEST_CHECK(zipWriter_flush(pZip));
+    TEST_CHECK(zipWriter_addEntry(pZip, "Foo/oat/arm64/Foo/classes.dex", 0, entries[1], kEntrySz));
+    TEST_CHECK(zipWriter_addEntry(pZip, "Bar/classes.dex", 1, entries[1], kEntrySz));
+    TEST_CHECK(!zipWriter_flush(pZip));
+    TEST_CHECK(zipWriter_addEntry(pZip, "Bar/classes.dex", 0, entries[1], kEntrySz));
+    TEST_CHECK(zipWriter_addEntry(pZip, "Bar/classes.dex", 1, entries[1], kEntrySz));
+    TEST_CHECK(!zipWriter_flush(pZip));
+    TEST_CHECK(zipWriter_addEntry(pZip, "Bar/classes.dex", 0, entries[1], kEntrySz));
+    TEST_CHECK(zipWriter_flush(pZip));
+    TEST_CHECK(pZip->entryCnt == 3);
+    TEST_CHECK(zipWriter_close(pZip, true));
+    TEST_CHECK(access(path, F_OK) == 0);
+  }
+
+  // Discarded archives are removed, along with the entries that haven't been written
+  pZip = zipWriter_open(path, true, true, 2);
+  TEST_CHECK(pZip != NULL);
+  if (pZip != NULL) {
+    TEST_CHECK(zipWriter_addEntry(pZip, "classes.dex", 0, entries[0], kEntrySz));
+    zipWriter_close(pZip, false);
+    TEST_CHECK(access(path, F_OK) != 0);
+  }
+
+  free(stored);
+  free(first);
+  free(entries);
+  test_removeTmpDir(tmpDir);
+  return test_report("test_zip_writer");
+}